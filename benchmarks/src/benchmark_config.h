@@ -0,0 +1,30 @@
+#pragma once
+#include "render/render_config.h"
+#include "volume/volume.h"
+#include <glm/vec2.hpp>
+
+// Render settings shared by the benchmarks. The transfer functions are tuned to the synthetic volume (see
+// synthetic_volume.h) so that every render mode produces a non-empty image, but work on any volume.
+inline render::RenderConfig createBenchmarkConfig(const volume::Volume& volume, const glm::ivec2& resolution)
+{
+    render::RenderConfig config {};
+    config.renderResolution = resolution;
+    config.isoValue = 120.0f;
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = volume.maximum();
+    for (size_t i = 0; i < config.tfColorMap.size(); i++) {
+        const float x = float(i) / float(config.tfColorMap.size());
+        config.tfColorMap[i] = glm::vec4(x, 0.5f, 1.0f - x, x < 0.3f ? 0.0f : 0.05f);
+    }
+    config.TF2DIntensity = 150.0f;
+    config.TF2DRadius = 40.0f;
+    config.TF2DColor = glm::vec4(0.0f, 0.8f, 0.6f, 0.3f);
+    config.TFSecondDerivativeIntensity = 150.0f;
+    config.TFSecondDerivativeRadius = 30.0f;
+    config.TFSecondDerivativeThreshold = 0.5f;
+    config.TFSecondDerivativeColor1 = glm::vec4(1.0f, 0.0f, 0.0f, 0.3f);
+    config.TFSecondDerivativeColor2 = glm::vec4(0.0f, 1.0f, 0.0f, 0.3f);
+    config.GoochWarmColor = glm::vec3(0.4f, 0.4f, 0.0f);
+    config.GoochColdColor = glm::vec3(0.0f, 0.0f, 0.4f);
+    return config;
+}
@@ -0,0 +1,149 @@
+// Measures the cost of the mode dispatch in the ray marching inner loop. The first part marches parallel rays
+// through a synthetic volume and compares the per-sample cost of the run-time dispatching accessors
+// (getSampleInterpolate / getGradientInterpolate, which switch on interpolationMode for every sample) with the
+// variants that fix the interpolation mode at compile time, for both the float and the quantized gradient storage.
+// The second part times complete frames of the renderer, which picks a specialized kernel once per frame.
+//
+// Usage: KernelBenchmark [volume size (default 256)] [image resolution (default 512)]
+#include "benchmark_config.h"
+#include "parallel_rays.h"
+#include "render/renderer.h"
+#include "synthetic_volume.h"
+#include "volume/gradient_volume.h"
+#include "volume/secondderivative_volume.h"
+#include "volume/volume.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <glm/geometric.hpp>
+#include <limits>
+#include <string>
+
+// Pinhole camera looking at the center of the volume from a fixed position.
+class FixedCamera : public render::RayTraceCamera {
+public:
+    FixedCamera(const glm::vec3& position, const glm::vec3& lookAt)
+        : m_position(position)
+        , m_forward(glm::normalize(lookAt - position))
+        , m_right(glm::normalize(glm::cross(m_forward, glm::vec3(0, 1, 0))))
+        , m_up(glm::cross(m_right, m_forward))
+    {
+    }
+
+    glm::vec3 position() const override { return m_position; }
+    glm::vec3 forward() const override { return m_forward; }
+    render::Ray generateRay(const glm::vec2& pixel) const override
+    {
+        const float halfFov = std::tan(0.5f * 1.04719755f); // 60 degrees.
+        const glm::vec3 direction = glm::normalize(m_forward + halfFov * (pixel.x * m_right + pixel.y * m_up));
+        return render::Ray { m_position, direction, 0.0f, std::numeric_limits<float>::max() };
+    }
+
+private:
+    glm::vec3 m_position, m_forward, m_right, m_up;
+};
+
+// Returns the best time in nanoseconds per sample over a few repetitions.
+template <typename Sample>
+static double nanosecondsPerSample(const glm::ivec3& dims, Sample&& sample)
+{
+    constexpr int repetitions = 3;
+    const glm::vec3 direction = glm::normalize(glm::vec3(0.3f, -0.8f, 0.5f));
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repetitions; i++) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        const auto [sum, samples] = marchParallelRays(dims, direction, dims.x, sample);
+        const auto end = std::chrono::high_resolution_clock::now();
+        // Use the sum so that the sampling cannot be optimized away.
+        if (std::isnan(sum))
+            fmt::print("NaN checksum\n");
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() / double(samples));
+    }
+    return best;
+}
+
+template <volume::InterpolationMode mode>
+static void benchmarkSamplers(volume::Volume& volume, volume::GradientVolume& gradientVolume, volume::GradientVolume& quantizedGradientVolume, const std::string& modeName)
+{
+    volume.interpolationMode = mode;
+    const glm::ivec3 dims = volume.dims();
+
+    const double volumeDynamic = nanosecondsPerSample(dims, [&](const glm::vec3& p) { return volume.getSampleInterpolate(p); });
+    const double volumeStatic = nanosecondsPerSample(dims, [&](const glm::vec3& p) { return volume.getSampleInterpolate<mode>(p); });
+    fmt::print("{:<20} {:<8} {:>14.2f} {:>14.2f}\n", "volume", modeName, volumeDynamic, volumeStatic);
+
+    for (volume::GradientVolume* pGradientVolume : { &gradientVolume, &quantizedGradientVolume }) {
+        pGradientVolume->interpolationMode = mode;
+        const double gradientDynamic = nanosecondsPerSample(dims, [&](const glm::vec3& p) { return pGradientVolume->getGradientInterpolate(p).magnitude; });
+        const double gradientStatic = nanosecondsPerSample(dims, [&](const glm::vec3& p) { return pGradientVolume->getGradientInterpolate<mode>(p).magnitude; });
+        const char* name = pGradientVolume->storage() == volume::GradientStorage::Quantized ? "gradient (quantized)" : "gradient";
+        fmt::print("{:<20} {:<8} {:>14.2f} {:>14.2f}\n", name, modeName, gradientDynamic, gradientStatic);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int size = argc > 1 ? std::atoi(argv[1]) : 256;
+    const int resolution = argc > 2 ? std::atoi(argv[2]) : 512;
+    constexpr int repetitions = 3;
+
+    fmt::print("Generating {0}x{0}x{0} synthetic volume...\n", size);
+    volume::Volume volume { createSyntheticVolume(glm::ivec3(size)), glm::ivec3(size) };
+    volume::GradientVolume gradientVolume { volume };
+    volume::GradientVolume quantizedGradientVolume { volume, volume::GradientStorage::Quantized };
+    volume::SecondDerivativeVolume secondDerivativeVolume { volume, gradientVolume };
+    fmt::print("Gradient volume: {:.1f} MB (float), {:.1f} MB (quantized)\n",
+        double(gradientVolume.sizeInBytes()) / 1e6, double(quantizedGradientVolume.sizeInBytes()) / 1e6);
+
+    fmt::print("\nPer sample cost (ns/sample)\n");
+    fmt::print("{:<20} {:<8} {:>14} {:>14}\n", "accessor", "mode", "run-time", "compile-time");
+    benchmarkSamplers<volume::InterpolationMode::NearestNeighbour>(volume, gradientVolume, quantizedGradientVolume, "nearest");
+    benchmarkSamplers<volume::InterpolationMode::Linear>(volume, gradientVolume, quantizedGradientVolume, "linear");
+
+    render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(resolution));
+    config.emptySpaceSkipping = false;
+    config.earlyRayTerminationThreshold = 1.0f;
+
+    const FixedCamera camera { glm::vec3(float(size)) * glm::vec3(1.8f, 0.9f, -0.7f), glm::vec3(float(size)) / 2.0f };
+    struct RenderCase {
+        std::string name;
+        render::RenderMode mode;
+        bool phongShading;
+        volume::GradientStorage gradientStorage { volume::GradientStorage::Float };
+    };
+    const RenderCase renderCases[] {
+        { "MIP", render::RenderMode::RenderMIP, false },
+        { "Iso", render::RenderMode::RenderIso, false },
+        { "Iso (Phong)", render::RenderMode::RenderIso, true },
+        { "Iso (Phong, quant.)", render::RenderMode::RenderIso, true, volume::GradientStorage::Quantized },
+        { "Composite", render::RenderMode::RenderComposite, false },
+        { "TF2D", render::RenderMode::RenderTF2D, false },
+        { "TF2D (quantized)", render::RenderMode::RenderTF2D, false, volume::GradientStorage::Quantized },
+        { "2nd derivative", render::RenderMode::RenderTFSecondDerivative, false }
+    };
+
+    fmt::print("\nFrame time at {0}x{0} (ms, no empty space skipping or early ray termination)\n", resolution);
+    fmt::print("{:<20} {:>14} {:>14}\n", "render mode", "nearest", "linear");
+    for (const auto& renderCase : renderCases) {
+        config.renderMode = renderCase.mode;
+        config.volumeShading = renderCase.phongShading;
+        fmt::print("{:<20}", renderCase.name);
+        for (const auto mode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear }) {
+            volume::GradientVolume& caseGradientVolume = renderCase.gradientStorage == volume::GradientStorage::Quantized ? quantizedGradientVolume : gradientVolume;
+            volume.interpolationMode = caseGradientVolume.interpolationMode = secondDerivativeVolume.interpolationMode = mode;
+            render::Renderer renderer { &volume, &caseGradientVolume, &secondDerivativeVolume, &camera, config };
+            double bestMs = std::numeric_limits<double>::max();
+            for (int i = 0; i < repetitions; i++) {
+                const auto start = std::chrono::high_resolution_clock::now();
+                renderer.render();
+                const auto end = std::chrono::high_resolution_clock::now();
+                bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(end - start).count());
+            }
+            fmt::print(" {:>14.2f}", bestMs);
+        }
+        fmt::print("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Compares the linear, bricked and Morton voxel layouts by marching parallel rays through a synthetic volume
+// along several view directions and timing the trilinear sampling.
+//
+// Usage: LayoutBenchmark [volume size (default 256)] [brick size (default 8)]
+#include "parallel_rays.h"
+#include "synthetic_volume.h"
+#include "volume/volume.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <glm/geometric.hpp>
+#include <limits>
+#include <string>
+#include <utility>
+
+struct ViewDirection {
+    std::string name;
+    glm::vec3 direction;
+};
+
+int main(int argc, char** argv)
+{
+    const int size = argc > 1 ? std::atoi(argv[1]) : 256;
+    const int brickSize = argc > 2 ? std::atoi(argv[2]) : 8;
+    constexpr int repetitions = 3;
+
+    fmt::print("Generating {0}x{0}x{0} synthetic volume...\n", size);
+    volume::Volume volume { createSyntheticVolume(glm::ivec3(size)), glm::ivec3(size) };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+
+    const std::array views {
+        ViewDirection { "+x", glm::vec3(1, 0, 0) },
+        ViewDirection { "+y", glm::vec3(0, 1, 0) },
+        ViewDirection { "+z", glm::vec3(0, 0, 1) },
+        ViewDirection { "diagonal", glm::normalize(glm::vec3(1, 1, 1)) },
+        ViewDirection { "oblique", glm::normalize(glm::vec3(0.3f, -0.8f, 0.5f)) }
+    };
+    const std::array layouts {
+        std::pair { volume::VoxelLayout::Linear, std::string("linear") },
+        std::pair { volume::VoxelLayout::Bricked, fmt::format("bricked {}^3", brickSize) },
+        std::pair { volume::VoxelLayout::Morton, std::string("morton") }
+    };
+
+    fmt::print("{:<14} {:>10} {:>12} {:>14}\n", "layout", "view", "ms", "Msamples/s");
+    for (const auto& [layout, layoutName] : layouts) {
+        volume.setVoxelLayout(layout, brickSize);
+        double checksum = 0.0;
+        for (const auto& view : views) {
+            double bestMs = std::numeric_limits<double>::max();
+            size_t numSamples = 0;
+            for (int i = 0; i < repetitions; i++) {
+                const auto start = std::chrono::high_resolution_clock::now();
+                const auto [sum, samples] = marchParallelRays(volume.dims(), view.direction, size,
+                    [&](const glm::vec3& samplePos) { return volume.getSampleInterpolate(samplePos); });
+                const auto end = std::chrono::high_resolution_clock::now();
+                bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(end - start).count());
+                numSamples = samples;
+                checksum += sum;
+            }
+            fmt::print("{:<14} {:>10} {:>12.2f} {:>14.1f}\n", layoutName, view.name, bestMs, double(numSamples) / bestMs / 1000.0);
+        }
+        // All layouts sample the same data so the checksums should match.
+        fmt::print("{:<14} checksum {:.6e}\n", layoutName, checksum);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <limits>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_reduce.h>
+#include <utility>
+
+// Clip the ray origin + t * direction against the box [0, upper].
+inline bool clipRay(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& upper, float& tmin, float& tmax)
+{
+    tmin = std::numeric_limits<float>::lowest();
+    tmax = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; axis++) {
+        if (direction[axis] == 0.0f) {
+            if (origin[axis] < 0.0f || origin[axis] > upper[axis])
+                return false;
+            continue;
+        }
+        const float t0 = (0.0f - origin[axis]) / direction[axis];
+        const float t1 = (upper[axis] - origin[axis]) / direction[axis];
+        tmin = std::max(tmin, std::min(t0, t1));
+        tmax = std::min(tmax, std::max(t0, t1));
+    }
+    return tmin <= tmax;
+}
+
+// March a res x res grid of parallel rays along the given direction through a volume of the given size with a
+// step of one voxel. Returns the sum of sample(samplePos) over all samples (to prevent the compiler from
+// optimizing the sampling away) and the number of samples taken.
+template <typename Sample>
+std::pair<double, size_t> marchParallelRays(const glm::ivec3& volumeDims, const glm::vec3& direction, int res, Sample&& sample)
+{
+    const glm::vec3 upper = glm::vec3(volumeDims - 1);
+    const glm::vec3 center = upper / 2.0f;
+    const float extent = glm::length(upper);
+
+    // Orthonormal basis of the image plane.
+    const glm::vec3 helper = std::abs(direction.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+    const glm::vec3 u = glm::normalize(glm::cross(direction, helper));
+    const glm::vec3 v = glm::cross(direction, u);
+
+    using Result = std::pair<double, size_t>;
+    return tbb::parallel_reduce(
+        tbb::blocked_range<int>(0, res), Result { 0.0, 0 },
+        [&](const tbb::blocked_range<int>& range, Result result) {
+            for (int y = std::begin(range); y != std::end(range); y++) {
+                for (int x = 0; x < res; x++) {
+                    const glm::vec2 uv = (glm::vec2(x, y) / float(res) - 0.5f) * extent;
+                    const glm::vec3 origin = center + uv.x * u + uv.y * v - direction * extent;
+                    float tmin, tmax;
+                    if (!clipRay(origin, direction, upper, tmin, tmax))
+                        continue;
+
+                    glm::vec3 samplePos = origin + tmin * direction;
+                    for (float t = tmin; t <= tmax; t += 1.0f, samplePos += direction) {
+                        result.first += double(sample(samplePos));
+                        result.second++;
+                    }
+                }
+            }
+            return result;
+        },
+        [](const Result& lhs, const Result& rhs) { return Result { lhs.first + rhs.first, lhs.second + rhs.second }; });
+}
@@ -0,0 +1,322 @@
+// Rendering benchmark suite. Renders every render mode with every interpolation mode along a scripted camera orbit
+// at several resolutions, on synthetic volumes (see synthetic_volume.h) and/or .fld files, and writes the results as
+// JSON so that runs of different builds can be compared. For every case it reports the frame time percentiles, rays/s
+// (pixels per second) and samples/s. The sample count is the number of samples that a brute force ray marcher takes
+// (ray length inside the volume / sample step), independent of the render mode, so empty space skipping and early
+// ray termination show up as a higher samples/s. Thread scaling is measured for one reference case per volume
+// (composite, trilinear, highest resolution) by limiting the number of TBB worker threads.
+//
+// Usage: VolVisBench [--sizes 64,128,256] [--volume file.fld]... [--resolutions 256,512] [--frames 16]
+//                    [--threads 1,2,4,...] [--output volvis_bench.json]
+#include "benchmark_config.h"
+#include "parallel_rays.h"
+#include "render/look_at_camera.h"
+#include "render/renderer.h"
+#include "render/simd.h"
+#include "synthetic_volume.h"
+#include "volume/gradient_volume.h"
+#include "volume/secondderivative_volume.h"
+#include "volume/volume.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <fmt/format.h>
+#include <fstream>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <glm/trigonometric.hpp>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <tbb/global_control.h>
+#include <tbb/info.h>
+#include <vector>
+
+using json = nlohmann::ordered_json;
+
+// Sample step used by Renderer::render.
+static constexpr float sampleStep = 1.0f;
+
+struct Options {
+    std::vector<int> sizes { 64, 128, 256 };
+    std::vector<std::string> volumeFiles;
+    std::vector<int> resolutions { 256, 512 };
+    int frames { 16 };
+    std::vector<int> threads;
+    std::string output { "volvis_bench.json" };
+};
+
+struct RenderCase {
+    std::string name;
+    render::RenderMode mode;
+    bool phongShading;
+};
+
+struct InterpolationCase {
+    std::string name;
+    volume::InterpolationMode mode;
+};
+
+static const RenderCase renderCases[] {
+    { "slicer", render::RenderMode::RenderSlicer, false },
+    { "mip", render::RenderMode::RenderMIP, false },
+    { "iso", render::RenderMode::RenderIso, false },
+    { "iso-phong", render::RenderMode::RenderIso, true },
+    { "composite", render::RenderMode::RenderComposite, false },
+    { "tf2d", render::RenderMode::RenderTF2D, false },
+    { "tfSecondDerivative", render::RenderMode::RenderTFSecondDerivative, false }
+};
+
+static const InterpolationCase interpolationCases[] {
+    { "nearest", volume::InterpolationMode::NearestNeighbour },
+    { "linear", volume::InterpolationMode::Linear },
+    { "cubic", volume::InterpolationMode::Cubic }
+};
+
+static std::vector<int> parseList(const std::string& value)
+{
+    std::vector<int> out;
+    std::stringstream stream { value };
+    std::string item;
+    while (std::getline(stream, item, ','))
+        out.push_back(std::atoi(item.c_str()));
+    return out;
+}
+
+static std::optional<Options> parseCommandLine(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return {};
+        }
+        const std::string value = argv[++i];
+        if (arg == "--sizes")
+            options.sizes = parseList(value);
+        else if (arg == "--volume")
+            options.volumeFiles.push_back(value);
+        else if (arg == "--resolutions")
+            options.resolutions = parseList(value);
+        else if (arg == "--frames")
+            options.frames = std::max(std::atoi(value.c_str()), 1);
+        else if (arg == "--threads")
+            options.threads = parseList(value);
+        else if (arg == "--output")
+            options.output = value;
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return {};
+        }
+    }
+    return options;
+}
+
+// Camera path: a full circle around the center of the volume while the elevation oscillates between -20 and +20
+// degrees, so that the rays traverse the volume along every axis at some point.
+static std::vector<render::LookAtCamera> createOrbit(const glm::ivec3& dims, int frames)
+{
+    const glm::vec3 center = glm::vec3(dims) / 2.0f;
+    const float distance = 1.6f * float(glm::compMax(dims));
+    std::vector<render::LookAtCamera> cameras;
+    for (int i = 0; i < frames; i++) {
+        const float phase = float(i) / float(frames) * 2.0f * glm::pi<float>();
+        const float azimuth = phase;
+        const float elevation = glm::radians(20.0f) * std::sin(phase);
+        const glm::vec3 direction { std::sin(azimuth) * std::cos(elevation), std::sin(elevation), std::cos(azimuth) * std::cos(elevation) };
+        cameras.emplace_back(center - distance * direction, center, glm::vec3(0, 1, 0), glm::radians(60.0f), 1.0f);
+    }
+    return cameras;
+}
+
+// Number of samples that a brute force ray marcher takes to render the frame (see the comment at the top).
+static double countSamples(const render::RayTraceCamera& camera, const glm::ivec3& dims, int resolution)
+{
+    double samples = 0.0;
+    for (int y = 0; y < resolution; y++) {
+        for (int x = 0; x < resolution; x++) {
+            const glm::vec2 pixelPos = glm::vec2(x, y) / glm::vec2(float(resolution));
+            const render::Ray ray = camera.generateRay(pixelPos * 2.0f - 1.0f);
+            float tmin, tmax;
+            if (clipRay(ray.origin, ray.direction, glm::vec3(dims - 1), tmin, tmax))
+                samples += double(std::floor((tmax - tmin) / sampleStep)) + 1.0;
+        }
+    }
+    return samples;
+}
+
+// Nearest rank percentile of sorted values.
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    const size_t rank = size_t(std::ceil(p / 100.0 * double(sorted.size())));
+    return sorted[std::clamp(rank, size_t(1), sorted.size()) - 1];
+}
+
+// Renders the orbit once (after one warm up frame) and returns the statistics of the frame times.
+static json renderOrbit(render::Renderer& renderer, const std::vector<render::LookAtCamera>& cameras, double samplesPerOrbit, int resolution)
+{
+    std::vector<double> frameTimes;
+    renderer.render();
+    for (const auto& camera : cameras) {
+        renderer.setCamera(&camera);
+        const auto start = std::chrono::high_resolution_clock::now();
+        renderer.render();
+        const auto end = std::chrono::high_resolution_clock::now();
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    const double totalSeconds = std::accumulate(std::begin(frameTimes), std::end(frameTimes), 0.0) / 1000.0;
+    std::sort(std::begin(frameTimes), std::end(frameTimes));
+    json out;
+    out["msPerFrame"] = {
+        { "min", frameTimes.front() },
+        { "mean", totalSeconds * 1000.0 / double(frameTimes.size()) },
+        { "p50", percentile(frameTimes, 50.0) },
+        { "p90", percentile(frameTimes, 90.0) },
+        { "p99", percentile(frameTimes, 99.0) },
+        { "max", frameTimes.back() }
+    };
+    out["raysPerSecond"] = double(resolution) * double(resolution) * double(frameTimes.size()) / totalSeconds;
+    out["samplesPerSecond"] = samplesPerOrbit / totalSeconds;
+    return out;
+}
+
+static json benchmarkVolume(const std::string& name, volume::Volume& volume, const Options& options)
+{
+    const glm::ivec3 dims = volume.dims();
+    fmt::print("{} ({}x{}x{}): computing derived volumes...\n", name, dims.x, dims.y, dims.z);
+    volume::GradientVolume gradientVolume { volume };
+    volume::SecondDerivativeVolume secondDerivativeVolume { volume, gradientVolume };
+
+    const auto cameras = createOrbit(dims, options.frames);
+    json results = json::array();
+    for (const int resolution : options.resolutions) {
+        double samplesPerOrbit = 0.0;
+        for (const auto& camera : cameras)
+            samplesPerOrbit += countSamples(camera, dims, resolution);
+
+        for (const auto& renderCase : renderCases) {
+            for (const auto& interpolationCase : interpolationCases) {
+                volume.interpolationMode = gradientVolume.interpolationMode = secondDerivativeVolume.interpolationMode = interpolationCase.mode;
+                render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(resolution));
+                config.renderMode = renderCase.mode;
+                config.volumeShading = renderCase.phongShading;
+                render::Renderer renderer { &volume, &gradientVolume, &secondDerivativeVolume, &cameras.front(), config };
+
+                json result;
+                result["renderMode"] = renderCase.name;
+                result["interpolation"] = interpolationCase.name;
+                result["resolution"] = resolution;
+                result.update(renderOrbit(renderer, cameras, samplesPerOrbit, resolution));
+                fmt::print("  {:<20} {:<8} {:>5}^2 {:>10.2f} ms (p50) {:>10.2f} Mrays/s {:>10.1f} Msamples/s\n",
+                    renderCase.name, interpolationCase.name, resolution, result["msPerFrame"]["p50"].get<double>(),
+                    result["raysPerSecond"].get<double>() / 1e6, result["samplesPerSecond"].get<double>() / 1e6);
+                results.push_back(std::move(result));
+            }
+        }
+    }
+
+    // Thread scaling of the reference case.
+    const int resolution = options.resolutions.back();
+    double samplesPerOrbit = 0.0;
+    for (const auto& camera : cameras)
+        samplesPerOrbit += countSamples(camera, dims, resolution);
+    volume.interpolationMode = gradientVolume.interpolationMode = secondDerivativeVolume.interpolationMode = volume::InterpolationMode::Linear;
+    render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(resolution));
+    config.renderMode = render::RenderMode::RenderComposite;
+
+    json threadScaling = json::array();
+    double firstMeanMs = 0.0;
+    for (const int threads : options.threads) {
+        const tbb::global_control threadLimit { tbb::global_control::max_allowed_parallelism, size_t(threads) };
+        render::Renderer renderer { &volume, &gradientVolume, &secondDerivativeVolume, &cameras.front(), config };
+        json result;
+        result["threads"] = threads;
+        result.update(renderOrbit(renderer, cameras, samplesPerOrbit, resolution));
+        const double meanMs = result["msPerFrame"]["mean"].get<double>();
+        if (threadScaling.empty())
+            firstMeanMs = meanMs;
+        // Relative to the first thread count (1 unless specified otherwise with --threads).
+        result["speedup"] = firstMeanMs / meanMs;
+        fmt::print("  composite linear {:>5}^2 {:>3} threads: {:>10.2f} ms (mean)\n", resolution, threads, meanMs);
+        threadScaling.push_back(std::move(result));
+    }
+
+    json out;
+    out["name"] = name;
+    out["dims"] = { dims.x, dims.y, dims.z };
+    out["frames"] = options.frames;
+    out["results"] = std::move(results);
+    out["threadScaling"] = std::move(threadScaling);
+    return out;
+}
+
+static std::string compilerName()
+{
+#if defined(__clang__)
+    return fmt::format("clang {}.{}.{}", __clang_major__, __clang_minor__, __clang_patchlevel__);
+#elif defined(__GNUC__)
+    return fmt::format("gcc {}.{}.{}", __GNUC__, __GNUC_MINOR__, __GNUC_PATCHLEVEL__);
+#elif defined(_MSC_VER)
+    return fmt::format("msvc {}", _MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    auto optOptions = parseCommandLine(argc, argv);
+    if (!optOptions)
+        return 1;
+    Options& options = *optOptions;
+    if (options.threads.empty()) {
+        const int maxThreads = tbb::info::default_concurrency();
+        for (int threads = 1; threads < maxThreads; threads *= 2)
+            options.threads.push_back(threads);
+        options.threads.push_back(maxThreads);
+    }
+
+    json report;
+    report["build"] = {
+        { "compiler", compilerName() },
+#ifdef NDEBUG
+        { "buildType", "release" },
+#else
+        { "buildType", "debug" },
+#endif
+        { "maxRayPacketWidth", render::simd::maxWidth },
+        { "hardwareThreads", tbb::info::default_concurrency() },
+        { "timestamp", std::time(nullptr) }
+    };
+    report["volumes"] = json::array();
+
+    for (const int size : options.sizes) {
+        fmt::print("Generating {0}x{0}x{0} synthetic volume...\n", size);
+        volume::Volume volume { createSyntheticVolume(glm::ivec3(size)), glm::ivec3(size) };
+        report["volumes"].push_back(benchmarkVolume(fmt::format("synthetic-{}", size), volume, options));
+    }
+    for (const auto& file : options.volumeFiles) {
+        volume::Volume volume { file, volume::LoadMode::MemoryMap };
+        if (volume.data().empty()) {
+            std::cerr << "Could not load volume " << file << std::endl;
+            return 1;
+        }
+        report["volumes"].push_back(benchmarkVolume(file, volume, options));
+    }
+
+    std::ofstream stream { options.output };
+    stream << report.dump(4) << std::endl;
+    if (!stream) {
+        std::cerr << "Could not write " << options.output << std::endl;
+        return 1;
+    }
+    fmt::print("Results written to {}\n", options.output);
+    return 0;
+}
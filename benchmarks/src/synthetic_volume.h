@@ -0,0 +1,51 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <glm/geometric.hpp>
+#include <glm/vec3.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <vector>
+
+// Procedurally generated test volume: a "patient" made of a few nested blobs surrounded by empty space,
+// which roughly mimics the value distribution (and amount of air) of the CT scans that ship with VolVis.
+inline std::vector<uint16_t> createSyntheticVolume(const glm::ivec3& dim)
+{
+    struct Blob {
+        glm::vec3 center;
+        float radius;
+        uint16_t value;
+    };
+    const glm::vec3 size { dim };
+    const Blob blobs[] {
+        { size * glm::vec3(0.5f, 0.5f, 0.5f), 0.40f, 80 }, // Soft tissue.
+        { size * glm::vec3(0.4f, 0.45f, 0.5f), 0.12f, 200 }, // Bone.
+        { size * glm::vec3(0.62f, 0.55f, 0.45f), 0.08f, 240 },
+        { size * glm::vec3(0.5f, 0.35f, 0.65f), 0.06f, 150 }
+    };
+    const float scale = float(std::min(dim.x, std::min(dim.y, dim.z)));
+
+    std::vector<uint16_t> out(size_t(dim.x) * size_t(dim.y) * size_t(dim.z), 0);
+    tbb::parallel_for(tbb::blocked_range<int>(0, dim.z), [&](const tbb::blocked_range<int>& range) {
+        for (int z = std::begin(range); z != std::end(range); z++) {
+            for (int y = 0; y < dim.y; y++) {
+                for (int x = 0; x < dim.x; x++) {
+                    const glm::vec3 p { x, y, z };
+                    uint16_t value = 0;
+                    for (const auto& blob : blobs) {
+                        // Smooth falloff over a few voxels so that gradients are well defined.
+                        const float d = glm::length(p - blob.center) - blob.radius * scale;
+                        const float w = std::clamp(0.5f - d / 4.0f, 0.0f, 1.0f);
+                        value = std::max(value, uint16_t(w * float(blob.value)));
+                    }
+                    // Cheap deterministic "noise" so that the data does not compress into constant regions.
+                    const uint32_t hash = uint32_t(x * 73856093) ^ uint32_t(y * 19349663) ^ uint32_t(z * 83492791);
+                    if (value > 0)
+                        value = uint16_t(value + (hash % 5));
+                    out[size_t(x) + size_t(dim.x) * (size_t(y) + size_t(dim.y) * size_t(z))] = value;
+                }
+            }
+        }
+    });
+    return out;
+}
@@ -0,0 +1,106 @@
+// Offline converter: preprocesses a volume once so that the viewer and the offline renderer can open it without
+// computing anything. A .vvc output is a volume container (see volume_container.h) with the voxels, the bricks for
+// streaming, the statistics and the derived volumes; a .vvb output only has the bricks (see brick_cache.h).
+//
+// Usage: VolVisConvert input.fld output.vvc|output.vvb [--brick-size N] [--gradient-storage float|quantized]
+//                      [--no-voxels] [--no-bricks] [--no-derived] [--no-pyramid]
+//        VolVisConvert --verify file.vvc
+#include "volume/brick_cache.h"
+#include "volume/volume.h"
+#include "volume/volume_container.h"
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static constexpr const char* usage = "Usage: VolVisConvert input.fld output.vvc|output.vvb [--brick-size N] [--gradient-storage float|quantized] [--no-voxels] [--no-bricks] [--no-derived] [--no-pyramid]\n"
+                                     "       VolVisConvert --verify file.vvc";
+
+static int verify(const std::filesystem::path& file)
+{
+    const volume::VolumeContainer container { file };
+    if (!container.isOpen())
+        return 1;
+    if (!container.verify()) {
+        std::cerr << "File " << file << " is corrupt" << std::endl;
+        return 1;
+    }
+    if (container.isStale())
+        std::cerr << "File " << file << " is intact but out of date: " << container.sourceFile() << " changed since it was converted" << std::endl;
+    fmt::print("{}: {} sections OK\n", file.string(), container.sections().size());
+    return container.isStale() ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        const std::vector<std::string> args(argv + 1, argv + argc);
+        if (args.size() == 2 && args[0] == "--verify")
+            return verify(args[1]);
+        if (args.size() < 2) {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+
+        const std::filesystem::path input = args[0], output = args[1];
+        volume::ContainerOptions options;
+        for (size_t i = 2; i < args.size(); i++) {
+            const std::string& arg = args[i];
+            if (arg == "--no-voxels") {
+                options.voxels = false;
+            } else if (arg == "--no-bricks") {
+                options.bricks = false;
+            } else if (arg == "--no-derived") {
+                options.derivedVolumes = false;
+            } else if (arg == "--no-pyramid") {
+                options.pyramid = false;
+            } else if (arg == "--brick-size" && i + 1 < args.size()) {
+                options.brickSize = std::stoi(args[++i]);
+            } else if (arg == "--gradient-storage" && i + 1 < args.size()) {
+                const std::string& storage = args[++i];
+                if (storage != "float" && storage != "quantized") {
+                    std::cerr << "Unknown gradient storage " << storage << " (expected float or quantized)" << std::endl;
+                    return 1;
+                }
+                options.gradientStorage = storage == "quantized" ? volume::GradientStorage::Quantized : volume::GradientStorage::Float;
+            } else {
+                std::cerr << "Unknown option " << arg << "\n"
+                          << usage << std::endl;
+                return 1;
+            }
+        }
+        if (!options.voxels && !options.bricks) {
+            std::cerr << "A container needs the voxels, the bricks or both" << std::endl;
+            return 1;
+        }
+        if (options.brickSize < 2) {
+            std::cerr << "Invalid brick size " << options.brickSize << std::endl;
+            return 1;
+        }
+
+        const volume::Volume volume { input, volume::LoadMode::MemoryMap };
+        if (volume.data().empty()) {
+            std::cerr << "Could not load volume " << input << std::endl;
+            return 1;
+        }
+
+        using clock = std::chrono::high_resolution_clock;
+        const auto start = clock::now();
+        const bool written = output.extension() == ".vvb"
+            ? volume::writeBrickedVolume(volume, output, options.brickSize)
+            : volume::writeVolumeContainer(volume, output, options);
+        const auto end = clock::now();
+        if (!written) {
+            std::cerr << "Could not write " << output << std::endl;
+            return 1;
+        }
+        fmt::print("{}: {}MB in {:.1f}s\n", output.string(), std::filesystem::file_size(output) / (1024 * 1024), std::chrono::duration<double>(end - start).count());
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
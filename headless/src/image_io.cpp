@@ -0,0 +1,43 @@
+#include "image_io.h"
+#include <algorithm>
+#include <cstdint>
+#include <fmt/format.h>
+#include <fstream>
+#include <glm/common.hpp>
+#include <vector>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+namespace headless {
+
+bool writePNG(const std::filesystem::path& file, gsl::span<const glm::vec4> image, const glm::ivec2& resolution)
+{
+    // PNG stores the top row first.
+    std::vector<uint8_t> pixels(image.size() * 4);
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            const glm::vec4 color = glm::clamp(image[size_t(x + (resolution.y - 1 - y) * resolution.x)], 0.0f, 1.0f);
+            for (int c = 0; c < 4; c++)
+                pixels[size_t(4 * (x + y * resolution.x) + c)] = uint8_t(color[c] * 255.0f + 0.5f);
+        }
+    }
+    return stbi_write_png(file.string().c_str(), resolution.x, resolution.y, 4, pixels.data(), resolution.x * 4) != 0;
+}
+
+bool writePFM(const std::filesystem::path& file, gsl::span<const glm::vec4> image, const glm::ivec2& resolution)
+{
+    std::ofstream stream { file, std::ios::binary };
+    if (!stream)
+        return false;
+
+    // A negative scale indicates little-endian data. PFM stores the bottom row first, like the frame buffer.
+    stream << fmt::format("PF\n{} {}\n-1.0\n", resolution.x, resolution.y);
+    std::vector<float> pixels;
+    pixels.reserve(image.size() * 3);
+    for (const glm::vec4& color : image)
+        pixels.insert(std::end(pixels), { color.r, color.g, color.b });
+    stream.write(reinterpret_cast<const char*>(pixels.data()), std::streamsize(pixels.size() * sizeof(float)));
+    return bool(stream);
+}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <filesystem>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <gsl/span>
+
+namespace headless {
+
+// The images are stored like the frame buffer of the renderer: row by row, starting at the bottom row.
+
+// Writes an 8-bit RGBA PNG (colors are clamped to [0, 1]). Returns false if the file could not be written.
+bool writePNG(const std::filesystem::path& file, gsl::span<const glm::vec4> image, const glm::ivec2& resolution);
+// Writes a little-endian 32-bit float RGB PFM (alpha is dropped). Returns false if the file could not be written.
+bool writePFM(const std::filesystem::path& file, gsl::span<const glm::vec4> image, const glm::ivec2& resolution);
+
+}
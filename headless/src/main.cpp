@@ -0,0 +1,213 @@
+// Offline renderer: renders one or more images of a volume without opening a window, using the same renderer as the
+// viewer. The settings are read from a JSON render spec (see render_job.cpp for the format); the command line options
+// override the corresponding top-level keys of the spec. In batch mode (a spec with "views") the volume and its
+// derived volumes are loaded once and reused for every view. With "mesh" (or --mesh) the iso surface is also (or, without
+// an output, only) exported as a triangle mesh.
+//
+// Usage: VolVisRender [spec.json] [--volume file.fld|file.vvb|file.vvc] [--output image.png|image.pfm] [--mode name]
+//                     [--interpolation name] [--resolution WIDTHxHEIGHT] [--iso value] [--mesh mesh.ply|mesh.obj]
+#include "image_io.h"
+#include "render/look_at_camera.h"
+#include "render/renderer.h"
+#include "render_job.h"
+#include "volume/gradient_volume.h"
+#include "volume/marching_cubes.h"
+#include "volume/secondderivative_volume.h"
+#include "volume/volume.h"
+#include "volume/volume_container.h"
+#include "volume/volume_pyramid.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+static bool needsGradientVolume(const headless::RenderJob& job)
+{
+    return render::needsGradientVolume(job.config);
+}
+
+static bool needsSecondDerivativeVolume(const headless::RenderJob& job)
+{
+    return render::needsSecondDerivativeVolume(job.config);
+}
+
+// Reads the spec file (if any) and applies the command line options on top of it.
+static std::optional<json> parseCommandLine(int argc, char** argv)
+{
+    json spec = json::object();
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            std::ifstream file { arg };
+            if (!file) {
+                std::cerr << "Could not open render spec " << arg << std::endl;
+                return {};
+            }
+            json fileSpec = json::parse(file);
+            fileSpec.merge_patch(spec);
+            spec = std::move(fileSpec);
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return {};
+        }
+        const std::string value = argv[++i];
+        if (arg == "--volume") {
+            spec["volume"] = value;
+        } else if (arg == "--output") {
+            spec["output"] = value;
+        } else if (arg == "--mode") {
+            spec["renderMode"] = value;
+        } else if (arg == "--interpolation") {
+            spec["interpolation"] = value;
+        } else if (arg == "--iso") {
+            spec["isoValue"] = std::stof(value);
+        } else if (arg == "--mesh") {
+            spec["mesh"] = value;
+        } else if (arg == "--resolution") {
+            int width = 0, height = 0;
+            if (std::sscanf(value.c_str(), "%dx%d", &width, &height) != 2) {
+                std::cerr << "Invalid resolution " << value << " (expected WIDTHxHEIGHT)" << std::endl;
+                return {};
+            }
+            spec["resolution"] = { width, height };
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return {};
+        }
+    }
+    return spec;
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        const auto optSpec = parseCommandLine(argc, argv);
+        if (!optSpec)
+            return 1;
+        const json& spec = *optSpec;
+        if (!spec.contains("volume")) {
+            std::cerr << "Usage: VolVisRender [spec.json] [--volume file.fld|file.vvb|file.vvc] [--output image.png|image.pfm] [--mode name] [--interpolation name] [--resolution WIDTHxHEIGHT] [--iso value] [--mesh mesh.ply|mesh.obj]" << std::endl;
+            return 1;
+        }
+
+        volume::Volume volume { spec["volume"].get<std::string>(), volume::LoadMode::MemoryMap };
+        if (volume.data().empty() && !volume.brickCache()) {
+            std::cerr << "Could not load volume " << spec["volume"].get<std::string>() << std::endl;
+            return 1;
+        }
+        // A spec that only exports a mesh renders no images.
+        const bool exportMesh = spec.contains("mesh");
+        const std::vector<headless::RenderJob> jobs = !exportMesh || spec.contains("output") || spec.contains("views")
+            ? headless::parseRenderJobs(spec, volume)
+            : std::vector<headless::RenderJob> {};
+        // Streamed volumes are too large for derived volumes.
+        volume::BrickCache* pBrickCache = volume.brickCache();
+        if (pBrickCache && std::any_of(std::begin(jobs), std::end(jobs), [](const headless::RenderJob& job) { return needsGradientVolume(job) || needsSecondDerivativeVolume(job); }))
+            throw std::runtime_error("Render modes and shading that need gradients are not supported for streamed volumes");
+        if (pBrickCache && exportMesh)
+            throw std::runtime_error("Mesh export is not supported for streamed volumes");
+
+        // Derived volumes are only computed if one of the views needs them, and only if the volume was not converted
+        // with them (see VolVisConvert).
+        const volume::GradientStorage gradientStorage = headless::parseGradientStorage(spec);
+        std::unique_ptr<volume::GradientVolume> pGradientVolume;
+        if (exportMesh || std::any_of(std::begin(jobs), std::end(jobs), needsGradientVolume)) {
+            pGradientVolume = volume::loadGradientVolume(volume, gradientStorage);
+            if (!pGradientVolume)
+                pGradientVolume = std::make_unique<volume::GradientVolume>(volume, gradientStorage);
+        }
+        // The second derivative volume reuses the gradient volume if there is one, and otherwise computes the gradients
+        // on the fly (which needs far less memory than building a gradient volume just for this).
+        std::unique_ptr<volume::SecondDerivativeVolume> pSecondDerivativeVolume;
+        if (std::any_of(std::begin(jobs), std::end(jobs), needsSecondDerivativeVolume)) {
+            pSecondDerivativeVolume = volume::loadSecondDerivativeVolume(volume);
+            if (!pSecondDerivativeVolume)
+                pSecondDerivativeVolume = pGradientVolume ? std::make_unique<volume::SecondDerivativeVolume>(volume, *pGradientVolume) : std::make_unique<volume::SecondDerivativeVolume>(volume);
+        }
+
+        std::unique_ptr<volume::VolumePyramid> pVolumePyramid;
+        if (!pBrickCache && std::any_of(std::begin(jobs), std::end(jobs), [](const headless::RenderJob& job) { return job.config.levelOfDetail; })) {
+            pVolumePyramid = volume::loadVolumePyramid(volume, gradientStorage);
+            if (!pVolumePyramid)
+                pVolumePyramid = std::make_unique<volume::VolumePyramid>(volume, gradientStorage);
+        }
+
+        bool success = true;
+        if (exportMesh) {
+            // The vertex normals are always interpolated linearly, whatever the interpolation of the views.
+            const std::filesystem::path meshFile = spec["mesh"].get<std::string>();
+            const float isoValue = spec.value("isoValue", render::RenderConfig {}.isoValue);
+            using clock = std::chrono::high_resolution_clock;
+            const auto start = clock::now();
+            const volume::Mesh mesh = volume::extractIsoSurface(volume, *pGradientVolume, isoValue);
+            const auto end = clock::now();
+            if (volume::writeMesh(mesh, meshFile)) {
+                fmt::print("{} ({} vertices, {} triangles): {:.1f}ms\n", meshFile.string(), mesh.positions.size(), mesh.triangles.size(), std::chrono::duration<double, std::milli>(end - start).count());
+            } else {
+                std::cerr << "Could not write " << meshFile << std::endl;
+                success = false;
+            }
+        }
+        for (const headless::RenderJob& job : jobs) {
+            volume.interpolationMode = job.interpolationMode;
+            if (pGradientVolume)
+                pGradientVolume->interpolationMode = job.interpolationMode;
+            if (pSecondDerivativeVolume)
+                pSecondDerivativeVolume->interpolationMode = job.interpolationMode;
+            if (pVolumePyramid)
+                pVolumePyramid->setInterpolationMode(job.interpolationMode);
+
+            const glm::ivec2 resolution = job.config.renderResolution;
+            const render::LookAtCamera camera { job.camera.position, job.camera.lookAt, job.camera.up, job.camera.fovy, float(resolution.x) / float(resolution.y) };
+            render::Renderer renderer {
+                &volume,
+                pGradientVolume.get(),
+                pSecondDerivativeVolume.get(),
+                &camera,
+                job.config
+            };
+            renderer.setVolumePyramid(pVolumePyramid.get());
+
+            using clock = std::chrono::high_resolution_clock;
+            const auto start = clock::now();
+            renderer.render();
+            // Streamed volumes render from the coarse copy where bricks are missing; render again until all bricks
+            // that the view needs are loaded (or, if they do not fit in the cache, a fixed number of times).
+            constexpr int maxStreamingPasses = 16;
+            for (int pass = 0; pBrickCache && pBrickCache->numPendingBricks() > 0 && pass < maxStreamingPasses; pass++) {
+                pBrickCache->waitForPendingBricks();
+                renderer.render();
+            }
+            const auto end = clock::now();
+
+            const bool written = job.output.extension() == ".pfm"
+                ? headless::writePFM(job.output, renderer.frameBuffer(), resolution)
+                : headless::writePNG(job.output, renderer.frameBuffer(), resolution);
+            if (written) {
+                fmt::print("{} ({}x{}): {:.1f}ms\n", job.output.string(), resolution.x, resolution.y, std::chrono::duration<double, std::milli>(end - start).count());
+            } else {
+                std::cerr << "Could not write " << job.output << std::endl;
+                success = false;
+            }
+        }
+        return success ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
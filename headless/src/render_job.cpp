@@ -0,0 +1,243 @@
+// Render specs are JSON objects. Every key is optional (except "output", unless the spec only exports a "mesh"); missing
+// keys keep the defaults of the viewer.
+//
+// {
+//     "volume": "data/foot.fld",           (only read by main.cpp)
+//     "gradientStorage": "float",          float | quantized (top-level only, shared by all views)
+//     "renderMode": "composite",           slicer | mip | iso | composite | tf2d | tfSecondDerivative
+//     "interpolation": "linear",           nearest | linear | cubic
+//     "resolution": [512, 512],
+//     "shading": "phong",                  none | phong | gooch
+//     "isoValue": 95.0,
+//     "emptySpaceSkipping": true,
+//     "earlyRayTermination": 0.99,
+//     "rayPacketWidth": 1,
+//     "levelOfDetail": false,              render zoomed out views from a coarser level of the volume pyramid
+//     "sampleStep": 1.0,                   distance between the samples of composite mode, in voxels
+//     "preintegrated": false,              composite with a preintegrated transfer function (for larger steps)
+//     "transferFunction": [                1D transfer function control points, like in the transfer function widget.
+//         { "position": 0.0, "color": [0, 0, 0], "opacity": 0.0 },     position is relative to the volume maximum.
+//         { "position": 1.0, "color": [1, 1, 1], "opacity": 1.0 }
+//     ],
+//     "tf2D": { "intensity": 68.0, "radius": 38.0, "color": [0.0, 0.8, 0.6, 0.3] },
+//     "tfSecondDerivative": { "intensity": 206.0, "radius": 32.0, "threshold": 0.61, "color": [...], "color2": [...] },
+//     "gooch": { "warm": [0.9, 0.3, 0.3], "cold": [0.0, 0.0, 1.0] },
+//     "camera": { "position": [x, y, z], "lookAt": [x, y, z], "up": [0, 1, 0], "fovy": 60.0 },
+//     "output": "image.png",               .png (8-bit RGBA) or .pfm (32-bit float RGB)
+//     "mesh": "surface.ply",               iso surface of "isoValue" as a triangle mesh, .ply or .obj (only read by main.cpp)
+//     "views": [ { ... }, ... ]
+// }
+//
+// Instead of a position the camera may be given in spherical coordinates around the look-at point (which defaults to
+// the center of the volume): { "azimuth": 30.0, "elevation": 20.0, "distance": 300.0 }, with angles in degrees.
+// An azimuth and elevation of 0 correspond to the initial view of the viewer (looking along the +z axis).
+//
+// Batch mode: every entry of "views" describes one image. Its keys override the top-level keys, except for "camera"
+// which is replaced as a whole.
+#include "render_job.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <glm/trigonometric.hpp>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string>
+
+using json = nlohmann::json;
+
+namespace headless {
+
+// Control point of the 1D transfer function.
+struct TFPoint {
+    float position;
+    glm::vec3 color;
+    float opacity;
+};
+
+static glm::vec3 toVec3(const json& value)
+{
+    return glm::vec3(value.at(0).get<float>(), value.at(1).get<float>(), value.at(2).get<float>());
+}
+
+static glm::vec4 toVec4(const json& value)
+{
+    return glm::vec4(value.at(0).get<float>(), value.at(1).get<float>(), value.at(2).get<float>(), value.at(3).get<float>());
+}
+
+// Returns the index of name in names or throws if it is not one of them.
+template <size_t N>
+static size_t parseEnum(const json& value, const char* key, const std::array<const char*, N>& names)
+{
+    const std::string name = value.get<std::string>();
+    const auto it = std::find(std::begin(names), std::end(names), name);
+    if (it == std::end(names))
+        throw std::runtime_error("Invalid value \"" + name + "\" for \"" + key + "\"");
+    return size_t(std::distance(std::begin(names), it));
+}
+
+// Piecewise linear interpolation of the control points, evaluated at position i / size for entry i of the color map
+// (like TransferFunctionWidget::updateColormap). Positions outside of the control points get the first / last point.
+static void computeColorMap(std::vector<TFPoint> points, render::RenderConfig& config)
+{
+    if (points.empty())
+        throw std::runtime_error("\"transferFunction\" needs at least one control point");
+    std::sort(std::begin(points), std::end(points), [](const TFPoint& lhs, const TFPoint& rhs) { return lhs.position < rhs.position; });
+
+    const auto toRGBA = [](const TFPoint& point) { return glm::vec4(point.color, point.opacity); };
+    auto& colorMap = config.tfColorMap;
+    for (size_t i = 0; i < colorMap.size(); i++) {
+        const float x = float(i) / float(colorMap.size());
+        const auto right = std::find_if(std::begin(points), std::end(points), [&](const TFPoint& point) { return point.position >= x; });
+        if (right == std::begin(points)) {
+            colorMap[i] = toRGBA(points.front());
+        } else if (right == std::end(points)) {
+            colorMap[i] = toRGBA(points.back());
+        } else {
+            const auto left = right - 1;
+            colorMap[i] = glm::mix(toRGBA(*left), toRGBA(*right), (x - left->position) / (right->position - left->position));
+        }
+    }
+}
+
+RenderJob defaultRenderJob(const volume::Volume& volume)
+{
+    RenderJob job {};
+    job.config.renderResolution = glm::ivec2(720);
+    job.interpolationMode = volume::InterpolationMode::NearestNeighbour;
+
+    // Same defaults as TransferFunctionWidget, TransferFunction2DWidget, TransferFunctionSecondDerivativeWidget and GoochWidget.
+    computeColorMap({ TFPoint { 0.0f, glm::vec3(0.0f), 0.0f }, TFPoint { 0.7f, glm::vec3(0.7f), 0.03f }, TFPoint { 1.0f, glm::vec3(1.0f), 1.0f } }, job.config);
+    job.config.tfColorMapIndexStart = 0.0f;
+    job.config.tfColorMapIndexRange = volume.maximum();
+    job.config.TF2DIntensity = 68.0f;
+    job.config.TF2DRadius = 38.0f;
+    job.config.TF2DColor = glm::vec4(0.0f, 0.8f, 0.6f, 0.3f);
+    job.config.TFSecondDerivativeIntensity = 206.0f;
+    job.config.TFSecondDerivativeRadius = 32.0f;
+    job.config.TFSecondDerivativeThreshold = 0.61f;
+    job.config.TFSecondDerivativeColor1 = glm::vec4(0.8f, 0.0f, 0.6f, 0.3f);
+    job.config.TFSecondDerivativeColor2 = glm::vec4(0.0f, 1.0f, 0.0f, 0.3f);
+    job.config.GoochWarmColor = glm::vec3(0.9f, 0.3f, 0.3f);
+    job.config.GoochColdColor = glm::vec3(0.0f, 0.0f, 1.0f);
+
+    // Initial view of the trackball after loading a volume.
+    const glm::vec3 center = glm::vec3(volume.dims()) / 2.0f;
+    job.camera = CameraSpec { center - glm::vec3(0.0f, 0.0f, float(glm::compMax(volume.dims()))), center, glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(60.0f) };
+    return job;
+}
+
+static CameraSpec parseCamera(const json& camera, const volume::Volume& volume)
+{
+    CameraSpec out = defaultRenderJob(volume).camera;
+    out.lookAt = camera.contains("lookAt") ? toVec3(camera["lookAt"]) : out.lookAt;
+    out.up = camera.contains("up") ? toVec3(camera["up"]) : out.up;
+    out.fovy = camera.contains("fovy") ? glm::radians(camera["fovy"].get<float>()) : out.fovy;
+    if (camera.contains("position")) {
+        out.position = toVec3(camera["position"]);
+    } else {
+        const float azimuth = glm::radians(camera.value("azimuth", 0.0f));
+        const float elevation = glm::radians(camera.value("elevation", 0.0f));
+        const float distance = camera.value("distance", float(glm::compMax(volume.dims())));
+        const glm::vec3 direction { std::sin(azimuth) * std::cos(elevation), std::sin(elevation), std::cos(azimuth) * std::cos(elevation) };
+        out.position = out.lookAt - distance * direction;
+    }
+    if (glm::length(glm::cross(out.lookAt - out.position, out.up)) == 0.0f)
+        throw std::runtime_error("Camera view direction is parallel to the up vector (or the camera is at the look-at point)");
+    return out;
+}
+
+static RenderJob parseRenderJob(const json& spec, const volume::Volume& volume)
+{
+    RenderJob job = defaultRenderJob(volume);
+    render::RenderConfig& config = job.config;
+
+    if (spec.contains("renderMode"))
+        config.renderMode = render::RenderMode(parseEnum(spec["renderMode"], "renderMode", std::array { "slicer", "mip", "iso", "composite", "tf2d", "tfSecondDerivative" }));
+    if (spec.contains("interpolation"))
+        job.interpolationMode = volume::InterpolationMode(parseEnum(spec["interpolation"], "interpolation", std::array { "nearest", "linear", "cubic" }));
+    if (spec.contains("resolution")) {
+        config.renderResolution = glm::ivec2(spec["resolution"].at(0).get<int>(), spec["resolution"].at(1).get<int>());
+        if (config.renderResolution.x <= 0 || config.renderResolution.y <= 0)
+            throw std::runtime_error("\"resolution\" must be positive");
+    }
+    if (spec.contains("shading")) {
+        const size_t shading = parseEnum(spec["shading"], "shading", std::array { "none", "phong", "gooch" });
+        config.volumeShading = shading == 1;
+        config.goochShading = shading == 2;
+    }
+    config.isoValue = spec.value("isoValue", config.isoValue);
+    config.emptySpaceSkipping = spec.value("emptySpaceSkipping", config.emptySpaceSkipping);
+    config.earlyRayTerminationThreshold = spec.value("earlyRayTermination", config.earlyRayTerminationThreshold);
+    config.rayPacketWidth = spec.value("rayPacketWidth", config.rayPacketWidth);
+    config.levelOfDetail = spec.value("levelOfDetail", config.levelOfDetail);
+    config.compositeSampleStep = spec.value("sampleStep", config.compositeSampleStep);
+    if (!(config.compositeSampleStep > 0.0f))
+        throw std::runtime_error("\"sampleStep\" must be positive");
+    config.preintegratedTransferFunction = spec.value("preintegrated", config.preintegratedTransferFunction);
+
+    if (spec.contains("transferFunction")) {
+        std::vector<TFPoint> points;
+        for (const json& point : spec["transferFunction"])
+            points.push_back(TFPoint { point.at("position").get<float>(), toVec3(point.at("color")), point.at("opacity").get<float>() });
+        computeColorMap(std::move(points), config);
+    }
+    if (spec.contains("tf2D")) {
+        const json& tf2D = spec["tf2D"];
+        config.TF2DIntensity = tf2D.value("intensity", config.TF2DIntensity);
+        config.TF2DRadius = tf2D.value("radius", config.TF2DRadius);
+        config.TF2DColor = tf2D.contains("color") ? toVec4(tf2D["color"]) : config.TF2DColor;
+    }
+    if (spec.contains("tfSecondDerivative")) {
+        const json& tf = spec["tfSecondDerivative"];
+        config.TFSecondDerivativeIntensity = tf.value("intensity", config.TFSecondDerivativeIntensity);
+        config.TFSecondDerivativeRadius = tf.value("radius", config.TFSecondDerivativeRadius);
+        config.TFSecondDerivativeThreshold = tf.value("threshold", config.TFSecondDerivativeThreshold);
+        config.TFSecondDerivativeColor1 = tf.contains("color") ? toVec4(tf["color"]) : config.TFSecondDerivativeColor1;
+        config.TFSecondDerivativeColor2 = tf.contains("color2") ? toVec4(tf["color2"]) : config.TFSecondDerivativeColor2;
+    }
+    if (spec.contains("gooch")) {
+        const json& gooch = spec["gooch"];
+        config.GoochWarmColor = gooch.contains("warm") ? toVec3(gooch["warm"]) : config.GoochWarmColor;
+        config.GoochColdColor = gooch.contains("cold") ? toVec3(gooch["cold"]) : config.GoochColdColor;
+    }
+    if (spec.contains("camera"))
+        job.camera = parseCamera(spec["camera"], volume);
+
+    if (!spec.contains("output"))
+        throw std::runtime_error("Missing \"output\"");
+    job.output = spec["output"].get<std::string>();
+    const std::string extension = job.output.extension().string();
+    if (extension != ".png" && extension != ".pfm")
+        throw std::runtime_error("Unsupported output format \"" + extension + "\" (expected .png or .pfm)");
+    return job;
+}
+
+std::vector<RenderJob> parseRenderJobs(const json& spec, const volume::Volume& volume)
+{
+    if (!spec.contains("views"))
+        return { parseRenderJob(spec, volume) };
+
+    json defaults = spec;
+    defaults.erase("views");
+    std::vector<RenderJob> jobs;
+    for (const json& view : spec["views"]) {
+        json merged = defaults;
+        merged.merge_patch(view);
+        if (view.contains("camera"))
+            merged["camera"] = view["camera"];
+        jobs.push_back(parseRenderJob(merged, volume));
+    }
+    return jobs;
+}
+
+volume::GradientStorage parseGradientStorage(const json& spec)
+{
+    if (!spec.contains("gradientStorage"))
+        return volume::GradientStorage::Float;
+    return volume::GradientStorage(parseEnum(spec["gradientStorage"], "gradientStorage", std::array { "float", "quantized" }));
+}
+
+}
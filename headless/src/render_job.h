@@ -0,0 +1,39 @@
+#pragma once
+#include "render/render_config.h"
+#include "volume/gradient_volume.h"
+#include "volume/volume.h"
+#include <filesystem>
+#include <glm/vec3.hpp>
+#include <nlohmann/json_fwd.hpp>
+#include <vector>
+
+namespace headless {
+
+struct CameraSpec {
+    glm::vec3 position;
+    glm::vec3 lookAt;
+    glm::vec3 up;
+    // Vertical field of view in radians.
+    float fovy;
+};
+
+// Everything that is needed to render one image: the settings that the viewer takes from its menu and trackball,
+// plus the file to write the image to.
+struct RenderJob {
+    render::RenderConfig config;
+    volume::InterpolationMode interpolationMode;
+    CameraSpec camera;
+    std::filesystem::path output;
+};
+
+// The settings the viewer starts with after loading the volume (trackball camera, default transfer functions).
+RenderJob defaultRenderJob(const volume::Volume& volume);
+
+// Converts a render spec (see render_job.cpp) into a list of render jobs: one per entry of "views", or a single job if
+// the spec has no "views". Throws std::runtime_error (or nlohmann::json::exception) if the spec is invalid.
+std::vector<RenderJob> parseRenderJobs(const nlohmann::json& spec, const volume::Volume& volume);
+
+// Storage of the gradient volume that is shared by all views ("gradientStorage", float by default).
+volume::GradientStorage parseGradientStorage(const nlohmann::json& spec);
+
+}
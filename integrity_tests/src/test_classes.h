@@ -55,7 +55,9 @@ public:
     provide_member_function_access(traceRayISO)
     provide_member_function_access(traceRayComposite)
     provide_member_function_access(traceRayTF2D)
+    provide_member_function_access(traceRayPacket)
 
+    provide_member_function_access(findIsoSurfaceExact)
     provide_member_function_access(bisectionAccuracy)
     provide_member_function_access(computePhongShading)
 };
\ No newline at end of file
@@ -1,7 +1,21 @@
 // Can access the header files from the viewer...
 #include "test_classes.h"
+#include "render/look_at_camera.h"
+#include "render/render_thread.h"
+#include "render/simd.h"
 #include "ui/window.h"
+#include "volume/histogram_2d.h"
+#include "volume/marching_cubes.h"
+#include "volume/volume_container.h"
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <ranges>
+#include <thread>
+#include <tuple>
 #include <catch2/catch.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -37,6 +51,49 @@ TEST_CASE("Volume Tests")
     REQUIRE_NOTHROW(volume.test_getSampleTriCubicInterpolation(glm::vec3(2.5f)));
 }
 
+TEST_CASE("Volume Statistics Tests")
+{
+    // Statistics of the values 10, 11, ..., 134 (an odd count, so one voxel is left over after the pairs).
+    std::vector<uint16_t> values(125);
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = uint16_t(i + 10);
+    const volume::Volume ramp { values, glm::ivec3(5) };
+    REQUIRE(ramp.minimum() == 10.0f);
+    REQUIRE(ramp.maximum() == 134.0f);
+    REQUIRE(ramp.histogram().size() == 135);
+    REQUIRE(ramp.histogram()[134] == 1);
+    REQUIRE(ramp.percentile(0.0f) == 10.0f);
+    REQUIRE(ramp.percentile(0.5f) == 72.0f);
+    REQUIRE(ramp.percentile(1.0f) == 134.0f);
+    const std::vector<int> bins = ramp.binnedHistogram(27);
+    REQUIRE(bins.size() == 27);
+    REQUIRE(bins[0] == 0);
+    REQUIRE(std::accumulate(std::begin(bins), std::end(bins), 0) == 125);
+}
+
+TEST_CASE("Voxel Layout Tests")
+{
+    // Odd sizes so that the bricks at the border of the volume are only partially filled.
+    const glm::ivec3 dim { 21, 13, 10 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t((i * 7919) % 1021);
+
+    volume::Volume volume { data, dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const std::array coords { glm::vec3(0.0f), glm::vec3(7.5f, 7.99f, 8.0f), glm::vec3(19.9f, 11.2f, 8.7f), glm::vec3(15.3f, 0.4f, 3.1f) };
+
+    std::vector<float> linearSamples;
+    for (const auto& coord : coords)
+        linearSamples.push_back(volume.getSampleInterpolate(coord));
+
+    for (const auto layout : { volume::VoxelLayout::Bricked, volume::VoxelLayout::Morton }) {
+        volume.setVoxelLayout(layout);
+        for (size_t i = 0; i < coords.size(); i++)
+            REQUIRE(volume.getSampleInterpolate(coords[i]) == linearSamples[i]);
+    }
+}
+
 TEST_CASE("Gradient Volume Tests")
 {
     volume::GradientVoxel gv = { glm::vec3(1.f, 0.f, 0.f), 1.f };
@@ -46,3 +103,750 @@ TEST_CASE("Gradient Volume Tests")
     const TestGradientVolume gradient { volume };
     REQUIRE_NOTHROW(gradient.test_getGradientLinearInterpolate(glm::vec3(100.f)));
 }
+
+TEST_CASE("Quantized Gradient Volume Tests")
+{
+    // The range of values is below 32768, so the quantized gradients are exact.
+    const glm::ivec3 dim { 21, 13, 10 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t((i * 7919) % 4096);
+
+    const volume::Volume volume { data, dim };
+    volume::GradientVolume gradientVolume { volume };
+    volume::GradientVolume quantizedGradientVolume { volume, volume::GradientStorage::Quantized };
+    REQUIRE(quantizedGradientVolume.sizeInBytes() < gradientVolume.sizeInBytes());
+    REQUIRE(quantizedGradientVolume.maxMagnitude() == gradientVolume.maxMagnitude());
+
+    gradientVolume.interpolationMode = quantizedGradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    for (const auto& coord : { glm::vec3(1.0f), glm::vec3(7.5f, 7.99f, 8.0f), glm::vec3(15.3f, 0.4f, 3.1f) }) {
+        const volume::GradientVoxel expected = gradientVolume.getGradientInterpolate(coord);
+        const volume::GradientVoxel quantized = quantizedGradientVolume.getGradientInterpolate(coord);
+        REQUIRE(quantized.dir == expected.dir);
+        REQUIRE(quantized.magnitude == expected.magnitude);
+    }
+}
+
+TEST_CASE("2D Histogram Tests")
+{
+    // A ramp along x has the same gradient everywhere except at the borders (one-sided differences).
+    const glm::ivec3 dim { 16, 4, 4 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t((i % size_t(dim.x)) * 10);
+    const volume::Volume volume { data, dim };
+    const volume::GradientVolume gradientVolume { volume };
+
+    const volume::Histogram2D histogram = volume::computeHistogram2D(volume, gradientVolume, glm::ivec2(16, 8));
+    REQUIRE(histogram.counts.size() == 16 * 8);
+    REQUIRE(std::accumulate(std::begin(histogram.counts), std::end(histogram.counts), 0) == dim.x * dim.y * dim.z);
+    REQUIRE(histogram.maxCount == *std::max_element(std::begin(histogram.counts), std::end(histogram.counts)));
+    // Every voxel value has its own bin along x, so each column holds one slab of 4x4 voxels.
+    for (int x = 0; x < 16; x++) {
+        int columnCount = 0;
+        for (int y = 0; y < 8; y++)
+            columnCount += histogram.counts[size_t(x + 16 * y)];
+        REQUIRE(columnCount == dim.y * dim.z);
+    }
+}
+
+TEST_CASE("Second Derivative Volume Tests")
+{
+    // Half of the volume is constant so that it contains zero gradients.
+    const glm::ivec3 dim { 21, 13, 10 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z), 0);
+    for (size_t i = 0; i < data.size() / 2; i++)
+        data[i] = uint16_t((i * 7919) % 1021);
+
+    const volume::Volume volume { data, dim };
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::SecondDerivativeVolume fromGradients { volume, gradientVolume };
+    const volume::SecondDerivativeVolume streamed { volume };
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                const float magnitude = fromGradients.getSecondDerivative(x, y, z).magnitude;
+                REQUIRE(std::isfinite(magnitude));
+                REQUIRE(streamed.getSecondDerivative(x, y, z).magnitude == magnitude);
+            }
+        }
+    }
+    REQUIRE(fromGradients.maxMagnitude() == streamed.maxMagnitude());
+}
+
+TEST_CASE("Volume Pyramid Tests")
+{
+    // Averaging a constant volume should give the same constant on every level.
+    const glm::ivec3 dim { 70, 33, 20 };
+    const volume::Volume volume { std::vector<uint16_t>(size_t(dim.x * dim.y * dim.z), 1000), dim };
+    const volume::VolumePyramid pyramid { volume, volume::GradientStorage::Float, 16 };
+    REQUIRE(pyramid.numLevels() == 4);
+    REQUIRE(pyramid.volume(1).dims() == glm::ivec3(35, 17, 10));
+    REQUIRE(pyramid.volume(3).dims() == glm::ivec3(9, 5, 3));
+    for (int level = 1; level < pyramid.numLevels(); level++) {
+        const volume::Volume& levelVolume = pyramid.volume(level);
+        REQUIRE(levelVolume.minimum() == 1000.0f);
+        REQUIRE(levelVolume.maximum() == 1000.0f);
+        REQUIRE(pyramid.gradientVolume(level).maxMagnitude() == 0.0f);
+    }
+    REQUIRE(volume::VolumePyramid::toLevelCoordinates(glm::vec3(0.5f), 1) == glm::vec3(0.0f));
+}
+
+TEST_CASE("Span Space Index Tests")
+{
+    // A small sphere in a large empty volume, plus some noise so that the cells have many different value ranges.
+    const glm::ivec3 dim { 96, 80, 72 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    uint32_t seed = 1;
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                seed = seed * 1664525u + 1013904223u;
+                const float sphere = 300.0f - 30.0f * glm::distance(glm::vec3(x, y, z), glm::vec3(70.0f, 20.0f, 50.0f));
+                const float noise = x < 24 ? float(seed >> 24) : 0.0f;
+                data[size_t((z * dim.y + y) * dim.x + x)] = uint16_t(std::max({ 0.0f, sphere, noise }));
+            }
+        }
+    }
+    volume::Volume volume { data, dim };
+
+    const auto cells = volume.macroCells().cells();
+    for (const auto& [lo, hi] : { std::pair(0.0f, 0.0f), std::pair(100.0f, 100.0f), std::pair(100.5f, 250.0f), std::pair(255.0f, 1e9f), std::pair(400.0f, 400.0f) }) {
+        std::vector<uint32_t> expected;
+        for (uint32_t cell = 0; cell < uint32_t(cells.size()); cell++) {
+            if (float(cells[cell].max) >= lo && float(cells[cell].min) < hi)
+                expected.push_back(cell);
+        }
+        std::vector<uint32_t> found = volume.spanSpaceIndex().findCells(lo, hi);
+        std::ranges::sort(found);
+        REQUIRE(found == expected);
+        REQUIRE(volume.spanSpaceIndex().countCells(lo, hi) == expected.size());
+    }
+
+    // Leaping over the empty space around the surface should not change the image.
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderIso;
+    config.renderResolution = glm::ivec2(64, 64);
+    const render::LookAtCamera camera { glm::vec3(-60.0f, 90.0f, -80.0f), glm::vec3(48.0f, 40.0f, 36.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(50.0f), 1.0f };
+    for (const auto interpolationMode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear }) {
+        volume.interpolationMode = interpolationMode;
+        for (const float isoValue : { 100.0f, 200.0f }) {
+            config.isoValue = isoValue;
+            config.emptySpaceSkipping = true;
+            render::Renderer renderer { &volume, nullptr, nullptr, &camera, config };
+            REQUIRE(renderer.render());
+            config.emptySpaceSkipping = false;
+            render::Renderer reference { &volume, nullptr, nullptr, &camera, config };
+            REQUIRE(reference.render());
+            REQUIRE(std::ranges::equal(renderer.frameBuffer(), reference.frameBuffer()));
+        }
+    }
+}
+
+TEST_CASE("Marching Cubes Tests")
+{
+    // Every edge of a closed surface is shared by exactly two triangles, which use it in opposite directions.
+    const auto requireClosed = [](const volume::Mesh& mesh) {
+        std::vector<std::pair<uint32_t, uint32_t>> edges;
+        for (const glm::uvec3& triangle : mesh.triangles) {
+            for (int i = 0; i < 3; i++)
+                edges.emplace_back(triangle[i], triangle[(i + 1) % 3]);
+        }
+        std::ranges::sort(edges);
+        REQUIRE(std::ranges::adjacent_find(edges) == std::end(edges));
+        size_t numUnmatched = 0;
+        for (const auto& [first, second] : edges)
+            numUnmatched += std::ranges::binary_search(edges, std::pair(second, first)) ? size_t(0) : size_t(1);
+        REQUIRE(numUnmatched == 0);
+        return edges.size() / 2;
+    };
+
+    // A sphere in the middle of the volume. The iso value lies between two voxel values, so that no vertex lies on a
+    // voxel and all vertices are different.
+    const glm::ivec3 dim { 32, 30, 34 };
+    const glm::vec3 center { 15.3f, 14.6f, 16.8f };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++)
+                data[size_t((z * dim.y + y) * dim.x + x)] = uint16_t(std::max(0.0f, 1000.0f - 40.0f * glm::distance(glm::vec3(x, y, z), center)));
+        }
+    }
+    volume::Volume volume { data, dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::GradientVolume gradientVolume { volume };
+
+    const float isoValue = 500.5f;
+    const volume::Mesh mesh = volume::extractIsoSurface(volume, gradientVolume, isoValue);
+    REQUIRE(!mesh.triangles.empty());
+    REQUIRE(mesh.normals.size() == mesh.positions.size());
+    for (const glm::uvec3& triangle : mesh.triangles)
+        REQUIRE(glm::all(glm::lessThan(triangle, glm::uvec3(uint32_t(mesh.positions.size())))));
+
+    // A closed surface without holes or handles (Euler characteristic 2), wound counter-clockwise seen from outside.
+    const size_t numEdges = requireClosed(mesh);
+    REQUIRE(mesh.positions.size() + mesh.triangles.size() == numEdges + 2);
+    size_t numInwardTriangles = 0;
+    for (const glm::uvec3& triangle : mesh.triangles) {
+        const glm::vec3 p0 = mesh.positions[triangle.x], p1 = mesh.positions[triangle.y], p2 = mesh.positions[triangle.z];
+        numInwardTriangles += glm::dot(glm::cross(p1 - p0, p2 - p0), (p0 + p1 + p2) / 3.0f - center) > 0.0f ? size_t(0) : size_t(1);
+    }
+    REQUIRE(numInwardTriangles == 0);
+
+    // The vertices lie on the iso surface (of the linearly interpolated volume, along the edges) with outward normals.
+    float maxError = 0.0f, minNormalDot = 1.0f;
+    for (size_t i = 0; i < mesh.positions.size(); i++) {
+        maxError = std::max(maxError, std::abs(volume.getSampleInterpolate(mesh.positions[i]) - isoValue));
+        minNormalDot = std::min(minNormalDot, glm::dot(mesh.normals[i], glm::normalize(mesh.positions[i] - center)));
+    }
+    REQUIRE(maxError < 0.5f);
+    REQUIRE(minNormalDot > 0.9f);
+    std::vector<glm::vec3> positions = mesh.positions;
+    std::ranges::sort(positions, [](const glm::vec3& lhs, const glm::vec3& rhs) { return std::tie(lhs.x, lhs.y, lhs.z) < std::tie(rhs.x, rhs.y, rhs.z); });
+    REQUIRE(std::ranges::adjacent_find(positions) == std::end(positions));
+
+    // Noise (with all the ambiguous configurations) surrounded by empty voxels still gives closed surfaces.
+    std::vector<uint16_t> noise(data.size(), 0);
+    uint32_t seed = 7;
+    for (int z = 1; z + 1 < dim.z; z++) {
+        for (int y = 1; y + 1 < dim.y; y++) {
+            for (int x = 1; x + 1 < dim.x; x++) {
+                seed = seed * 1664525u + 1013904223u;
+                noise[size_t((z * dim.y + y) * dim.x + x)] = uint16_t(seed >> 24);
+            }
+        }
+    }
+    const volume::Volume noiseVolume { noise, dim };
+    const volume::GradientVolume noiseGradientVolume { noiseVolume };
+    const volume::Mesh noiseMesh = volume::extractIsoSurface(noiseVolume, noiseGradientVolume, 127.5f);
+    REQUIRE(noiseMesh.triangles.size() > mesh.triangles.size());
+    requireClosed(noiseMesh);
+
+    // Binary PLY: the header, then six floats per vertex and a count plus three indices per face.
+    const std::filesystem::path file = std::filesystem::temp_directory_path() / "volvis_marching_cubes_test.ply";
+    REQUIRE(volume::writeMesh(mesh, file));
+    const std::string header = "ply\nformat binary_little_endian 1.0\nelement vertex " + std::to_string(mesh.positions.size())
+        + "\nproperty float x\nproperty float y\nproperty float z\nproperty float nx\nproperty float ny\nproperty float nz\n"
+        + "element face " + std::to_string(mesh.triangles.size()) + "\nproperty list uchar uint vertex_indices\nend_header\n";
+    REQUIRE(std::filesystem::file_size(file) == header.size() + mesh.positions.size() * 24 + mesh.triangles.size() * 13);
+    std::filesystem::remove(file);
+    REQUIRE(!volume::writeMesh(mesh, std::filesystem::temp_directory_path() / "volvis_marching_cubes_test.stl"));
+}
+
+TEST_CASE("Streamed Volume Tests")
+{
+    const glm::ivec3 dim { 21, 13, 10 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t((i * 7919) % 1021);
+    volume::Volume volume { data, dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+
+    // Small bricks and a cache that only holds a few of them, so that bricks are evicted.
+    const std::filesystem::path file = std::filesystem::temp_directory_path() / "volvis_streamed_volume_test.vvb";
+    REQUIRE(volume::writeBrickedVolume(volume, file, 4, 4));
+    REQUIRE(volume::isBrickedVolumeFile(file));
+    {
+        volume::Volume streamed { file, volume::LoadMode::Copy, 6 * 5 * 5 * 5 * sizeof(uint16_t) };
+        volume::BrickCache* pBrickCache = streamed.brickCache();
+        REQUIRE(pBrickCache);
+        REQUIRE(streamed.dims() == dim);
+        REQUIRE(streamed.maximum() == volume.maximum());
+        REQUIRE(std::ranges::equal(streamed.histogram(), volume.histogram()));
+        streamed.interpolationMode = volume::InterpolationMode::Linear;
+
+        // Missing bricks are requested by sampling them and are available from the next frame on.
+        const std::array coords { glm::vec3(0.0f), glm::vec3(7.5f, 7.99f, 8.0f), glm::vec3(19.9f, 11.2f, 8.7f), glm::vec3(15.3f, 0.4f, 3.1f), glm::vec3(4.0f, 4.0f, 4.0f) };
+        for (const auto& coord : coords) {
+            streamed.getSampleInterpolate(coord);
+            pBrickCache->waitForPendingBricks();
+            pBrickCache->beginFrame(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            REQUIRE(streamed.getSampleInterpolate(coord) == volume.getSampleInterpolate(coord));
+            REQUIRE(streamed.getVoxel(int(coord.x), int(coord.y), int(coord.z)) == volume.getVoxel(int(coord.x), int(coord.y), int(coord.z)));
+        }
+    }
+    {
+        // More bricks arrive in one frame than there are free slots: the first row of bricks fills most of the cache,
+        // so loading the second row has to evict some of them.
+        const glm::ivec3 cubeDim { 16 };
+        std::vector<uint16_t> cubeData(size_t(cubeDim.x * cubeDim.y * cubeDim.z));
+        for (size_t i = 0; i < cubeData.size(); i++)
+            cubeData[i] = uint16_t((i * 7919) % 1021);
+        const volume::Volume cube { cubeData, cubeDim };
+        REQUIRE(volume::writeBrickedVolume(cube, file, 4, 4));
+        volume::Volume streamed { file, volume::LoadMode::Copy, 6 * 5 * 5 * 5 * sizeof(uint16_t) };
+        volume::BrickCache* pBrickCache = streamed.brickCache();
+        REQUIRE(pBrickCache);
+        for (int by = 0; by < 2; by++) {
+            for (int bx = 0; bx < 4; bx++)
+                streamed.getVoxel(4 * bx + 1, 4 * by + 1, 1);
+            pBrickCache->waitForPendingBricks();
+            pBrickCache->beginFrame(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            for (int z = 0; z < 4; z++) {
+                for (int y = 4 * by; y < 4 * by + 4; y++) {
+                    for (int x = 0; x < cubeDim.x; x++)
+                        REQUIRE(streamed.getVoxel(x, y, z) == cube.getVoxel(x, y, z));
+                }
+            }
+        }
+    }
+    std::filesystem::remove(file);
+}
+
+TEST_CASE("Volume Container Tests")
+{
+    // Large enough for a volume pyramid with a few levels.
+    const glm::ivec3 dim { 70, 33, 20 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t((i * 7919) % 1021);
+    const volume::Volume volume { data, dim };
+    const volume::GradientVolume gradientVolume { volume, volume::GradientStorage::Quantized };
+    const volume::SecondDerivativeVolume secondDerivativeVolume { volume, gradientVolume };
+
+    const std::filesystem::path file = std::filesystem::temp_directory_path() / "volvis_volume_container_test.vvc";
+    volume::ContainerOptions options;
+    options.brickSize = 4;
+    options.gradientStorage = volume::GradientStorage::Quantized;
+    REQUIRE(volume::writeVolumeContainer(volume, file, options));
+    REQUIRE(volume::isVolumeContainerFile(file));
+    {
+        const volume::Volume converted { file, volume::LoadMode::MemoryMap };
+        REQUIRE(converted.container());
+        REQUIRE(converted.container()->verify());
+        REQUIRE(!converted.brickCache());
+        REQUIRE(std::equal(std::begin(converted.data()), std::end(converted.data()), std::begin(data), std::end(data)));
+        REQUIRE(std::ranges::equal(converted.histogram(), volume.histogram()));
+        REQUIRE(converted.maximum() == volume.maximum());
+
+        // The derived volumes are only stored in the storage that was converted.
+        REQUIRE(!volume::loadGradientVolume(converted, volume::GradientStorage::Float));
+        const auto pGradientVolume = volume::loadGradientVolume(converted, volume::GradientStorage::Quantized);
+        const auto pSecondDerivativeVolume = volume::loadSecondDerivativeVolume(converted);
+        const auto pVolumePyramid = volume::loadVolumePyramid(converted, volume::GradientStorage::Quantized);
+        REQUIRE(pGradientVolume);
+        REQUIRE(pSecondDerivativeVolume);
+        REQUIRE(pVolumePyramid);
+        REQUIRE(pGradientVolume->maxMagnitude() == gradientVolume.maxMagnitude());
+        REQUIRE(pSecondDerivativeVolume->maxMagnitude() == secondDerivativeVolume.maxMagnitude());
+        REQUIRE(pVolumePyramid->numLevels() == volume::VolumePyramid(volume, volume::GradientStorage::Quantized).numLevels());
+        for (int z = 0; z < dim.z; z++) {
+            for (int y = 0; y < dim.y; y++) {
+                for (int x = 0; x < dim.x; x++) {
+                    REQUIRE(pGradientVolume->getGradient(x, y, z).dir == gradientVolume.getGradient(x, y, z).dir);
+                    REQUIRE(pSecondDerivativeVolume->getSecondDerivative(x, y, z).magnitude == secondDerivativeVolume.getSecondDerivative(x, y, z).magnitude);
+                }
+            }
+        }
+    }
+
+    // A modified voxel is detected by the checksums.
+    {
+        std::fstream stream { file, std::ios::binary | std::ios::in | std::ios::out };
+        const volume::VolumeContainer container { file };
+        stream.seekp(std::streamoff(container.findSection(volume::ContainerSectionType::Voxels)->offset));
+        stream.put('\x7F');
+    }
+    REQUIRE(!volume::VolumeContainer(file).verify());
+    std::filesystem::remove(file);
+}
+
+TEST_CASE("Compositing Tests")
+{
+    const glm::ivec3 dim { 16, 4, 4 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t((i % size_t(dim.x)) * 16);
+    const volume::Volume volume { data, dim };
+    const volume::GradientVolume gradient { volume };
+
+    render::RenderConfig config {};
+    config.renderResolution = glm::ivec2(1);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 256.0f;
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(float(i) / 255.0f, 0.5f, 1.0f - float(i) / 255.0f, 0.2f);
+
+    const render::Ray ray { glm::vec3(-1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f), 1.0f, 16.0f };
+    const float sampleStep = 0.5f;
+
+    // Reference: back-to-front compositing of the samples t = tmax - k * sampleStep (excluding tmin).
+    glm::vec3 expected { 0.0f };
+    for (float t = ray.tmax; t > ray.tmin; t -= sampleStep) {
+        const float val = volume.getSampleInterpolate(ray.origin + t * ray.direction);
+        const glm::vec4 tfValue = config.tfColorMap[std::min(size_t(val), size_t(255))];
+        expected = glm::vec3(tfValue) * tfValue.a + (1.0f - tfValue.a) * expected;
+    }
+
+    for (const bool emptySpaceSkipping : { false, true }) {
+        config.emptySpaceSkipping = emptySpaceSkipping;
+
+        config.earlyRayTerminationThreshold = 1.0f;
+        TestRenderer exactRenderer { &volume, &gradient, nullptr, nullptr, config };
+        const glm::vec4 exact = exactRenderer.test_traceRayComposite(ray, sampleStep);
+        for (int c = 0; c < 3; c++)
+            REQUIRE(exact[c] == Approx(expected[c]).margin(1e-5f));
+
+        // Terminating early may only drop the contribution of the remaining (1 - threshold) transparency.
+        config.earlyRayTerminationThreshold = 0.9f;
+        TestRenderer earlyRenderer { &volume, &gradient, nullptr, nullptr, config };
+        const glm::vec4 early = earlyRenderer.test_traceRayComposite(ray, sampleStep);
+        for (int c = 0; c < 3; c++)
+            REQUIRE(early[c] == Approx(expected[c]).margin(0.1f));
+    }
+
+    // Ray packets should give the same result as tracing the rays one by one.
+    if constexpr (render::simd::maxWidth >= 4) {
+        config.emptySpaceSkipping = false;
+        config.earlyRayTerminationThreshold = 0.9f;
+        const std::array<render::Ray, 4> rays {
+            render::Ray { glm::vec3(-1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f), 1.0f, 16.0f },
+            render::Ray { glm::vec3(-1.0f, 1.5f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f), 1.3f, 15.2f },
+            render::Ray { glm::vec3(-1.0f, 2.0f, 2.5f), glm::vec3(1.0f, 0.0f, 0.0f), 2.0f, 16.0f },
+            render::Ray { glm::vec3(-1.0f, 2.5f, 1.5f), glm::vec3(1.0f, 0.0f, 0.0f), 1.1f, 14.0f }
+        };
+        for (const auto renderMode : { render::RenderMode::RenderMIP, render::RenderMode::RenderComposite }) {
+            config.renderMode = renderMode;
+            TestRenderer renderer { &volume, &gradient, nullptr, nullptr, config };
+            std::array<glm::vec4, 4> colors;
+            REQUIRE(renderer.test_traceRayPacket(gsl::span<const render::Ray>(rays), sampleStep, gsl::span<glm::vec4>(colors)));
+            for (size_t i = 0; i < rays.size(); i++) {
+                const glm::vec4 expectedColor = renderMode == render::RenderMode::RenderMIP ? renderer.test_traceRayMIP(rays[i], sampleStep) : renderer.test_traceRayComposite(rays[i], sampleStep);
+                for (int c = 0; c < 3; c++)
+                    REQUIRE(colors[i][c] == Approx(expectedColor[c]).margin(1e-5f));
+            }
+        }
+    }
+}
+
+TEST_CASE("Render Thread Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t(i % 251);
+    const volume::Volume volume { data, dim };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderMIP;
+    config.renderResolution = glm::ivec2(32, 24);
+    const render::LookAtCamera camera { glm::vec3(8.0f, 8.0f, -30.0f), glm::vec3(8.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(60.0f), 32.0f / 24.0f };
+    render::Renderer renderer { &volume, nullptr, nullptr, &camera, config };
+    REQUIRE(renderer.render());
+    const std::vector<glm::vec4> expected(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+
+    // A cancelled frame stops before rendering any row.
+    render::CancellationToken cancellationToken;
+    cancellationToken.cancel();
+    REQUIRE(!renderer.render(&cancellationToken));
+    REQUIRE(std::ranges::all_of(renderer.frameBuffer(), [](const glm::vec4& color) { return color == glm::vec4(0.0f); }));
+
+    // The render thread delivers the same image; of several requests only the newest is guaranteed to be rendered.
+    render::RenderThread renderThread;
+    render::RenderConfig otherConfig = config;
+    otherConfig.renderMode = render::RenderMode::RenderSlicer;
+    renderThread.requestFrame({ otherConfig, camera, &volume });
+    renderThread.requestFrame({ config, camera, &volume });
+    while (renderThread.isBusy())
+        std::this_thread::yield();
+    const std::unique_ptr<render::Frame> pFrame = renderThread.takeFrame();
+    REQUIRE(pFrame);
+    REQUIRE(pFrame->resolution == config.renderResolution);
+    REQUIRE(pFrame->pixels == expected);
+    REQUIRE(!renderThread.takeFrame());
+
+    // The iso empty space distances are kept from frame to frame while only the camera changes.
+    const volume::GradientVolume gradientVolume { volume };
+    render::RenderConfig isoConfig = config;
+    isoConfig.renderMode = render::RenderMode::RenderIso;
+    isoConfig.isoValue = 200.0f;
+    const render::LookAtCamera otherCamera { glm::vec3(30.0f, 8.0f, -20.0f), glm::vec3(8.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(60.0f), 32.0f / 24.0f };
+    for (const auto& frameCamera : { camera, otherCamera }) {
+        renderThread.requestFrame({ isoConfig, frameCamera, &volume, &gradientVolume });
+        while (renderThread.isBusy())
+            std::this_thread::yield();
+        const std::unique_ptr<render::Frame> pIsoFrame = renderThread.takeFrame();
+        REQUIRE(pIsoFrame);
+        REQUIRE(pIsoFrame->numIsoDistanceUpdates == 1);
+    }
+}
+
+TEST_CASE("Progressive Refinement Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t(i % 251);
+    const volume::Volume volume { data, dim };
+
+    // The resolution is not a multiple of the block size, so the last blocks are partial.
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderMIP;
+    config.renderResolution = glm::ivec2(30, 22);
+    const render::LookAtCamera camera { glm::vec3(8.0f, 8.0f, -30.0f), glm::vec3(8.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(60.0f), 30.0f / 22.0f };
+    render::Renderer renderer { &volume, nullptr, nullptr, &camera, config };
+    renderer.render();
+    const std::vector<glm::vec4> expected(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+
+    config.progressiveRefinement = true;
+    renderer.setConfig(config);
+    // The first pass fills the image with one pixel per block of 4x4 pixels.
+    REQUIRE(renderer.render());
+    REQUIRE(renderer.frameBuffer()[0] == expected[0]);
+    REQUIRE(renderer.frameBuffer()[3 * 30 + 3] == expected[0]);
+    REQUIRE(renderer.frameBuffer()[4] == expected[4]);
+
+    // A cancelled pass starts over.
+    render::CancellationToken cancellationToken;
+    cancellationToken.cancel();
+    REQUIRE(!renderer.render(&cancellationToken));
+
+    // After one round every pixel has the sample that it has without progressive refinement.
+    for (int pass = 0; pass < 16; pass++)
+        REQUIRE(renderer.render());
+    REQUIRE(std::ranges::equal(renderer.frameBuffer(), expected));
+
+    // The following rounds add jittered samples until the image has converged.
+    for (int pass = 16; pass < 16 * render::Renderer::progressiveSamplesPerPixel; pass++) {
+        REQUIRE(!renderer.isConverged());
+        REQUIRE(renderer.render());
+    }
+    REQUIRE(renderer.isConverged());
+    REQUIRE(!std::ranges::equal(renderer.frameBuffer(), expected));
+
+    // Moving the camera starts over.
+    const render::LookAtCamera otherCamera { glm::vec3(8.0f, 8.0f, -31.0f), glm::vec3(8.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(60.0f), 30.0f / 22.0f };
+    renderer.setCamera(&otherCamera);
+    REQUIRE(renderer.render());
+    REQUIRE(!renderer.isConverged());
+}
+
+TEST_CASE("Preintegrated Transfer Function Tests")
+{
+    // A ball whose value falls off by 10 per voxel, and a transfer function with a shell that is only a few values
+    // wide. Samples more than a voxel apart step over the shell, unless the transfer function is preintegrated.
+    const glm::ivec3 dim { 40, 40, 40 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++)
+                data[size_t((z * dim.y + y) * dim.x + x)] = uint16_t(std::max(0.0f, 250.0f - 10.0f * glm::distance(glm::vec3(x, y, z), glm::vec3(19.3f, 19.6f, 20.1f))));
+        }
+    }
+    volume::Volume volume { data, dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(48, 48);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 256.0f;
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(float(i) / 255.0f, 0.5f, 1.0f - float(i) / 255.0f, i >= 100 && i < 103 ? 0.8f : (i >= 200 ? 0.05f : 0.0f));
+    const render::LookAtCamera camera { glm::vec3(-30.0f, 50.0f, -60.0f), glm::vec3(19.5f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(40.0f), 1.0f };
+    const auto renderImage = [&](float sampleStep, bool preintegrated) {
+        config.compositeSampleStep = sampleStep;
+        config.preintegratedTransferFunction = preintegrated;
+        render::Renderer renderer { &volume, nullptr, nullptr, &camera, config };
+        REQUIRE(renderer.render());
+        return std::vector<glm::vec4>(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+    };
+    const auto meanError = [](const std::vector<glm::vec4>& image, const std::vector<glm::vec4>& expected) {
+        float error = 0.0f;
+        for (size_t i = 0; i < image.size(); i++)
+            error += glm::distance(image[i], expected[i]);
+        return error / float(image.size());
+    };
+
+    // With four times larger steps the preintegrated image is closer to finely sampled one than point sampling with
+    // steps of one voxel.
+    const std::vector<glm::vec4> reference = renderImage(0.125f, false);
+    const float pointError = meanError(renderImage(1.0f, false), reference);
+    const float largeStepPointError = meanError(renderImage(4.0f, false), reference);
+    for (const float sampleStep : { 2.0f, 4.0f }) {
+        const float preintegratedError = meanError(renderImage(sampleStep, true), reference);
+        REQUIRE(preintegratedError < pointError);
+        REQUIRE(preintegratedError * 4.0f < largeStepPointError);
+    }
+
+    // Skipping empty space samples the value in front of the first sample after a gap, which gives the same image.
+    config.emptySpaceSkipping = false;
+    const std::vector<glm::vec4> withoutSkipping = renderImage(3.0f, true);
+    config.emptySpaceSkipping = true;
+    REQUIRE(meanError(renderImage(3.0f, true), withoutSkipping) < 1e-4f);
+
+    // A transfer function with a single color and opacity gives every segment the color and the (opacity corrected)
+    // opacity of a single sample.
+    std::ranges::fill(config.tfColorMap, glm::vec4(0.2f, 0.6f, 0.4f, 0.1f));
+    for (const float sampleStep : { 1.0f, 2.5f })
+        REQUIRE(meanError(renderImage(sampleStep, true), renderImage(sampleStep, false)) < 1e-4f);
+}
+
+TEST_CASE("Temporal Reprojection Tests")
+{
+    // A sphere, so that rotating the camera around it shows the same surface from a slightly different angle.
+    const glm::ivec3 dim { 32, 32, 32 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++)
+                data[size_t((z * dim.y + y) * dim.x + x)] = uint16_t(std::max(0.0f, 200.0f - 16.0f * glm::distance(glm::vec3(x, y, z), glm::vec3(15.5f))));
+        }
+    }
+    const volume::Volume volume { data, dim };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderIso;
+    config.isoValue = 100.0f;
+    config.renderResolution = glm::ivec2(64, 64);
+    const auto cameraAt = [](float angle) {
+        const glm::vec3 position = glm::vec3(15.5f) + 60.0f * glm::vec3(std::sin(angle), 0.0f, -std::cos(angle));
+        return render::LookAtCamera { position, glm::vec3(15.5f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(40.0f), 1.0f };
+    };
+    const render::LookAtCamera camera = cameraAt(0.0f), movedCamera = cameraAt(0.02f);
+
+    render::Renderer reference { &volume, nullptr, nullptr, &movedCamera, config };
+    reference.render();
+    const std::vector<glm::vec4> expected(std::begin(reference.frameBuffer()), std::end(reference.frameBuffer()));
+
+    config.temporalReprojection = true;
+    render::Renderer renderer { &volume, nullptr, nullptr, &camera, config };
+    REQUIRE(renderer.render());
+    // The moved camera reuses the pixels of the previous frame, which show the same iso surface; only pixels at the
+    // silhouette may get the color of a neighbour.
+    renderer.setCamera(&movedCamera);
+    REQUIRE(renderer.render());
+    const auto numMismatches = std::ranges::count_if(std::views::iota(size_t(0), expected.size()), [&](size_t i) { return renderer.frameBuffer()[i] != expected[i]; });
+    REQUIRE(numMismatches < 64);
+    // A camera that stands still gets a fully traced image.
+    REQUIRE(renderer.render());
+    REQUIRE(std::ranges::equal(renderer.frameBuffer(), expected));
+}
+
+TEST_CASE("Exact Iso Surface Tests")
+{
+    // A sphere and a plane that is only one voxel thick, which sampling at unit steps can miss.
+    const glm::ivec3 dim { 32, 32, 32 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++)
+                data[size_t((z * dim.y + y) * dim.x + x)] = uint16_t(x == 24 ? 200.0f : std::max(0.0f, 200.0f - 16.0f * glm::distance(glm::vec3(x, y, z), glm::vec3(12.5f, 15.5f, 15.0f))));
+        }
+    }
+    volume::Volume volume { data, dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderIso;
+    config.isoValue = 150.0f;
+    config.exactIsoSurface = true;
+    const float maxCoord = float(dim.x - 1);
+    uint32_t seed = 7;
+    const auto random = [&]() {
+        seed = seed * 1664525u + 1013904223u;
+        return float(seed >> 8) / float(1 << 24);
+    };
+    for (const bool emptySpaceSkipping : { false, true }) {
+        config.emptySpaceSkipping = emptySpaceSkipping;
+        TestRenderer renderer { &volume, nullptr, nullptr, nullptr, config };
+        int numHits = 0;
+        for (int i = 0; i < 200; i++) {
+            // Rays that start at the x = 0 side of the volume and leave through the other side.
+            const glm::vec3 origin { 0.0f, 2.0f + 27.0f * random(), 2.0f + 27.0f * random() };
+            const glm::vec3 target { maxCoord, 2.0f + 27.0f * random(), 2.0f + 27.0f * random() };
+            render::Ray ray { origin, glm::normalize(target - origin), 0.0f, glm::distance(origin, target) };
+            float t;
+            glm::vec3 position;
+            REQUIRE(renderer.test_findIsoSurfaceExact(ray, t, position));
+            numHits++;
+            // The hit lies on the iso surface, and no part of the ray in front of it reaches the iso value.
+            REQUIRE(volume.getSampleInterpolate(position) == Approx(config.isoValue).margin(0.05f));
+            float maxInFront = 0.0f;
+            for (float s = ray.tmin; s < t - 0.01f; s += 0.005f)
+                maxInFront = std::max(maxInFront, volume.getSampleInterpolate(ray.origin + s * ray.direction));
+            REQUIRE(maxInFront < config.isoValue);
+        }
+        REQUIRE(numHits == 200);
+    }
+
+    // Sampling can step over the plane; the exact intersection cannot.
+    const render::Ray ray { glm::vec3(0.0f, 3.0f, 3.0f), glm::vec3(1.0f, 0.0f, 0.0f), 0.0f, maxCoord };
+    float t;
+    glm::vec3 position;
+    TestRenderer renderer { &volume, nullptr, nullptr, nullptr, config };
+    REQUIRE(renderer.test_findIsoSurfaceExact(ray, t, position));
+    REQUIRE(t == Approx(23.75f).margin(1e-3f));
+    // Its samples lie halfway between the voxels, where the plane interpolates to 100.
+    const render::Ray offsetRay { ray.origin + glm::vec3(0.5f, 0.0f, 0.0f), ray.direction, 0.0f, maxCoord - 0.5f };
+    config.exactIsoSurface = false;
+    TestRenderer samplingRenderer { &volume, nullptr, nullptr, nullptr, config };
+    REQUIRE(samplingRenderer.test_traceRayISO(offsetRay, 1.0f) == glm::vec4(0, 0, 0, 1));
+}
+
+TEST_CASE("Iso G-Buffer Tests")
+{
+    const glm::ivec3 dim { 32, 32, 32 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++)
+                data[size_t((z * dim.y + y) * dim.x + x)] = uint16_t(std::max(0.0f, 200.0f - 16.0f * glm::distance(glm::vec3(x, y, z), glm::vec3(15.5f))));
+        }
+    }
+    volume::Volume volume { data, dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    volume::GradientVolume gradientVolume { volume };
+    gradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    const render::LookAtCamera camera { glm::vec3(15.5f, 20.0f, -45.0f), glm::vec3(15.5f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(40.0f), 1.0f };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderIso;
+    config.isoValue = 100.0f;
+    config.renderResolution = glm::ivec2(64, 64);
+    config.GoochWarmColor = glm::vec3(0.8f, 0.6f, 0.0f);
+    config.GoochColdColor = glm::vec3(0.0f, 0.0f, 0.6f);
+
+    // Changing only the shading reuses the hits of the previous frame, which must give the same image as rendering
+    // from scratch.
+    render::Renderer renderer { &volume, &gradientVolume, nullptr, &camera, config };
+    const auto requireSameAsFreshRenderer = [&](const render::RenderConfig& shadingConfig) {
+        renderer.setConfig(shadingConfig);
+        REQUIRE(renderer.render());
+        render::Renderer reference { &volume, &gradientVolume, nullptr, &camera, shadingConfig };
+        REQUIRE(reference.render());
+        REQUIRE(std::ranges::equal(renderer.frameBuffer(), reference.frameBuffer()));
+    };
+    requireSameAsFreshRenderer(config);
+    config.goochShading = true;
+    requireSameAsFreshRenderer(config);
+    config.volumeShading = true;
+    requireSameAsFreshRenderer(config);
+    config.volumeShading = false;
+    config.GoochWarmColor = glm::vec3(1.0f, 0.2f, 0.2f);
+    requireSameAsFreshRenderer(config);
+    config.goochShading = false;
+    requireSameAsFreshRenderer(config);
+    // A different iso value needs new hits.
+    config.goochShading = true;
+    config.isoValue = 150.0f;
+    requireSameAsFreshRenderer(config);
+
+    // Frames drawn by progressive refinement or temporal reprojection do not update the hits, so the hits of an earlier
+    // camera must not be reused once those are switched off again.
+    const render::LookAtCamera movedCamera { glm::vec3(40.0f, 20.0f, -30.0f), glm::vec3(15.5f), glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(40.0f), 1.0f };
+    render::Renderer reference { &volume, &gradientVolume, nullptr, &movedCamera, config };
+    REQUIRE(reference.render());
+    for (const auto pMode : { &render::RenderConfig::progressiveRefinement, &render::RenderConfig::temporalReprojection }) {
+        render::Renderer toggled { &volume, &gradientVolume, nullptr, &camera, config };
+        REQUIRE(toggled.render());
+        render::RenderConfig modeConfig = config;
+        modeConfig.*pMode = true;
+        toggled.setConfig(modeConfig);
+        toggled.setCamera(&movedCamera);
+        REQUIRE(toggled.render());
+        toggled.setConfig(config);
+        REQUIRE(toggled.render());
+        REQUIRE(std::ranges::equal(toggled.frameBuffer(), reference.frameBuffer()));
+    }
+}
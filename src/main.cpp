@@ -5,7 +5,7 @@
 #include "imgui/imgui_impl_glfw.h"
 #include "imgui/imgui_impl_opengl3.h"
 
-#include "render/renderer.h"
+#include "render/render_thread.h"
 #include "ui/full_screen_texture_gl.h"
 #include "ui/menu.h"
 #include "ui/surface_cube.h"
@@ -13,8 +13,11 @@
 #include "ui/window.h"
 #include "ui/wireframe_cube.h"
 #include "volume/gradient_volume.h"
+#include "volume/lazy_volume.h"
 #include "volume/secondderivative_volume.h"
 #include "volume/volume.h"
+#include "volume/volume_container.h"
+#include "volume/volume_pyramid.h"
 #include <chrono>
 #include <cmath> // log2
 #include <glm/geometric.hpp>
@@ -22,6 +25,7 @@
 #include <glm/vec3.hpp>
 #include <imgui.h>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <ratio>
 #include <vector>
@@ -48,10 +52,15 @@ int main(int argc, char** argv)
     // Render instance contains everything you need to render (volume + renderer). Initially there is
     // nothing to render hence the optional (initially it is empty). The optional is passed to the menu
     // class which is responsible for creating the volume + renderer when the user loads a volume.
+    // The derived volumes are only computed (in the background) once the render settings or one of the transfer
+    // function widgets need them, so that the first image of a new volume only has to wait for the volume itself.
     std::optional<volume::Volume> optVolume;
-    std::optional<volume::GradientVolume> optGradientVolume;
-    std::optional<volume::SecondDerivativeVolume> optSecondDerivativeVolume;
-    std::optional<render::Renderer> optRenderer;
+    std::optional<volume::LazyVolume<volume::GradientVolume>> optGradientVolume;
+    std::optional<volume::LazyVolume<volume::SecondDerivativeVolume>> optSecondDerivativeVolume;
+    std::optional<volume::LazyVolume<volume::VolumePyramid>> optVolumePyramid;
+    // Renders on a thread of its own so that the UI stays responsive. It reads the volumes above, so it is declared
+    // after them (and thus destroyed first).
+    render::RenderThread renderThread;
     ui::Menu volVisMenu { viewportSize };
 
     // Whether to redraw because the user interacted with the application. When this is the reason for the
@@ -60,35 +69,55 @@ int main(int argc, char** argv)
     bool redrawUserInteraction = false;
     bool redrawFullResolution = true;
     auto loadVolume = [&](const std::filesystem::path& filePath) {
-        optVolume.emplace(filePath.string());
+        // Wait for derived volumes of the previous volume that are still being computed before replacing it, and
+        // for the histograms that the menu computes from them.
+        volVisMenu.setDerivedVolumes(nullptr, nullptr);
+        renderThread.cancelAndWait();
+        optVolumePyramid.reset();
+        optSecondDerivativeVolume.reset();
+        optGradientVolume.reset();
+
+        optVolume.emplace(filePath, volume::LoadMode::MemoryMap);
         optVolume->interpolationMode = volVisMenu.interpolationMode();
-        optGradientVolume.emplace(optVolume.value());
-        optSecondDerivativeVolume.emplace(optVolume.value());
-        optRenderer.emplace(&optVolume.value(), &optGradientVolume.value(), &optSecondDerivativeVolume.value(), & trackballCamera, volVisMenu.renderConfig());
+        optGradientVolume.emplace();
+        optSecondDerivativeVolume.emplace();
+        optVolumePyramid.emplace();
 
         const float maxDimension = float(glm::compMax(optVolume->dims()));
         trackballCamera.setDistance(maxDimension);
         trackballCamera.setWorldScale(maxDimension);
         trackballCamera.setLookAt(glm::vec3(optVolume->dims()) / 2.0f);
 
-        volVisMenu.setLoadedVolume(optVolume.value(), optGradientVolume.value(), optSecondDerivativeVolume.value());
+        volVisMenu.setLoadedVolume(optVolume.value());
 
         redrawUserInteraction = true;
     };
 
+    // Sets the interpolation mode of the volume and of the derived volumes that have been computed. Only volumes with
+    // another mode are changed, since the render thread may be reading the others.
+    const auto updateInterpolationMode = [&](volume::InterpolationMode interpolationMode) {
+        if (optVolume->interpolationMode != interpolationMode)
+            optVolume->interpolationMode = interpolationMode;
+        if (auto* pGradientVolume = optGradientVolume->get(); pGradientVolume && pGradientVolume->interpolationMode != interpolationMode)
+            pGradientVolume->interpolationMode = interpolationMode;
+        if (auto* pSecondDerivativeVolume = optSecondDerivativeVolume->get(); pSecondDerivativeVolume && pSecondDerivativeVolume->interpolationMode != interpolationMode)
+            pSecondDerivativeVolume->interpolationMode = interpolationMode;
+        if (auto* pVolumePyramid = optVolumePyramid->get(); pVolumePyramid && pVolumePyramid->interpolationMode() != interpolationMode)
+            pVolumePyramid->setInterpolationMode(interpolationMode);
+    };
+
     // Callbacks.
     volVisMenu.setLoadVolumeCallback(loadVolume);
     volVisMenu.setRenderConfigChangedCallback(
-        [&](const render::RenderConfig& renderConfig) {
-            if (optRenderer)
-                optRenderer->setConfig(renderConfig);
+        [&](const render::RenderConfig&) {
+            // The render config is sent along with the next frame request.
             redrawUserInteraction = true;
         });
     volVisMenu.setInterpolationModeChangedCallback(
         [&](volume::InterpolationMode interpolationMode) {
             if (optVolume) {
-                optVolume->interpolationMode = interpolationMode;
-                optGradientVolume->interpolationMode = interpolationMode;
+                renderThread.cancelAndWait();
+                updateInterpolationMode(interpolationMode);
             }
             redrawUserInteraction = true;
         });
@@ -109,13 +138,61 @@ int main(int argc, char** argv)
     ui::WireframeCube wireframeCube;
     ui::SurfaceCube surfaceCube;
 
-    // The dynamic resolution scale that was used in previous frame (to keep the frame time below the target).
-    int prevResolutionScale = 1;
+    // Render time of the newest frame, and the factor by which its resolution was reduced (to keep the frame time
+    // below the target).
     std::chrono::duration<double> renderTime { 0 };
+    float renderTimeResolutionScale = 1.0f;
     while (!myWindow.shouldClose()) {
         myWindow.updateInput();
 
-        if (optRenderer.has_value()) {
+        // Present the newest frame that the render thread finished (if any).
+        if (const std::unique_ptr<render::Frame> pFrame = renderThread.takeFrame()) {
+            fullScreenTextureGL.update(pFrame->pixels, pFrame->resolution);
+            renderTime = pFrame->renderTime;
+            renderTimeResolutionScale = float(baseRenderResolution.x) / float(pFrame->resolution.x);
+        }
+
+        // Start computing the derived volumes that are needed, and hand them to the render thread and menu once they are done.
+        bool derivedVolumesReady = true;
+        volume::GradientVolume* pGradientVolume = nullptr;
+        volume::SecondDerivativeVolume* pSecondDerivativeVolume = nullptr;
+        volume::VolumePyramid* pVolumePyramid = nullptr;
+        if (optVolume.has_value()) {
+            if (volVisMenu.needsGradientVolume())
+                optGradientVolume->request([&volume = optVolume.value(), storage = volVisMenu.gradientStorage()]() {
+                    // Converted volumes (see VolVisConvert) may have the derived volumes already.
+                    auto pLoadedGradientVolume = volume::loadGradientVolume(volume, storage);
+                    return pLoadedGradientVolume ? std::move(pLoadedGradientVolume) : std::make_unique<volume::GradientVolume>(volume, storage);
+                });
+            pGradientVolume = optGradientVolume->get();
+            if (volVisMenu.needsSecondDerivativeVolume()) {
+                // Reuse the gradients if they are already available; otherwise they are computed on the fly.
+                optSecondDerivativeVolume->request([&volume = optVolume.value(), pGradientVolume]() {
+                    if (auto pLoadedSecondDerivativeVolume = volume::loadSecondDerivativeVolume(volume))
+                        return pLoadedSecondDerivativeVolume;
+                    return pGradientVolume ? std::make_unique<volume::SecondDerivativeVolume>(volume, *pGradientVolume) : std::make_unique<volume::SecondDerivativeVolume>(volume);
+                });
+            }
+            pSecondDerivativeVolume = optSecondDerivativeVolume->get();
+            volVisMenu.setDerivedVolumes(pGradientVolume, pSecondDerivativeVolume);
+
+            // The renderer uses full resolution until the pyramid is available (which streamed volumes never have).
+            if (volVisMenu.renderConfig().levelOfDetail && !optVolume->brickCache())
+                optVolumePyramid->request([&volume = optVolume.value(), storage = volVisMenu.gradientStorage()]() {
+                    auto pLoadedVolumePyramid = volume::loadVolumePyramid(volume, storage);
+                    return pLoadedVolumePyramid ? std::move(pLoadedVolumePyramid) : std::make_unique<volume::VolumePyramid>(volume, storage);
+                });
+            pVolumePyramid = optVolumePyramid->get();
+            // Derived volumes that were computed after the interpolation mode last changed have not been rendered
+            // yet, so they can pick up the current mode without waiting for the render thread.
+            updateInterpolationMode(volVisMenu.interpolationMode());
+
+            // Keep showing the previous image until the volumes that the current settings need are available.
+            const render::RenderConfig renderConfig = volVisMenu.renderConfig();
+            derivedVolumesReady = (pGradientVolume || !render::needsGradientVolume(renderConfig)) && (pSecondDerivativeVolume || !render::needsSecondDerivativeVolume(renderConfig));
+        }
+
+        if (optVolume.has_value()) {
             // If camera changed in any way then we need to redraw.
             static glm::mat4 prevViewMatrix = glm::identity<glm::mat4>();
             const glm::mat4 viewMatrix = trackballCamera.viewMatrix();
@@ -126,18 +203,38 @@ int main(int argc, char** argv)
             // If previous frame we rendered at a lower resolution (because something changed) then it will request to draw
             // the next frame in full resolution. If the user is still holding the mouse button then we can reasonably assume
             // that (s)he is not finished with the interaction (so we should keep rendering at a lower resolution).
+            // Streamed volumes are rendered again (at full resolution) whenever more bricks have been loaded, once the
+            // current frame is done (requesting it right away would cancel that frame).
+            if (const volume::BrickCache* pBrickCache = optVolume->brickCache(); pBrickCache && pBrickCache->numLoadedBricks() > 0 && !renderThread.isBusy())
+                redrawFullResolution = true;
             if (redrawFullResolution && (myWindow.isMouseButtonPressed(GLFW_MOUSE_BUTTON_LEFT) || myWindow.isMouseButtonPressed(GLFW_MOUSE_BUTTON_RIGHT)))
                 redrawUserInteraction = true;
 
             // We draw when either the user has interacted (camera matrix changed or render config changed (see callback)) or if
             //  last frame we rendered at a lower resolution and we want to now render at the full resolution.
-            if (redrawUserInteraction || redrawFullResolution) {
-                if (redrawUserInteraction) {
+            // A new request cancels a full resolution frame that is still being rendered, but waits for a reduced
+            // resolution one (see render::FrameRequest::preview), so the full resolution frame that follows an
+            // interaction is rendered after its preview.
+            if (derivedVolumesReady && (redrawUserInteraction || redrawFullResolution)) {
+                const bool preview = redrawUserInteraction && !volVisMenu.renderConfig().progressiveRefinement;
+                if (volVisMenu.renderConfig().progressiveRefinement) {
+                    // Progressive refinement bounds the time per frame by itself: the render thread shows a sparse
+                    // image right away and refines it at full resolution for as long as nothing changes.
+                    volVisMenu.setBaseRenderResolution(baseRenderResolution);
+                    volVisMenu.setLevelOfDetailBias(0);
+                    redrawFullResolution = false;
+                } else if (volVisMenu.renderConfig().temporalReprojection && volVisMenu.renderConfig().renderMode != render::RenderMode::RenderSlicer) {
+                    // Temporal reprojection makes the frames cheap while the camera moves, so they keep the full
+                    // resolution. The frame after the interaction (with a camera that did not move) is traced fully.
+                    volVisMenu.setBaseRenderResolution(baseRenderResolution);
+                    volVisMenu.setLevelOfDetailBias(0);
+                    redrawFullResolution = preview;
+                } else if (redrawUserInteraction) {
                     // Reduce the resolution if the performance drops below the target frame time.
                     // Estimated performance when rendering at full resolution (resolution returned from menu).
                     // This way we can dynamically update the resolution while the user is moving the camera since
                     // some views may be slower to render than others.
-                    const float estimatedFullResFrameTime = float(renderTime.count()) * float(prevResolutionScale * prevResolutionScale);
+                    const float estimatedFullResFrameTime = float(renderTime.count()) * renderTimeResolutionScale * renderTimeResolutionScale;
                     const float performanceScale = estimatedFullResFrameTime / float(frameTimeTarget);
                     // Resolution scale changes the number of pixels quadratically (scales both width and height).
                     const int resolutionScale = std::max(int(std::sqrt(performanceScale)) + 1, 1);
@@ -146,22 +243,17 @@ int main(int argc, char** argv)
                     //  the associated callback. Make sure that you don't read redrawUserInteraction after
                     //  this call because it will always be true.
                     volVisMenu.setBaseRenderResolution(baseRenderResolution / resolutionScale);
+                    // With level of detail enabled, also sample one level coarser than needed while interacting.
+                    volVisMenu.setLevelOfDetailBias(1);
                     redrawFullResolution = true;
-                    prevResolutionScale = resolutionScale;
                 } else {
-                    prevResolutionScale = 1;
                     volVisMenu.setBaseRenderResolution(baseRenderResolution);
+                    volVisMenu.setLevelOfDetailBias(0);
                     redrawFullResolution = false;
                 }
                 redrawUserInteraction = false;
 
-                using clock = std::chrono::high_resolution_clock;
-                const auto start = clock::now();
-                optRenderer->render();
-                const auto end = clock::now();
-                renderTime = end - start;
-
-                fullScreenTextureGL.update(optRenderer->frameBuffer(), volVisMenu.renderConfig().renderResolution);
+                renderThread.requestFrame({ volVisMenu.renderConfig(), trackballCamera.lookAtCamera(), &optVolume.value(), pGradientVolume, pSecondDerivativeVolume, pVolumePyramid, preview });
             }
 
             // === Drawing the framebuffer to the screen and adding the wireframe. ===
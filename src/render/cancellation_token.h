@@ -0,0 +1,18 @@
+#pragma once
+#include <atomic>
+
+namespace render {
+
+// Lets one thread ask another thread to stop the work that it is doing, for example to cancel a frame that became
+// outdated while it was being rendered (see Renderer::render).
+class CancellationToken {
+public:
+    void cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+    void reset() { m_cancelled.store(false, std::memory_order_relaxed); }
+    bool isCancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> m_cancelled { false };
+};
+
+}
@@ -0,0 +1,39 @@
+#include "look_at_camera.h"
+#include <cmath>
+#include <glm/geometric.hpp>
+#include <limits>
+
+namespace render {
+
+LookAtCamera::LookAtCamera(const glm::vec3& position, const glm::vec3& lookAt, const glm::vec3& up, float fovy, float aspectRatio)
+    : m_position(position)
+    , m_forward(glm::normalize(lookAt - position))
+    // Same handedness as the trackball: right = up x forward.
+    , m_right(glm::normalize(glm::cross(up, m_forward)))
+    , m_up(glm::cross(m_forward, m_right))
+    , m_halfScreenPlaneWidth(aspectRatio * std::tan(fovy / 2.0f))
+    , m_halfScreenPlaneHeight(std::tan(fovy / 2.0f))
+{
+}
+
+glm::vec3 LookAtCamera::position() const
+{
+    return m_position;
+}
+
+glm::vec3 LookAtCamera::forward() const
+{
+    return m_forward;
+}
+
+render::Ray LookAtCamera::generateRay(const glm::vec2& pixel) const
+{
+    render::Ray ray;
+    ray.origin = m_position;
+    ray.direction = glm::normalize(m_forward + pixel.x * m_halfScreenPlaneWidth * m_right + pixel.y * m_halfScreenPlaneHeight * m_up);
+    ray.tmin = std::numeric_limits<float>::lowest();
+    ray.tmax = std::numeric_limits<float>::max();
+    return ray;
+}
+
+}
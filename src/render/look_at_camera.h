@@ -0,0 +1,27 @@
+#pragma once
+#include "ray.h"
+#include "ray_trace_camera.h"
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+namespace render {
+
+// Pinhole camera defined by a position, a look-at point and an up vector. Generates the same rays as the trackball
+// of the viewer (same field of view convention and image orientation) but does not depend on a window, so it can be
+// used for offline rendering.
+class LookAtCamera : public RayTraceCamera {
+public:
+    LookAtCamera(const glm::vec3& position, const glm::vec3& lookAt, const glm::vec3& up, float fovy, float aspectRatio);
+
+    glm::vec3 position() const override;
+    glm::vec3 forward() const override;
+
+    // Generate ray given pixel in NDC space (-1 to +1)
+    render::Ray generateRay(const glm::vec2& pixel) const override;
+
+private:
+    glm::vec3 m_position, m_forward, m_right, m_up;
+    float m_halfScreenPlaneWidth, m_halfScreenPlaneHeight;
+};
+
+}
@@ -22,7 +22,32 @@ struct RenderConfig {
 
     bool volumeShading { false };
     bool goochShading { false };
+    // Skip macro cells that cannot contribute to the image under the current transfer function / iso value.
+    bool emptySpaceSkipping { true };
     float isoValue { 95.0f };
+    // Compositing stops once the accumulated opacity reaches this value (1.0 disables early ray termination).
+    float earlyRayTerminationThreshold { 0.99f };
+    // Number of neighbouring rays that are marched together using SIMD instructions (1 = one ray at a time).
+    // Only used for MIP and 1D TF compositing without empty space skipping (see Renderer::rayPacketWidth).
+    int rayPacketWidth { 1 };
+    // Sample a coarser level of the volume pyramid when a voxel projects to less than a pixel (see Renderer::selectLevel).
+    bool levelOfDetail { false };
+    // Render a fraction of the pixels per frame and refine the image over the following frames (see Renderer::render).
+    bool progressiveRefinement { false };
+    // Reuse the pixels of the previous frame while only the camera moves (see Renderer::renderReprojectedFrame).
+    // Ignored with progressive refinement and by the slicer.
+    bool temporalReprojection { false };
+    // Intersect the rays exactly with the trilinear iso surface instead of sampling it (see
+    // Renderer::findIsoSurfaceExact). Only used with linear interpolation.
+    bool exactIsoSurface { false };
+    // Number of levels to go coarser than the projected voxel size asks for (used while the user is interacting).
+    int levelOfDetailBias { 0 };
+    // Distance between the samples of composite mode, in voxels. Larger steps are faster but skip over thin features
+    // of the transfer function, unless it is preintegrated.
+    float compositeSampleStep { 1.0f };
+    // Composite with a preintegrated transfer function, which accounts for all values between two samples instead of
+    // only the values at the samples (see Renderer::updatePreintegratedTF).
+    bool preintegratedTransferFunction { false };
 
     // 1D transfer function.
     std::array<glm::vec4, 256> tfColorMap;
@@ -48,6 +73,17 @@ struct RenderConfig {
     glm::vec3 GoochColdColor;
 };
 
+// Whether rendering with this config samples the gradient volume / second derivative volume.
+inline bool needsGradientVolume(const RenderConfig& config)
+{
+    const bool shading = config.volumeShading || config.goochShading;
+    return config.renderMode == RenderMode::RenderTF2D || (config.renderMode == RenderMode::RenderIso && shading);
+}
+inline bool needsSecondDerivativeVolume(const RenderConfig& config)
+{
+    return config.renderMode == RenderMode::RenderTFSecondDerivative;
+}
+
 // NOTE(Mathijs): should be replaced by C++20 three-way operator (aka spaceship operator) if we require C++ 20 support from Linux users (GCC10 / Clang10).
 inline bool operator==(const RenderConfig& lhs, const RenderConfig& rhs)
 {
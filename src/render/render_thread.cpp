@@ -0,0 +1,101 @@
+#include "render_thread.h"
+
+namespace render {
+
+RenderThread::RenderThread()
+    : m_thread([this]() { renderLoop(); })
+{
+}
+
+RenderThread::~RenderThread()
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_stop = true;
+        m_cancellationToken.cancel();
+    }
+    m_requestAdded.notify_one();
+    m_thread.join();
+    delete m_pLatestFrame.exchange(nullptr);
+}
+
+void RenderThread::requestFrame(const FrameRequest& request)
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_pendingRequest = request;
+        if (m_isRendering && !m_isRenderingPreview)
+            m_cancellationToken.cancel();
+    }
+    m_requestAdded.notify_one();
+}
+
+std::unique_ptr<Frame> RenderThread::takeFrame()
+{
+    return std::unique_ptr<Frame>(m_pLatestFrame.exchange(nullptr, std::memory_order_acquire));
+}
+
+bool RenderThread::isBusy() const
+{
+    std::lock_guard lock { m_mutex };
+    return m_isRendering || m_pendingRequest.has_value() || m_refiningRequest.has_value();
+}
+
+void RenderThread::cancelAndWait()
+{
+    std::unique_lock lock { m_mutex };
+    m_pendingRequest.reset();
+    m_refiningRequest.reset();
+    m_cancellationToken.cancel();
+    m_idle.wait(lock, [this]() { return !m_isRendering; });
+    // A new volume may be allocated at the address of the previous one, so don't reuse the renderer.
+    m_pRenderer.reset();
+}
+
+void RenderThread::renderLoop()
+{
+    std::unique_lock lock { m_mutex };
+    while (true) {
+        m_requestAdded.wait(lock, [this]() { return m_stop || m_pendingRequest.has_value() || m_refiningRequest.has_value(); });
+        if (m_stop)
+            return;
+
+        // Without a new request, render the next pass of the image that is being refined.
+        const FrameRequest request = m_pendingRequest ? *m_pendingRequest : *m_refiningRequest;
+        m_pendingRequest.reset();
+        m_refiningRequest.reset();
+        m_cancellationToken.reset();
+        m_isRendering = true;
+        m_isRenderingPreview = request.preview;
+        lock.unlock();
+
+        using clock = std::chrono::high_resolution_clock;
+        const auto start = clock::now();
+        m_camera.emplace(request.camera);
+        if (m_pRenderer) {
+            m_pRenderer->setConfig(request.config);
+            m_pRenderer->setCamera(&m_camera.value());
+        } else {
+            m_pRenderer = std::make_unique<Renderer>(request.pVolume, nullptr, nullptr, &m_camera.value(), request.config);
+        }
+        m_pRenderer->setGradientVolume(request.pGradientVolume);
+        m_pRenderer->setSecondDerivativeVolume(request.pSecondDerivativeVolume);
+        m_pRenderer->setVolumePyramid(request.pVolumePyramid);
+        const bool completed = m_pRenderer->render(&m_cancellationToken);
+        if (completed) {
+            const auto frameBuffer = m_pRenderer->frameBuffer();
+            auto pFrame = std::make_unique<Frame>(Frame { std::vector(std::begin(frameBuffer), std::end(frameBuffer)), request.config.renderResolution, clock::now() - start, m_pRenderer->numIsoDistanceUpdates() });
+            delete m_pLatestFrame.exchange(pFrame.release(), std::memory_order_acq_rel);
+        }
+
+        lock.lock();
+        // The token is only cancelled while holding the lock, so a pass that completed just before cancelAndWait()
+        // does not continue refining.
+        if (completed && !m_cancellationToken.isCancelled() && !m_pendingRequest && request.config.progressiveRefinement && !m_pRenderer->isConverged())
+            m_refiningRequest = request;
+        m_isRendering = false;
+        m_idle.notify_all();
+    }
+}
+
+}
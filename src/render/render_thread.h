@@ -0,0 +1,92 @@
+#pragma once
+#include "render/cancellation_token.h"
+#include "render/look_at_camera.h"
+#include "render/render_config.h"
+#include "render/renderer.h"
+#include "volume/gradient_volume.h"
+#include "volume/secondderivative_volume.h"
+#include "volume/volume.h"
+#include "volume/volume_pyramid.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace render {
+
+// Everything that a frame is rendered from. The volumes are read while the frame is being rendered, so they may only
+// be changed or destroyed once the render thread is idle (see RenderThread::cancelAndWait).
+struct FrameRequest {
+    RenderConfig config;
+    LookAtCamera camera;
+    const volume::Volume* pVolume;
+    const volume::GradientVolume* pGradientVolume { nullptr };
+    const volume::SecondDerivativeVolume* pSecondDerivativeVolume { nullptr };
+    const volume::VolumePyramid* pVolumePyramid { nullptr };
+    // Reduced resolution frames that are rendered while the user interacts are not cancelled by newer requests: they
+    // are fast by construction (see the dynamic resolution scaling of the viewer), and cancelling each of them while
+    // the camera keeps moving would never show an image.
+    bool preview { false };
+};
+
+struct Frame {
+    std::vector<glm::vec4> pixels;
+    glm::ivec2 resolution;
+    std::chrono::duration<double> renderTime;
+    // Renderer::numIsoDistanceUpdates of the renderer that rendered the frame.
+    size_t numIsoDistanceUpdates;
+};
+
+// Renders frames on a thread of its own, so that the UI stays responsive while a frame takes long. Only the newest
+// request is rendered: it replaces a request that has not been started yet and cancels the frame that is being
+// rendered (unless that is a preview). Finished frames are put in a mailbox that only holds the newest one, from
+// which the UI takes them without ever waiting for the render thread.
+//
+// With RenderConfig::progressiveRefinement, the render thread keeps refining the image of the newest request (and
+// publishing every pass) until it has converged or a new request arrives.
+class RenderThread {
+public:
+    RenderThread();
+    RenderThread(const RenderThread&) = delete;
+    ~RenderThread();
+
+    void requestFrame(const FrameRequest& request);
+    // The newest frame that was finished since the previous call, or nullptr.
+    std::unique_ptr<Frame> takeFrame();
+    // Whether a frame is being rendered or waiting to be rendered, or the image is still being refined.
+    bool isBusy() const;
+    // Cancels the frame that is being rendered, drops the pending request and blocks until the render thread is
+    // idle, after which the volumes of the previous requests may be changed or destroyed.
+    void cancelAndWait();
+
+private:
+    void renderLoop();
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_requestAdded, m_idle;
+    std::optional<FrameRequest> m_pendingRequest;
+    // The request of the previous frame, if its image is being refined progressively.
+    std::optional<FrameRequest> m_refiningRequest;
+    bool m_isRendering { false };
+    bool m_isRenderingPreview { false };
+    bool m_stop { false };
+    CancellationToken m_cancellationToken;
+
+    // Only used by the render thread (or while it is idle).
+    std::optional<LookAtCamera> m_camera;
+    std::unique_ptr<Renderer> m_pRenderer;
+
+    // Lock free mailbox: the render thread swaps in a new frame (deleting the one that was never taken), the UI swaps
+    // in nullptr.
+    std::atomic<Frame*> m_pLatestFrame { nullptr };
+
+    std::thread m_thread;
+};
+
+}
@@ -1,11 +1,16 @@
 #include "renderer.h"
+#include "simd.h"
 #include <algorithm>
-#include <algorithm> // std::fill
+#include <bit>
+#include <cassert>
 #include <cmath>
 #include <functional>
 #include <glm/common.hpp>
+#include <glm/geometric.hpp>
 #include <glm/gtx/component_wise.hpp>
 #include <iostream>
+#include <limits>
+#include <tbb/blocked_range.h>
 #include <tbb/blocked_range2d.h>
 #include <tbb/parallel_for.h>
 #include <tuple>
@@ -30,6 +35,7 @@ Renderer::Renderer(
     , m_config(initialConfig)
 {
     resizeImage(initialConfig.renderResolution);
+    updateTFVisibility();
 }
 
 // Set a new render config if the user changed the settings.
@@ -39,6 +45,30 @@ void Renderer::setConfig(const RenderConfig& config)
         resizeImage(config.renderResolution);
 
     m_config = config;
+    updateTFVisibility();
+}
+
+void Renderer::setCamera(const RayTraceCamera* pCamera)
+{
+    m_pCamera = pCamera;
+}
+
+void Renderer::setGradientVolume(const volume::GradientVolume* pGradientVolume)
+{
+    m_pGradientVolume = pGradientVolume;
+}
+
+void Renderer::setSecondDerivativeVolume(const volume::SecondDerivativeVolume* pSecondDerivativeVolume)
+{
+    m_pSecondDerivativeVolume = pSecondDerivativeVolume;
+}
+
+void Renderer::setVolumePyramid(const volume::VolumePyramid* pVolumePyramid)
+{
+    // A new pyramid may be allocated at the address of a level of the previous one.
+    if (pVolumePyramid != m_pVolumePyramid)
+        m_pIsoDistanceVolume = nullptr;
+    m_pVolumePyramid = pVolumePyramid;
 }
 
 // Resize the framebuffer and fill it with black pixels.
@@ -60,16 +90,213 @@ gsl::span<const glm::vec4> Renderer::frameBuffer() const
     return m_frameBuffer;
 }
 
+// Camera that generates the rays of another camera in the voxel coordinates of a level of the volume pyramid.
+class LevelCamera : public RayTraceCamera {
+public:
+    LevelCamera(const RayTraceCamera& camera, int level)
+        : m_camera(camera)
+        , m_level(level)
+    {
+    }
+
+    glm::vec3 position() const override { return volume::VolumePyramid::toLevelCoordinates(m_camera.position(), m_level); }
+    glm::vec3 forward() const override { return m_camera.forward(); }
+    Ray generateRay(const glm::vec2& pixel) const override
+    {
+        Ray ray = m_camera.generateRay(pixel);
+        ray.origin = volume::VolumePyramid::toLevelCoordinates(ray.origin, m_level);
+        return ray;
+    }
+
+private:
+    const RayTraceCamera& m_camera;
+    const int m_level;
+};
+
 // Main render function. It computes an image according to the current renderMode.
+// With level of detail enabled the image may be rendered from a coarser level of the volume pyramid: the renderer
+// then points at the volumes of that level and at a camera in its voxel coordinates for the duration of the frame.
+// The samples stay one (level) voxel apart, so a coarser level also takes fewer, larger steps.
+bool Renderer::render(const CancellationToken* pCancellationToken)
+{
+    assert(m_pGradientVolume || !needsGradientVolume(m_config));
+    assert(m_pSecondDerivativeVolume || !needsSecondDerivativeVolume(m_config));
+
+    volume::BrickCache* pBrickCache = m_pVolume->brickCache();
+    const bool bricksLoaded = pBrickCache && pBrickCache->numLoadedBricks() > 0;
+    const int level = selectLevel();
+    const ImageState state {
+        m_config,
+        { m_pCamera->position(), m_pCamera->generateRay(glm::vec2(-1.0f)).direction, m_pCamera->generateRay(glm::vec2(1.0f)).direction },
+        { m_pGradientVolume, m_pSecondDerivativeVolume, m_pVolumePyramid },
+        level
+    };
+
+    // Progressive refinement starts over whenever the image changes: when the view, the config or the volumes change,
+    // or when a streamed volume has loaded more bricks.
+    if (m_config.progressiveRefinement) {
+        if (state != m_progressiveState || bricksLoaded) {
+            m_progressiveState = state;
+            m_progressivePass = 0;
+        }
+        if (isConverged())
+            return true;
+    }
+
+    // Temporal reprojection reuses the previous frame if only the camera has moved. A camera that stands still gets
+    // a fully traced image, so the errors of the reprojection disappear as soon as the user stops moving.
+    ImageState previousView = state;
+    previousView.camera = m_previousState.camera;
+    m_reproject = m_hasPreviousSamples && !bricksLoaded && state.camera != m_previousState.camera && previousView == m_previousState;
+    m_previousState = state;
+
+    // The iso surface hits of the previous frame are reused as long as only the shading changes (see renderIsoFrame).
+    const IsoHitState isoHitState { state.camera, m_config.renderResolution, m_config.isoValue, m_config.exactIsoSurface, m_pVolume->interpolationMode, level, m_pVolume };
+    m_isoHitsValid = m_hasIsoHits && !bricksLoaded && isoHitState == m_isoHitState;
+    m_isoHitState = isoHitState;
+
+    // Streamed volumes pick up the bricks that were loaded since the previous frame.
+    if (pBrickCache)
+        pBrickCache->beginFrame(m_pCamera->position(), m_pCamera->forward());
+
+    if (level == 0)
+        return renderFrame(pCancellationToken);
+
+    const LevelCamera levelCamera { *m_pCamera, level };
+    const auto* pVolume = m_pVolume;
+    const auto* pGradientVolume = m_pGradientVolume;
+    const auto* pCamera = m_pCamera;
+    m_pVolume = &m_pVolumePyramid->volume(level);
+    m_pGradientVolume = pGradientVolume ? &m_pVolumePyramid->gradientVolume(level) : nullptr;
+    m_pCamera = &levelCamera;
+    m_opacityCorrection = float(1 << level);
+    const bool completed = renderFrame(pCancellationToken);
+    m_pVolume = pVolume;
+    m_pGradientVolume = pGradientVolume;
+    m_pCamera = pCamera;
+    m_opacityCorrection = 1.0f;
+    return completed;
+}
+
+// Selects the level of the volume pyramid whose voxels project to about one pixel. The footprint of a pixel is
+// measured at the point of the volume that is closest to the camera, so no part of the volume is undersampled.
+// The slicer takes a single sample per pixel and the second derivative has no pyramid, so both use level 0.
+int Renderer::selectLevel() const
+{
+    const bool supportedMode = m_config.renderMode != RenderMode::RenderSlicer && m_config.renderMode != RenderMode::RenderTFSecondDerivative;
+    if (!m_config.levelOfDetail || !m_pVolumePyramid || !supportedMode)
+        return 0;
+
+    // Angle between the rays of two neighbouring pixels in the center of the image.
+    const glm::vec3 centerDirection = glm::normalize(m_pCamera->generateRay(glm::vec2(0.0f)).direction);
+    const glm::vec3 neighbourDirection = glm::normalize(m_pCamera->generateRay(glm::vec2(2.0f / float(m_config.renderResolution.x), 0.0f)).direction);
+    const float pixelAngle = glm::length(glm::cross(centerDirection, neighbourDirection));
+
+    const glm::vec3 cameraPosition = m_pCamera->position();
+    const glm::vec3 closestPoint = glm::clamp(cameraPosition, glm::vec3(0.0f), glm::vec3(m_pVolume->dims() - 1));
+    const float pixelFootprint = glm::distance(cameraPosition, closestPoint) * pixelAngle;
+    const int level = pixelFootprint > 1.0f ? int(std::log2(pixelFootprint)) : 0;
+    return std::clamp(level + m_config.levelOfDetailBias, 0, m_pVolumePyramid->numLevels() - 1);
+}
+
+// Computes an image of the current volume, camera and render config.
 // Multithreading is enabled in Release/RelWithDebInfo modes. In Debug mode multithreading is disabled to make debugging easier.
-void Renderer::render()
+// The token is checked before every row, so a cancelled frame stops within a row of each tile.
+bool Renderer::renderFrame(const CancellationToken* pCancellationToken)
 {
-    resetImage();
+    // Only composite mode can trade step size for speed; the other modes sample every voxel.
+    const float sampleStep = m_config.renderMode == RenderMode::RenderComposite ? m_config.compositeSampleStep : 1.0f;
+    if (m_config.renderMode == RenderMode::RenderIso && useEmptySpaceSkipping())
+        updateIsoEmptySpaceDistances();
+    if (m_config.renderMode == RenderMode::RenderComposite && m_config.preintegratedTransferFunction)
+        updatePreintegratedTF(compositeSegmentLength());
 
-    static constexpr float sampleStep = 1.0f;
     const glm::vec3 planeNormal = -glm::normalize(m_pCamera->forward());
     const glm::vec3 volumeCenter = glm::vec3(m_pVolume->dims()) / 2.0f;
     const Bounds bounds { glm::vec3(0.0f), glm::vec3(m_pVolume->dims() - glm::ivec3(1)) };
+    // Ray marching kernel for the current render mode, interpolation mode and shading model.
+    const RayKernel rayKernel = selectRayKernel(m_config.renderMode);
+
+    // Number of neighbouring pixels that are traced together as one ray packet (1 if packets are disabled).
+    const int packetWidth = rayPacketWidth();
+
+    // Compute the color of a sample at the given position (in pixels), and the point of the volume that represents
+    // it (w = 0 if there is none).
+    const auto traceSample = [&](const glm::vec2& pixel, glm::vec4& samplePoint) {
+        // Compute a ray for the current pixel.
+        const glm::vec2 pixelPos = pixel / glm::vec2(m_config.renderResolution);
+        Ray ray = m_pCamera->generateRay(pixelPos * 2.0f - 1.0f);
+
+        // Compute where the ray enters and exists the volume.
+        // If the ray misses the volume then the pixel stays black.
+        if (!instersectRayVolumeBounds(ray, bounds)) {
+            samplePoint = glm::vec4(0.0f);
+            return glm::vec4(0.0f);
+        }
+
+        // Get a color for the current pixel according to the current render mode.
+        glm::vec4 color {};
+        float depth = ray.tmin;
+        if (m_config.renderMode == RenderMode::RenderSlicer)
+            color = traceRaySlice(ray, volumeCenter, planeNormal);
+        else
+            color = (this->*rayKernel)(ray, sampleStep, depth);
+        samplePoint = glm::vec4(ray.origin + depth * ray.direction, 1.0f);
+        return color;
+    };
+    const auto tracePixel = [&](const glm::vec2& pixel) {
+        glm::vec4 samplePoint;
+        return traceSample(pixel, samplePoint);
+    };
+
+    // Compute the color of a single pixel and write it to the screen.
+    const auto renderPixel = [&](int x, int y) {
+        fillColor(x, y, tracePixel(glm::vec2(x, y)));
+    };
+
+    // Compute the colors of the pixels [xBegin, xEnd) of row y. Groups of packetWidth pixels are traced as a
+    // packet if all their rays hit the volume; pixels at the edge of the volume and at the end of the row are
+    // traced one by one.
+    const auto renderRow = [&](int y, int xBegin, int xEnd) {
+        int x = xBegin;
+        if (packetWidth > 1) {
+            std::array<Ray, simd::maxWidth> rays;
+            std::array<glm::vec4, simd::maxWidth> colors;
+            for (; x + packetWidth <= xEnd; x += packetWidth) {
+                bool allHit = true;
+                for (int i = 0; i < packetWidth; i++) {
+                    const glm::vec2 pixelPos = glm::vec2(x + i, y) / glm::vec2(m_config.renderResolution);
+                    rays[size_t(i)] = m_pCamera->generateRay(pixelPos * 2.0f - 1.0f);
+                    allHit = instersectRayVolumeBounds(rays[size_t(i)], bounds) && allHit;
+                }
+                const auto packetRays = gsl::span<const Ray>(rays).first(size_t(packetWidth));
+                const auto packetColors = gsl::span<glm::vec4>(colors).first(size_t(packetWidth));
+                if (allHit && traceRayPacket(packetRays, sampleStep, packetColors)) {
+                    for (int i = 0; i < packetWidth; i++)
+                        fillColor(x + i, y, colors[size_t(i)]);
+                } else {
+                    for (int i = 0; i < packetWidth; i++)
+                        renderPixel(x + i, y);
+                }
+            }
+        }
+        for (; x < xEnd; x++)
+            renderPixel(x, y);
+    };
+
+    const auto isCancelled = [=]() { return pCancellationToken && pCancellationToken->isCancelled(); };
+    // The iso surface hits belong to the last frame that renderIsoFrame drew; other paths may draw a different view.
+    if (m_config.progressiveRefinement || m_config.temporalReprojection || m_config.renderMode != RenderMode::RenderIso)
+        m_hasIsoHits = false;
+    if (m_config.progressiveRefinement)
+        return renderProgressivePass(tracePixel, isCancelled);
+    // The slicer's plane moves with the camera, so its pixels cannot be reprojected.
+    if (m_config.temporalReprojection && m_config.renderMode != RenderMode::RenderSlicer)
+        return renderReprojectedFrame(traceSample, isCancelled);
+    if (m_config.renderMode == RenderMode::RenderIso)
+        return renderIsoFrame(isCancelled);
+
+    resetImage();
 
     // 0 = sequential (single-core), 1 = TBB (multi-core)
 #ifdef NDEBUG
@@ -81,65 +308,346 @@ void Renderer::render()
 #endif
 
 #if PARALLELISM == 0
-    // Regular (single threaded) for loops.
-    for (int x = 0; x < m_config.renderResolution.x; x++) {
-        for (int y = 0; y < m_config.renderResolution.y; y++) {
+    // Regular (single threaded) for loop.
+    for (int y = 0; y < m_config.renderResolution.y && !isCancelled(); y++)
+        renderRow(y, 0, m_config.renderResolution.x);
 #else
     // Parallel for loop (in 2 dimensions) that subdivides the screen into tiles.
     const tbb::blocked_range2d<int> screenRange { 0, m_config.renderResolution.y, 0, m_config.renderResolution.x };
-        tbb::parallel_for(screenRange, [&](tbb::blocked_range2d<int> localRange) {
-        // Loop over the pixels in a tile. This function is called on multiple threads at the same time.
-        for (int y = std::begin(localRange.rows()); y != std::end(localRange.rows()); y++) {
-            for (int x = std::begin(localRange.cols()); x != std::end(localRange.cols()); x++) {
+    tbb::parallel_for(screenRange, [&](tbb::blocked_range2d<int> localRange) {
+        // Loop over the rows of a tile. This function is called on multiple threads at the same time.
+        for (int y = std::begin(localRange.rows()); y != std::end(localRange.rows()) && !isCancelled(); y++)
+            renderRow(y, std::begin(localRange.cols()), std::end(localRange.cols()));
+    });
 #endif
-            // Compute a ray for the current pixel.
-            const glm::vec2 pixelPos = glm::vec2(x, y) / glm::vec2(m_config.renderResolution);
-            Ray ray = m_pCamera->generateRay(pixelPos * 2.0f - 1.0f);
-
-            // Compute where the ray enters and exists the volume.
-            // If the ray misses the volume then we continue to the next pixel.
-            if (!instersectRayVolumeBounds(ray, bounds))
-                continue;
-
-            // Get a color for the current pixel according to the current render mode.
-            glm::vec4 color {};
-            switch (m_config.renderMode) {
-            case RenderMode::RenderSlicer: {
-                color = traceRaySlice(ray, volumeCenter, planeNormal);
-                break;
+    return !isCancelled();
+}
+
+// Progressive refinement renders a fraction of the pixels per call to render(), so every call takes a bounded amount
+// of time however large the image is. The image is divided into blocks of 4x4 pixels and pass p renders the pixel of
+// rank p % 16 of every block, where the ranks form a Bayer matrix so that each pass spreads its pixels evenly.
+// During the first 16 passes, pixels that have not been rendered yet show the nearest rendered pixel of their block.
+// Every following round of 16 passes adds a sample to every pixel at a sub-pixel offset from the Halton sequence,
+// and the image shows the average, until every pixel has progressiveSamplesPerPixel samples.
+static constexpr int progressiveBlockSize = 4;
+static constexpr int progressiveBlockPixels = progressiveBlockSize * progressiveBlockSize;
+// Rank of every pixel (y * progressiveBlockSize + x) of a block.
+static constexpr std::array<int, progressiveBlockPixels> progressiveRanks { 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+
+// For every pass of the first round and every pixel of a block: the nearest pixel that has been rendered after the pass.
+static constexpr auto progressiveFillSources = []() {
+    std::array<std::array<int, progressiveBlockPixels>, progressiveBlockPixels> fillSources {};
+    for (int pass = 0; pass < progressiveBlockPixels; pass++) {
+        for (int pixel = 0; pixel < progressiveBlockPixels; pixel++) {
+            int nearest = -1, nearestDistance = 0;
+            for (int source = 0; source < progressiveBlockPixels; source++) {
+                const int dx = source % progressiveBlockSize - pixel % progressiveBlockSize;
+                const int dy = source / progressiveBlockSize - pixel / progressiveBlockSize;
+                const int distance = dx * dx + dy * dy;
+                if (progressiveRanks[size_t(source)] <= pass && (nearest == -1 || distance < nearestDistance)) {
+                    nearest = source;
+                    nearestDistance = distance;
+                }
             }
-            case RenderMode::RenderMIP: {
-                color = traceRayMIP(ray, sampleStep);
-                break;
+            fillSources[size_t(pass)][size_t(pixel)] = nearest;
+        }
+    }
+    return fillSources;
+}();
+
+// Element i of the Halton sequence with the given base, in [0, 1).
+static float radicalInverse(int i, int base)
+{
+    float result = 0.0f, digitWeight = 1.0f / float(base);
+    for (; i > 0; i /= base, digitWeight /= float(base))
+        result += float(i % base) * digitWeight;
+    return result;
+}
+
+bool Renderer::isConverged() const
+{
+    return m_config.progressiveRefinement && m_progressivePass >= progressiveBlockPixels * progressiveSamplesPerPixel;
+}
+
+template <typename TracePixel, typename IsCancelled>
+bool Renderer::renderProgressivePass(TracePixel&& tracePixel, IsCancelled&& isCancelled)
+{
+    const glm::ivec2 resolution = m_config.renderResolution;
+    const int rank = m_progressivePass % progressiveBlockPixels;
+    const int sample = m_progressivePass / progressiveBlockPixels;
+    if (m_progressivePass == 0)
+        m_sampleSums.assign(m_frameBuffer.size(), glm::vec4(0.0f));
+
+    // The first sample of every pixel is taken at the same position as without progressive refinement.
+    const int rankPixel = int(std::find(std::begin(progressiveRanks), std::end(progressiveRanks), rank) - std::begin(progressiveRanks));
+    const glm::ivec2 offset { rankPixel % progressiveBlockSize, rankPixel / progressiveBlockSize };
+    const glm::vec2 jitter = sample == 0 ? glm::vec2(0.0f) : glm::vec2(radicalInverse(sample, 2), radicalInverse(sample, 3)) - 0.5f;
+
+    // Render the pixel of the current rank of the blocks [bxBegin, bxEnd) of block row by.
+    const auto renderBlockRow = [&](int by, int bxBegin, int bxEnd) {
+        const int y = by * progressiveBlockSize + offset.y;
+        for (int x = bxBegin * progressiveBlockSize + offset.x; x < std::min(bxEnd * progressiveBlockSize, resolution.x) && y < resolution.y; x += progressiveBlockSize) {
+            const size_t index = size_t(y) * size_t(resolution.x) + size_t(x);
+            m_sampleSums[index] += tracePixel(glm::vec2(x, y) + jitter);
+            m_frameBuffer[index] = m_sampleSums[index] / float(sample + 1);
+        }
+    };
+    // Show the nearest rendered pixel of the block in the pixels of row y that have not been rendered yet.
+    const auto fillRow = [&](int y) {
+        for (int x = 0; x < resolution.x; x++) {
+            const int pixel = (y % progressiveBlockSize) * progressiveBlockSize + x % progressiveBlockSize;
+            const int source = progressiveFillSources[size_t(rank)][size_t(pixel)];
+            const int sourceX = std::min(x - x % progressiveBlockSize + source % progressiveBlockSize, resolution.x - 1);
+            const int sourceY = std::min(y - y % progressiveBlockSize + source / progressiveBlockSize, resolution.y - 1);
+            fillColor(x, y, m_sampleSums[size_t(sourceY) * size_t(resolution.x) + size_t(sourceX)]);
+        }
+    };
+
+    const glm::ivec2 numBlocks = (resolution + progressiveBlockSize - 1) / progressiveBlockSize;
+#if PARALLELISM == 0
+    for (int by = 0; by < numBlocks.y && !isCancelled(); by++)
+        renderBlockRow(by, 0, numBlocks.x);
+#else
+    const tbb::blocked_range2d<int> blockRange { 0, numBlocks.y, 0, numBlocks.x };
+    tbb::parallel_for(blockRange, [&](tbb::blocked_range2d<int> localRange) {
+        for (int by = std::begin(localRange.rows()); by != std::end(localRange.rows()) && !isCancelled(); by++)
+            renderBlockRow(by, std::begin(localRange.cols()), std::end(localRange.cols()));
+    });
+#endif
+    // The samples of a cancelled pass are incomplete, so start over.
+    if (isCancelled()) {
+        m_progressivePass = 0;
+        return false;
+    }
+
+    if (sample == 0) {
+#if PARALLELISM == 0
+        for (int y = 0; y < resolution.y; y++)
+            fillRow(y);
+#else
+        tbb::parallel_for(0, resolution.y, fillRow);
+#endif
+    }
+    m_progressivePass++;
+    return true;
+}
+
+// Projects points onto the image of a camera. The projection is derived from the rays that the camera generates, so
+// it works for any pinhole RayTraceCamera.
+class CameraProjection {
+public:
+    CameraProjection(const RayTraceCamera& camera, const glm::ivec2& resolution)
+        : m_position(camera.position())
+        , m_forward(glm::normalize(camera.generateRay(glm::vec2(0.0f)).direction))
+        , m_resolution(resolution)
+    {
+        // Offsets from the image center to the image edges, on the plane at distance 1 in front of the camera.
+        const auto planeOffset = [&](const glm::vec2& pixel) {
+            const glm::vec3 direction = camera.generateRay(pixel).direction;
+            return direction / glm::dot(direction, m_forward) - m_forward;
+        };
+        const glm::vec3 right = planeOffset(glm::vec2(1.0f, 0.0f));
+        const glm::vec3 up = planeOffset(glm::vec2(0.0f, 1.0f));
+        m_right = right / glm::dot(right, right);
+        m_up = up / glm::dot(up, up);
+    }
+
+    float depth(const glm::vec3& point) const { return glm::dot(point - m_position, m_forward); }
+    // Position in pixels (like the pixels that renderFrame traces) of a point in front of the camera (depth > 0).
+    glm::vec2 pixel(const glm::vec3& point, float depth) const
+    {
+        const glm::vec3 offset = (point - m_position) / depth - m_forward;
+        const glm::vec2 ndc { glm::dot(offset, m_right), glm::dot(offset, m_up) };
+        return (ndc + 1.0f) / 2.0f * glm::vec2(m_resolution);
+    }
+
+private:
+    glm::vec3 m_position, m_forward, m_right, m_up;
+    glm::vec2 m_resolution;
+};
+
+// Temporal reprojection: while the camera moves, most pixels show the same point of the volume as some pixel of the
+// previous frame. Every pixel keeps the point that represents its color (the first hit, the maximum, or the depth
+// weighted by opacity; see RayKernel), and the points of the previous frame are projected into the new view, where
+// the nearest point that lands on a pixel provides its color. Only the pixels that no point lands on (disocclusions
+// and the image borders) are traced, plus a rolling subset of one pixel per block of 4x4 pixels (in the order of
+// progressive refinement) so that every pixel is traced again at least once every 16 frames.
+template <typename TraceSample, typename IsCancelled>
+bool Renderer::renderReprojectedFrame(TraceSample&& traceSample, IsCancelled&& isCancelled)
+{
+    const glm::ivec2 resolution = m_config.renderResolution;
+    const size_t numPixels = m_frameBuffer.size();
+    std::swap(m_frameBuffer, m_previousFrameBuffer);
+    std::swap(m_samplePoints, m_previousSamplePoints);
+    m_frameBuffer.resize(numPixels);
+    m_samplePoints.resize(numPixels);
+
+    // The source pixel of every pixel, in the lower 32 bits, with the depth of its point in the upper 32 bits so that
+    // the nearest point wins (positive floats compare like their bits).
+    static constexpr uint64_t noSource = std::numeric_limits<uint64_t>::max();
+    if (m_reproject) {
+        if (m_reprojectionSources.size() != numPixels)
+            m_reprojectionSources = std::vector<std::atomic<uint64_t>>(numPixels);
+        const CameraProjection projection { *m_pCamera, resolution };
+        const auto clearSources = [&](size_t i) { m_reprojectionSources[i].store(noSource, std::memory_order_relaxed); };
+        const auto splat = [&](size_t source) {
+            const glm::vec4 point = m_previousSamplePoints[source];
+            const float depth = projection.depth(glm::vec3(point));
+            if (point.w == 0.0f || depth <= 0.0f)
+                return;
+            const glm::vec2 pixel = glm::round(projection.pixel(glm::vec3(point), depth));
+            if (pixel.x < 0.0f || pixel.y < 0.0f || pixel.x >= float(resolution.x) || pixel.y >= float(resolution.y))
+                return;
+            const uint64_t candidate = uint64_t(std::bit_cast<uint32_t>(depth)) << 32 | uint64_t(source);
+            std::atomic<uint64_t>& target = m_reprojectionSources[size_t(pixel.y) * size_t(resolution.x) + size_t(pixel.x)];
+            uint64_t current = target.load(std::memory_order_relaxed);
+            while (candidate < current && !target.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) { }
+        };
+#if PARALLELISM == 0
+        for (size_t i = 0; i < numPixels; i++)
+            clearSources(i);
+        for (size_t i = 0; i < numPixels; i++)
+            splat(i);
+#else
+        tbb::parallel_for(size_t(0), numPixels, clearSources);
+        tbb::parallel_for(size_t(0), numPixels, splat);
+#endif
+    }
+
+    const int refreshRank = m_reprojectedFrames++ % progressiveBlockPixels;
+    const auto renderRow = [&](int y) {
+        for (int x = 0; x < resolution.x; x++) {
+            const size_t index = size_t(y) * size_t(resolution.x) + size_t(x);
+            const int rank = progressiveRanks[size_t((y % progressiveBlockSize) * progressiveBlockSize + x % progressiveBlockSize)];
+            const uint64_t source = m_reproject ? m_reprojectionSources[index].load(std::memory_order_relaxed) : noSource;
+            if (source == noSource || rank == refreshRank) {
+                m_frameBuffer[index] = traceSample(glm::vec2(x, y), m_samplePoints[index]);
+            } else {
+                const size_t sourceIndex = size_t(source & 0xFFFFFFFF);
+                m_frameBuffer[index] = m_previousFrameBuffer[sourceIndex];
+                m_samplePoints[index] = m_previousSamplePoints[sourceIndex];
             }
-            case RenderMode::RenderComposite: {
-                color = traceRayComposite(ray, sampleStep);
-                break;
+        }
+    };
+#if PARALLELISM == 0
+    for (int y = 0; y < resolution.y && !isCancelled(); y++)
+        renderRow(y);
+#else
+    tbb::parallel_for(tbb::blocked_range<int>(0, resolution.y), [&](const tbb::blocked_range<int>& rows) {
+        for (int y = rows.begin(); y != rows.end() && !isCancelled(); y++)
+            renderRow(y);
+    });
+#endif
+    // The next frame can only reproject the points of a complete frame.
+    m_hasPreviousSamples = !isCancelled();
+    return m_hasPreviousSamples;
+}
+
+static constexpr glm::vec3 isoColor { 0.8f, 0.8f, 0.2f };
+
+// Iso surface rendering is split into a hit pass, which marches the rays and stores the hit of every pixel, and a
+// shade pass that computes the colors from the hits. The hits stay valid as long as the camera, the iso value and the
+// volume do not change (see render), so switching the shading model or editing the Gooch colors only runs the shade
+// pass. Shading needs hits that were refined by bisection and the gradients at the hits, which are sampled once when
+// shading is first enabled (hits without shading are not refined, like in traceRayISO).
+template <typename IsCancelled>
+bool Renderer::renderIsoFrame(IsCancelled&& isCancelled)
+{
+    using volume::InterpolationMode;
+    const glm::ivec2 resolution = m_config.renderResolution;
+    const size_t numPixels = m_frameBuffer.size();
+    const bool shading = m_config.volumeShading || m_config.goochShading;
+
+    if (!m_isoHitsValid || (shading && !m_isoHitsRefined)) {
+        using FindIsoSurface = bool (Renderer::*)(const Ray&, float, bool, float&, glm::vec3&) const;
+        static constexpr std::array<FindIsoSurface, 3> findIsoSurfaceKernels {
+            &Renderer::findIsoSurface<InterpolationMode::NearestNeighbour>,
+            &Renderer::findIsoSurface<InterpolationMode::Linear>,
+            &Renderer::findIsoSurface<InterpolationMode::Cubic>
+        };
+        const FindIsoSurface findHit = findIsoSurfaceKernels[size_t(m_pVolume->interpolationMode)];
+        static constexpr float sampleStep = 1.0f;
+        const Bounds bounds { glm::vec3(0.0f), glm::vec3(m_pVolume->dims() - glm::ivec3(1)) };
+
+        m_isoHits.resize(numPixels);
+        const auto hitRow = [&](int y) {
+            for (int x = 0; x < resolution.x; x++) {
+                const glm::vec2 pixelPos = glm::vec2(x, y) / glm::vec2(resolution);
+                Ray ray = m_pCamera->generateRay(pixelPos * 2.0f - 1.0f);
+                IsoHit& hit = m_isoHits[size_t(y) * size_t(resolution.x) + size_t(x)];
+                if (!instersectRayVolumeBounds(ray, bounds)) {
+                    hit.type = IsoHitType::MissedVolume;
+                    continue;
+                }
+                float t = ray.tmin;
+                hit.type = (this->*findHit)(ray, sampleStep, shading, t, hit.position) ? IsoHitType::Surface : IsoHitType::NoSurface;
             }
-            case RenderMode::RenderIso: {
-                color = traceRayISO(ray, sampleStep);
+        };
+#if PARALLELISM == 0
+        for (int y = 0; y < resolution.y && !isCancelled(); y++)
+            hitRow(y);
+#else
+        tbb::parallel_for(tbb::blocked_range<int>(0, resolution.y), [&](const tbb::blocked_range<int>& rows) {
+            for (int y = rows.begin(); y != rows.end() && !isCancelled(); y++)
+                hitRow(y);
+        });
+#endif
+        m_hasIsoHits = !isCancelled();
+        if (!m_hasIsoHits)
+            return false;
+        // Exact hits lie on the surface already.
+        m_isoHitsRefined = shading || (m_config.exactIsoSurface && m_pVolume->interpolationMode == InterpolationMode::Linear);
+        m_pIsoHitGradientVolume = nullptr;
+    }
+
+    // Sample the gradients at the hits (with the interpolation mode of the volume, like the ray kernels).
+    if (shading && m_pIsoHitGradientVolume != m_pGradientVolume) {
+        const auto sampleGradient = [&](size_t i) {
+            IsoHit& hit = m_isoHits[i];
+            if (hit.type != IsoHitType::Surface)
+                return;
+            switch (m_pVolume->interpolationMode) {
+            case InterpolationMode::NearestNeighbour:
+                hit.gradient = m_pGradientVolume->getGradientInterpolate<InterpolationMode::NearestNeighbour>(hit.position);
                 break;
-            }
-            case RenderMode::RenderTF2D: {
-                color = traceRayTF2D(ray, sampleStep);
+            case InterpolationMode::Linear:
+                hit.gradient = m_pGradientVolume->getGradientInterpolate<InterpolationMode::Linear>(hit.position);
                 break;
-            }
-            case RenderMode::RenderTFSecondDerivative: {
-                color = traceRayTFSecondDerivative(ray, sampleStep);
+            case InterpolationMode::Cubic:
+                hit.gradient = m_pGradientVolume->getGradientInterpolate<InterpolationMode::Cubic>(hit.position);
                 break;
             }
-            };
-            // Write the resulting color to the screen.
-            fillColor(x, y, color);
-
-#if PARALLELISM == 1
-        }
+        };
+#if PARALLELISM == 0
+        for (size_t i = 0; i < numPixels; i++)
+            sampleGradient(i);
+#else
+        tbb::parallel_for(size_t(0), numPixels, sampleGradient);
+#endif
+        m_pIsoHitGradientVolume = m_pGradientVolume;
     }
-});
+
+    const glm::vec3 cameraPosition = m_pCamera->position();
+    const auto shade = [&](size_t i) {
+        const IsoHit& hit = m_isoHits[i];
+        if (hit.type == IsoHitType::MissedVolume)
+            m_frameBuffer[i] = glm::vec4(0.0f);
+        else if (hit.type == IsoHitType::NoSurface)
+            m_frameBuffer[i] = glm::vec4(0, 0, 0, 1.0f);
+        else if (m_config.volumeShading)
+            m_frameBuffer[i] = glm::vec4(computePhongShading(isoColor, hit.gradient, cameraPosition, cameraPosition), 1.0f);
+        else if (m_config.goochShading)
+            m_frameBuffer[i] = glm::vec4(computeGoochShading(isoColor, hit.gradient, cameraPosition, cameraPosition), 1.0f);
+        else
+            m_frameBuffer[i] = glm::vec4(isoColor, 1.0f);
+    };
+#if PARALLELISM == 0
+    for (size_t i = 0; i < numPixels; i++)
+        shade(i);
 #else
-            }
-        }
+    tbb::parallel_for(size_t(0), numPixels, shade);
 #endif
+    return true;
 }
 
 // ======= DO NOT MODIFY THIS FUNCTION ========
@@ -160,15 +668,27 @@ glm::vec4 Renderer::traceRaySlice(const Ray& ray, const glm::vec3& volumeCenter,
 // The ray must be sampled with a distance defined by the sampleStep
 glm::vec4 Renderer::traceRayMIP(const Ray& ray, float sampleStep) const
 {
-    float maxVal = 0.0f;
+    float depth;
+    return (this->*selectRayKernel(RenderMode::RenderMIP))(ray, sampleStep, depth);
+}
 
-    // Incrementing samplePos directly instead of recomputing it each frame gives a measureable speed-up.
-    glm::vec3 samplePos = ray.origin + ray.tmin * ray.direction;
-    const glm::vec3 increment = sampleStep * ray.direction;
-    for (float t = ray.tmin; t <= ray.tmax; t += sampleStep, samplePos += increment) {
-        const float val = m_pVolume->getSampleInterpolate(samplePos);
-        maxVal = std::max(val, maxVal);
-    }
+template <volume::InterpolationMode interpolation>
+glm::vec4 Renderer::traceRayMIP(const Ray& ray, float sampleStep, float& depth) const
+{
+    float maxVal = 0.0f;
+    // The depth is that of the maximum.
+    depth = ray.tmin;
+
+    // Macro cells that cannot contain a value larger than what we have already seen can be skipped.
+    const auto isActive = [&](const volume::MacroCell& cell) { return float(cell.max) > maxVal; };
+    forEachSampleFrontToBack(ray, sampleStep, isActive, [&](float t, const glm::vec3& samplePos) {
+        const float val = m_pVolume->getSampleInterpolate<interpolation>(samplePos);
+        if (val > maxVal) {
+            maxVal = val;
+            depth = t;
+        }
+        return true;
+    });
 
     // Normalize the result to a range of [0 to mpVolume->maximum()].
     return glm::vec4(glm::vec3(maxVal) / m_pVolume->maximum(), 1.0f);
@@ -182,38 +702,211 @@ glm::vec4 Renderer::traceRayMIP(const Ray& ray, float sampleStep) const
 // Use the bisectionAccuracy function (to be implemented) to get a more precise isosurface location between two steps.
 glm::vec4 Renderer::traceRayISO(const Ray& ray, float sampleStep) const
 {
-    static constexpr glm::vec3 isoColor { 0.8f, 0.8f, 0.2f };
-    float isoValue = m_config.isoValue;
-    float phongShading = m_config.volumeShading;
-    float goochShading = m_config.goochShading;
-    float refined_t;
-    // Incrementing samplePos directly instead of recomputing it each frame gives a measureable speed-up.
-    glm::vec3 samplePos = ray.origin + ray.tmin * ray.direction;
-    const glm::vec3 increment = sampleStep * ray.direction;
-    bool check;
-    for (float t = ray.tmin; t <= ray.tmax; t += sampleStep, samplePos += increment) {
-        const float val = m_pVolume->getSampleInterpolate(samplePos);
-
-        if (val >= isoValue) {
-            if (phongShading) {
-                if (t!=ray.tmin)
-                    samplePos = ray.origin + ray.direction * bisectionAccuracy(ray, t - sampleStep, t, isoValue);
-                return glm::vec4(computePhongShading(isoColor, m_pGradientVolume->getGradientInterpolate(samplePos), m_pCamera->position(), m_pCamera->position()), 1.0f);
-            } 
-            else if (goochShading)
-            {
-                if (t != ray.tmin)
-                    samplePos = ray.origin + ray.direction * bisectionAccuracy(ray, t - sampleStep, t, isoValue);
-                return glm::vec4(computeGoochShading(isoColor, m_pGradientVolume->getGradientInterpolate(samplePos), m_pCamera->position(), m_pCamera->position()), 1.0f);
+    float depth;
+    return (this->*selectRayKernel(RenderMode::RenderIso))(ray, sampleStep, depth);
+}
+
+template <volume::InterpolationMode interpolation, Renderer::ShadingModel shading>
+glm::vec4 Renderer::traceRayISO(const Ray& ray, float sampleStep, float& depth) const
+{
+    // The depth is that of the hit.
+    depth = ray.tmin;
+    glm::vec3 position;
+    if (!findIsoSurface<interpolation>(ray, sampleStep, shading != ShadingModel::None, depth, position))
+        return glm::vec4(0, 0, 0, 1.0f);
+    if constexpr (shading == ShadingModel::None)
+        return glm::vec4(isoColor, 1.0f);
+
+    const volume::GradientVoxel gradient = m_pGradientVolume->getGradientInterpolate<interpolation>(position);
+    if constexpr (shading == ShadingModel::Phong)
+        return glm::vec4(computePhongShading(isoColor, gradient, m_pCamera->position(), m_pCamera->position()), 1.0f);
+    else
+        return glm::vec4(computeGoochShading(isoColor, gradient, m_pCamera->position(), m_pCamera->position()), 1.0f);
+}
+
+// Finds the first sample of the ray with a value of at least the iso value, and returns its distance along the ray
+// and its position. With refine, the hit is moved onto the iso surface by bisection (for shading). In exact mode the
+// hit is found without sampling (see findIsoSurfaceExact).
+template <volume::InterpolationMode interpolation>
+bool Renderer::findIsoSurface(const Ray& ray, float sampleStep, bool refine, float& t, glm::vec3& position) const
+{
+    if constexpr (interpolation == volume::InterpolationMode::Linear) {
+        if (m_config.exactIsoSurface)
+            return findIsoSurfaceExact(ray, t, position);
+    }
+
+    const float isoValue = m_config.isoValue;
+    bool hit = false;
+    // Only macro cells that contain a value of at least the iso value can produce a hit. Those are either crossed by
+    // the iso surface, or lie behind it so that their first sample is the hit.
+    const auto isActive = [&](const volume::MacroCell& cell) { return float(cell.max) >= isoValue; };
+    forEachSampleFrontToBack(ray, sampleStep, isActive, [&](float sampleT, const glm::vec3& samplePos) {
+        const float val = m_pVolume->getSampleInterpolate<interpolation>(samplePos);
+        if (val < isoValue)
+            return true;
+
+        hit = true;
+        t = sampleT;
+        position = samplePos;
+        if (refine && sampleT != ray.tmin) {
+            t = bisectionAccuracy(ray, sampleT - sampleStep, sampleT, isoValue);
+            position = ray.origin + ray.direction * t;
+        }
+        return false;
+    }, isoEmptySpaceDistances());
+    return hit;
+}
+
+// Finds the first root in [0, length] of the cubic polynomial g(s) = coefficients[0] + ... + coefficients[3] * s^3,
+// or the first point at which g is positive. The extrema of g split the interval into at most three parts in which g
+// is monotonic; the first part that ends at a non-negative value contains the root, which a few Newton steps (falling
+// back to bisection when they leave the bracket) find to well below the precision of the samples.
+static bool findFirstRoot(const std::array<float, 4>& coefficients, float length, float& s)
+{
+    const auto g = [&](float x) { return ((coefficients[3] * x + coefficients[2]) * x + coefficients[1]) * x + coefficients[0]; };
+    const auto derivative = [&](float x) { return (3.0f * coefficients[3] * x + 2.0f * coefficients[2]) * x + coefficients[1]; };
+    if (coefficients[0] >= 0.0f) {
+        s = 0.0f;
+        return true;
+    }
+
+    // Roots of the derivative 3 c3 s^2 + 2 c2 s + c1, computed in the numerically stable way.
+    std::array<float, 4> borders { 0.0f };
+    size_t numBorders = 1;
+    const float a = 3.0f * coefficients[3], b = 2.0f * coefficients[2], c = coefficients[1];
+    std::array<float, 2> extrema { -1.0f, -1.0f };
+    if (std::abs(a) < 1e-12f) {
+        if (b != 0.0f)
+            extrema[0] = -c / b;
+    } else if (const float discriminant = b * b - 4.0f * a * c; discriminant > 0.0f) {
+        const float q = -0.5f * (b + std::copysign(std::sqrt(discriminant), b));
+        extrema[0] = q / a;
+        extrema[1] = q != 0.0f ? c / q : -1.0f;
+        if (extrema[0] > extrema[1])
+            std::swap(extrema[0], extrema[1]);
+    }
+    for (const float extremum : extrema) {
+        if (extremum > 0.0f && extremum < length)
+            borders[numBorders++] = extremum;
+    }
+    borders[numBorders++] = length;
+
+    for (size_t i = 0; i + 1 < numBorders; i++) {
+        float lo = borders[i], hi = borders[i + 1];
+        const float gLo = g(lo), gHi = g(hi);
+        if (gHi < 0.0f)
+            continue;
+        // Start at the secant, then refine with Newton steps inside the bracket [lo, hi].
+        s = lo - gLo * (hi - lo) / (gHi - gLo);
+        for (int iteration = 0; iteration < 8; iteration++) {
+            const float value = g(s);
+            if (std::abs(value) < 1e-4f)
+                break;
+            (value < 0.0f ? lo : hi) = s;
+            const float slope = derivative(s);
+            const float next = slope != 0.0f ? s - value / slope : lo;
+            s = next > lo && next < hi ? next : 0.5f * (lo + hi);
+        }
+        return true;
+    }
+    return false;
+}
+
+// Intersects the ray exactly with the iso surface of the trilinearly interpolated volume instead of sampling it, so
+// that thin features are never missed and no bisection is needed (Marmitt et al., "Fast and Accurate Ray-Voxel
+// Intersection Techniques for Iso-Surface Ray Tracing"). The ray walks the voxel cells with a 3D-DDA; inside a cell
+// the interpolated value along the ray is a cubic polynomial in t, whose first root is the hit. Neighbouring cells
+// share four voxels, so every cell only fetches the other four. Macro cells that cannot produce a hit are skipped
+// like in findIsoSurface.
+bool Renderer::findIsoSurfaceExact(const Ray& ray, float& t, glm::vec3& position) const
+{
+    const float isoValue = m_config.isoValue;
+    const glm::ivec3 maxCell = m_pVolume->dims() - 2;
+    bool hit = false;
+    const auto intersectSegment = [&](float t0, float t1) {
+        glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor(ray.origin + t0 * ray.direction)), glm::ivec3(0), maxCell);
+        glm::ivec3 step;
+        glm::vec3 tNext, tDelta;
+        for (int axis = 0; axis < 3; axis++) {
+            if (ray.direction[axis] == 0.0f) {
+                step[axis] = 0;
+                tNext[axis] = tDelta[axis] = std::numeric_limits<float>::max();
+            } else {
+                step[axis] = ray.direction[axis] > 0.0f ? 1 : -1;
+                tNext[axis] = (float(cell[axis] + (step[axis] > 0 ? 1 : 0)) - ray.origin[axis]) / ray.direction[axis];
+                tDelta[axis] = 1.0f / std::abs(ray.direction[axis]);
             }
-            else
-            {
+        }
 
-                return glm::vec4(isoColor, 1.0f);
+        // Voxels at the corners of the cell; bit 0/1/2 of the index selects the upper corner along x/y/z.
+        std::array<float, 8> corners;
+        const auto fetch = [&](size_t corner) {
+            corners[corner] = m_pVolume->getVoxel(cell.x + int(corner & 1), cell.y + int((corner >> 1) & 1), cell.z + int(corner >> 2));
+        };
+        for (size_t corner = 0; corner < corners.size(); corner++)
+            fetch(corner);
+
+        float tIn = t0;
+        while (true) {
+            const int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+            const float tOut = std::min(tNext[axis], t1);
+            if (*std::max_element(std::begin(corners), std::end(corners)) >= isoValue) {
+                // Write the trilinear interpolant as v0 + v1 x + v2 y + v3 z + v4 xy + v5 xz + v6 yz + v7 xyz and
+                // substitute (x, y, z) = entry + s * direction.
+                const std::array<float, 8>& c = corners;
+                const float v0 = c[0] - isoValue, v1 = c[1] - c[0], v2 = c[2] - c[0], v3 = c[4] - c[0];
+                const float v4 = c[3] - c[1] - c[2] + c[0], v5 = c[5] - c[1] - c[4] + c[0], v6 = c[6] - c[2] - c[4] + c[0];
+                const float v7 = c[7] - c[3] - c[5] - c[6] + c[1] + c[2] + c[4] - c[0];
+                const glm::vec3 e = ray.origin + tIn * ray.direction - glm::vec3(cell);
+                const glm::vec3 d = ray.direction;
+                const std::array<float, 3> xy { e.x * e.y, e.x * d.y + d.x * e.y, d.x * d.y };
+                const std::array<float, 3> xz { e.x * e.z, e.x * d.z + d.x * e.z, d.x * d.z };
+                const std::array<float, 3> yz { e.y * e.z, e.y * d.z + d.y * e.z, d.y * d.z };
+                const std::array<float, 4> coefficients {
+                    v0 + v1 * e.x + v2 * e.y + v3 * e.z + v4 * xy[0] + v5 * xz[0] + v6 * yz[0] + v7 * xy[0] * e.z,
+                    v1 * d.x + v2 * d.y + v3 * d.z + v4 * xy[1] + v5 * xz[1] + v6 * yz[1] + v7 * (xy[0] * d.z + xy[1] * e.z),
+                    v4 * xy[2] + v5 * xz[2] + v6 * yz[2] + v7 * (xy[1] * d.z + xy[2] * e.z),
+                    v7 * xy[2] * d.z
+                };
+                float s;
+                if (findFirstRoot(coefficients, tOut - tIn, s)) {
+                    t = tIn + s;
+                    position = ray.origin + t * ray.direction;
+                    hit = true;
+                    return false;
+                }
+            }
+
+            if (tNext[axis] >= t1)
+                return true;
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] > maxCell[axis])
+                return true;
+            tIn = tNext[axis];
+            tNext[axis] += tDelta[axis];
+            // The face of the previous cell on the side of the step is the opposite face of the new cell.
+            const size_t bit = size_t(1) << axis;
+            for (size_t corner = 0; corner < corners.size(); corner++) {
+                if (corner & bit)
+                    continue;
+                if (step[axis] > 0) {
+                    corners[corner] = corners[corner | bit];
+                    fetch(corner | bit);
+                } else {
+                    corners[corner | bit] = corners[corner];
+                    fetch(corner);
+                }
             }
         }
+    };
+
+    if (useEmptySpaceSkipping()) {
+        const auto isActive = [&](const volume::MacroCell& cell) { return float(cell.max) >= isoValue; };
+        traverseMacroCells(ray, isActive, intersectSegment, isoEmptySpaceDistances());
+    } else {
+        intersectSegment(ray.tmin, ray.tmax);
     }
-    return glm::vec4(0, 0, 0, 1.0f);
+    return hit;
 }
 
 // ======= TODO: IMPLEMENT ========
@@ -355,28 +1048,37 @@ glm::vec3 Renderer::computeGoochShading(const glm::vec3& color, const volume::Gr
 // Use getTFValue to compute the color for a given volume value according to the 1D transfer function.
 glm::vec4 Renderer::traceRayComposite(const Ray& ray, float sampleStep) const
 {
-    glm::vec3 accColor = glm::vec3(0.0f);
-    float accAlpha = 0.0f;
-
-    // Incrementing samplePos directly instead of recomputing it each frame gives a measureable speed-up.
-    glm::vec3 samplePos = ray.origin + ray.tmax * ray.direction;
-    const glm::vec3 increment = sampleStep * ray.direction;
-
-    for (float t = ray.tmax; t > ray.tmin; t -= sampleStep, samplePos -= increment) {
-        const float val = m_pVolume->getSampleInterpolate(samplePos);
-        glm::vec4 tfValue = getTFValue(val);
-        volume::GradientVoxel gradient = m_pGradientVolume->getGradientInterpolate(samplePos);
-        glm::vec3 tfcolor = glm::vec3(tfValue.x, tfValue.y, tfValue.z);
-        float alpha = tfValue[3];
-        glm::vec3 phongColor = computePhongShading(tfcolor, gradient, m_pCamera->position(), m_pCamera->position());
-
-        // glm::vec4 phongValue = tfValue;
-        // glm::vec3 phongColor = computePhongShading(glm::vec3(tfValue[0], tfValue[1], tfValue[2]), m_pGradientVolume->getGradientInterpolate(samplePos), ray.direction, ray.direction) * tfValue[3];
+    float depth;
+    return (this->*selectRayKernel(RenderMode::RenderComposite))(ray, sampleStep, depth);
+}
 
-        // back to front compositing
-        accColor = tfcolor * alpha + (1 - alpha) * accColor;
+template <volume::InterpolationMode interpolation>
+glm::vec4 Renderer::traceRayComposite(const Ray& ray, float sampleStep, float& depth) const
+{
+    // Samples with zero opacity leave the accumulated color unchanged, so cells without any visible value are skipped.
+    const auto isActive = [&](const volume::MacroCell& cell) { return isTFRangeVisible(float(cell.min), float(cell.max)); };
+    if (!m_config.preintegratedTransferFunction) {
+        const glm::vec4 accColor = compositeFrontToBack(ray, sampleStep, isActive, [&](float, const glm::vec3& samplePos) {
+            return correctOpacity(getTFValue(m_pVolume->getSampleInterpolate<interpolation>(samplePos)), compositeSegmentLength());
+        }, depth);
+        return glm::vec4(glm::vec3(accColor), 1.0f);
     }
-    return glm::vec4(accColor, 1.0f);
+
+    // Every sample stands for the segment from the previous sample. After skipped samples the value one step in front
+    // is sampled again, and the first sample of the ray stands for a segment of constant value.
+    const size_t tfSize = m_config.tfColorMap.size();
+    float previousT = -std::numeric_limits<float>::infinity();
+    size_t frontIndex = 0;
+    const glm::vec4 accColor = compositeFrontToBack(ray, sampleStep, isActive, [&](float t, const glm::vec3& samplePos) {
+        const size_t backIndex = getTFIndex(m_pVolume->getSampleInterpolate<interpolation>(samplePos));
+        if (t - previousT > 1.5f * sampleStep)
+            frontIndex = t - sampleStep > ray.tmin ? getTFIndex(m_pVolume->getSampleInterpolate<interpolation>(samplePos - sampleStep * ray.direction)) : backIndex;
+        const glm::vec4 segment = m_preintegratedTF[frontIndex * tfSize + backIndex];
+        previousT = t;
+        frontIndex = backIndex;
+        return segment;
+    }, depth);
+    return glm::vec4(glm::vec3(accColor), 1.0f);
 }
 
 // ======= DO NOT MODIFY THIS FUNCTION ========
@@ -395,52 +1097,58 @@ glm::vec4 Renderer::getTFValue(float val) const
 // Use the getTF2DOpacity function that you implemented to compute the opacity according to the 2D transfer function.
 glm::vec4 Renderer::traceRayTF2D(const Ray& ray, float sampleStep) const
 {
-    glm::vec3 accColor = glm::vec3(0.0f);
-    float accAlpha = 0.0f;
+    float depth;
+    return (this->*selectRayKernel(RenderMode::RenderTF2D))(ray, sampleStep, depth);
+}
 
-    // Incrementing samplePos directly instead of recomputing it each frame gives a measureable speed-up.
-    glm::vec3 samplePos = ray.origin + ray.tmax * ray.direction;
-    const glm::vec3 increment = sampleStep * ray.direction;
-
-    for (float t = ray.tmax; t > ray.tmin; t -= sampleStep, samplePos -= increment) {
-        const float val = m_pVolume->getSampleInterpolate(samplePos);
-        glm::vec4 tfValue = m_config.TF2DColor;
-        glm::vec3 tfcolor = glm::vec3(tfValue.x, tfValue.y, tfValue.z);
-        float alpha;
-        volume::GradientVoxel gradient = m_pGradientVolume->getGradientInterpolate(samplePos);
-        alpha = getTF2DOpacity(val, gradient.magnitude);
-        accColor = tfcolor * alpha + (1 - alpha) * accColor;
-    }
-    return glm::vec4(accColor, 0.5f);
+template <volume::InterpolationMode interpolation>
+glm::vec4 Renderer::traceRayTF2D(const Ray& ray, float sampleStep, float& depth) const
+{
+    // The 2D transfer function is zero outside of the triangle, whose widest point (at the maximum gradient
+    // magnitude) spans [TF2DIntensity - halfWidth, TF2DIntensity + halfWidth].
+    const float gradientMax = m_pGradientVolume->maxMagnitude();
+    // A constant gradient magnitude gives no triangle (the division is 0 / 0), so then no cell is skipped.
+    const float gradientRange = gradientMax - m_pGradientVolume->minMagnitude();
+    const float halfWidth = gradientRange > 0.0f ? m_config.TF2DRadius / gradientRange * gradientMax : std::numeric_limits<float>::infinity();
+    const auto isActive = [&](const volume::MacroCell& cell) {
+        return float(cell.max) >= m_config.TF2DIntensity - halfWidth && float(cell.min) <= m_config.TF2DIntensity + halfWidth;
+    };
+    const glm::vec4 accColor = compositeFrontToBack(ray, sampleStep, isActive, [&](float, const glm::vec3& samplePos) {
+        const float val = m_pVolume->getSampleInterpolate<interpolation>(samplePos);
+        const volume::GradientVoxel gradient = m_pGradientVolume->getGradientInterpolate<interpolation>(samplePos);
+        return correctOpacity(glm::vec4(glm::vec3(m_config.TF2DColor), getTF2DOpacity(val, gradient.magnitude)), m_opacityCorrection);
+    }, depth);
+    return glm::vec4(glm::vec3(accColor), 0.5f);
 }
 
 glm::vec4 Renderer::traceRayTFSecondDerivative(const Ray& ray, float sampleStep) const
 {
-    glm::vec3 accColor = glm::vec3(0.0f);
-    float accAlpha = 0.0f;
-
-    // Incrementing samplePos directly instead of recomputing it each frame gives a measureable speed-up.
-    glm::vec3 samplePos = ray.origin + ray.tmax * ray.direction;
-    const glm::vec3 increment = sampleStep * ray.direction;
+    float depth;
+    return (this->*selectRayKernel(RenderMode::RenderTFSecondDerivative))(ray, sampleStep, depth);
+}
 
-    for (float t = ray.tmax; t > ray.tmin; t -= sampleStep, samplePos -= increment) {
-        const float val = m_pVolume->getSampleInterpolate(samplePos);
-        glm::vec4 tfValue1 = m_config.TFSecondDerivativeColor1;
-        glm::vec4 tfValue2 = m_config.TFSecondDerivativeColor2;
-        glm::vec3 tfcolor1 = glm::vec3(tfValue1.x, tfValue1.y, tfValue1.z);
-        glm::vec3 tfcolor2 = glm::vec3(tfValue2.x, tfValue2.y, tfValue2.z);
-        float alpha;
-        volume::SecondDerivativeVoxel secondDeriv = m_pSecondDerivativeVolume->getSecondDerivativeInterpolate(samplePos);
-        alpha = getTFSecondDerivativeOpacity(val, secondDeriv.magnitude);
+template <volume::InterpolationMode interpolation>
+glm::vec4 Renderer::traceRayTFSecondDerivative(const Ray& ray, float sampleStep, float& depth) const
+{
+    // Same reasoning as for the 2D transfer function but with the second derivative on the vertical axis.
+    const float secondDerivativeMax = m_pSecondDerivativeVolume->maxMagnitude();
+    const float secondDerivativeRange = secondDerivativeMax - m_pSecondDerivativeVolume->minMagnitude();
+    const float halfWidth = secondDerivativeRange > 0.0f ? m_config.TFSecondDerivativeRadius / secondDerivativeRange * secondDerivativeMax : std::numeric_limits<float>::infinity();
+    const auto isActive = [&](const volume::MacroCell& cell) {
+        return float(cell.max) >= m_config.TFSecondDerivativeIntensity - halfWidth && float(cell.min) <= m_config.TFSecondDerivativeIntensity + halfWidth;
+    };
+    const glm::vec4 accColor = compositeFrontToBack(ray, sampleStep, isActive, [&](float, const glm::vec3& samplePos) {
+        const float val = m_pVolume->getSampleInterpolate<interpolation>(samplePos);
+        const volume::SecondDerivativeVoxel secondDeriv = m_pSecondDerivativeVolume->getSecondDerivativeInterpolate<interpolation>(samplePos);
+        const float alpha = getTFSecondDerivativeOpacity(val, secondDeriv.magnitude);
 
         // distinguish different materials
-        if (alpha < m_config.TFSecondDerivativeThreshold) {
-            accColor = tfcolor1 * alpha + (1 - alpha) * accColor;
-        } else {
-            accColor = tfcolor2 * alpha + (1 - alpha) * accColor;
-        }
-    }
-    return glm::vec4(accColor, 0.5f);
+        if (alpha < m_config.TFSecondDerivativeThreshold)
+            return correctOpacity(glm::vec4(glm::vec3(m_config.TFSecondDerivativeColor1), alpha), m_opacityCorrection);
+        else
+            return correctOpacity(glm::vec4(glm::vec3(m_config.TFSecondDerivativeColor2), alpha), m_opacityCorrection);
+    }, depth);
+    return glm::vec4(glm::vec3(accColor), 0.5f);
 }
 
 // ======= TODO: IMPLEMENT ========
@@ -507,6 +1215,334 @@ float Renderer::getTFSecondDerivativeOpacity(float intensity, float secondDeriva
     return opacity;
 }
 
+// Ray marching kernels for one combination of interpolation mode and shading model, indexed by RenderMode.
+// The slicer does not march rays and has no entry.
+template <volume::InterpolationMode interpolation, Renderer::ShadingModel shading>
+constexpr auto Renderer::rayKernels() -> std::array<RayKernel, numRenderModes>
+{
+    return {
+        nullptr, // RenderSlicer
+        &Renderer::traceRayMIP<interpolation>,
+        &Renderer::traceRayISO<interpolation, shading>,
+        &Renderer::traceRayComposite<interpolation>,
+        &Renderer::traceRayTF2D<interpolation>,
+        &Renderer::traceRayTFSecondDerivative<interpolation>
+    };
+}
+
+// Returns the ray marching kernel that is specialized for the given render mode and the current interpolation mode
+// and shading model. The derived (gradient and second derivative) volumes are sampled with the interpolation mode
+// of the volume. The kernels contain no run-time mode checks, so this should be called once per frame and not
+// once per sample.
+Renderer::RayKernel Renderer::selectRayKernel(RenderMode renderMode) const
+{
+    using volume::InterpolationMode;
+    static constexpr std::array kernelTable {
+        rayKernels<InterpolationMode::NearestNeighbour, ShadingModel::None>(),
+        rayKernels<InterpolationMode::NearestNeighbour, ShadingModel::Phong>(),
+        rayKernels<InterpolationMode::NearestNeighbour, ShadingModel::Gooch>(),
+        rayKernels<InterpolationMode::Linear, ShadingModel::None>(),
+        rayKernels<InterpolationMode::Linear, ShadingModel::Phong>(),
+        rayKernels<InterpolationMode::Linear, ShadingModel::Gooch>(),
+        rayKernels<InterpolationMode::Cubic, ShadingModel::None>(),
+        rayKernels<InterpolationMode::Cubic, ShadingModel::Phong>(),
+        rayKernels<InterpolationMode::Cubic, ShadingModel::Gooch>()
+    };
+
+    // Phong shading takes precedence over Gooch shading.
+    const ShadingModel shading = m_config.volumeShading ? ShadingModel::Phong : (m_config.goochShading ? ShadingModel::Gooch : ShadingModel::None);
+    const size_t row = size_t(m_pVolume->interpolationMode) * numShadingModels + size_t(shading);
+    return kernelTable[row][size_t(renderMode)];
+}
+
+// Empty space skipping relies on the macro cell bounds, which do not hold for the (4x4x4 voxel) cubic kernel.
+bool Renderer::useEmptySpaceSkipping() const
+{
+    return m_config.emptySpaceSkipping && m_pVolume->interpolationMode != volume::InterpolationMode::Cubic;
+}
+
+// Computes the chessboard distance from every macro cell to the nearest cell with a value of at least the iso value
+// (at most 255 cells), so that the iso ray marcher can leap over the empty space around the surface. The cells with
+// such a value come from the span space index of the volume, which finds them without looking at the other cells.
+// The distances are kept until the iso value or the volume (level) changes.
+void Renderer::updateIsoEmptySpaceDistances()
+{
+    if (m_pIsoDistanceVolume == m_pVolume && m_isoDistanceValue == m_config.isoValue)
+        return;
+
+    const glm::ivec3 dims = m_pVolume->macroCells().dims();
+    m_isoEmptySpaceDistances.assign(m_pVolume->macroCells().cells().size(), 255);
+    m_pVolume->spanSpaceIndex().forEachCell(m_config.isoValue, std::numeric_limits<float>::infinity(), [&](uint32_t cell) { m_isoEmptySpaceDistances[cell] = 0; });
+
+    // Two-pass chamfer distance transform. With a distance of 1 to all 26 neighbours it computes the exact chessboard
+    // distance: the forward pass looks at the 13 neighbours that come earlier in x-major order, the backward pass at
+    // the other 13.
+    static constexpr std::array<glm::ivec3, 13> earlierNeighbours {
+        glm::ivec3(-1, -1, -1), glm::ivec3(0, -1, -1), glm::ivec3(1, -1, -1),
+        glm::ivec3(-1, 0, -1), glm::ivec3(0, 0, -1), glm::ivec3(1, 0, -1),
+        glm::ivec3(-1, 1, -1), glm::ivec3(0, 1, -1), glm::ivec3(1, 1, -1),
+        glm::ivec3(-1, -1, 0), glm::ivec3(0, -1, 0), glm::ivec3(1, -1, 0),
+        glm::ivec3(-1, 0, 0)
+    };
+    const auto index = [&](const glm::ivec3& cell) { return size_t(cell.x) + size_t(dims.x) * (size_t(cell.y) + size_t(dims.y) * size_t(cell.z)); };
+    const auto sweep = [&](int direction) {
+        for (int i = 0; i < dims.z; i++) {
+            for (int j = 0; j < dims.y; j++) {
+                for (int k = 0; k < dims.x; k++) {
+                    const glm::ivec3 cell = direction > 0 ? glm::ivec3(k, j, i) : dims - 1 - glm::ivec3(k, j, i);
+                    uint8_t& distance = m_isoEmptySpaceDistances[index(cell)];
+                    for (const glm::ivec3& offset : earlierNeighbours) {
+                        const glm::ivec3 neighbour = cell + direction * offset;
+                        if (glm::all(glm::greaterThanEqual(neighbour, glm::ivec3(0))) && glm::all(glm::lessThan(neighbour, dims)))
+                            distance = std::min(distance, uint8_t(std::min(m_isoEmptySpaceDistances[index(neighbour)] + 1, 255)));
+                    }
+                }
+            }
+        }
+    };
+    sweep(1);
+    sweep(-1);
+
+    m_pIsoDistanceVolume = m_pVolume;
+    m_isoDistanceValue = m_config.isoValue;
+    m_numIsoDistanceUpdates++;
+}
+
+size_t Renderer::numIsoDistanceUpdates() const
+{
+    return m_numIsoDistanceUpdates;
+}
+
+// The distances of updateIsoEmptySpaceDistances if they belong to the current volume (level) and iso value.
+gsl::span<const uint8_t> Renderer::isoEmptySpaceDistances() const
+{
+    if (m_pIsoDistanceVolume != m_pVolume || m_isoDistanceValue != m_config.isoValue)
+        return {};
+    return m_isoEmptySpaceDistances;
+}
+
+// Count the visible (non-zero opacity) entries of the 1D transfer function so that isTFRangeVisible()
+// can check any range of values in constant time.
+void Renderer::updateTFVisibility()
+{
+    m_tfVisiblePrefixSum[0] = 0;
+    for (size_t i = 0; i < m_config.tfColorMap.size(); i++)
+        m_tfVisiblePrefixSum[i + 1] = m_tfVisiblePrefixSum[i] + (m_config.tfColorMap[i].a > 0.0f ? 1 : 0);
+}
+
+// Returns whether any value in [minVal, maxVal] maps to a visible entry of the 1D transfer function.
+bool Renderer::isTFRangeVisible(float minVal, float maxVal) const
+{
+    return m_tfVisiblePrefixSum[getTFIndex(maxVal) + 1] - m_tfVisiblePrefixSum[getTFIndex(minVal)] > 0;
+}
+
+// Index of the entry of the 1D transfer function that getTFValue returns for the value (values below the color map
+// get the first entry).
+size_t Renderer::getTFIndex(float val) const
+{
+    const float range01 = std::max((val - m_config.tfColorMapIndexStart) / m_config.tfColorMapIndexRange, 0.0f);
+    return std::min(static_cast<size_t>(range01 * static_cast<float>(m_config.tfColorMap.size())), m_config.tfColorMap.size() - 1);
+}
+
+// The transfer functions give the opacity of one voxel (of level 0). A sample that stands for a longer part of the
+// ray, because the samples are further apart or lie on a coarser level, covers more material (opacity correction).
+glm::vec4 Renderer::correctOpacity(const glm::vec4& sample, float segmentLength)
+{
+    return segmentLength == 1.0f ? sample : glm::vec4(glm::vec3(sample), 1.0f - std::pow(1.0f - sample.a, segmentLength));
+}
+
+// Length of the part of the ray that a sample of composite mode stands for, in voxels of level 0. It follows the
+// configured step (the kernels may be called with other steps, whose samples then keep the same opacities).
+float Renderer::compositeSegmentLength() const
+{
+    return m_opacityCorrection * m_config.compositeSampleStep;
+}
+
+// Preintegrates the 1D transfer function for segments of the given length (in voxels of level 0) if the color map or
+// the length changed since the last call (Engel et al., "High-Quality Pre-Integrated Volume Rendering Using
+// Hardware-Accelerated Pixel Shading"). Entry [front * size + back] holds the (non-premultiplied) color and the
+// opacity of a segment along which the value runs linearly from the value of entry front to that of entry back. The
+// segment is split into one piece of equal length per entry that it passes through, and the pieces are composited
+// front-to-back. All segments that pass through the same number of entries share the opacities of their pieces, so
+// those are computed once per row of the parallel loop.
+void Renderer::updatePreintegratedTF(float segmentLength)
+{
+    if (m_preintegratedSegmentLength == segmentLength && m_preintegratedColorMap == m_config.tfColorMap)
+        return;
+    m_preintegratedSegmentLength = segmentLength;
+    m_preintegratedColorMap = m_config.tfColorMap;
+
+    const auto& colorMap = m_config.tfColorMap;
+    constexpr size_t size = std::tuple_size_v<decltype(RenderConfig::tfColorMap)>;
+    m_preintegratedTF.resize(size * size);
+    tbb::parallel_for(size_t(0), size, [&](size_t distance) {
+        std::array<float, size> pieceAlpha;
+        for (size_t i = 0; i < size; i++)
+            pieceAlpha[i] = 1.0f - std::pow(1.0f - colorMap[i].a, segmentLength / float(distance + 1));
+
+        const auto integrate = [&](size_t front, size_t back) {
+            const ptrdiff_t direction = back >= front ? 1 : -1;
+            glm::vec3 color { 0.0f };
+            float alpha = 0.0f;
+            for (size_t k = 0, i = front; k <= distance; k++, i = size_t(ptrdiff_t(i) + direction)) {
+                const float weight = (1.0f - alpha) * pieceAlpha[i];
+                color += weight * glm::vec3(colorMap[i]);
+                alpha += weight;
+            }
+            m_preintegratedTF[front * size + back] = glm::vec4(alpha > 0.0f ? color / alpha : glm::vec3(0.0f), alpha);
+        };
+        for (size_t front = 0; front + distance < size; front++) {
+            integrate(front, front + distance);
+            if (distance > 0)
+                integrate(front + distance, front);
+        }
+    });
+}
+
+// Walks the macro cells that the ray passes through between ray.tmin and ray.tmax using a 3D-DDA
+// (Amanatides & Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing"). Consecutive cells for which
+// isActive(cell) returns true are merged into one segment, and visitor(t0, t1) is called for every such
+// segment in front-to-back order. The traversal stops early when the visitor returns false.
+//
+// Optionally, distances gives for every cell the chessboard distance (in cells) to the nearest active cell. The
+// traversal then leaps over the cells around an inactive cell that are closer to it than that distance, instead of
+// visiting them one by one.
+template <typename IsActive, typename Visitor>
+void Renderer::traverseMacroCells(const Ray& ray, IsActive&& isActive, Visitor&& visitor, gsl::span<const uint8_t> distances) const
+{
+    const volume::MacroCellGrid& grid = m_pVolume->macroCells();
+    const float cellSize = float(grid.cellSize());
+    const glm::ivec3 gridDims = grid.dims();
+
+    const glm::vec3 entry = (ray.origin + ray.tmin * ray.direction) / cellSize;
+    glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor(entry)), glm::ivec3(0), gridDims - 1);
+    glm::ivec3 step;
+    // Distance along the ray to the next cell border and between two cell borders (per axis).
+    glm::vec3 tNext, tDelta;
+    for (int axis = 0; axis < 3; axis++) {
+        if (ray.direction[axis] == 0.0f) {
+            step[axis] = 0;
+            tNext[axis] = tDelta[axis] = std::numeric_limits<float>::max();
+        } else {
+            step[axis] = ray.direction[axis] > 0.0f ? 1 : -1;
+            const float border = float(cell[axis] + (step[axis] > 0 ? 1 : 0)) * cellSize;
+            tNext[axis] = (border - ray.origin[axis]) / ray.direction[axis];
+            tDelta[axis] = cellSize / std::abs(ray.direction[axis]);
+        }
+    }
+
+    float t = ray.tmin;
+    float segmentStart = 0.0f;
+    bool inSegment = false;
+    while (true) {
+        const bool active = isActive(grid.getCell(cell.x, cell.y, cell.z));
+        if (active && !inSegment) {
+            segmentStart = t;
+            inSegment = true;
+        } else if (!active && inSegment) {
+            inSegment = false;
+            if (!visitor(segmentStart, t))
+                return;
+        }
+
+        // All cells in the cube of the given radius around the current cell are inactive. The ray leaves the cube
+        // through the border that it reaches first, and crosses fewer borders of the other axes on the way.
+        const int leapRadius = active || distances.empty() ? 0 : int(distances[size_t(cell.x) + size_t(gridDims.x) * (size_t(cell.y) + size_t(gridDims.y) * size_t(cell.z))]) - 1;
+        if (leapRadius > 0) {
+            float tExit = std::numeric_limits<float>::max();
+            int exitAxis = 0;
+            for (int axis = 0; axis < 3; axis++) {
+                if (step[axis] != 0 && tNext[axis] + float(leapRadius) * tDelta[axis] < tExit) {
+                    tExit = tNext[axis] + float(leapRadius) * tDelta[axis];
+                    exitAxis = axis;
+                }
+            }
+            if (tExit >= ray.tmax)
+                break;
+            for (int axis = 0; axis < 3; axis++) {
+                if (step[axis] == 0 || tNext[axis] > tExit)
+                    continue;
+                const int numBorders = axis == exitAxis ? leapRadius + 1 : std::min(leapRadius, int((tExit - tNext[axis]) / tDelta[axis]) + 1);
+                cell[axis] += numBorders * step[axis];
+                tNext[axis] += float(numBorders) * tDelta[axis];
+            }
+            if (glm::any(glm::lessThan(cell, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(cell, gridDims)))
+                break;
+            t = std::max(t, tExit);
+            continue;
+        }
+
+        const int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+        if (tNext[axis] >= ray.tmax)
+            break;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= gridDims[axis])
+            break;
+        t = std::max(t, tNext[axis]);
+        tNext[axis] += tDelta[axis];
+    }
+    if (inSegment)
+        visitor(segmentStart, ray.tmax);
+}
+
+// Calls f(t, samplePos) for the samples t = ray.tmin + k * sampleStep (k = 0, 1, ...) up to ray.tmax, in that
+// order, skipping samples in macro cells for which isActive returns false. Marching stops when f returns false.
+// The optional distances speed up skipping (see traverseMacroCells).
+template <typename IsActive, typename F>
+void Renderer::forEachSampleFrontToBack(const Ray& ray, float sampleStep, IsActive&& isActive, F&& f, gsl::span<const uint8_t> distances) const
+{
+    // Index of the first sample that has not been visited yet.
+    int nextSample = 0;
+    const auto marchSegment = [&](float t0, float t1) {
+        int k = std::max(nextSample, static_cast<int>(std::ceil((t0 - ray.tmin) / sampleStep)));
+        float t = ray.tmin + float(k) * sampleStep;
+        // Incrementing samplePos directly instead of recomputing it each frame gives a measureable speed-up.
+        glm::vec3 samplePos = ray.origin + t * ray.direction;
+        const glm::vec3 increment = sampleStep * ray.direction;
+        for (; t <= t1; t += sampleStep, samplePos += increment, k++) {
+            if (!f(t, samplePos))
+                return false;
+        }
+        nextSample = k;
+        return true;
+    };
+
+    if (useEmptySpaceSkipping())
+        traverseMacroCells(ray, isActive, marchSegment, distances);
+    else
+        marchSegment(ray.tmin, ray.tmax);
+}
+
+// Composites the samples along the ray front-to-back and returns the accumulated (color, opacity). classify(t,
+// samplePos) returns the (non-premultiplied) color and the opacity of the step that the sample stands for (see
+// correctOpacity). The samples lie at t = ray.tmax - k * sampleStep (k = 0, 1, ...) down to (but excluding) ray.tmin,
+// which is where the original back-to-front compositing sampled the ray. Marching stops as soon as the accumulated
+// opacity reaches m_config.earlyRayTerminationThreshold; the samples behind that point could change the color by at
+// most (1 - threshold) per channel.
+// The depth is the average distance of the samples weighted by their contribution (tmin if nothing is visible).
+template <typename IsActive, typename Classify>
+glm::vec4 Renderer::compositeFrontToBack(const Ray& ray, float sampleStep, IsActive&& isActive, Classify&& classify, float& depth) const
+{
+    glm::vec3 accColor { 0.0f };
+    float accAlpha = 0.0f;
+    float accDepth = 0.0f;
+
+    Ray alignedRay = ray;
+    alignedRay.tmin = ray.tmax - std::floor((ray.tmax - ray.tmin) / sampleStep) * sampleStep;
+    if (alignedRay.tmin <= ray.tmin)
+        alignedRay.tmin += sampleStep;
+    forEachSampleFrontToBack(alignedRay, sampleStep, isActive, [&](float t, const glm::vec3& samplePos) {
+        const glm::vec4 sample = classify(t, samplePos);
+        const float weight = (1.0f - accAlpha) * sample.a;
+        accColor += weight * glm::vec3(sample);
+        accAlpha += weight;
+        accDepth += weight * t;
+        return accAlpha < m_config.earlyRayTerminationThreshold;
+    });
+    depth = accAlpha > 0.0f ? accDepth / accAlpha : ray.tmin;
+    return glm::vec4(accColor, accAlpha);
+}
+
 // This function computes if a ray intersects with the axis-aligned bounding box around the volume.
 // If the ray intersects then tmin/tmax are set to the distance at which the ray hits/exists the
 // volume and true is returned. If the ray misses the volume the the function returns false.
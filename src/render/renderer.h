@@ -1,10 +1,16 @@
 #pragma once
+#include "render/cancellation_token.h"
 #include "render/ray.h"
 #include "render/ray_trace_camera.h"
 #include "render/render_config.h"
 #include "volume/gradient_volume.h"
+#include "volume/macro_cell_grid.h"
 #include "volume/secondderivative_volume.h"
 #include "volume/volume.h"
+#include "volume/volume_pyramid.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <cstring> // memcmp
 #include <glm/mat4x4.hpp>
 #include <glm/vec2.hpp>
@@ -17,6 +23,9 @@
 
 namespace render {
 
+template <int width>
+struct RayPacket;
+
 union Bounds {
     struct {
         glm::vec3 lower;
@@ -36,9 +45,25 @@ public:
     );
 
     void setConfig(const RenderConfig& config);
-    void render();
+    void setCamera(const RayTraceCamera* pCamera);
+    // The derived volumes may be null as long as the render config does not need them (see needsGradientVolume).
+    void setGradientVolume(const volume::GradientVolume* pGradientVolume);
+    void setSecondDerivativeVolume(const volume::SecondDerivativeVolume* pSecondDerivativeVolume);
+    // Coarser levels of the volume for RenderConfig::levelOfDetail (may be null).
+    void setVolumePyramid(const volume::VolumePyramid* pVolumePyramid);
+    // Returns false if the frame was cancelled through the token, in which case the frame buffer is incomplete.
+    // With RenderConfig::progressiveRefinement, every call refines the image of the previous call instead (see
+    // renderProgressivePass).
+    bool render(const CancellationToken* pCancellationToken = nullptr);
     gsl::span<const glm::vec4> frameBuffer() const;
 
+    // Number of samples per pixel after which progressive refinement stops.
+    static constexpr int progressiveSamplesPerPixel = 16;
+    // Whether progressive refinement has finished the image, so that further calls to render() do not change it.
+    bool isConverged() const;
+    // How often the iso empty space distances were computed (see updateIsoEmptySpaceDistances).
+    size_t numIsoDistanceUpdates() const;
+
 protected:
     // These functions will be automatically tested.
     glm::vec4 traceRaySlice(const Ray& ray, const glm::vec3& volumeCenter, const glm::vec3& planeNormal) const;
@@ -47,20 +72,83 @@ protected:
     glm::vec4 traceRayComposite(const Ray& ray, float sampleStep) const;
     glm::vec4 traceRayTF2D(const Ray& ray, float sampleStep) const;
     glm::vec4 traceRayTFSecondDerivative(const Ray& ray, float sampleStep) const;
+    bool traceRayPacket(gsl::span<const Ray> rays, float sampleStep, gsl::span<glm::vec4> colors) const;
 
     float bisectionAccuracy(const Ray& ray, float t0, float t1, float isoValue) const;
+    bool findIsoSurfaceExact(const Ray& ray, float& t, glm::vec3& position) const;
 
     static glm::vec3 computePhongShading(const glm::vec3& color, const volume::GradientVoxel& gradient, const glm::vec3& lightDirection, const glm::vec3& viewDirection);
     glm::vec3 computeGoochShading(const glm::vec3& color, const volume::GradientVoxel& gradient, const glm::vec3& lightDirection, const glm::vec3& viewDirection) const;
 
 private:
+    enum class ShadingModel {
+        None = 0,
+        Phong,
+        Gooch
+    };
+    static constexpr size_t numShadingModels = 3;
+    static constexpr size_t numRenderModes = 6;
+    // Also returns the distance along the ray that best represents the pixel (see Renderer::renderReprojectedFrame).
+    using RayKernel = glm::vec4 (Renderer::*)(const Ray& ray, float sampleStep, float& depth) const;
+
+    RayKernel selectRayKernel(RenderMode renderMode) const;
+    int selectLevel() const;
+    bool renderFrame(const CancellationToken* pCancellationToken);
+    template <typename TracePixel, typename IsCancelled>
+    bool renderProgressivePass(TracePixel&& tracePixel, IsCancelled&& isCancelled);
+    template <typename TraceSample, typename IsCancelled>
+    bool renderReprojectedFrame(TraceSample&& traceSample, IsCancelled&& isCancelled);
+    template <typename IsCancelled>
+    bool renderIsoFrame(IsCancelled&& isCancelled);
+    template <volume::InterpolationMode interpolation, ShadingModel shading>
+    static constexpr auto rayKernels() -> std::array<RayKernel, numRenderModes>;
+
+    // Ray marching kernels specialized at compile time (see selectRayKernel).
+    template <volume::InterpolationMode interpolation>
+    glm::vec4 traceRayMIP(const Ray& ray, float sampleStep, float& depth) const;
+    template <volume::InterpolationMode interpolation, ShadingModel shading>
+    glm::vec4 traceRayISO(const Ray& ray, float sampleStep, float& depth) const;
+    template <volume::InterpolationMode interpolation>
+    bool findIsoSurface(const Ray& ray, float sampleStep, bool refine, float& t, glm::vec3& position) const;
+    template <volume::InterpolationMode interpolation>
+    glm::vec4 traceRayComposite(const Ray& ray, float sampleStep, float& depth) const;
+    template <volume::InterpolationMode interpolation>
+    glm::vec4 traceRayTF2D(const Ray& ray, float sampleStep, float& depth) const;
+    template <volume::InterpolationMode interpolation>
+    glm::vec4 traceRayTFSecondDerivative(const Ray& ray, float sampleStep, float& depth) const;
+
     void resizeImage(const glm::ivec2& resolution);
     void resetImage();
 
     glm::vec4 getTFValue(float val) const;
+    size_t getTFIndex(float val) const;
+    static glm::vec4 correctOpacity(const glm::vec4& sample, float segmentLength);
+    float compositeSegmentLength() const;
+    void updatePreintegratedTF(float segmentLength);
     float getTF2DOpacity(float val, float gradientMagnitude) const;
     float getTFSecondDerivativeOpacity(float val, float gradientMagnitude) const;
 
+    bool useEmptySpaceSkipping() const;
+    void updateTFVisibility();
+    bool isTFRangeVisible(float minVal, float maxVal) const;
+    void updateIsoEmptySpaceDistances();
+    gsl::span<const uint8_t> isoEmptySpaceDistances() const;
+    template <typename IsActive, typename Visitor>
+    void traverseMacroCells(const Ray& ray, IsActive&& isActive, Visitor&& visitor, gsl::span<const uint8_t> distances = {}) const;
+    template <typename IsActive, typename F>
+    void forEachSampleFrontToBack(const Ray& ray, float sampleStep, IsActive&& isActive, F&& f, gsl::span<const uint8_t> distances = {}) const;
+    template <typename IsActive, typename Classify>
+    glm::vec4 compositeFrontToBack(const Ray& ray, float sampleStep, IsActive&& isActive, Classify&& classify, float& depth) const;
+
+    // Ray packet tracing (see renderer_packet.cpp).
+    int rayPacketWidth() const;
+    template <int width>
+    bool traceRayPacket(gsl::span<const Ray> rays, float sampleStep, gsl::span<glm::vec4> colors) const;
+    template <int width, volume::InterpolationMode interpolation>
+    void traceRayPacketMIP(const RayPacket<width>& packet, float sampleStep, gsl::span<glm::vec4> colors) const;
+    template <int width, volume::InterpolationMode interpolation>
+    void traceRayPacketComposite(const RayPacket<width>& packet, float sampleStep, gsl::span<glm::vec4> colors) const;
+
     bool instersectRayVolumeBounds(Ray& ray, const Bounds& volumeBounds) const;
     void fillColor(int x, int y, const glm::vec4& color);
 
@@ -69,9 +157,83 @@ protected:
     const volume::GradientVolume* m_pGradientVolume;
     const volume::SecondDerivativeVolume* m_pSecondDerivativeVolume;
     const render::RayTraceCamera* m_pCamera;
+    const volume::VolumePyramid* m_pVolumePyramid { nullptr };
     RenderConfig m_config;
+    // Opacities are corrected for samples that are this many voxels (of level 0) apart (see selectLevel).
+    float m_opacityCorrection { 1.0f };
+
+    // Number of entries in m_config.tfColorMap[0, i) with a non-zero opacity.
+    std::array<int, std::tuple_size_v<decltype(RenderConfig::tfColorMap)> + 1> m_tfVisiblePrefixSum;
+    // Preintegrated 1D transfer function, and the color map and segment length that it was computed for (see
+    // updatePreintegratedTF).
+    std::vector<glm::vec4> m_preintegratedTF;
+    decltype(RenderConfig::tfColorMap) m_preintegratedColorMap {};
+    float m_preintegratedSegmentLength { 0.0f };
 
     std::vector<glm::vec4> m_frameBuffer;
+
+    // What an image depends on besides the voxels, to detect whether previous images can be reused. The camera is
+    // represented by its position and the directions of the rays through two corners.
+    struct ImageState {
+        RenderConfig config;
+        std::array<glm::vec3, 3> camera;
+        std::array<const void*, 3> derivedVolumes;
+        int level;
+        bool operator==(const ImageState&) const = default;
+    };
+
+    // Progressive refinement: the state that the passes so far were rendered for, and the sum of the samples of
+    // every pixel.
+    ImageState m_progressiveState {};
+    int m_progressivePass { 0 };
+    std::vector<glm::vec4> m_sampleSums;
+
+    // Temporal reprojection: the state of the previous frame, whether its colors and sample points can be reprojected
+    // into the current frame, and the pixel of the previous frame that provides each pixel (see renderReprojectedFrame).
+    ImageState m_previousState {};
+    bool m_hasPreviousSamples { false };
+    bool m_reproject { false };
+    int m_reprojectedFrames { 0 };
+    std::vector<glm::vec4> m_previousFrameBuffer;
+    std::vector<glm::vec4> m_samplePoints, m_previousSamplePoints;
+    std::vector<std::atomic<uint64_t>> m_reprojectionSources;
+
+    // Iso surface G-buffer: what the hits depend on, whether the hits of the previous frame are still valid, and the
+    // hit of every pixel (see renderIsoFrame).
+    struct IsoHitState {
+        std::array<glm::vec3, 3> camera;
+        glm::ivec2 resolution;
+        float isoValue;
+        bool exact;
+        volume::InterpolationMode interpolationMode;
+        int level;
+        const volume::Volume* pVolume;
+        bool operator==(const IsoHitState&) const = default;
+    };
+    enum class IsoHitType : uint8_t {
+        MissedVolume,
+        NoSurface,
+        Surface
+    };
+    struct IsoHit {
+        IsoHitType type;
+        glm::vec3 position;
+        volume::GradientVoxel gradient;
+    };
+    IsoHitState m_isoHitState {};
+    bool m_hasIsoHits { false };
+    bool m_isoHitsValid { false };
+    // Whether the hits were refined by bisection, and the gradient volume that the gradients were sampled from.
+    bool m_isoHitsRefined { false };
+    const volume::GradientVolume* m_pIsoHitGradientVolume { nullptr };
+    std::vector<IsoHit> m_isoHits;
+
+    // Per macro cell, the chessboard distance to the nearest cell that can produce an iso surface hit, for the volume
+    // (level) and iso value that it was computed for (see updateIsoEmptySpaceDistances).
+    const volume::Volume* m_pIsoDistanceVolume { nullptr };
+    float m_isoDistanceValue { 0.0f };
+    size_t m_numIsoDistanceUpdates { 0 };
+    std::vector<uint8_t> m_isoEmptySpaceDistances;
 };
 
 }
@@ -0,0 +1,291 @@
+// Ray packet tracing: marches `width` neighbouring rays together, one ray per SIMD lane. Every lane keeps its own
+// sample positions (the same ones the scalar marcher uses) and retires independently, so the result matches the
+// scalar path up to floating point rounding. Only MIP and 1D transfer function compositing with nearest neighbour or
+// trilinear interpolation are supported; everything else uses the scalar path.
+#include "renderer.h"
+#include "simd.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cmath>
+#include <glm/common.hpp>
+#include <limits>
+
+namespace render {
+
+// Packets in which less than this fraction of the lane-steps does useful work (because the rays have very
+// different lengths inside the volume) are traced with the scalar path instead.
+static constexpr float minPacketUtilization = 0.5f;
+
+#ifdef VOLVIS_SIMD_SSE2
+
+using simd::Float;
+using simd::Mask;
+
+// One scalar per lane, used to move data between the SIMD registers and scalar code.
+template <typename T, int width>
+using LaneArray = std::array<T, size_t(width)>;
+
+// Structure-of-arrays copy of width rays.
+template <int width>
+struct RayPacket {
+    std::array<Float<width>, 3> origin, direction;
+    Float<width> tmin, tmax;
+};
+
+template <int width>
+static Float<width> linearInterpolate(Float<width> g0, Float<width> g1, Float<width> factor)
+{
+    return g0 * (Float<width>(1.0f) - factor) + g1 * factor;
+}
+
+// Samples the volume at the given positions for the lanes in mask and returns 0 for the other lanes. Follows the
+// scalar Volume::getSampleNearestNeighbourInterpolation / getSampleTriLinearInterpolation (including the
+// interpolation order) so the results are identical. The voxels are gathered from the linear voxel array.
+template <int width, volume::InterpolationMode interpolation>
+static Float<width> sampleVolume(const volume::Volume& volume, const std::array<Float<width>, 3>& pos, Mask<width> mask)
+{
+    const glm::ivec3 dims = volume.dims();
+    const uint16_t* pVoxels = volume.data().data();
+    const size_t strideY = size_t(dims.x);
+    const size_t strideZ = size_t(dims.x) * size_t(dims.y);
+
+    if constexpr (interpolation == volume::InterpolationMode::NearestNeighbour) {
+        std::array<Float<width>, 3> rounded;
+        for (size_t axis = 0; axis < 3; axis++) {
+            rounded[axis] = pos[axis] + Float<width>(0.5f);
+            mask = mask & (rounded[axis] >= Float<width>(0.0f)) & (rounded[axis] < Float<width>(float(dims[int(axis)])));
+        }
+        const int bits = mask.bits();
+        if (bits == 0)
+            return 0.0f;
+
+        std::array<LaneArray<int, width>, 3> voxel;
+        for (size_t axis = 0; axis < 3; axis++)
+            simd::truncate(rounded[axis]).store(voxel[axis].data());
+        LaneArray<float, width> values {};
+        for (size_t lane = 0; lane < size_t(width); lane++) {
+            if (bits & (1 << lane))
+                values[lane] = float(pVoxels[size_t(voxel[0][lane]) + strideY * size_t(voxel[1][lane]) + strideZ * size_t(voxel[2][lane])]);
+        }
+        return Float<width>::load(values.data());
+    } else {
+        for (size_t axis = 0; axis < 3; axis++)
+            mask = mask & (pos[axis] >= Float<width>(0.0f)) & (pos[axis] < Float<width>(float(dims[int(axis)] - 1)));
+        const int bits = mask.bits();
+        if (bits == 0)
+            return 0.0f;
+
+        std::array<LaneArray<int, width>, 3> base;
+        std::array<Float<width>, 3> factor;
+        for (size_t axis = 0; axis < 3; axis++) {
+            const auto truncated = simd::truncate(pos[axis]);
+            truncated.store(base[axis].data());
+            factor[axis] = pos[axis] - simd::toFloat(truncated);
+        }
+
+        // Corners in the order (x, y, z) = 000, 100, 010, 110, 001, 101, 011, 111.
+        std::array<LaneArray<float, width>, 8> corners {};
+        for (size_t lane = 0; lane < size_t(width); lane++) {
+            if (!(bits & (1 << lane)))
+                continue;
+            const uint16_t* p = &pVoxels[size_t(base[0][lane]) + strideY * size_t(base[1][lane]) + strideZ * size_t(base[2][lane])];
+            corners[0][lane] = float(p[0]);
+            corners[1][lane] = float(p[1]);
+            corners[2][lane] = float(p[strideY]);
+            corners[3][lane] = float(p[strideY + 1]);
+            corners[4][lane] = float(p[strideZ]);
+            corners[5][lane] = float(p[strideZ + 1]);
+            corners[6][lane] = float(p[strideZ + strideY]);
+            corners[7][lane] = float(p[strideZ + strideY + 1]);
+        }
+        const auto corner = [&](int i) { return Float<width>::load(corners[size_t(i)].data()); };
+        const Float<width> c00 = linearInterpolate(corner(0), corner(1), factor[0]);
+        const Float<width> c10 = linearInterpolate(corner(2), corner(3), factor[0]);
+        const Float<width> c01 = linearInterpolate(corner(4), corner(5), factor[0]);
+        const Float<width> c11 = linearInterpolate(corner(6), corner(7), factor[0]);
+        const Float<width> c0 = linearInterpolate(c00, c10, factor[1]);
+        const Float<width> c1 = linearInterpolate(c01, c11, factor[1]);
+        return simd::select(mask, linearInterpolate(c0, c1, factor[2]), Float<width>(0.0f));
+    }
+}
+
+// Same as traceRayMIP but for a packet of rays.
+template <int width, volume::InterpolationMode interpolation>
+void Renderer::traceRayPacketMIP(const RayPacket<width>& packet, float sampleStep, gsl::span<glm::vec4> colors) const
+{
+    Float<width> t = packet.tmin;
+    std::array<Float<width>, 3> samplePos, increment;
+    for (size_t axis = 0; axis < 3; axis++) {
+        samplePos[axis] = packet.origin[axis] + t * packet.direction[axis];
+        increment[axis] = packet.direction[axis] * Float<width>(sampleStep);
+    }
+
+    Float<width> maxVal { 0.0f };
+    Mask<width> active = t <= packet.tmax;
+    while (active.bits()) {
+        const Float<width> val = sampleVolume<width, interpolation>(*m_pVolume, samplePos, active);
+        maxVal = simd::select(active, simd::max(val, maxVal), maxVal);
+
+        t = t + Float<width>(sampleStep);
+        for (size_t axis = 0; axis < 3; axis++)
+            samplePos[axis] = samplePos[axis] + increment[axis];
+        active = active & (t <= packet.tmax);
+    }
+
+    LaneArray<float, width> result;
+    (maxVal / Float<width>(m_pVolume->maximum())).store(result.data());
+    for (size_t lane = 0; lane < size_t(width); lane++)
+        colors[lane] = glm::vec4(glm::vec3(result[lane]), 1.0f);
+}
+
+// Same as traceRayComposite but for a packet of rays. Lanes retire once their opacity reaches the early ray
+// termination threshold; the packet is done when all lanes have retired or left the volume.
+template <int width, volume::InterpolationMode interpolation>
+void Renderer::traceRayPacketComposite(const RayPacket<width>& packet, float sampleStep, gsl::span<glm::vec4> colors) const
+{
+    const Float<width> step { sampleStep };
+
+    // Start at the first sample of the grid t = tmax - k * sampleStep that lies past tmin (see compositeFrontToBack).
+    LaneArray<float, width> laneTMin, laneTMax;
+    packet.tmin.store(laneTMin.data());
+    packet.tmax.store(laneTMax.data());
+    for (size_t lane = 0; lane < size_t(width); lane++) {
+        const float first = laneTMax[lane] - std::floor((laneTMax[lane] - laneTMin[lane]) / sampleStep) * sampleStep;
+        laneTMin[lane] = first <= laneTMin[lane] ? first + sampleStep : first;
+    }
+    Float<width> t = Float<width>::load(laneTMin.data());
+    std::array<Float<width>, 3> samplePos, increment;
+    for (size_t axis = 0; axis < 3; axis++) {
+        samplePos[axis] = packet.origin[axis] + t * packet.direction[axis];
+        increment[axis] = packet.direction[axis] * step;
+    }
+
+    const auto& tfColorMap = m_config.tfColorMap;
+    const Float<width> indexStart { m_config.tfColorMapIndexStart };
+    const Float<width> indexScale { float(tfColorMap.size()) / m_config.tfColorMapIndexRange };
+    const Float<width> threshold { m_config.earlyRayTerminationThreshold };
+
+    std::array<Float<width>, 3> accColor { Float<width>(0.0f), Float<width>(0.0f), Float<width>(0.0f) };
+    Float<width> accAlpha { 0.0f };
+    Mask<width> active = t <= packet.tmax;
+    while (active.bits()) {
+        const int activeBits = active.bits();
+        const Float<width> val = sampleVolume<width, interpolation>(*m_pVolume, samplePos, active);
+
+        // Transfer function lookup, same value to index mapping as getTFValue.
+        LaneArray<int, width> index;
+        simd::truncate(simd::max((val - indexStart) * indexScale, Float<width>(0.0f))).store(index.data());
+        std::array<LaneArray<float, width>, 4> tf {};
+        for (size_t lane = 0; lane < size_t(width); lane++) {
+            if (!(activeBits & (1 << lane)))
+                continue;
+            const glm::vec4& tfValue = tfColorMap[std::min(size_t(index[lane]), tfColorMap.size() - 1)];
+            for (size_t c = 0; c < 4; c++)
+                tf[c][lane] = tfValue[int(c)];
+        }
+
+        const Float<width> weight = (Float<width>(1.0f) - accAlpha) * Float<width>::load(tf[3].data());
+        for (size_t c = 0; c < 3; c++)
+            accColor[c] = accColor[c] + weight * Float<width>::load(tf[c].data());
+        accAlpha = accAlpha + weight;
+        active = active & (accAlpha < threshold);
+
+        t = t + step;
+        for (size_t axis = 0; axis < 3; axis++)
+            samplePos[axis] = samplePos[axis] + increment[axis];
+        active = active & (t <= packet.tmax);
+    }
+
+    std::array<LaneArray<float, width>, 3> result;
+    for (size_t c = 0; c < 3; c++)
+        accColor[c].store(result[c].data());
+    for (size_t lane = 0; lane < size_t(width); lane++)
+        colors[lane] = glm::vec4(result[0][lane], result[1][lane], result[2][lane], 1.0f);
+}
+
+template <int width>
+bool Renderer::traceRayPacket(gsl::span<const Ray> rays, float sampleStep, gsl::span<glm::vec4> colors) const
+{
+    std::array<LaneArray<float, width>, 3> origin, direction;
+    LaneArray<float, width> tmin, tmax;
+    float sumLength = 0.0f, maxLength = 0.0f;
+    for (size_t lane = 0; lane < size_t(width); lane++) {
+        const Ray& ray = rays[lane];
+        for (size_t axis = 0; axis < 3; axis++) {
+            origin[axis][lane] = ray.origin[int(axis)];
+            direction[axis][lane] = ray.direction[int(axis)];
+        }
+        tmin[lane] = ray.tmin;
+        tmax[lane] = ray.tmax;
+        sumLength += ray.tmax - ray.tmin;
+        maxLength = std::max(maxLength, ray.tmax - ray.tmin);
+    }
+    if (sumLength < minPacketUtilization * float(width) * maxLength)
+        return false;
+
+    RayPacket<width> packet;
+    for (size_t axis = 0; axis < 3; axis++) {
+        packet.origin[axis] = Float<width>::load(origin[axis].data());
+        packet.direction[axis] = Float<width>::load(direction[axis].data());
+    }
+    packet.tmin = Float<width>::load(tmin.data());
+    packet.tmax = Float<width>::load(tmax.data());
+
+    using volume::InterpolationMode;
+    const bool linear = m_pVolume->interpolationMode == InterpolationMode::Linear;
+    if (m_config.renderMode == RenderMode::RenderMIP) {
+        if (linear)
+            traceRayPacketMIP<width, InterpolationMode::Linear>(packet, sampleStep, colors);
+        else
+            traceRayPacketMIP<width, InterpolationMode::NearestNeighbour>(packet, sampleStep, colors);
+    } else {
+        if (linear)
+            traceRayPacketComposite<width, InterpolationMode::Linear>(packet, sampleStep, colors);
+        else
+            traceRayPacketComposite<width, InterpolationMode::NearestNeighbour>(packet, sampleStep, colors);
+    }
+    return true;
+}
+
+#endif
+
+// Returns the number of rays that are traced together for the current settings, or 1 if packet tracing is
+// disabled, not supported by this build or not supported for the current render mode / interpolation mode.
+// Packets also fall back to the scalar path when empty space skipping is enabled: neighbouring rays cross macro cell
+// borders at different steps, so a packet can rarely leap over a cell as a whole and the scalar DDA is faster.
+int Renderer::rayPacketWidth() const
+{
+    // The packets implement neither the opacity correction of coarser levels of detail and larger steps, nor the
+    // preintegrated transfer function.
+    const bool opacityCorrected = m_opacityCorrection != 1.0f || m_config.compositeSampleStep != 1.0f;
+    const bool supportedMode = m_config.renderMode == RenderMode::RenderMIP || (m_config.renderMode == RenderMode::RenderComposite && !opacityCorrected && !m_config.preintegratedTransferFunction);
+    const bool supportedInterpolation = m_pVolume->interpolationMode != volume::InterpolationMode::Cubic;
+    // The packets gather straight from the voxel array, which streamed volumes do not have.
+    const bool supportedVolume = !m_pVolume->brickCache();
+    if (!supportedMode || !supportedInterpolation || !supportedVolume || useEmptySpaceSkipping())
+        return 1;
+    if (m_config.rayPacketWidth >= 8 && simd::maxWidth >= 8)
+        return 8;
+    if (m_config.rayPacketWidth >= 4 && simd::maxWidth >= 4)
+        return 4;
+    return 1;
+}
+
+// Traces rays.size() (equal to rayPacketWidth()) rays that all intersect the volume as a packet and writes the
+// resulting colors. Returns false without writing anything if the rays are not coherent enough to be traced
+// together, in which case the caller should trace them one by one.
+bool Renderer::traceRayPacket(gsl::span<const Ray> rays, float sampleStep, gsl::span<glm::vec4> colors) const
+{
+#ifdef VOLVIS_SIMD_AVX2
+    if (rays.size() == 8)
+        return traceRayPacket<8>(rays, sampleStep, colors);
+#endif
+#ifdef VOLVIS_SIMD_SSE2
+    if (rays.size() == 4)
+        return traceRayPacket<4>(rays, sampleStep, colors);
+#endif
+    return false;
+}
+
+}
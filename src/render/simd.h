@@ -0,0 +1,161 @@
+#pragma once
+// Minimal wrappers around SSE2 (4 lanes) and AVX2 (8 lanes) registers for the ray packet tracer. SSE2 is part of
+// every x86-64 CPU; AVX2 is only used when the compiler targets it (see the VOLVIS_ENABLE_AVX2 CMake option).
+// Only the operations that the packet tracer needs are provided.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOLVIS_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define VOLVIS_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace render::simd {
+
+// Widest packet supported by this build (1 means that packet tracing is not available).
+#if defined(VOLVIS_SIMD_AVX2)
+inline constexpr int maxWidth = 8;
+#elif defined(VOLVIS_SIMD_SSE2)
+inline constexpr int maxWidth = 4;
+#else
+inline constexpr int maxWidth = 1;
+#endif
+
+template <int width>
+struct Float;
+template <int width>
+struct Mask;
+template <int width>
+struct Int;
+
+#ifdef VOLVIS_SIMD_SSE2
+template <>
+struct Float<4> {
+    __m128 v;
+
+    Float() = default;
+    Float(__m128 v_)
+        : v(v_)
+    {
+    }
+    Float(float f)
+        : v(_mm_set1_ps(f))
+    {
+    }
+    static Float load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+template <>
+struct Mask<4> {
+    __m128 v;
+
+    Mask(__m128 v_)
+        : v(v_)
+    {
+    }
+    // One bit per lane, lane i in bit i.
+    int bits() const { return _mm_movemask_ps(v); }
+    static Mask fromBits(int bits)
+    {
+        const __m128i laneBits = _mm_set_epi32(8, 4, 2, 1);
+        const __m128i set = _mm_and_si128(_mm_set1_epi32(bits), laneBits);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(set, laneBits));
+    }
+};
+
+template <>
+struct Int<4> {
+    __m128i v;
+
+    Int(__m128i v_)
+        : v(v_)
+    {
+    }
+    void store(int* p) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+};
+
+inline Float<4> operator+(Float<4> a, Float<4> b) { return _mm_add_ps(a.v, b.v); }
+inline Float<4> operator-(Float<4> a, Float<4> b) { return _mm_sub_ps(a.v, b.v); }
+inline Float<4> operator*(Float<4> a, Float<4> b) { return _mm_mul_ps(a.v, b.v); }
+inline Float<4> operator/(Float<4> a, Float<4> b) { return _mm_div_ps(a.v, b.v); }
+inline Float<4> min(Float<4> a, Float<4> b) { return _mm_min_ps(a.v, b.v); }
+inline Float<4> max(Float<4> a, Float<4> b) { return _mm_max_ps(a.v, b.v); }
+inline Mask<4> operator<(Float<4> a, Float<4> b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Mask<4> operator<=(Float<4> a, Float<4> b) { return _mm_cmple_ps(a.v, b.v); }
+inline Mask<4> operator>(Float<4> a, Float<4> b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Mask<4> operator>=(Float<4> a, Float<4> b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Mask<4> operator&(Mask<4> a, Mask<4> b) { return _mm_and_ps(a.v, b.v); }
+inline Mask<4> operator|(Mask<4> a, Mask<4> b) { return _mm_or_ps(a.v, b.v); }
+// Returns a where the mask is set and b elsewhere.
+inline Float<4> select(Mask<4> mask, Float<4> a, Float<4> b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+// Conversion with truncation towards zero (equal to flooring for non-negative values).
+inline Int<4> truncate(Float<4> a) { return _mm_cvttps_epi32(a.v); }
+inline Float<4> toFloat(Int<4> a) { return _mm_cvtepi32_ps(a.v); }
+#endif
+
+#ifdef VOLVIS_SIMD_AVX2
+template <>
+struct Float<8> {
+    __m256 v;
+
+    Float() = default;
+    Float(__m256 v_)
+        : v(v_)
+    {
+    }
+    Float(float f)
+        : v(_mm256_set1_ps(f))
+    {
+    }
+    static Float load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+template <>
+struct Mask<8> {
+    __m256 v;
+
+    Mask(__m256 v_)
+        : v(v_)
+    {
+    }
+    int bits() const { return _mm256_movemask_ps(v); }
+    static Mask fromBits(int bits)
+    {
+        const __m256i laneBits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+        const __m256i set = _mm256_and_si256(_mm256_set1_epi32(bits), laneBits);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, laneBits));
+    }
+};
+
+template <>
+struct Int<8> {
+    __m256i v;
+
+    Int(__m256i v_)
+        : v(v_)
+    {
+    }
+    void store(int* p) const { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+};
+
+inline Float<8> operator+(Float<8> a, Float<8> b) { return _mm256_add_ps(a.v, b.v); }
+inline Float<8> operator-(Float<8> a, Float<8> b) { return _mm256_sub_ps(a.v, b.v); }
+inline Float<8> operator*(Float<8> a, Float<8> b) { return _mm256_mul_ps(a.v, b.v); }
+inline Float<8> operator/(Float<8> a, Float<8> b) { return _mm256_div_ps(a.v, b.v); }
+inline Float<8> min(Float<8> a, Float<8> b) { return _mm256_min_ps(a.v, b.v); }
+inline Float<8> max(Float<8> a, Float<8> b) { return _mm256_max_ps(a.v, b.v); }
+inline Mask<8> operator<(Float<8> a, Float<8> b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline Mask<8> operator<=(Float<8> a, Float<8> b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline Mask<8> operator>(Float<8> a, Float<8> b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline Mask<8> operator>=(Float<8> a, Float<8> b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline Mask<8> operator&(Mask<8> a, Mask<8> b) { return _mm256_and_ps(a.v, b.v); }
+inline Mask<8> operator|(Mask<8> a, Mask<8> b) { return _mm256_or_ps(a.v, b.v); }
+inline Float<8> select(Mask<8> mask, Float<8> a, Float<8> b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline Int<8> truncate(Float<8> a) { return _mm256_cvttps_epi32(a.v); }
+inline Float<8> toFloat(Int<8> a) { return _mm256_cvtepi32_ps(a.v); }
+#endif
+
+}
@@ -1,5 +1,6 @@
 #include "menu.h"
 #include "render/renderer.h"
+#include "render/simd.h"
 #include <filesystem>
 #include <fmt/format.h>
 #include <imgui.h>
@@ -39,6 +40,11 @@ volume::InterpolationMode Menu::interpolationMode() const
     return m_interpolationMode;
 }
 
+volume::GradientStorage Menu::gradientStorage() const
+{
+    return m_gradientStorage;
+}
+
 void Menu::setBaseRenderResolution(const glm::ivec2& baseRenderResolution)
 {
     m_baseRenderResolution = baseRenderResolution;
@@ -46,27 +52,73 @@ void Menu::setBaseRenderResolution(const glm::ivec2& baseRenderResolution)
     callRenderConfigChangedCallback();
 }
 
+void Menu::setLevelOfDetailBias(int levelOfDetailBias)
+{
+    m_renderConfig.levelOfDetailBias = levelOfDetailBias;
+    callRenderConfigChangedCallback();
+}
+
 // This function handles a part of the volume loading where we create the widget histograms, set some config values
-//  and set the menu volume information
-void Menu::setLoadedVolume(const volume::Volume& volume, const volume::GradientVolume& gradientVolume, const volume::SecondDerivativeVolume& secondDerivativeVolume)
+//  and set the menu volume information. The widgets that need a derived volume are created in setDerivedVolumes.
+void Menu::setLoadedVolume(const volume::Volume& volume)
 {
     m_tfWidget = TransferFunctionWidget(volume);
-    m_tf2DWidget = TransferFunction2DWidget(volume, gradientVolume);
-    m_tfSecondDerivativeWidget = TransferFunctionSecondDerivativeWidget(volume, secondDerivativeVolume);
+    m_tf2DWidget.reset();
+    m_tfSecondDerivativeWidget.reset();
     m_goochWidget = GoochWidget();
 
     m_tfWidget->updateRenderConfig(m_renderConfig);
-    m_tf2DWidget->updateRenderConfig(m_renderConfig);
-    m_tfSecondDerivativeWidget->updateRenderConfig(m_renderConfig);
     m_goochWidget->updateRenderConfig(m_renderConfig);
 
     const glm::ivec3 dim = volume.dims();
     m_volumeInfo = fmt::format("Volume info:\n{}\nDimensions: ({}, {}, {})\nVoxel value range: {} - {}\n",
         volume.fileName(), dim.x, dim.y, dim.z, volume.minimum(), volume.maximum());
+    if (const volume::BrickCache* pBrickCache = volume.brickCache())
+        m_volumeInfo += fmt::format("Streamed from disk ({} MB cache)\n", pBrickCache->sizeInBytes() / (1024 * 1024));
     m_volumeMax = int(volume.maximum());
+    m_pVolume = &volume;
+    m_volumeStreamed = volume.brickCache() != nullptr;
+    m_pGradientVolume = nullptr;
+    m_pSecondDerivativeVolume = nullptr;
+    m_gradientVolumeRequested = false;
+    m_secondDerivativeVolumeRequested = false;
     m_volumeLoaded = true;
 }
 
+// Creates the transfer function widgets of the derived volumes once these become available, and removes them (waiting
+// for their histograms) when the volumes go away.
+void Menu::setDerivedVolumes(const volume::GradientVolume* pGradientVolume, const volume::SecondDerivativeVolume* pSecondDerivativeVolume)
+{
+    const auto renderConfigBefore = m_renderConfig;
+    if (!pGradientVolume)
+        m_tf2DWidget.reset();
+    if (!pSecondDerivativeVolume)
+        m_tfSecondDerivativeWidget.reset();
+    if (pGradientVolume && !m_pGradientVolume) {
+        m_tf2DWidget = TransferFunction2DWidget(*m_pVolume, *pGradientVolume);
+        m_tf2DWidget->updateRenderConfig(m_renderConfig);
+    }
+    if (pSecondDerivativeVolume && !m_pSecondDerivativeVolume) {
+        m_tfSecondDerivativeWidget = TransferFunctionSecondDerivativeWidget(*m_pVolume, *pSecondDerivativeVolume);
+        m_tfSecondDerivativeWidget->updateRenderConfig(m_renderConfig);
+    }
+    m_pGradientVolume = pGradientVolume;
+    m_pSecondDerivativeVolume = pSecondDerivativeVolume;
+
+    if (m_renderConfig != renderConfigBefore)
+        callRenderConfigChangedCallback();
+}
+
+bool Menu::needsGradientVolume() const
+{
+    return m_volumeLoaded && !m_volumeStreamed && (m_gradientVolumeRequested || render::needsGradientVolume(m_renderConfig));
+}
+
+bool Menu::needsSecondDerivativeVolume() const
+{
+    return m_volumeLoaded && !m_volumeStreamed && (m_secondDerivativeVolumeRequested || render::needsSecondDerivativeVolume(m_renderConfig));
+}
+
 // This function draws the menu
 void Menu::drawMenu(const glm::ivec2& pos, const glm::ivec2& size, std::chrono::duration<double> renderTime)
 {
@@ -104,7 +156,7 @@ void Menu::showLoadVolTab()
 
         if (ImGui::Button("Load volume")) {
             nfdchar_t* pOutPath = nullptr;
-            nfdresult_t result = NFD_OpenDialog("fld", nullptr, &pOutPath);
+            nfdresult_t result = NFD_OpenDialog("fld,vvb,vvc", nullptr, &pOutPath);
 
             if (result == NFD_OKAY) {
                 // Convert from char* to std::filesystem::path
@@ -114,6 +166,13 @@ void Menu::showLoadVolTab()
             }
         }
 
+        // Only used when the gradient volume is computed, so changes apply to the next loaded volume if it already exists.
+        int* pGradientStorageInt = reinterpret_cast<int*>(&m_gradientStorage);
+        ImGui::Text("Gradient storage:");
+        ImGui::RadioButton("Float (16 bytes/voxel)", pGradientStorageInt, int(volume::GradientStorage::Float));
+        ImGui::SameLine();
+        ImGui::RadioButton("Quantized (6 bytes/voxel)", pGradientStorageInt, int(volume::GradientStorage::Quantized));
+
         if (m_volumeLoaded)
             ImGui::Text("%s", m_volumeInfo.c_str());
 
@@ -129,6 +188,14 @@ void Menu::showRayCastTab(std::chrono::duration<double> renderTime)
         const std::string renderText = fmt::format("rendering time: {}ms\nrendering resolution: ({}, {})\n",
             std::chrono::duration_cast<std::chrono::milliseconds>(renderTime).count(), m_renderConfig.renderResolution.x, m_renderConfig.renderResolution.y);
         ImGui::Text("%s", renderText.c_str());
+        // Rendering is paused until the derived volumes that the current settings need have been computed.
+        // Streamed volumes never get them.
+        if (m_volumeStreamed && (render::needsGradientVolume(m_renderConfig) || render::needsSecondDerivativeVolume(m_renderConfig)))
+            ImGui::Text("These settings need gradients, which are not available for streamed volumes.");
+        if (!m_volumeStreamed && render::needsGradientVolume(m_renderConfig) && !m_pGradientVolume)
+            ImGui::Text("Computing gradient volume...");
+        if (!m_volumeStreamed && render::needsSecondDerivativeVolume(m_renderConfig) && !m_pSecondDerivativeVolume)
+            ImGui::Text("Computing second derivative volume...");
         ImGui::NewLine();
 
         int* pRenderModeInt = reinterpret_cast<int*>(&m_renderConfig.renderMode);
@@ -149,7 +216,34 @@ void Menu::showRayCastTab(std::chrono::duration<double> renderTime)
 
         ImGui::NewLine();
 
+        ImGui::Checkbox("Empty space skipping", &m_renderConfig.emptySpaceSkipping);
+        ImGui::Checkbox("Level of detail (volume pyramid)", &m_renderConfig.levelOfDetail);
+        ImGui::Checkbox("Progressive refinement", &m_renderConfig.progressiveRefinement);
+        ImGui::Checkbox("Temporal reprojection", &m_renderConfig.temporalReprojection);
+        ImGui::SliderFloat("Early ray termination", &m_renderConfig.earlyRayTerminationThreshold, 0.9f, 1.0f, "%.3f");
+        if constexpr (render::simd::maxWidth > 1) {
+            // The packets march every sample, so they are only used without empty space skipping.
+            ImGui::Text("Ray packets (MIP / Composite, no empty space skipping):");
+            ImGui::BeginDisabled(m_renderConfig.emptySpaceSkipping);
+            ImGui::RadioButton("Off", &m_renderConfig.rayPacketWidth, 1);
+            ImGui::SameLine();
+            ImGui::RadioButton("4 wide", &m_renderConfig.rayPacketWidth, 4);
+            if constexpr (render::simd::maxWidth >= 8) {
+                ImGui::SameLine();
+                ImGui::RadioButton("8 wide", &m_renderConfig.rayPacketWidth, 8);
+            }
+            ImGui::EndDisabled();
+        }
+
+        ImGui::NewLine();
+
         ImGui::DragFloat("Iso Value", &m_renderConfig.isoValue, 0.1f, 0.0f, float(m_volumeMax));
+        ImGui::Checkbox("Exact iso surface (linear interpolation)", &m_renderConfig.exactIsoSurface);
+
+        ImGui::NewLine();
+
+        ImGui::SliderFloat("Composite step size", &m_renderConfig.compositeSampleStep, 0.25f, 4.0f, "%.2f voxels");
+        ImGui::Checkbox("Preintegrated transfer function", &m_renderConfig.preintegratedTransferFunction);
 
         ImGui::NewLine();
 
@@ -182,8 +276,16 @@ void Menu::showTransFuncTab()
 void Menu::show2DTransFuncTab()
 {
     if (ImGui::BeginTabItem("2D transfer function")) {
-        m_tf2DWidget->draw();
-        m_tf2DWidget->updateRenderConfig(m_renderConfig);
+        if (m_tf2DWidget) {
+            m_tf2DWidget->draw();
+            m_tf2DWidget->updateRenderConfig(m_renderConfig);
+        } else if (m_volumeStreamed) {
+            ImGui::Text("Not available for streamed volumes.");
+        } else {
+            // The histogram needs the gradient volume.
+            m_gradientVolumeRequested = true;
+            ImGui::Text("Computing gradient volume...");
+        }
         ImGui::EndTabItem();
     }
 }
@@ -192,8 +294,16 @@ void Menu::show2DTransFuncTab()
 void Menu::showSecondDerivativeTab()
 {
     if (ImGui::BeginTabItem("2nd deriv transfer function")) {
-        m_tfSecondDerivativeWidget->draw();
-        m_tfSecondDerivativeWidget->updateRenderConfig(m_renderConfig);
+        if (m_tfSecondDerivativeWidget) {
+            m_tfSecondDerivativeWidget->draw();
+            m_tfSecondDerivativeWidget->updateRenderConfig(m_renderConfig);
+        } else if (m_volumeStreamed) {
+            ImGui::Text("Not available for streamed volumes.");
+        } else {
+            // The histogram needs the second derivative volume.
+            m_secondDerivativeVolumeRequested = true;
+            ImGui::Text("Computing second derivative volume...");
+        }
         ImGui::EndTabItem();
     }
 }
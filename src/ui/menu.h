@@ -32,9 +32,16 @@ public:
 
     render::RenderConfig renderConfig() const;
     volume::InterpolationMode interpolationMode() const;
+    volume::GradientStorage gradientStorage() const;
 
     void setBaseRenderResolution(const glm::ivec2& baseRenderResolution);
-    void setLoadedVolume(const volume::Volume& volume, const volume::GradientVolume& gradientVolume, const volume::SecondDerivativeVolume& secondDerivativeVolume);
+    void setLevelOfDetailBias(int levelOfDetailBias);
+    void setLoadedVolume(const volume::Volume& volume);
+    // The derived volumes are computed in the background; they are null until they are available.
+    void setDerivedVolumes(const volume::GradientVolume* pGradientVolume, const volume::SecondDerivativeVolume* pSecondDerivativeVolume);
+    // Whether the current render config or one of the (opened) transfer function widgets needs the derived volume.
+    bool needsGradientVolume() const;
+    bool needsSecondDerivativeVolume() const;
 
     void drawMenu(const glm::ivec2& pos, const glm::ivec2& size, std::chrono::duration<double> renderTime);
 
@@ -53,6 +60,13 @@ private:
     bool m_volumeLoaded = false;
     std::string m_volumeInfo;
     int m_volumeMax;
+    const volume::Volume* m_pVolume { nullptr };
+    // Streamed volumes have no derived volumes (those would not fit in memory either).
+    bool m_volumeStreamed { false };
+    const volume::GradientVolume* m_pGradientVolume { nullptr };
+    const volume::SecondDerivativeVolume* m_pSecondDerivativeVolume { nullptr };
+    bool m_gradientVolumeRequested { false };
+    bool m_secondDerivativeVolumeRequested { false };
 
     std::optional<TransferFunctionWidget> m_tfWidget;
     std::optional<TransferFunction2DWidget> m_tf2DWidget;
@@ -63,6 +77,7 @@ private:
     float m_resolutionScale { 1.0f };
     render::RenderConfig m_renderConfig {};
     volume::InterpolationMode m_interpolationMode { volume::InterpolationMode::NearestNeighbour };
+    volume::GradientStorage m_gradientStorage { volume::GradientStorage::Float };
 
     std::optional<LoadVolumeCallback> m_optLoadVolumeCallback;
     std::optional<RenderConfigChangedCallback> m_optRenderConfigChangedCallback;
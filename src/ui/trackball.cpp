@@ -106,6 +106,11 @@ render::Ray Trackball::generateRay(const glm::vec2& pixel) const
     return ray;
 }
 
+render::LookAtCamera Trackball::lookAtCamera() const
+{
+    return render::LookAtCamera { m_cameraPos, m_cameraPos + forward(), up(), m_fovy, m_aspectRatio };
+}
+
 // This function handles mouse button interaction, where the type of movement depends on
 //  the button pressed
 void Trackball::mouseButtonCallback(int button, int action, int /* mods */)
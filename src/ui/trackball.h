@@ -1,4 +1,5 @@
 #pragma once
+#include "render/look_at_camera.h"
 #include "render/ray.h"
 #include "render/ray_trace_camera.h"
 #include "ui/rasterization_camera.h"
@@ -31,6 +32,8 @@ public:
 
     // Generate ray given pixel in NDC space (-1 to +1)
     render::Ray generateRay(const glm::vec2& pixel) const override;
+    // Copy of the current view that generates the same rays, for rendering on another thread.
+    render::LookAtCamera lookAtCamera() const;
 
 private:
     void mouseButtonCallback(int button, int action, int mods);
@@ -35,7 +35,8 @@ TransferFunctionWidget::TransferFunctionWidget(const volume::Volume& volume)
     m_tfPoints.push_back(TFPoint { glm::vec2(0.7f, 0.03f), glm::vec3(0.7f) });
     m_tfPoints.push_back(TFPoint { glm::vec2(1.0f), glm::vec3(1.0f) });
 
-    const auto histogram = volume.histogram();
+    // One bin per pixel at most, which also keeps the texture within the size limits for 16-bit volumes.
+    const auto histogram = volume.binnedHistogram(widgetSize.x);
     const auto imgData = createHistogramImage(histogram, histogramOpacity);
 
     glBindTexture(GL_TEXTURE_2D, m_histogramImg);
@@ -1,6 +1,9 @@
 #include "transfer_func_secondderivative.h"
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <filesystem>
 #include <glm/common.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -11,14 +14,15 @@
 
 static ImVec2 glmToIm(const glm::vec2& v);
 static glm::vec2 ImToGlm(const ImVec2& v);
-static std::vector<glm::vec4> createHistogramImage(
-    const volume::Volume& volume, const volume::SecondDerivativeVolume& secondDerivative, const glm::ivec2& res);
+static std::vector<uint8_t> createHistogramImage(const volume::Histogram2D& histogram);
 
 namespace ui {
 
 // Radius of the three points in the histogram image.
 static constexpr float pointRadius = 8.0f;
 static constexpr glm::ivec2 widgetSize { 475, 300 };
+// Upper bound on the number of histogram bins along the voxel value and magnitude axes.
+static constexpr glm::ivec2 maxHistogramBins { 512, 256 };
 
 TransferFunctionSecondDerivativeWidget::TransferFunctionSecondDerivativeWidget(const volume::Volume& volume, const volume::SecondDerivativeVolume& secondDerivative)
     : m_intensity(206.0f)
@@ -30,8 +34,9 @@ TransferFunctionSecondDerivativeWidget::TransferFunctionSecondDerivativeWidget(c
     , m_interactingPoint(-1)
     , m_histogramImg(0)
 {
-    const glm::ivec2 res = glm::ivec2(volume.maximum(), secondDerivative.maxMagnitude()+1);
-    const auto imgData = createHistogramImage(volume, secondDerivative, res);
+    // At most one bin per voxel value and per unit of magnitude.
+    const glm::ivec2 numBins = glm::min(glm::ivec2(int(volume.maximum()) + 1, int(secondDerivative.maxMagnitude()) + 1), maxHistogramBins);
+    m_histogram = std::async(std::launch::async, [&volume, &secondDerivative, numBins]() { return volume::computeHistogram2D(volume, secondDerivative, numBins); });
 
     glGenTextures(1, &m_histogramImg);
     glBindTexture(GL_TEXTURE_2D, m_histogramImg);
@@ -39,14 +44,33 @@ TransferFunctionSecondDerivativeWidget::TransferFunctionSecondDerivativeWidget(c
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Single channel texture that is shown as white with the count as opacity.
+    const std::array<GLint, 4> swizzle { GL_ONE, GL_ONE, GL_ONE, GL_RED };
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Upload the histogram once the background task has finished.
+void TransferFunctionSecondDerivativeWidget::updateHistogramImage()
+{
+    if (!m_histogram.valid() || m_histogram.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+
+    const volume::Histogram2D histogram = m_histogram.get();
+    const auto imgData = createHistogramImage(histogram);
     glBindTexture(GL_TEXTURE_2D, m_histogramImg);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, res.x, res.y, 0, GL_RGBA, GL_FLOAT, imgData.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, histogram.numBins.x, histogram.numBins.y, 0, GL_RED, GL_UNSIGNED_BYTE, imgData.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_histogramReady = true;
 }
 
 // Draw the widget and handle interactions
 void TransferFunctionSecondDerivativeWidget::draw()
 {
     const ImGuiIO& io = ImGui::GetIO();
+    updateHistogramImage();
 
     ImGui::Text("Second Derivative Transfer Function");
     ImGui::Text("Click and drag points to alter the m_radius or m_intensity");
@@ -86,7 +110,14 @@ void TransferFunctionSecondDerivativeWidget::draw()
     // https://en.cppreference.com/w/cpp/language/reinterpret_cast
     ImTextureID imguiTexture;
     std::memcpy(&imguiTexture, &m_histogramImg, sizeof(m_histogramImg));
-    ImGui::Image(imguiTexture, glmToIm(canvasSize - glm::vec2(1)));
+    if (m_histogramReady) {
+        ImGui::Image(imguiTexture, glmToIm(canvasSize - glm::vec2(1)));
+    } else {
+        ImGui::Dummy(glmToIm(canvasSize - glm::vec2(1)));
+        const char* placeholder = "Computing histogram...";
+        const glm::vec2 textSize = ImToGlm(ImGui::CalcTextSize(placeholder));
+        drawList->AddText(glmToIm(canvasPos + (canvasSize - textSize) / 2.0f), ImColor(180, 180, 180, 255), placeholder);
+    }
 
     // Detect and handle mouse interaction.
     if (!io.MouseDown[0] && !io.MouseDown[1]) {
@@ -226,30 +257,17 @@ static glm::vec2 ImToGlm(const ImVec2& v)
     return glm::vec2(v.x, v.y);
 }
 
-// Compute a histogram texture from the volume and 2nd deriv data
-static std::vector<glm::vec4> createHistogramImage(
-    const volume::Volume& volume, const volume::SecondDerivativeVolume& secondDerivative, const glm::ivec2& res)
+// Logarithmically scaled counts, with the highest magnitudes in the first row (the top of the widget).
+static std::vector<uint8_t> createHistogramImage(const volume::Histogram2D& histogram)
 {
-    const size_t numPixels = static_cast<size_t>(res.x * res.y);
-    std::vector<int> bins(numPixels, 0);
-    for (int z = 0; z < volume.dims().z; z++) {
-        for (int y = 0; y < volume.dims().y; y++) {
-            for (int x = 0; x < volume.dims().x; x++) {
-                const size_t imgX = static_cast<size_t>(volume.getVoxel(x, y, z));
-                const size_t imgY = static_cast<size_t>(res.y - 1) - static_cast<size_t>(secondDerivative.getSecondDerivative(x, y, z).magnitude);
-                const size_t index = imgX + imgY * static_cast<size_t>(res.x);
-                bins[index]++;
-            }
+    const glm::ivec2 numBins = histogram.numBins;
+    const float factor = 255.0f / std::log(1.0f + float(histogram.maxCount));
+    std::vector<uint8_t> imageData(histogram.counts.size());
+    for (int y = 0; y < numBins.y; y++) {
+        for (int x = 0; x < numBins.x; x++) {
+            const int count = histogram.counts[size_t(x) + size_t(numBins.x) * size_t(y)];
+            imageData[size_t(x) + size_t(numBins.x) * size_t(numBins.y - 1 - y)] = uint8_t(std::log(1.0f + float(count)) * factor);
         }
     }
-
-    const int maxCount = *std::max_element(std::begin(bins), std::end(bins));
-    const float factor = 1.0f / std::log(float(maxCount));
-
-    std::vector<glm::vec4> imageData(numPixels, glm::vec4(0.0f));
-    std::transform(std::begin(bins), std::end(bins), std::begin(imageData),
-        [&](int count) {
-            return glm::vec4(1.0f, 1.0f, 1.0f, std::log(float(count)) * factor);
-        });
     return imageData;
 }
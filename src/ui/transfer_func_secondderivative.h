@@ -1,8 +1,10 @@
 #pragma once
 #include "render/render_config.h"
 #include "volume/secondderivative_volume.h"
+#include "volume/histogram_2d.h"
 #include "volume/volume.h"
 #include <GL/glew.h> // Include before glfw3
+#include <future>
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
 
@@ -16,6 +18,8 @@ public:
     void updateRenderConfig(render::RenderConfig& renderConfig);
 
 private:
+    void updateHistogramImage();
+
     float m_intensity, m_maxIntensity;
     float m_radius;
     float m_threshold;
@@ -24,5 +28,8 @@ private:
 
     int m_interactingPoint;
     GLuint m_histogramImg;
+    // The histogram is computed in the background; the widget shows a placeholder until it is uploaded.
+    std::future<volume::Histogram2D> m_histogram;
+    bool m_histogramReady { false };
 };
 }
@@ -0,0 +1,458 @@
+#include "brick_cache.h"
+#include "volume.h"
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <iostream>
+#include <ostream>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace volume {
+
+template <typename T>
+static bool readSection(std::ifstream& ifs, uint64_t offset, std::vector<T>& out)
+{
+    ifs.seekg(std::streamoff(offset));
+    ifs.read(reinterpret_cast<char*>(out.data()), std::streamsize(out.size() * sizeof(T)));
+    return bool(ifs);
+}
+
+template <typename T>
+static void writeSection(std::ostream& stream, gsl::span<const T> data)
+{
+    stream.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size() * sizeof(T)));
+}
+
+static glm::ivec3 toIVec3(const std::array<int32_t, 3>& v)
+{
+    return { v[0], v[1], v[2] };
+}
+
+static size_t numVoxels(const glm::ivec3& dim)
+{
+    return size_t(dim.x) * size_t(dim.y) * size_t(dim.z);
+}
+
+bool isBrickedVolumeFile(const std::filesystem::path& file)
+{
+    std::ifstream ifs(file, std::ios::binary);
+    std::array<char, 8> magic {};
+    ifs.read(magic.data(), std::streamsize(magic.size()));
+    return ifs && magic == BrickFileHeader::expectedMagic;
+}
+
+// Averages blocks of factor^3 voxels; blocks at the border only average the voxels inside the volume.
+static std::vector<uint16_t> downsampleBlocks(gsl::span<const uint16_t> voxels, const glm::ivec3& dim, int factor, const glm::ivec3& outDim)
+{
+    std::vector<uint16_t> out(numVoxels(outDim));
+    tbb::parallel_for(tbb::blocked_range<int>(0, outDim.z), [&](const tbb::blocked_range<int>& range) {
+        for (int z = std::begin(range); z != std::end(range); z++) {
+            for (int y = 0; y < outDim.y; y++) {
+                for (int x = 0; x < outDim.x; x++) {
+                    const glm::ivec3 lower = glm::ivec3(x, y, z) * factor;
+                    const glm::ivec3 upper = glm::min(lower + factor, dim);
+                    uint64_t sum = 0;
+                    for (int vz = lower.z; vz < upper.z; vz++) {
+                        for (int vy = lower.y; vy < upper.y; vy++) {
+                            const uint16_t* pRow = &voxels[size_t(dim.x) * (size_t(vy) + size_t(dim.y) * size_t(vz))];
+                            for (int vx = lower.x; vx < upper.x; vx++)
+                                sum += pRow[vx];
+                        }
+                    }
+                    const uint64_t count = numVoxels(upper - lower);
+                    out[size_t(x) + size_t(outDim.x) * (size_t(y) + size_t(outDim.y) * size_t(z))] = uint16_t((sum + count / 2) / count);
+                }
+            }
+        }
+    });
+    return out;
+}
+
+bool writeBrickedVolume(const Volume& volume, const std::filesystem::path& file, int brickSize, int coarseSize)
+{
+    std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+    if (!ofs) {
+        std::cerr << "Could not open " << file << " for writing" << std::endl;
+        return false;
+    }
+    if (!writeBrickedVolume(volume, ofs, brickSize, coarseSize)) {
+        std::cerr << "Could not write " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool writeBrickedVolume(const Volume& volume, std::ostream& stream, int brickSize, int coarseSize)
+{
+    const gsl::span<const uint16_t> voxels = volume.data();
+    if (voxels.empty()) {
+        std::cerr << "Cannot write an empty (or streamed) volume as bricks" << std::endl;
+        return false;
+    }
+    const glm::ivec3 dim = volume.dims();
+    const glm::ivec3 brickGridDim = (dim + brickSize - 1) / brickSize;
+    int coarseFactor = 1;
+    while (glm::compMax((dim + coarseFactor - 1) / coarseFactor) > coarseSize)
+        coarseFactor *= 2;
+    const glm::ivec3 coarseDim = (dim + coarseFactor - 1) / coarseFactor;
+
+    std::vector<int32_t> histogram;
+    for (const int count : volume.histogram())
+        histogram.push_back(int32_t(count));
+    const MacroCellGrid brickBounds { voxels, dim, brickSize };
+    const std::vector<uint16_t> coarseVoxels = downsampleBlocks(voxels, dim, coarseFactor, coarseDim);
+
+    BrickFileHeader header {};
+    header.magic = BrickFileHeader::expectedMagic;
+    header.version = BrickFileHeader::expectedVersion;
+    header.brickSize = uint32_t(brickSize);
+    header.dim = { dim.x, dim.y, dim.z };
+    header.brickGridDim = { brickGridDim.x, brickGridDim.y, brickGridDim.z };
+    header.coarseDim = { coarseDim.x, coarseDim.y, coarseDim.z };
+    header.coarseFactor = uint32_t(coarseFactor);
+    header.minimum = uint16_t(volume.minimum());
+    header.maximum = uint16_t(volume.maximum());
+    header.histogramOffset = sizeof(BrickFileHeader);
+    header.brickBoundsOffset = header.histogramOffset + histogram.size() * sizeof(int32_t);
+    header.coarseOffset = header.brickBoundsOffset + brickBounds.cells().size() * sizeof(MacroCell);
+    header.bricksOffset = header.coarseOffset + coarseVoxels.size() * sizeof(uint16_t);
+
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeSection<int32_t>(stream, histogram);
+    writeSection<MacroCell>(stream, brickBounds.cells());
+    writeSection<uint16_t>(stream, coarseVoxels);
+
+    // Gather one row of bricks at a time.
+    const int stride = brickSize + 1;
+    const size_t brickVoxels = size_t(stride) * size_t(stride) * size_t(stride);
+    std::vector<uint16_t> row(size_t(brickGridDim.x) * brickVoxels);
+    for (int bz = 0; bz < brickGridDim.z; bz++) {
+        for (int by = 0; by < brickGridDim.y; by++) {
+            tbb::parallel_for(tbb::blocked_range<int>(0, brickGridDim.x), [&](const tbb::blocked_range<int>& range) {
+                for (int bx = std::begin(range); bx != std::end(range); bx++) {
+                    const glm::ivec3 origin = glm::ivec3(bx, by, bz) * brickSize;
+                    uint16_t* pOut = &row[size_t(bx) * brickVoxels];
+                    for (int z = 0; z < stride; z++) {
+                        const int vz = std::min(origin.z + z, dim.z - 1);
+                        for (int y = 0; y < stride; y++) {
+                            const int vy = std::min(origin.y + y, dim.y - 1);
+                            const uint16_t* pRow = &voxels[size_t(dim.x) * (size_t(vy) + size_t(dim.y) * size_t(vz))];
+                            for (int x = 0; x < stride; x++)
+                                *pOut++ = pRow[std::min(origin.x + x, dim.x - 1)];
+                        }
+                    }
+                }
+            });
+            writeSection<uint16_t>(stream, row);
+        }
+    }
+    return bool(stream);
+}
+
+BrickCache::BrickCache(const std::filesystem::path& file, size_t cacheSize, uint64_t fileOffset, int numIOThreads)
+    : m_file(file)
+    , m_fileOffset(fileOffset)
+{
+    std::ifstream ifs(file, std::ios::binary);
+    ifs.seekg(std::streamoff(fileOffset));
+    ifs.read(reinterpret_cast<char*>(&m_header), sizeof(m_header));
+    if (!ifs || m_header.magic != BrickFileHeader::expectedMagic || m_header.version != BrickFileHeader::expectedVersion) {
+        std::cerr << "File " << file << " is not a bricked volume (of version " << BrickFileHeader::expectedVersion << ")" << std::endl;
+        return;
+    }
+
+    m_dim = toIVec3(m_header.dim);
+    m_brickGridDim = toIVec3(m_header.brickGridDim);
+    m_brickSize = int(m_header.brickSize);
+    m_brickStride = m_brickSize + 1;
+    m_brickVoxels = size_t(m_brickStride) * size_t(m_brickStride) * size_t(m_brickStride);
+    m_coarseDim = toIVec3(m_header.coarseDim);
+    m_coarseFactor = float(m_header.coarseFactor);
+
+    const size_t numBricks = numVoxels(m_brickGridDim);
+    std::vector<MacroCell> brickBounds(numBricks);
+    m_coarseVoxels.resize(numVoxels(m_coarseDim));
+    if (!readSection(ifs, m_fileOffset + m_header.brickBoundsOffset, brickBounds) || !readSection(ifs, m_fileOffset + m_header.coarseOffset, m_coarseVoxels)) {
+        std::cerr << "File " << file << " is smaller than its header claims" << std::endl;
+        return;
+    }
+    m_brickBounds = MacroCellGrid(std::move(brickBounds), m_brickGridDim, m_brickSize);
+
+    m_numSlots = std::clamp(cacheSize / (m_brickVoxels * sizeof(uint16_t)), size_t(1), numBricks);
+    m_slots.resize(m_numSlots * m_brickVoxels);
+    m_slotOfBrick.resize(numBricks, -1);
+    m_brickOfSlot.resize(m_numSlots, noBrick);
+    for (size_t slot = m_numSlots; slot-- > 0;)
+        m_freeSlots.push_back(slot);
+    m_lastUsed = std::vector<std::atomic<uint32_t>>(numBricks);
+    m_requested = std::vector<std::atomic<uint8_t>>(numBricks);
+    // Loaded bricks wait outside of the cache until the next frame; limit how many so that they cannot exceed it.
+    m_maxLoadedBricks = std::min(m_numSlots, size_t(256));
+    m_isOpen = true;
+
+    for (int i = 0; i < numIOThreads; i++)
+        m_ioThreads.emplace_back([this]() { ioThreadLoop(); });
+}
+
+BrickCache::~BrickCache()
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_stop = true;
+    }
+    m_requestAdded.notify_all();
+    for (std::thread& thread : m_ioThreads)
+        thread.join();
+}
+
+bool BrickCache::isOpen() const
+{
+    return m_isOpen;
+}
+
+const BrickFileHeader& BrickCache::header() const
+{
+    return m_header;
+}
+
+glm::ivec3 BrickCache::dims() const
+{
+    return m_dim;
+}
+
+std::vector<int> BrickCache::readHistogram() const
+{
+    std::ifstream ifs(m_file, std::ios::binary);
+    std::vector<int32_t> histogram(size_t(m_header.maximum) + 1);
+    if (!readSection(ifs, m_fileOffset + m_header.histogramOffset, histogram))
+        std::cerr << "Could not read the histogram of " << m_file << std::endl;
+    return { std::begin(histogram), std::end(histogram) };
+}
+
+// Minimum/maximum per brick; conservative in the same way as Volume::macroCells().
+const MacroCellGrid& BrickCache::brickBounds() const
+{
+    return m_brickBounds;
+}
+
+size_t BrickCache::sizeInBytes() const
+{
+    const size_t numBricks = m_slotOfBrick.size();
+    return m_slots.size() * sizeof(uint16_t) + m_coarseVoxels.size() * sizeof(uint16_t)
+        + numBricks * (sizeof(MacroCell) + sizeof(int32_t) + sizeof(uint32_t) + sizeof(uint8_t)) + m_numSlots * sizeof(size_t);
+}
+
+size_t BrickCache::brickIndex(const glm::ivec3& brick) const
+{
+    return size_t(brick.x) + size_t(m_brickGridDim.x) * (size_t(brick.y) + size_t(m_brickGridDim.y) * size_t(brick.z));
+}
+
+// Returns the voxels of the brick if it is in the cache (and marks it as used in this frame), or nullptr otherwise.
+const uint16_t* BrickCache::residentBrick(size_t brick) const
+{
+    const int32_t slot = m_slotOfBrick[brick];
+    if (slot < 0)
+        return nullptr;
+    // Only write if needed, so that threads sampling the same brick do not keep invalidating each others cache line.
+    if (m_lastUsed[brick].load(std::memory_order_relaxed) != m_frame)
+        m_lastUsed[brick].store(m_frame, std::memory_order_relaxed);
+    return &m_slots[size_t(slot) * m_brickVoxels];
+}
+
+float BrickCache::getVoxel(int x, int y, int z) const
+{
+    const glm::ivec3 voxel { x, y, z };
+    const glm::ivec3 brick = voxel / m_brickSize;
+    const size_t index = brickIndex(brick);
+    const uint16_t* pBrick = residentBrick(index);
+    if (!pBrick)
+        return getMissingSample(index, glm::vec3(voxel));
+
+    const glm::ivec3 local = voxel - brick * m_brickSize;
+    return float(pBrick[size_t(local.x) + size_t(m_brickStride) * (size_t(local.y) + size_t(m_brickStride) * size_t(local.z))]);
+}
+
+// Same interpolation order as Volume::getSampleTriLinearInterpolation, so a resident brick gives identical results.
+float BrickCache::getSampleTriLinear(const glm::vec3& coord) const
+{
+    const glm::ivec3 base { coord };
+    const glm::ivec3 brick = base / m_brickSize;
+    const size_t index = brickIndex(brick);
+    const uint16_t* pBrick = residentBrick(index);
+    if (!pBrick)
+        return getMissingSample(index, coord);
+
+    const glm::ivec3 local = base - brick * m_brickSize;
+    const glm::vec3 factor = coord - glm::vec3(base);
+    const size_t strideY = size_t(m_brickStride), strideZ = strideY * strideY;
+    const uint16_t* p = pBrick + size_t(local.x) + strideY * size_t(local.y) + strideZ * size_t(local.z);
+    const auto lerp = [](float g0, float g1, float f) { return g0 * (1 - f) + g1 * f; };
+    const auto biLinear = [&](const uint16_t* pSlice) {
+        const float c0 = lerp(float(pSlice[0]), float(pSlice[1]), factor.x);
+        const float c1 = lerp(float(pSlice[strideY]), float(pSlice[strideY + 1]), factor.x);
+        return lerp(c0, c1, factor.y);
+    };
+    return lerp(biLinear(p), biLinear(p + strideZ), factor.z);
+}
+
+// Constant bricks are never loaded since their bounds already give the value. Other bricks are requested and the
+// sample is taken from the coarse copy (trilinear, clamped to its border) until the brick is in the cache.
+float BrickCache::getMissingSample(size_t brick, const glm::vec3& coord) const
+{
+    const MacroCell& bounds = m_brickBounds.cells()[brick];
+    if (bounds.min == bounds.max)
+        return float(bounds.min);
+    request(brick);
+
+    // Voxel i of the coarse copy is the average of the voxels [i * factor, (i + 1) * factor).
+    const glm::vec3 coarseCoord = glm::clamp((coord - 0.5f * (m_coarseFactor - 1.0f)) / m_coarseFactor, glm::vec3(0.0f), glm::vec3(m_coarseDim - 1));
+    const glm::ivec3 base { coarseCoord };
+    const glm::ivec3 next = glm::min(base + 1, m_coarseDim - 1);
+    const glm::vec3 factor = coarseCoord - glm::vec3(base);
+    const auto voxel = [&](int x, int y, int z) {
+        return float(m_coarseVoxels[size_t(x) + size_t(m_coarseDim.x) * (size_t(y) + size_t(m_coarseDim.y) * size_t(z))]);
+    };
+    const auto lerp = [](float g0, float g1, float f) { return g0 * (1 - f) + g1 * f; };
+    const auto biLinear = [&](int z) {
+        return lerp(lerp(voxel(base.x, base.y, z), voxel(next.x, base.y, z), factor.x), lerp(voxel(base.x, next.y, z), voxel(next.x, next.y, z), factor.x), factor.y);
+    };
+    return lerp(biLinear(base.z), biLinear(next.z), factor.z);
+}
+
+// Distance of the center of the brick along the view direction of the latest frame.
+float BrickCache::depth(size_t brick) const
+{
+    const size_t x = brick % size_t(m_brickGridDim.x);
+    const size_t y = (brick / size_t(m_brickGridDim.x)) % size_t(m_brickGridDim.y);
+    const size_t z = brick / (size_t(m_brickGridDim.x) * size_t(m_brickGridDim.y));
+    const glm::vec3 center = (glm::vec3(x, y, z) + 0.5f) * float(m_brickSize);
+    return glm::dot(center - m_viewPosition, m_viewDirection);
+}
+
+// Queues the brick for the I/O threads, unless it was already requested.
+void BrickCache::request(size_t brick) const
+{
+    if (m_requested[brick].load(std::memory_order_relaxed) || m_requested[brick].exchange(1))
+        return;
+    m_numPending++;
+    {
+        std::lock_guard lock { m_mutex };
+        m_requests.push({ depth(brick), brick });
+    }
+    m_requestAdded.notify_one();
+}
+
+void BrickCache::ioThreadLoop()
+{
+    std::ifstream ifs(m_file, std::ios::binary);
+    std::unique_lock lock { m_mutex };
+    while (true) {
+        m_requestAdded.wait(lock, [&]() { return m_stop || (!m_requests.empty() && m_loadedBricks.size() + m_numLoading < m_maxLoadedBricks); });
+        if (m_stop)
+            return;
+        LoadedBrick loadedBrick { m_requests.top().second, {} };
+        m_requests.pop();
+        m_numLoading++;
+        lock.unlock();
+
+        loadedBrick.voxels.resize(m_brickVoxels);
+        if (!readSection(ifs, m_fileOffset + m_header.bricksOffset + loadedBrick.brick * m_brickVoxels * sizeof(uint16_t), loadedBrick.voxels)) {
+            std::cerr << "Could not read brick " << loadedBrick.brick << " of " << m_file << std::endl;
+            ifs.clear();
+        }
+
+        lock.lock();
+        m_numLoading--;
+        m_loadedBricks.push_back(std::move(loadedBrick));
+        m_brickLoaded.notify_all();
+    }
+}
+
+void BrickCache::beginFrame(const glm::vec3& viewPosition, const glm::vec3& viewDirection)
+{
+    std::vector<LoadedBrick> loadedBricks;
+    {
+        std::lock_guard lock { m_mutex };
+        loadedBricks.swap(m_loadedBricks);
+        m_viewPosition = viewPosition;
+        m_viewDirection = viewDirection;
+        RequestQueue requests;
+        for (; !m_requests.empty(); m_requests.pop())
+            requests.push({ depth(m_requests.top().second), m_requests.top().second });
+        m_requests.swap(requests);
+    }
+    // There is room for more loaded bricks again.
+    m_requestAdded.notify_all();
+    m_frame++;
+
+    // Make room by evicting the least recently used bricks (free slots hold no brick and are not candidates).
+    std::vector<size_t> evictedSlots;
+    if (loadedBricks.size() > m_freeSlots.size()) {
+        for (size_t slot = 0; slot < m_numSlots; slot++) {
+            if (m_brickOfSlot[slot] != noBrick)
+                evictedSlots.push_back(slot);
+        }
+        const auto lastUsed = [&](size_t slot) { return m_lastUsed[m_brickOfSlot[slot]].load(std::memory_order_relaxed); };
+        const auto evictedEnd = std::begin(evictedSlots) + std::ptrdiff_t(loadedBricks.size() - m_freeSlots.size());
+        std::nth_element(std::begin(evictedSlots), evictedEnd, std::end(evictedSlots), [&](size_t lhs, size_t rhs) { return lastUsed(lhs) < lastUsed(rhs); });
+        evictedSlots.erase(evictedEnd, std::end(evictedSlots));
+        for (const size_t slot : evictedSlots) {
+            const size_t brick = m_brickOfSlot[slot];
+            m_slotOfBrick[brick] = -1;
+            m_requested[brick] = 0;
+            m_brickOfSlot[slot] = noBrick;
+            m_freeSlots.push_back(slot);
+        }
+    }
+
+    for (const LoadedBrick& loadedBrick : loadedBricks) {
+        const size_t slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        std::copy(std::begin(loadedBrick.voxels), std::end(loadedBrick.voxels), &m_slots[slot * m_brickVoxels]);
+        m_slotOfBrick[loadedBrick.brick] = int32_t(slot);
+        m_brickOfSlot[slot] = loadedBrick.brick;
+        m_lastUsed[loadedBrick.brick] = m_frame;
+        m_numPending--;
+    }
+
+    // Rays that needed a brick will most likely also need the next brick further away from the viewer. Only prefetch
+    // into free space, so that prefetching never evicts bricks that are in use.
+    const int axis = glm::abs(viewDirection.x) > glm::abs(viewDirection.y) ? (glm::abs(viewDirection.x) > glm::abs(viewDirection.z) ? 0 : 2) : (glm::abs(viewDirection.y) > glm::abs(viewDirection.z) ? 1 : 2);
+    glm::ivec3 step { 0 };
+    step[axis] = viewDirection[axis] > 0.0f ? 1 : -1;
+    for (const LoadedBrick& loadedBrick : loadedBricks) {
+        if (m_freeSlots.size() <= m_numPending)
+            break;
+        const size_t index = loadedBrick.brick;
+        const glm::ivec3 brick = glm::ivec3(index % size_t(m_brickGridDim.x), (index / size_t(m_brickGridDim.x)) % size_t(m_brickGridDim.y), index / (size_t(m_brickGridDim.x) * size_t(m_brickGridDim.y))) + step;
+        if (glm::any(glm::lessThan(brick, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(brick, m_brickGridDim)))
+            continue;
+        const size_t next = brickIndex(brick);
+        const MacroCell& bounds = m_brickBounds.cells()[next];
+        if (m_slotOfBrick[next] < 0 && bounds.min != bounds.max)
+            request(next);
+    }
+}
+
+size_t BrickCache::numPendingBricks() const
+{
+    return m_numPending;
+}
+
+size_t BrickCache::numLoadedBricks() const
+{
+    std::lock_guard lock { m_mutex };
+    return m_loadedBricks.size();
+}
+
+void BrickCache::waitForPendingBricks() const
+{
+    std::unique_lock lock { m_mutex };
+    m_brickLoaded.wait(lock, [&]() { return m_numLoading == 0 && (m_requests.empty() || m_loadedBricks.size() >= m_maxLoadedBricks); });
+}
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include "default_init_allocator.h"
+#include "macro_cell_grid.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <glm/vec3.hpp>
+#include <mutex>
+#include <ostream>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace volume {
+
+class Volume;
+
+// Header of a bricked volume file (.vvb), followed by the sections that it points to (at offsets from the header):
+//  - the histogram (maximum + 1 int32 counts),
+//  - the minimum/maximum per brick (a MacroCellGrid with cellSize = brickSize),
+//  - a coarse copy of the volume that is averaged over blocks of coarseFactor^3 voxels,
+//  - the bricks in x-major order. Brick (bx, by, bz) stores the (brickSize + 1)^3 voxels starting at voxel
+//    (bx, by, bz) * brickSize, so neighbouring bricks share one layer of voxels and every trilinear sample
+//    only reads from a single brick. Voxels past the border of the volume repeat the last voxel.
+// All values are stored in native (little-endian) byte order.
+struct BrickFileHeader {
+    static constexpr std::array<char, 8> expectedMagic { 'V', 'V', 'B', 'R', 'I', 'C', 'K', '\0' };
+    static constexpr uint32_t expectedVersion = 1;
+
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t brickSize;
+    std::array<int32_t, 3> dim;
+    std::array<int32_t, 3> brickGridDim;
+    std::array<int32_t, 3> coarseDim;
+    uint32_t coarseFactor;
+    uint16_t minimum, maximum;
+    uint64_t histogramOffset;
+    uint64_t brickBoundsOffset;
+    uint64_t coarseOffset;
+    uint64_t bricksOffset;
+};
+
+bool isBrickedVolumeFile(const std::filesystem::path& file);
+// Converts the volume into a bricked volume file. Only one row of bricks is kept in memory at a time, so this also
+// works on memory mapped volumes that are larger than RAM. The coarse copy is at most coarseSize voxels along each axis.
+bool writeBrickedVolume(const Volume& volume, const std::filesystem::path& file, int brickSize = 32, int coarseSize = 256);
+// Same, but writes to the current position of the stream (for example to embed the bricks in a VolumeContainer).
+bool writeBrickedVolume(const Volume& volume, std::ostream& stream, int brickSize = 32, int coarseSize = 256);
+
+// Out-of-core storage of a bricked volume file: a fixed number of bricks is kept in memory and replaced in least
+// recently used order. Samples in bricks that are not in memory request the brick from the background I/O threads
+// and are taken from the coarse copy of the volume in the meantime (or from the brick bounds if the brick is constant).
+//
+// Samplers may run on any number of threads, but only read the cache: bricks that have been loaded are moved into
+// the cache in beginFrame(), which must not run concurrently with sampling (the renderer calls it before a frame).
+class BrickCache {
+public:
+    static constexpr size_t defaultCacheSize = size_t(1) << 30;
+
+    // The bricked volume starts at fileOffset bytes into the file.
+    BrickCache(const std::filesystem::path& file, size_t cacheSize = defaultCacheSize, uint64_t fileOffset = 0, int numIOThreads = 2);
+    BrickCache(const BrickCache&) = delete;
+    ~BrickCache();
+
+    bool isOpen() const;
+    const BrickFileHeader& header() const;
+    glm::ivec3 dims() const;
+    std::vector<int> readHistogram() const;
+    const MacroCellGrid& brickBounds() const;
+    size_t sizeInBytes() const;
+
+    float getVoxel(int x, int y, int z) const;
+    // coord must lie inside [0, dim - 1) like in Volume::getSampleTriLinearInterpolation.
+    float getSampleTriLinear(const glm::vec3& coord) const;
+
+    // Moves the bricks that were loaded since the previous frame into the cache, and orders the outstanding requests
+    // front to back for the given view. Also prefetches the bricks behind the ones that were just loaded.
+    void beginFrame(const glm::vec3& viewPosition, const glm::vec3& viewDirection);
+    // Number of bricks that were requested but are not in the cache yet; the image is approximate while non-zero.
+    size_t numPendingBricks() const;
+    // Number of bricks that were loaded since the last frame; the next frame will be more detailed if non-zero.
+    size_t numLoadedBricks() const;
+    // Blocks until the I/O threads have loaded all requested bricks (or as many as fit in the cache).
+    void waitForPendingBricks() const;
+
+private:
+    size_t brickIndex(const glm::ivec3& brick) const;
+    const uint16_t* residentBrick(size_t brick) const;
+    float getMissingSample(size_t brick, const glm::vec3& coord) const;
+    void request(size_t brick) const;
+    float depth(size_t brick) const;
+    void ioThreadLoop();
+
+    struct LoadedBrick {
+        size_t brick;
+        std::vector<uint16_t> voxels;
+    };
+    using PendingBrick = std::pair<float, size_t>;
+    using RequestQueue = std::priority_queue<PendingBrick, std::vector<PendingBrick>, std::greater<PendingBrick>>;
+
+    std::filesystem::path m_file;
+    uint64_t m_fileOffset { 0 };
+    BrickFileHeader m_header {};
+    bool m_isOpen { false };
+    glm::ivec3 m_dim { 0 };
+    glm::ivec3 m_brickGridDim { 0 };
+    int m_brickSize { 0 };
+    // Voxels per brick side (brickSize + 1) and per brick.
+    int m_brickStride { 0 };
+    size_t m_brickVoxels { 0 };
+    MacroCellGrid m_brickBounds;
+    glm::ivec3 m_coarseDim { 0 };
+    float m_coarseFactor { 1.0f };
+    std::vector<uint16_t> m_coarseVoxels;
+
+    // The cache: numSlots bricks, and which brick is in which slot (noBrick for free slots). Only changed in beginFrame().
+    static constexpr size_t noBrick = std::numeric_limits<size_t>::max();
+    size_t m_numSlots { 0 };
+    std::vector<uint16_t, DefaultInitAllocator<uint16_t>> m_slots;
+    std::vector<int32_t> m_slotOfBrick;
+    std::vector<size_t> m_brickOfSlot;
+    std::vector<size_t> m_freeSlots;
+    // Frame in which each brick was last sampled, to evict the least recently used bricks.
+    uint32_t m_frame { 1 };
+    mutable std::vector<std::atomic<uint32_t>> m_lastUsed;
+
+    // Requests from the samplers to the I/O threads, nearest to the viewer first.
+    mutable std::vector<std::atomic<uint8_t>> m_requested;
+    mutable std::atomic<size_t> m_numPending { 0 };
+    glm::vec3 m_viewPosition { 0.0f }, m_viewDirection { 0.0f };
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_requestAdded, m_brickLoaded;
+    mutable RequestQueue m_requests;
+    std::vector<LoadedBrick> m_loadedBricks;
+    size_t m_numLoading { 0 };
+    size_t m_maxLoadedBricks { 0 };
+    bool m_stop { false };
+    std::vector<std::thread> m_ioThreads;
+};
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace volume {
+
+// Allocator that default-initializes elements instead of value-initializing them, so that std::vector<T>(size) of a
+// trivial type T leaves the memory untouched. Used for the derived volumes: they are written in parallel right after
+// allocation, which is also where the pages are first touched, instead of in a single threaded zero fill.
+template <typename T>
+class DefaultInitAllocator : public std::allocator<T> {
+public:
+    template <typename U>
+    struct rebind {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    using std::allocator<T>::allocator;
+
+    template <typename U>
+    void construct(U* p) noexcept(std::is_nothrow_default_constructible_v<U>)
+    {
+        ::new (static_cast<void*>(p)) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+}
@@ -1,64 +1,190 @@
 #include "gradient_volume.h"
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <exception>
+#include <glm/common.hpp>
 #include <glm/geometric.hpp>
 #include <glm/vector_relational.hpp>
 #include <gsl/span>
+#include <limits>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <utility>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRADIENT_VOLUME_SSE2 1
+#include <emmintrin.h>
+#endif
 
 namespace volume {
 
 // Compute the maximum magnitude from all gradient voxels
-static float computeMaxMagnitude(gsl::span<const GradientVoxel> data)
+template <typename Magnitude>
+static float computeMaxMagnitude(size_t numVoxels, Magnitude&& magnitude)
 {
-    return std::max_element(
-        std::begin(data),
-        std::end(data),
-        [](const GradientVoxel& lhs, const GradientVoxel& rhs) {
-            return lhs.magnitude < rhs.magnitude;
-        })
-        ->magnitude;
+    return tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, numVoxels), std::numeric_limits<float>::lowest(),
+        [&](const tbb::blocked_range<size_t>& range, float maxMagnitude) {
+            for (size_t i = std::begin(range); i != std::end(range); i++)
+                maxMagnitude = std::max(maxMagnitude, magnitude(i));
+            return maxMagnitude;
+        },
+        [](float lhs, float rhs) { return std::max(lhs, rhs); });
 }
 
 // Compute the minimum magnitude from all gradient voxels
-static float computeMinMagnitude(gsl::span<const GradientVoxel> data)
+template <typename Magnitude>
+static float computeMinMagnitude(size_t numVoxels, Magnitude&& magnitude)
 {
-    return std::min_element(
-        std::begin(data),
-        std::end(data),
-        [](const GradientVoxel& lhs, const GradientVoxel& rhs) {
-            return lhs.magnitude < rhs.magnitude;
-        })
-        ->magnitude;
+    return tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, numVoxels), std::numeric_limits<float>::max(),
+        [&](const tbb::blocked_range<size_t>& range, float minMagnitude) {
+            for (size_t i = std::begin(range); i != std::end(range); i++)
+                minMagnitude = std::min(minMagnitude, magnitude(i));
+            return minMagnitude;
+        },
+        [](float lhs, float rhs) { return std::min(lhs, rhs); });
 }
 
-// Compute a gradient volume from a volume
-static std::vector<GradientVoxel> computeGradientVolume(const Volume& volume)
+// Central differences for the inner voxels [1, width - 1) of a row. pRow points to the voxels of the row, pPrevY /
+// pNextY and pPrevZ / pNextZ to the neighbouring rows in y and z, and pOut to the gradients of the row.
+static void computeGradientRow(const uint16_t* pRow, const uint16_t* pPrevY, const uint16_t* pNextY,
+    const uint16_t* pPrevZ, const uint16_t* pNextZ, int width, GradientVoxel* pOut)
+{
+    int x = 1;
+#ifdef GRADIENT_VOLUME_SSE2
+    // Four voxels at a time: the differences are computed one axis per register and then transposed, so that every
+    // register holds one (dir, magnitude) voxel.
+    static_assert(sizeof(GradientVoxel) == 4 * sizeof(float));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const auto load = [&](const uint16_t* p) {
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), zero));
+    };
+    for (; x + 5 <= width; x += 4) {
+        __m128 gx = _mm_mul_ps(_mm_sub_ps(load(pRow + x + 1), load(pRow + x - 1)), half);
+        __m128 gy = _mm_mul_ps(_mm_sub_ps(load(pNextY + x), load(pPrevY + x)), half);
+        __m128 gz = _mm_mul_ps(_mm_sub_ps(load(pNextZ + x), load(pPrevZ + x)), half);
+        __m128 magnitude = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), _mm_mul_ps(gz, gz)));
+        _MM_TRANSPOSE4_PS(gx, gy, gz, magnitude);
+        float* pOutFloats = reinterpret_cast<float*>(pOut + x);
+        _mm_storeu_ps(pOutFloats + 0, gx);
+        _mm_storeu_ps(pOutFloats + 4, gy);
+        _mm_storeu_ps(pOutFloats + 8, gz);
+        _mm_storeu_ps(pOutFloats + 12, magnitude);
+    }
+#endif
+    for (; x < width - 1; x++) {
+        const glm::vec3 v {
+            (float(pRow[x + 1]) - float(pRow[x - 1])) / 2.0f,
+            (float(pNextY[x]) - float(pPrevY[x])) / 2.0f,
+            (float(pNextZ[x]) - float(pPrevZ[x])) / 2.0f
+        };
+        pOut[x] = GradientVoxel { v, glm::length(v) };
+    }
+}
+
+void computeGradientSlice(const Volume& volume, int z, gsl::span<GradientVoxel> out)
+{
+    const auto dim = volume.dims();
+    const size_t strideY = size_t(dim.x);
+    const size_t strideZ = size_t(dim.x) * size_t(dim.y);
+    assert(out.size() == strideZ);
+    constexpr GradientVoxel zero { glm::vec3(0.0f), 0.0f };
+
+    GradientVoxel* pSlice = out.data();
+    if (z == 0 || z == dim.z - 1) {
+        std::fill(pSlice, pSlice + strideZ, zero);
+        return;
+    }
+
+    const uint16_t* pVoxels = volume.data().data() + size_t(z) * strideZ;
+    std::fill(pSlice, pSlice + strideY, zero);
+    for (int y = 1; y < dim.y - 1; y++) {
+        const uint16_t* pRow = pVoxels + size_t(y) * strideY;
+        GradientVoxel* pOut = pSlice + size_t(y) * strideY;
+        pOut[0] = pOut[dim.x - 1] = zero;
+        computeGradientRow(pRow, pRow - strideY, pRow + strideY, pRow - strideZ, pRow + strideZ, dim.x, pOut);
+    }
+    if (dim.y > 1)
+        std::fill(pSlice + size_t(dim.y - 1) * strideY, pSlice + strideZ, zero);
+}
+
+// Compute a gradient volume from a volume. The gradient at the border of the volume is zero.
+// The z-slices are processed in parallel and written directly into the output, which is not initialized beforehand.
+static std::vector<GradientVoxel, DefaultInitAllocator<GradientVoxel>> computeGradientVolume(const Volume& volume)
 {
     const auto dim = volume.dims();
+    const size_t sliceSize = size_t(dim.x) * size_t(dim.y);
 
-    std::vector<GradientVoxel> out(static_cast<size_t>(dim.x * dim.y * dim.z));
-    for (int z = 1; z < dim.z - 1; z++) {
-        for (int y = 1; y < dim.y - 1; y++) {
-            for (int x = 1; x < dim.x - 1; x++) {
-                const float gx = (volume.getVoxel(x + 1, y, z) - volume.getVoxel(x - 1, y, z)) / 2.0f;
-                const float gy = (volume.getVoxel(x, y + 1, z) - volume.getVoxel(x, y - 1, z)) / 2.0f;
-                const float gz = (volume.getVoxel(x, y, z + 1) - volume.getVoxel(x, y, z - 1)) / 2.0f;
-
-                const glm::vec3 v { gx, gy, gz };
-                const size_t index = static_cast<size_t>(x + dim.x * (y + dim.y * z));
-                out[index] = GradientVoxel { v, glm::length(v) };
+    std::vector<GradientVoxel, DefaultInitAllocator<GradientVoxel>> out(sliceSize * size_t(dim.z));
+    tbb::parallel_for(tbb::blocked_range<int>(0, dim.z), [&](const tbb::blocked_range<int>& range) {
+        for (int z = std::begin(range); z != std::end(range); z++)
+            computeGradientSlice(volume, z, gsl::span(out.data() + size_t(z) * sliceSize, sliceSize));
+    });
+    return out;
+}
+
+// The gradient components are central differences (a - b) / 2 of two voxel values, so they lie within
+// [-range / 2, range / 2]. Store them as (a - b) if that fits into an int16_t, and scale them down otherwise.
+static float computeDequantizationScale(const Volume& volume)
+{
+    const float halfRange = (volume.maximum() - volume.minimum()) / 2.0f;
+    constexpr float maxQuantized = float(std::numeric_limits<int16_t>::max());
+    return halfRange * 2.0f <= maxQuantized ? 0.5f : halfRange / maxQuantized;
+}
+
+// Compute a quantized gradient volume from a volume. Every z-slice is computed in floating point into a per task
+// buffer and then quantized into the output.
+static std::vector<QuantizedGradientVoxel, DefaultInitAllocator<QuantizedGradientVoxel>> computeQuantizedGradientVolume(const Volume& volume, float dequantizationScale)
+{
+    const auto dim = volume.dims();
+    const size_t sliceSize = size_t(dim.x) * size_t(dim.y);
+    const float quantizationScale = 1.0f / dequantizationScale;
+
+    std::vector<QuantizedGradientVoxel, DefaultInitAllocator<QuantizedGradientVoxel>> out(sliceSize * size_t(dim.z));
+    tbb::parallel_for(tbb::blocked_range<int>(0, dim.z), [&](const tbb::blocked_range<int>& range) {
+        std::vector<GradientVoxel, DefaultInitAllocator<GradientVoxel>> slice(sliceSize);
+        for (int z = std::begin(range); z != std::end(range); z++) {
+            computeGradientSlice(volume, z, slice);
+            QuantizedGradientVoxel* pOut = out.data() + size_t(z) * sliceSize;
+            for (size_t i = 0; i < sliceSize; i++) {
+                const glm::vec3 quantized = glm::round(slice[i].dir * quantizationScale);
+                pOut[i] = QuantizedGradientVoxel { { int16_t(quantized.x), int16_t(quantized.y), int16_t(quantized.z) } };
             }
         }
-    }
+    });
     return out;
 }
 
-GradientVolume::GradientVolume(const Volume& volume)
+GradientVolume::GradientVolume(const Volume& volume, GradientStorage storage)
     : m_dim(volume.dims())
-    , m_data(computeGradientVolume(volume))
-    , m_minMagnitude(computeMinMagnitude(m_data))
-    , m_maxMagnitude(computeMaxMagnitude(m_data))
+    , m_storage(storage)
+    , m_dequantizationScale(computeDequantizationScale(volume))
+    , m_data(storage == GradientStorage::Float ? computeGradientVolume(volume) : decltype(m_data) {})
+    , m_quantizedData(storage == GradientStorage::Quantized ? computeQuantizedGradientVolume(volume, m_dequantizationScale) : decltype(m_quantizedData) {})
+    , m_voxels(m_data)
+    , m_quantizedVoxels(m_quantizedData)
+    , m_minMagnitude(computeMinMagnitude(size_t(m_dim.x) * size_t(m_dim.y) * size_t(m_dim.z), [this](size_t i) { return getGradient(i).magnitude; }))
+    , m_maxMagnitude(computeMaxMagnitude(size_t(m_dim.x) * size_t(m_dim.y) * size_t(m_dim.z), [this](size_t i) { return getGradient(i).magnitude; }))
+{
+}
+
+GradientVolume::GradientVolume(const glm::ivec3& dim, gsl::span<const GradientVoxel> data, gsl::span<const QuantizedGradientVoxel> quantizedData,
+    float dequantizationScale, float minMagnitude, float maxMagnitude, std::shared_ptr<const void> pStorage)
+    : m_dim(dim)
+    , m_storage(quantizedData.empty() ? GradientStorage::Float : GradientStorage::Quantized)
+    , m_dequantizationScale(dequantizationScale)
+    , m_pStorage(std::move(pStorage))
+    , m_voxels(data)
+    , m_quantizedVoxels(quantizedData)
+    , m_minMagnitude(minMagnitude)
+    , m_maxMagnitude(maxMagnitude)
 {
+    assert((m_storage == GradientStorage::Float ? m_voxels.size() : m_quantizedVoxels.size()) == size_t(dim.x) * size_t(dim.y) * size_t(dim.z));
 }
 
 float GradientVolume::maxMagnitude() const
@@ -76,6 +202,31 @@ glm::ivec3 GradientVolume::dims() const
     return m_dim;
 }
 
+GradientStorage GradientVolume::storage() const
+{
+    return m_storage;
+}
+
+size_t GradientVolume::sizeInBytes() const
+{
+    return m_voxels.size_bytes() + m_quantizedVoxels.size_bytes();
+}
+
+gsl::span<const GradientVoxel> GradientVolume::data() const
+{
+    return m_voxels;
+}
+
+gsl::span<const QuantizedGradientVoxel> GradientVolume::quantizedData() const
+{
+    return m_quantizedVoxels;
+}
+
+float GradientVolume::dequantizationScale() const
+{
+    return m_dequantizationScale;
+}
+
 // This function returns a gradientVoxel at coord based on the current interpolation mode.
 GradientVoxel GradientVolume::getGradientInterpolate(const glm::vec3& coord) const
 {
@@ -129,17 +280,18 @@ GradientVoxel GradientVolume::getGradientLinearInterpolate(const glm::vec3& coor
     float diffz = coord.z - floorZ;
 
     // Get surrounding 8 neighbors
-    GradientVoxel c000 = getGradient(floorX, floorY, floorZ);
-    GradientVoxel c001 = getGradient(floorX, floorY, floorZ + 1);
+    const std::array<GradientVoxel, 8> corners = getGradientCell(floorX, floorY, floorZ);
+    const GradientVoxel& c000 = corners[0];
+    const GradientVoxel& c001 = corners[1];
 
-    GradientVoxel c010 = getGradient(floorX, floorY + 1, floorZ);
-    GradientVoxel c011 = getGradient(floorX, floorY + 1, floorZ + 1);
+    const GradientVoxel& c010 = corners[2];
+    const GradientVoxel& c011 = corners[3];
 
-    GradientVoxel c100 = getGradient(floorX + 1, floorY, floorZ);
-    GradientVoxel c101 = getGradient(floorX + 1, floorY, floorZ + 1);
+    const GradientVoxel& c100 = corners[4];
+    const GradientVoxel& c101 = corners[5];
 
-    GradientVoxel c110 = getGradient(floorX + 1, floorY + 1, floorZ);
-    GradientVoxel c111 = getGradient(floorX + 1, floorY + 1, floorZ + 1);
+    const GradientVoxel& c110 = corners[6];
+    const GradientVoxel& c111 = corners[7];
 
     // Interpolate over z
     GradientVoxel c00 = linearInterpolate(c000, c001, diffz);
@@ -172,6 +324,50 @@ GradientVoxel GradientVolume::linearInterpolate(const GradientVoxel& g0, const G
 GradientVoxel GradientVolume::getGradient(int x, int y, int z) const
 {
     const size_t i = static_cast<size_t>(x + m_dim.x * (y + m_dim.y * z));
-    return m_data[i];
+    return getGradient(i);
+}
+
+// Returns the gradients at the 8 corners of the cell [x, x + 1] x [y, y + 1] x [z, z + 1], with corner
+// (dx, dy, dz) at index dx * 4 + dy * 2 + dz. Quantized gradients compute the 8 magnitudes at once.
+std::array<GradientVoxel, 8> GradientVolume::getGradientCell(int x, int y, int z) const
+{
+    std::array<GradientVoxel, 8> corners;
+    const size_t strideY = size_t(m_dim.x);
+    const size_t strideZ = size_t(m_dim.x) * size_t(m_dim.y);
+    const size_t i = static_cast<size_t>(x + m_dim.x * (y + m_dim.y * z));
+    const std::array<size_t, 8> offsets { 0, strideZ, strideY, strideY + strideZ, 1, 1 + strideZ, 1 + strideY, 1 + strideY + strideZ };
+    if (m_storage != GradientStorage::Quantized) {
+        for (size_t corner = 0; corner < 8; corner++)
+            corners[corner] = m_voxels[i + offsets[corner]];
+        return corners;
+    }
+
+    std::array<float, 8> squaredMagnitudes;
+    for (size_t corner = 0; corner < 8; corner++) {
+        const auto& components = m_quantizedVoxels[i + offsets[corner]].components;
+        corners[corner].dir = glm::vec3(float(components[0]), float(components[1]), float(components[2])) * m_dequantizationScale;
+        squaredMagnitudes[corner] = glm::dot(corners[corner].dir, corners[corner].dir);
+    }
+#ifdef GRADIENT_VOLUME_SSE2
+    std::array<float, 8> magnitudes;
+    _mm_storeu_ps(magnitudes.data(), _mm_sqrt_ps(_mm_loadu_ps(squaredMagnitudes.data())));
+    _mm_storeu_ps(magnitudes.data() + 4, _mm_sqrt_ps(_mm_loadu_ps(squaredMagnitudes.data() + 4)));
+    for (size_t corner = 0; corner < 8; corner++)
+        corners[corner].magnitude = magnitudes[corner];
+#else
+    for (size_t corner = 0; corner < 8; corner++)
+        corners[corner].magnitude = std::sqrt(squaredMagnitudes[corner]);
+#endif
+    return corners;
+}
+
+GradientVoxel GradientVolume::getGradient(size_t i) const
+{
+    if (m_storage == GradientStorage::Quantized) {
+        const auto& components = m_quantizedVoxels[i].components;
+        const glm::vec3 dir = glm::vec3(float(components[0]), float(components[1]), float(components[2])) * m_dequantizationScale;
+        return GradientVoxel { dir, glm::length(dir) };
+    }
+    return m_voxels[i];
 }
 }
\ No newline at end of file
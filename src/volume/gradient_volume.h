@@ -1,7 +1,12 @@
 #pragma once
+#include "default_init_allocator.h"
 #include "volume.h"
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
+#include <array>
+#include <cstdint>
+#include <gsl/span>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -11,29 +16,81 @@ struct GradientVoxel {
     float magnitude;
 };
 
+enum class GradientStorage {
+    // GradientVoxel per voxel (16 bytes).
+    Float = 0,
+    // QuantizedGradientVoxel per voxel (6 bytes); the magnitude is recomputed when a gradient is read.
+    Quantized
+};
+
+// Gradient components quantized to 16-bit integers: dir = components * dequantization scale. The gradients are
+// stored exactly (scale 0.5) as long as the range of voxel values is below 32768, which covers 8, 12 and 15-bit data.
+struct QuantizedGradientVoxel {
+    std::array<int16_t, 3> components;
+};
+
 class GradientVolume {
 public:
     // DO NOT REMOVE
     InterpolationMode interpolationMode { InterpolationMode::NearestNeighbour };
 
 public:
-    GradientVolume(const Volume& volume);
+    GradientVolume(const Volume& volume, GradientStorage storage = GradientStorage::Float);
+    // Gradients that were computed before (see VolumeContainer), in quantized storage if quantizedData is not empty.
+    // The data is not copied and must stay valid for as long as pStorage is alive.
+    GradientVolume(const glm::ivec3& dim, gsl::span<const GradientVoxel> data, gsl::span<const QuantizedGradientVoxel> quantizedData,
+        float dequantizationScale, float minMagnitude, float maxMagnitude, std::shared_ptr<const void> pStorage);
+    // m_voxels may point into m_data, which a copy would not update.
+    GradientVolume(const GradientVolume&) = delete;
 
+    GradientVoxel getGradientInterpolate(const glm::vec3& coord) const;
+    // Same as getGradientInterpolate but with the interpolation mode fixed at compile time.
+    template <InterpolationMode mode>
     GradientVoxel getGradientInterpolate(const glm::vec3& coord) const;
     GradientVoxel getGradient(int x, int y, int z) const;
 
     float minMagnitude() const;
     float maxMagnitude() const;
     glm::ivec3 dims() const;
+    GradientStorage storage() const;
+    size_t sizeInBytes() const;
+    // The gradients in GradientStorage::Float storage (empty for the other storage modes).
+    gsl::span<const GradientVoxel> data() const;
+    // The gradients in GradientStorage::Quantized storage (empty for the other storage modes).
+    gsl::span<const QuantizedGradientVoxel> quantizedData() const;
+    float dequantizationScale() const;
 
 protected:
     GradientVoxel getGradientNearestNeighbor(const glm::vec3& coord) const;
     GradientVoxel getGradientLinearInterpolate(const glm::vec3& coord) const;
     static GradientVoxel linearInterpolate(const GradientVoxel& g0, const GradientVoxel& g1, float factor);
+    GradientVoxel getGradient(size_t i) const;
+    std::array<GradientVoxel, 8> getGradientCell(int x, int y, int z) const;
 
 protected:
     const glm::ivec3 m_dim;
-    const std::vector<GradientVoxel> m_data;
+    const GradientStorage m_storage;
+    const float m_dequantizationScale;
+    const std::vector<GradientVoxel, DefaultInitAllocator<GradientVoxel>> m_data;
+    const std::vector<QuantizedGradientVoxel, DefaultInitAllocator<QuantizedGradientVoxel>> m_quantizedData;
+    // All accesses go through these views, of either m_data / m_quantizedData or of memory owned by m_pStorage.
+    const std::shared_ptr<const void> m_pStorage;
+    const gsl::span<const GradientVoxel> m_voxels;
+    const gsl::span<const QuantizedGradientVoxel> m_quantizedVoxels;
     const float m_minMagnitude, m_maxMagnitude;
 };
+
+// Computes the gradients of z-slice z of volume into out (dims.x * dims.y voxels), with zero gradients at the border
+// of the volume. Used to compute the gradients one slice at a time without storing a whole gradient volume.
+void computeGradientSlice(const Volume& volume, int z, gsl::span<GradientVoxel> out);
+
+template <InterpolationMode mode>
+GradientVoxel GradientVolume::getGradientInterpolate(const glm::vec3& coord) const
+{
+    // No cubic in this case, linear is good enough for the gradient.
+    if constexpr (mode == InterpolationMode::NearestNeighbour)
+        return getGradientNearestNeighbor(coord);
+    else
+        return getGradientLinearInterpolate(coord);
+}
 }
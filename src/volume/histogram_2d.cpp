@@ -0,0 +1,66 @@
+#include "histogram_2d.h"
+#include <algorithm>
+#include <cassert>
+#include <glm/geometric.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+namespace volume {
+
+template <typename Magnitude>
+static Histogram2D computeHistogram2D(const Volume& volume, float maxMagnitude, const glm::ivec2& numBins, Magnitude&& magnitude)
+{
+    assert(numBins.x > 0 && numBins.y > 0);
+    const size_t numBinsTotal = size_t(numBins.x) * size_t(numBins.y);
+    const float magnitudeScale = maxMagnitude > 0.0f ? float(numBins.y) / maxMagnitude : 0.0f;
+    // Bin of every voxel value, so that the inner loop only has to compute the bin of the magnitude.
+    const gsl::span<const uint16_t> voxels = volume.data();
+    std::vector<int> valueBins(size_t(volume.maximum()) + 1);
+    for (size_t value = 0; value < valueBins.size(); value++)
+        valueBins[value] = int(value * size_t(numBins.x) / valueBins.size());
+
+    tbb::enumerable_thread_specific<std::vector<int>> threadCounts(numBinsTotal, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, voxels.size(), size_t(1) << 14), [&](const tbb::blocked_range<size_t>& range) {
+        std::vector<int>& counts = threadCounts.local();
+        for (size_t i = range.begin(); i < range.end(); i++) {
+            const int binY = std::min(int(magnitude(i) * magnitudeScale), numBins.y - 1);
+            counts[size_t(valueBins[voxels[i]]) + size_t(numBins.x) * size_t(std::max(binY, 0))]++;
+        }
+    });
+
+    Histogram2D out;
+    out.numBins = numBins;
+    out.counts.assign(numBinsTotal, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, numBinsTotal, 4096), [&](const tbb::blocked_range<size_t>& range) {
+        for (const std::vector<int>& counts : threadCounts) {
+            for (size_t bin = range.begin(); bin < range.end(); bin++)
+                out.counts[bin] += counts[bin];
+        }
+    });
+    out.maxCount = *std::max_element(std::begin(out.counts), std::end(out.counts));
+    return out;
+}
+
+// The magnitudes are read straight from the storage of the derived volumes (by voxel index).
+Histogram2D computeHistogram2D(const Volume& volume, const GradientVolume& gradientVolume, const glm::ivec2& numBins)
+{
+    if (gradientVolume.storage() == GradientStorage::Quantized) {
+        const gsl::span<const QuantizedGradientVoxel> gradients = gradientVolume.quantizedData();
+        const float scale = gradientVolume.dequantizationScale();
+        return computeHistogram2D(volume, gradientVolume.maxMagnitude(), numBins, [&](size_t i) {
+            const auto& components = gradients[i].components;
+            return glm::length(glm::vec3(float(components[0]), float(components[1]), float(components[2])) * scale);
+        });
+    }
+    const gsl::span<const GradientVoxel> gradients = gradientVolume.data();
+    return computeHistogram2D(volume, gradientVolume.maxMagnitude(), numBins, [&](size_t i) { return gradients[i].magnitude; });
+}
+
+Histogram2D computeHistogram2D(const Volume& volume, const SecondDerivativeVolume& secondDerivativeVolume, const glm::ivec2& numBins)
+{
+    const gsl::span<const SecondDerivativeVoxel> secondDerivatives = secondDerivativeVolume.data();
+    return computeHistogram2D(volume, secondDerivativeVolume.maxMagnitude(), numBins, [&](size_t i) { return secondDerivatives[i].magnitude; });
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "gradient_volume.h"
+#include "secondderivative_volume.h"
+#include "volume.h"
+#include <glm/vec2.hpp>
+#include <vector>
+
+namespace volume {
+
+// Joint histogram of the voxel values and the magnitude of a derived volume, as shown by the 2D transfer function
+// widgets. The voxel values [0, maximum] are divided over numBins.x bins of equal width and the magnitudes
+// [0, maxMagnitude] over numBins.y bins.
+struct Histogram2D {
+    glm::ivec2 numBins { 0 };
+    // numBins.x * numBins.y counts in x-major order; bin (0, 0) has the lowest voxel values and magnitudes.
+    std::vector<int> counts;
+    int maxCount { 0 };
+};
+
+// Parallel over the voxels; every thread counts into a histogram of its own. Needs the voxels in memory, so streamed
+// volumes are not supported.
+Histogram2D computeHistogram2D(const Volume& volume, const GradientVolume& gradientVolume, const glm::ivec2& numBins);
+Histogram2D computeHistogram2D(const Volume& volume, const SecondDerivativeVolume& secondDerivativeVolume, const glm::ivec2& numBins);
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <chrono>
+#include <future>
+#include <memory>
+#include <utility>
+
+namespace volume {
+
+// A derived volume (e.g. GradientVolume) that is only computed once something asks for it, on a background thread.
+// request() starts the computation and get() returns the volume once it is done without ever blocking, so the
+// viewer can keep drawing (and show progress) in the meantime.
+template <typename T>
+class LazyVolume {
+public:
+    LazyVolume() = default;
+    LazyVolume(const LazyVolume&) = delete;
+    LazyVolume& operator=(const LazyVolume&) = delete;
+    // Waits for a computation that is still running (the std::future returned by std::async blocks when destroyed).
+    ~LazyVolume() = default;
+
+    // Starts computing the volume with build() (returning a std::unique_ptr<T>) unless that already happened.
+    template <typename Build>
+    void request(Build&& build)
+    {
+        if (!m_future.valid() && !m_pVolume)
+            m_future = std::async(std::launch::async, std::forward<Build>(build));
+    }
+
+    // Returns the volume if it has been computed, and nullptr otherwise. Rethrows if the computation threw.
+    T* get()
+    {
+        if (m_future.valid() && m_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            m_pVolume = m_future.get();
+        return m_pVolume.get();
+    }
+
+    bool isComputing() const
+    {
+        return m_future.valid();
+    }
+
+private:
+    std::future<std::unique_ptr<T>> m_future;
+    std::unique_ptr<T> m_pVolume;
+};
+
+}
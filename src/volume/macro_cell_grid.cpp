@@ -0,0 +1,76 @@
+#include "macro_cell_grid.h"
+#include <algorithm>
+#include <cassert>
+#include <glm/common.hpp>
+#include <glm/vector_relational.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <utility>
+
+namespace volume {
+
+MacroCellGrid::MacroCellGrid(gsl::span<const uint16_t> voxels, const glm::ivec3& volumeDims, int cellSize)
+    : m_cellSize(cellSize)
+    , m_dim((volumeDims + cellSize - 1) / cellSize)
+    , m_cells(size_t(m_dim.x) * size_t(m_dim.y) * size_t(m_dim.z))
+{
+    tbb::parallel_for(tbb::blocked_range<int>(0, m_dim.z), [&](const tbb::blocked_range<int>& range) {
+        for (int cz = std::begin(range); cz != std::end(range); cz++) {
+            for (int cy = 0; cy < m_dim.y; cy++) {
+                for (int cx = 0; cx < m_dim.x; cx++) {
+                    const glm::ivec3 cell { cx, cy, cz };
+                    // Samples inside the cell interpolate voxels up to one past the cell. One more voxel on either
+                    // side protects against rounding when a sample position lies exactly on a cell border.
+                    const glm::ivec3 lower = glm::max(cell * cellSize - 1, glm::ivec3(0));
+                    const glm::ivec3 upper = glm::min((cell + 1) * cellSize + 1, volumeDims - 1);
+
+                    MacroCell out { 0xFFFF, 0 };
+                    for (int z = lower.z; z <= upper.z; z++) {
+                        for (int y = lower.y; y <= upper.y; y++) {
+                            const uint16_t* pRow = &voxels[size_t(volumeDims.x) * (size_t(y) + size_t(volumeDims.y) * size_t(z))];
+                            const auto [minIt, maxIt] = std::minmax_element(pRow + lower.x, pRow + upper.x + 1);
+                            out.min = std::min(out.min, *minIt);
+                            out.max = std::max(out.max, *maxIt);
+                        }
+                    }
+
+                    // The samplers return 0 for positions on (or past) the upper border of the volume.
+                    if (glm::any(glm::greaterThanEqual((cell + 1) * cellSize + 1, volumeDims - 1)))
+                        out.min = 0;
+
+                    m_cells[size_t(cx) + size_t(m_dim.x) * (size_t(cy) + size_t(m_dim.y) * size_t(cz))] = out;
+                }
+            }
+        }
+    });
+}
+
+MacroCellGrid::MacroCellGrid(std::vector<MacroCell> cells, const glm::ivec3& dims, int cellSize)
+    : m_cellSize(cellSize)
+    , m_dim(dims)
+    , m_cells(std::move(cells))
+{
+    assert(m_cells.size() == size_t(m_dim.x) * size_t(m_dim.y) * size_t(m_dim.z));
+}
+
+int MacroCellGrid::cellSize() const
+{
+    return m_cellSize;
+}
+
+glm::ivec3 MacroCellGrid::dims() const
+{
+    return m_dim;
+}
+
+gsl::span<const MacroCell> MacroCellGrid::cells() const
+{
+    return m_cells;
+}
+
+const MacroCell& MacroCellGrid::getCell(int x, int y, int z) const
+{
+    return m_cells[size_t(x) + size_t(m_dim.x) * (size_t(y) + size_t(m_dim.y) * size_t(z))];
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <gsl/span>
+#include <vector>
+
+namespace volume {
+
+struct MacroCell {
+    uint16_t min, max;
+};
+
+// Coarse grid over the volume that stores the minimum and maximum voxel value per block of cellSize^3 voxels.
+// The bounds are conservative: they include the voxels one past the border of the cell (on both sides), so
+// they also bound every nearest neighbour or trilinear sample taken at a position inside the cell.
+class MacroCellGrid {
+public:
+    static constexpr int defaultCellSize = 8;
+
+    MacroCellGrid() = default;
+    MacroCellGrid(gsl::span<const uint16_t> voxels, const glm::ivec3& volumeDims, int cellSize = defaultCellSize);
+    // Grid of precomputed cells (in x-major order), for example read from a file.
+    MacroCellGrid(std::vector<MacroCell> cells, const glm::ivec3& dims, int cellSize);
+
+    int cellSize() const;
+    glm::ivec3 dims() const;
+    gsl::span<const MacroCell> cells() const;
+
+    const MacroCell& getCell(int x, int y, int z) const;
+
+private:
+    int m_cellSize { defaultCellSize };
+    glm::ivec3 m_dim { 0 };
+    std::vector<MacroCell> m_cells;
+};
+
+}
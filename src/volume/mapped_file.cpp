@@ -0,0 +1,127 @@
+#include "mapped_file.h"
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+// windows.h has to be included before psapi.h
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace volume {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path& file)
+{
+    HANDLE fileHandle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        std::cerr << "Could not open " << file << " for memory mapping" << std::endl;
+        return;
+    }
+    m_fileHandle = fileHandle;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+        return;
+
+    HANDLE mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr) {
+        std::cerr << "Could not create a file mapping for " << file << std::endl;
+        return;
+    }
+    m_mappingHandle = mappingHandle;
+
+    const void* pView = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (pView == nullptr) {
+        std::cerr << "Could not map " << file << " into memory" << std::endl;
+        return;
+    }
+    m_pData = static_cast<const std::byte*>(pView);
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_pData)
+        UnmapViewOfFile(m_pData);
+    if (m_mappingHandle)
+        CloseHandle(m_mappingHandle);
+    if (m_fileHandle)
+        CloseHandle(m_fileHandle);
+}
+
+size_t peakResidentSetSize()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& file)
+{
+    const int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::cerr << "Could not open " << file << " for memory mapping" << std::endl;
+        return;
+    }
+
+    struct stat fileInfo;
+    if (::fstat(fd, &fileInfo) == 0 && fileInfo.st_size > 0) {
+        void* pMapping = ::mmap(nullptr, size_t(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pMapping != MAP_FAILED) {
+            // Voxels are read in (roughly) file order when computing statistics and derived volumes.
+            ::madvise(pMapping, size_t(fileInfo.st_size), MADV_WILLNEED);
+            m_pData = static_cast<const std::byte*>(pMapping);
+            m_size = size_t(fileInfo.st_size);
+        } else {
+            std::cerr << "Could not map " << file << " into memory" << std::endl;
+        }
+    }
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_pData)
+        ::munmap(const_cast<std::byte*>(m_pData), m_size);
+}
+
+size_t peakResidentSetSize()
+{
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    // macOS reports bytes...
+    return size_t(usage.ru_maxrss);
+#else
+    // ...whereas Linux reports kilobytes.
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+#endif
+
+bool MappedFile::isOpen() const
+{
+    return m_pData != nullptr;
+}
+
+gsl::span<const std::byte> MappedFile::bytes() const
+{
+    return { m_pData, m_size };
+}
+
+}
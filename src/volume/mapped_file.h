@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <gsl/span>
+
+namespace volume {
+
+// Read-only memory mapping of a whole file. The mapping stays valid for the lifetime of the object,
+// which is why volumes that reference the mapped bytes directly hold on to it through a shared_ptr.
+class MappedFile {
+public:
+    MappedFile(const std::filesystem::path& file);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool isOpen() const;
+    gsl::span<const std::byte> bytes() const;
+
+private:
+    const std::byte* m_pData { nullptr };
+    size_t m_size { 0 };
+#ifdef _WIN32
+    void* m_fileHandle { nullptr };
+    void* m_mappingHandle { nullptr };
+#endif
+};
+
+// Peak resident set size (high water mark) of the current process in bytes, or 0 if unknown.
+size_t peakResidentSetSize();
+
+}
@@ -0,0 +1,333 @@
+#include "marching_cubes.h"
+#include "default_init_allocator.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <fmt/format.h>
+#include <fstream>
+#include <glm/geometric.hpp>
+#include <iostream>
+#include <iterator>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <utility>
+
+namespace volume {
+
+// The corners of a cube are numbered by their offset: bit 0/1/2 is set for the corner at +1 along x/y/z.
+// Edges 0-3 run along x, edges 4-7 along y and edges 8-11 along z; every edge starts at its lower corner.
+static constexpr std::array<std::array<int, 2>, 12> cubeEdges { {
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+    { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+    { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } } };
+// The corners of every face in cyclic order.
+static constexpr std::array<std::array<int, 4>, 6> cubeFaces { {
+    { 0, 2, 6, 4 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 5, 7, 6 } } };
+
+// Triangles of one configuration of inside and outside corners, as the edges that their vertices lie on.
+struct CubeCase {
+    int numTriangles;
+    std::array<uint8_t, 36> edges;
+};
+
+static glm::vec3 cornerPosition(int corner)
+{
+    return glm::vec3(corner & 1, (corner >> 1) & 1, corner >> 2);
+}
+
+static int edgeBetween(int corner0, int corner1)
+{
+    const auto it = std::find_if(std::begin(cubeEdges), std::end(cubeEdges), [&](const std::array<int, 2>& edge) {
+        return (edge[0] == corner0 && edge[1] == corner1) || (edge[0] == corner1 && edge[1] == corner0);
+    });
+    assert(it != std::end(cubeEdges));
+    return int(std::distance(std::begin(cubeEdges), it));
+}
+
+// Triangulation of every configuration (bit i set if corner i is inside). Instead of the usual hand-written table the
+// cases are derived: the surface crosses the edges between an inside and an outside corner, and on every face it runs
+// between those crossings. The segments on the faces join into closed loops, which are triangulated as fans and wound
+// so that they face away from the inside corners. On a face with two diagonally opposite inside corners (the
+// ambiguous case) the segments cut off the inside corners. This only depends on the face, so the two cubes that share
+// it agree and the surface has no holes.
+static std::array<CubeCase, 256> computeCubeCases()
+{
+    std::array<CubeCase, 256> cases {};
+    for (int config = 0; config < 256; config++) {
+        const auto inside = [&](int corner) { return ((config >> corner) & 1) != 0; };
+
+        // The two edges that every crossed edge is connected to, on the two faces that it belongs to.
+        std::array<std::array<int, 2>, 12> neighbours;
+        neighbours.fill({ -1, -1 });
+        const auto connect = [&](int edge0, int edge1) {
+            (neighbours[size_t(edge0)][0] < 0 ? neighbours[size_t(edge0)][0] : neighbours[size_t(edge0)][1]) = edge1;
+            (neighbours[size_t(edge1)][0] < 0 ? neighbours[size_t(edge1)][0] : neighbours[size_t(edge1)][1]) = edge0;
+        };
+        for (const auto& face : cubeFaces) {
+            std::array<int, 4> crossings;
+            size_t numCrossings = 0;
+            for (size_t i = 0; i < 4; i++) {
+                if (inside(face[i]) != inside(face[(i + 1) % 4]))
+                    crossings[numCrossings++] = edgeBetween(face[i], face[(i + 1) % 4]);
+            }
+            if (numCrossings == 2) {
+                connect(crossings[0], crossings[1]);
+            } else if (numCrossings == 4) {
+                // crossings[i] lies between face corners i and i + 1.
+                if (inside(face[0])) {
+                    connect(crossings[3], crossings[0]);
+                    connect(crossings[1], crossings[2]);
+                } else {
+                    connect(crossings[0], crossings[1]);
+                    connect(crossings[2], crossings[3]);
+                }
+            }
+        }
+
+        CubeCase& out = cases[size_t(config)];
+        std::array<bool, 12> visited {};
+        for (int start = 0; start < 12; start++) {
+            if (visited[size_t(start)] || neighbours[size_t(start)][0] < 0)
+                continue;
+            std::vector<int> loop;
+            for (int edge = start, previous = -1; !visited[size_t(edge)];) {
+                visited[size_t(edge)] = true;
+                loop.push_back(edge);
+                const int next = neighbours[size_t(edge)][0] != previous ? neighbours[size_t(edge)][0] : neighbours[size_t(edge)][1];
+                previous = edge;
+                edge = next;
+            }
+
+            // Compare the normal of the loop (Newell's method, on the edge midpoints) with the direction from the
+            // inside to the outside corners of its edges.
+            glm::vec3 normal { 0.0f }, outward { 0.0f };
+            for (size_t i = 0; i < loop.size(); i++) {
+                const auto midpoint = [](int edge) { return 0.5f * (cornerPosition(cubeEdges[size_t(edge)][0]) + cornerPosition(cubeEdges[size_t(edge)][1])); };
+                normal += glm::cross(midpoint(loop[i]), midpoint(loop[(i + 1) % loop.size()]));
+                const auto [corner0, corner1] = cubeEdges[size_t(loop[i])];
+                outward += (inside(corner0) ? 1.0f : -1.0f) * (cornerPosition(corner1) - cornerPosition(corner0));
+            }
+            if (glm::dot(normal, outward) < 0.0f)
+                std::reverse(std::begin(loop), std::end(loop));
+
+            for (size_t i = 1; i + 1 < loop.size(); i++) {
+                const size_t first = size_t(out.numTriangles++) * 3;
+                out.edges[first] = uint8_t(loop[0]);
+                out.edges[first + 1] = uint8_t(loop[i]);
+                out.edges[first + 2] = uint8_t(loop[i + 1]);
+            }
+        }
+    }
+    return cases;
+}
+
+// The surface is extracted in two passes. The first counts the crossed edges of every plane of voxels (an edge belongs
+// to the plane of its lower voxel), which gives every plane the index of its first vertex. The second pass walks slabs
+// of planes in parallel. It computes the vertices of every plane into an edge cache that holds the vertex of every
+// crossed edge of the plane, and emits the triangles of the cubes between two planes from the two caches. The cubes
+// at the top of a slab need the first plane of the next slab; its cache is filled again without computing the
+// vertices, which that slab does. Every vertex is thus computed once and gets the same index in both slabs.
+Mesh extractIsoSurface(const Volume& volume, const GradientVolume& gradientVolume, float isoValue)
+{
+    static const std::array<CubeCase, 256> cubeCases = computeCubeCases();
+
+    const gsl::span<const uint16_t> voxels = volume.data();
+    if (voxels.empty()) {
+        std::cerr << "Iso surface extraction needs the voxels in memory (streamed volumes are not supported)" << std::endl;
+        return {};
+    }
+    const glm::ivec3 dim = volume.dims();
+    const auto isInside = [&](int x, int y, int z) {
+        return float(voxels[size_t(x) + size_t(dim.x) * (size_t(y) + size_t(dim.y) * size_t(z))]) >= isoValue;
+    };
+
+    // Only macro cells that the surface passes through contain crossed edges (the edges of a voxel end within the
+    // bounds of its macro cell), and only their cubes have triangles.
+    const MacroCellGrid& grid = volume.macroCells();
+    const int cellSize = grid.cellSize();
+    const glm::ivec3 gridDims = grid.dims();
+    std::vector<uint8_t> activeCells(grid.cells().size(), 0);
+    std::vector<uint8_t> activeRows(size_t(gridDims.y) * size_t(gridDims.z), 0);
+    volume.spanSpaceIndex().forEachCell(isoValue, isoValue, [&](uint32_t cell) {
+        activeCells[cell] = 1;
+        activeRows[cell / uint32_t(gridDims.x)] = 1;
+    });
+    // Calls f(x, y) for the voxels (x, y, z) of the plane that lie in macro cells that the surface passes through.
+    const auto forEachActiveVoxel = [&](int z, int yEnd, int xEnd, auto&& f) {
+        const int cz = z / cellSize;
+        for (int y = 0; y < yEnd; y++) {
+            const int cy = y / cellSize;
+            if (!activeRows[size_t(cy) + size_t(gridDims.y) * size_t(cz)])
+                continue;
+            for (int cx = 0; cx < gridDims.x; cx++) {
+                if (!activeCells[size_t(cx) + size_t(gridDims.x) * (size_t(cy) + size_t(gridDims.y) * size_t(cz))])
+                    continue;
+                for (int x = cx * cellSize; x < std::min((cx + 1) * cellSize, xEnd); x++)
+                    f(x, y);
+            }
+        }
+    };
+    // Calls f(x, y, axis) for the crossed edges of the plane, in the same order for both passes.
+    const auto forEachCrossedEdge = [&](int z, auto&& f) {
+        forEachActiveVoxel(z, dim.y, dim.x, [&](int x, int y) {
+            const bool inside = isInside(x, y, z);
+            if (x + 1 < dim.x && isInside(x + 1, y, z) != inside)
+                f(x, y, 0);
+            if (y + 1 < dim.y && isInside(x, y + 1, z) != inside)
+                f(x, y, 1);
+            if (z + 1 < dim.z && isInside(x, y, z + 1) != inside)
+                f(x, y, 2);
+        });
+    };
+
+    std::vector<uint32_t> planeOffsets(size_t(dim.z) + 1, 0);
+    tbb::parallel_for(0, dim.z, [&](int z) {
+        uint32_t count = 0;
+        forEachCrossedEdge(z, [&](int, int, int) { count++; });
+        planeOffsets[size_t(z) + 1] = count;
+    });
+    for (size_t z = 0; z < size_t(dim.z); z++)
+        planeOffsets[z + 1] += planeOffsets[z];
+
+    Mesh mesh;
+    mesh.positions.resize(planeOffsets.back());
+    mesh.normals.resize(planeOffsets.back());
+
+    // Vertex of the crossed edge along each axis of every voxel of a plane (only valid for crossed edges).
+    using EdgeCache = std::array<std::vector<uint32_t, DefaultInitAllocator<uint32_t>>, 3>;
+    const size_t planeSize = size_t(dim.x) * size_t(dim.y);
+    tbb::enumerable_thread_specific<std::pair<EdgeCache, EdgeCache>> threadEdgeCaches;
+    const auto fillEdgeCache = [&](int z, EdgeCache& cache, bool computeVertices) {
+        for (auto& axisCache : cache)
+            axisCache.resize(planeSize);
+        uint32_t vertex = planeOffsets[size_t(z)];
+        forEachCrossedEdge(z, [&](int x, int y, int axis) {
+            cache[size_t(axis)][size_t(x) + size_t(dim.x) * size_t(y)] = vertex;
+            if (computeVertices) {
+                const glm::ivec3 voxel0 { x, y, z };
+                glm::ivec3 voxel1 = voxel0;
+                voxel1[axis]++;
+                const float value0 = float(voxels[size_t(voxel0.x) + planeSize * size_t(voxel0.z) + size_t(dim.x) * size_t(voxel0.y)]);
+                const float value1 = float(voxels[size_t(voxel1.x) + planeSize * size_t(voxel1.z) + size_t(dim.x) * size_t(voxel1.y)]);
+                const glm::vec3 position = glm::mix(glm::vec3(voxel0), glm::vec3(voxel1), (isoValue - value0) / (value1 - value0));
+                const glm::vec3 gradient = gradientVolume.getGradientInterpolate<InterpolationMode::Linear>(position).dir;
+                mesh.positions[vertex] = position;
+                mesh.normals[vertex] = glm::length(gradient) > 0.0f ? -glm::normalize(gradient) : glm::vec3(0.0f);
+            }
+            vertex++;
+        });
+    };
+
+    const int slabSize = cellSize;
+    const int numSlabs = (dim.z + slabSize - 1) / slabSize;
+    std::vector<std::vector<glm::uvec3>> slabTriangles;
+    slabTriangles.resize(size_t(numSlabs));
+    tbb::parallel_for(0, numSlabs, [&](int slab) {
+        auto& [current, next] = threadEdgeCaches.local();
+        std::vector<glm::uvec3>& triangles = slabTriangles[size_t(slab)];
+        const int z0 = slab * slabSize, z1 = std::min(z0 + slabSize, dim.z);
+        fillEdgeCache(z0, current, true);
+        for (int z = z0; z < z1 && z + 1 < dim.z; z++) {
+            fillEdgeCache(z + 1, next, z + 1 < z1);
+
+            const auto edgeVertex = [&](int x, int y, int edge) {
+                const glm::ivec3 corner = glm::ivec3(cornerPosition(cubeEdges[size_t(edge)][0])) + glm::ivec3(x, y, 0);
+                const EdgeCache& cache = corner.z ? next : current;
+                return cache[size_t(edge / 4)][size_t(corner.x) + size_t(dim.x) * size_t(corner.y)];
+            };
+            forEachActiveVoxel(z, dim.y - 1, dim.x - 1, [&](int x, int y) {
+                int config = 0;
+                for (int corner = 0; corner < 8; corner++) {
+                    if (isInside(x + (corner & 1), y + ((corner >> 1) & 1), z + (corner >> 2)))
+                        config |= 1 << corner;
+                }
+                const CubeCase& cubeCase = cubeCases[size_t(config)];
+                for (size_t i = 0; i < size_t(cubeCase.numTriangles) * 3; i += 3)
+                    triangles.emplace_back(edgeVertex(x, y, cubeCase.edges[i]), edgeVertex(x, y, cubeCase.edges[i + 1]), edgeVertex(x, y, cubeCase.edges[i + 2]));
+            });
+            std::swap(current, next);
+        }
+    });
+
+    for (const std::vector<glm::uvec3>& triangles : slabTriangles)
+        mesh.triangles.insert(std::end(mesh.triangles), std::begin(triangles), std::end(triangles));
+    return mesh;
+}
+
+static bool writePLY(const Mesh& mesh, const std::filesystem::path& file)
+{
+    std::ofstream stream { file, std::ios::binary };
+    if (!stream)
+        return false;
+    stream << "ply\n"
+           << "format binary_little_endian 1.0\n"
+           << "element vertex " << mesh.positions.size() << "\n"
+           << "property float x\nproperty float y\nproperty float z\n"
+           << "property float nx\nproperty float ny\nproperty float nz\n"
+           << "element face " << mesh.triangles.size() << "\n"
+           << "property list uchar uint vertex_indices\n"
+           << "end_header\n";
+
+    std::vector<glm::vec3> vertices;
+    vertices.reserve(mesh.positions.size() * 2);
+    for (size_t i = 0; i < mesh.positions.size(); i++) {
+        vertices.push_back(mesh.positions[i]);
+        vertices.push_back(mesh.normals[i]);
+    }
+    stream.write(reinterpret_cast<const char*>(vertices.data()), std::streamsize(vertices.size() * sizeof(glm::vec3)));
+
+    // Every face is a count (3) followed by three indices, without padding.
+    static constexpr size_t faceSize = 1 + 3 * sizeof(uint32_t);
+    std::vector<char> faces(mesh.triangles.size() * faceSize);
+    for (size_t i = 0; i < mesh.triangles.size(); i++) {
+        faces[i * faceSize] = 3;
+        std::copy_n(reinterpret_cast<const char*>(&mesh.triangles[i]), 3 * sizeof(uint32_t), &faces[i * faceSize + 1]);
+    }
+    stream.write(faces.data(), std::streamsize(faces.size()));
+    return bool(stream);
+}
+
+static bool writeOBJ(const Mesh& mesh, const std::filesystem::path& file)
+{
+    std::ofstream stream { file };
+    if (!stream)
+        return false;
+    // Formatted into a buffer that is written whenever it holds a few megabytes.
+    fmt::memory_buffer buffer;
+    const auto flush = [&](size_t threshold) {
+        if (buffer.size() >= threshold) {
+            stream.write(buffer.data(), std::streamsize(buffer.size()));
+            buffer.clear();
+        }
+    };
+    static constexpr size_t flushSize = size_t(1) << 22;
+    for (const glm::vec3& position : mesh.positions) {
+        fmt::format_to(std::back_inserter(buffer), "v {} {} {}\n", position.x, position.y, position.z);
+        flush(flushSize);
+    }
+    for (const glm::vec3& normal : mesh.normals) {
+        fmt::format_to(std::back_inserter(buffer), "vn {} {} {}\n", normal.x, normal.y, normal.z);
+        flush(flushSize);
+    }
+    // OBJ indices start at 1.
+    for (const glm::uvec3& triangle : mesh.triangles) {
+        fmt::format_to(std::back_inserter(buffer), "f {0}//{0} {1}//{1} {2}//{2}\n", triangle.x + 1, triangle.y + 1, triangle.z + 1);
+        flush(flushSize);
+    }
+    flush(0);
+    return bool(stream);
+}
+
+bool writeMesh(const Mesh& mesh, const std::filesystem::path& file)
+{
+    const std::filesystem::path extension = file.extension();
+    if (extension == ".ply")
+        return writePLY(mesh, file);
+    if (extension == ".obj")
+        return writeOBJ(mesh, file);
+    std::cerr << "Unsupported mesh format " << extension << " (expected .ply or .obj)" << std::endl;
+    return false;
+}
+
+}
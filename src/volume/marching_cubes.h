@@ -0,0 +1,28 @@
+#pragma once
+#include "gradient_volume.h"
+#include "volume.h"
+#include <filesystem>
+#include <glm/vec3.hpp>
+#include <vector>
+
+namespace volume {
+
+// Indexed triangle mesh in voxel coordinates (like the renderer). The triangles are wound counter-clockwise when seen
+// from outside the surface, and the normals point outwards, towards lower values.
+struct Mesh {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::uvec3> triangles;
+};
+
+// Extracts the iso surface with marching cubes, where voxels with a value of at least the iso value are inside (like
+// the hits of the iso renderer). Every vertex is shared by all triangles that use it, and the surface is closed
+// wherever it does not leave the volume. The normals are the interpolated gradients at the vertices. Only the macro
+// cells that the surface passes through are visited (see SpanSpaceIndex). Parallel over slabs of the volume; needs
+// the voxels in memory, so streamed volumes are not supported.
+Mesh extractIsoSurface(const Volume& volume, const GradientVolume& gradientVolume, float isoValue);
+
+// Binary (little-endian) PLY with vertex normals, or Wavefront OBJ; selected by the extension (.ply or .obj).
+bool writeMesh(const Mesh& mesh, const std::filesystem::path& file);
+
+}
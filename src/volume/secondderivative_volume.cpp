@@ -1,109 +1,163 @@
 #include "secondderivative_volume.h"
-#include "gradient_volume.h"
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
 #include <exception>
 #include <glm/glm.hpp>
 #include <glm/geometric.hpp>
 #include <glm/vector_relational.hpp>
 #include <gsl/span>
 #include <iostream>
+#include <limits>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <utility>
 
 namespace volume {
 
 // Compute the maximum magnitude from all Second Derivative voxels
 static float computeMaxMagnitude(gsl::span<const SecondDerivativeVoxel> data)
 {
-    return std::max_element(
-        std::begin(data),
-        std::end(data),
-        [](const SecondDerivativeVoxel& lhs, const SecondDerivativeVoxel& rhs) {
-            return lhs.magnitude < rhs.magnitude;
-        })
-        ->magnitude;
+    return tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, data.size()), std::numeric_limits<float>::lowest(),
+        [&](const tbb::blocked_range<size_t>& range, float maxMagnitude) {
+            for (size_t i = std::begin(range); i != std::end(range); i++)
+                maxMagnitude = std::max(maxMagnitude, data[i].magnitude);
+            return maxMagnitude;
+        },
+        [](float lhs, float rhs) { return std::max(lhs, rhs); });
 }
 
 // Compute the minimum magnitude from all Second Derivative voxels
 static float computeMinMagnitude(gsl::span<const SecondDerivativeVoxel> data)
 {
-    return std::min_element(
-        std::begin(data),
-        std::end(data),
-        [](const SecondDerivativeVoxel& lhs, const SecondDerivativeVoxel& rhs) {
-            return lhs.magnitude < rhs.magnitude;
-        })
-        ->magnitude;
+    return tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, data.size()), std::numeric_limits<float>::max(),
+        [&](const tbb::blocked_range<size_t>& range, float minMagnitude) {
+            for (size_t i = std::begin(range); i != std::end(range); i++)
+                minMagnitude = std::min(minMagnitude, data[i].magnitude);
+            return minMagnitude;
+        },
+        [](float lhs, float rhs) { return std::min(lhs, rhs); });
 }
 
-// Compute a second derivative volume from a volume, 
+// Compute z-slice z of the second derivative volume from the gradients of slices z - 1, z and z + 1,
 // based on the method raised in "Multi-Dimensional Transfer Functions for Interactive Volume Rendering", Joe Kniss et. al.
-static std::vector<SecondDerivativeVoxel> computeSecondDerivativeVolume(const Volume& volume)
+static void computeSecondDerivativeSlice(const Volume& volume, int z, const GradientVoxel* pPrevZ, const GradientVoxel* pSlice,
+    const GradientVoxel* pNextZ, SecondDerivativeVoxel* pOut)
 {
     const auto dim = volume.dims();
-
-    std::vector<GradientVoxel> gradients(static_cast<size_t>(dim.x * dim.y * dim.z));
-    std::vector<SecondDerivativeVoxel> out(static_cast<size_t>(dim.x * dim.y * dim.z));
-
-    // calculate gradient
-    for (int z = 1; z < dim.z - 1; z++) {
-        for (int y = 1; y < dim.y - 1; y++) {
-            for (int x = 1; x < dim.x - 1; x++) {
-                const float gx = (volume.getVoxel(x + 1, y, z) - volume.getVoxel(x - 1, y, z)) / 2.0f;
-                const float gy = (volume.getVoxel(x, y + 1, z) - volume.getVoxel(x, y - 1, z)) / 2.0f;
-                const float gz = (volume.getVoxel(x, y, z + 1) - volume.getVoxel(x, y, z - 1)) / 2.0f;
-                const glm::vec3 gradient { gx, gy, gz };
-                const size_t index = static_cast<size_t>(x + dim.x * (y + dim.y * z));
-                gradients[index] = GradientVoxel { gradient, glm::length(gradient) };
-                //gradients[index] = SecondDerivativeVoxel { gradient, glm::length(gradient) };
-            }
+    const size_t sliceSize = size_t(dim.x) * size_t(dim.y);
+    std::fill(pOut, pOut + sliceSize, SecondDerivativeVoxel { 0.0f });
+    if (z == 0 || z == dim.z - 1)
+        return;
+
+    for (int y = 1; y < dim.y - 1; y++) {
+        for (int x = 1; x < dim.x - 1; x++) {
+            const size_t index = size_t(x) + size_t(dim.x) * size_t(y);
+            const GradientVoxel& gradient = pSlice[index];
+            // The second derivative along a zero gradient is undefined (0 / 0), treat it as zero.
+            if (gradient.magnitude == 0.0f)
+                continue;
+
+            // calculate Hassian matrix (2nd partial derivatives)
+            const glm::vec3 dx = (pSlice[index + 1].dir - pSlice[index - 1].dir) / 2.0f;
+            const glm::vec3 dy = (pSlice[index + size_t(dim.x)].dir - pSlice[index - size_t(dim.x)].dir) / 2.0f;
+            const glm::vec3 dz = (pNextZ[index].dir - pPrevZ[index].dir) / 2.0f;
+            const glm::mat3 H { glm::vec3(dx.x, dy.x, dz.x), glm::vec3(dx.y, dy.y, dz.y), glm::vec3(dx.z, dy.z, dz.z) };
+
+            // the calculation method presented in the paper.
+            const float intensity = volume.getVoxel(x, y, z);
+            const float secondDeriv = glm::dot(H * intensity * gradient.dir, gradient.dir) / (gradient.magnitude * gradient.magnitude);
+            // normalize(compress the range) the absolute second derivatives to make the histogram visible
+            pOut[index] = SecondDerivativeVoxel { std::sqrt(std::abs(secondDeriv)) };
         }
     }
+}
 
-    // calculate second derivative
-    for (int z = 1; z < dim.z - 1; z++) {
-        for (int y = 1; y < dim.y - 1; y++) {
-            for (int x = 1; x < dim.x - 1; x++) {
-                glm::mat3 H = glm::mat3(1.0f);
-                const float intensity = volume.getVoxel(x, y, z);
-                const size_t index = static_cast<size_t>(x + dim.x * (y + dim.y * z));
-                const size_t index_upper_x = static_cast<size_t>(x + 1 + dim.x * (y + dim.y * z));
-                const size_t index_lower_x = static_cast<size_t>(x - 1 + dim.x * (y + dim.y * z));
-                const size_t index_upper_y = static_cast<size_t>(x + dim.x * (y + 1 + dim.y * z));
-                const size_t index_lower_y = static_cast<size_t>(x + dim.x * (y - 1 + dim.y * z));
-                const size_t index_upper_z = static_cast<size_t>(x + dim.x * (y + dim.y * (z + 1)));
-                const size_t index_lower_z = static_cast<size_t>(x + dim.x * (y + dim.y * (z - 1)));
-
-                // calculate Hassian matrix (2nd partial derivatives)
-                H[0][0] = (gradients[index_upper_x].dir[0] - gradients[index_lower_x].dir[0]) / 2.0f;
-                H[0][1] = (gradients[index_upper_y].dir[0] - gradients[index_lower_y].dir[0]) / 2.0f;
-                H[0][2] = (gradients[index_upper_z].dir[0] - gradients[index_lower_z].dir[0]) / 2.0f;
-
-                H[1][0] = (gradients[index_upper_x].dir[1] - gradients[index_lower_x].dir[1]) / 2.0f;
-                H[1][1] = (gradients[index_upper_y].dir[1] - gradients[index_lower_y].dir[1]) / 2.0f;
-                H[1][2] = (gradients[index_upper_z].dir[1] - gradients[index_lower_z].dir[1]) / 2.0f;
-
-                H[2][0] = (gradients[index_upper_x].dir[2] - gradients[index_lower_x].dir[2]) / 2.0f;
-                H[2][1] = (gradients[index_upper_y].dir[2] - gradients[index_lower_y].dir[2]) / 2.0f;
-                H[2][2] = (gradients[index_upper_z].dir[2] - gradients[index_lower_z].dir[2]) / 2.0f;
-
-                // the calculation method presented in the paper.
-                const float secondDeriv = glm::dot(H * intensity * gradients[index].dir, gradients[index].dir) / pow(gradients[index].magnitude, 2);
-                // normalize(compress the range) the absolute second derivatives to make the histogram visible
-                out[index] = SecondDerivativeVoxel { sqrt(abs(secondDeriv)) };
-            }
+// Compute a second derivative volume from the gradients of an existing gradient volume. The slices are independent
+// and computed in parallel.
+static std::vector<SecondDerivativeVoxel, DefaultInitAllocator<SecondDerivativeVoxel>> computeSecondDerivativeVolume(
+    const Volume& volume, const GradientVolume& gradientVolume)
+{
+    const auto dim = volume.dims();
+    assert(gradientVolume.dims() == dim);
+    const size_t sliceSize = size_t(dim.x) * size_t(dim.y);
+    const GradientVoxel* pGradients = gradientVolume.data().data();
+
+    std::vector<SecondDerivativeVoxel, DefaultInitAllocator<SecondDerivativeVoxel>> out(sliceSize * size_t(dim.z));
+    tbb::parallel_for(tbb::blocked_range<int>(0, dim.z), [&](const tbb::blocked_range<int>& range) {
+        for (int z = std::begin(range); z != std::end(range); z++) {
+            // The neighbouring slices are only read for inner slices.
+            const auto slice = [&](int sliceZ) { return pGradients + size_t(std::clamp(sliceZ, 0, dim.z - 1)) * sliceSize; };
+            computeSecondDerivativeSlice(volume, z, slice(z - 1), slice(z), slice(z + 1), out.data() + size_t(z) * sliceSize);
         }
-    }
+    });
+    return out;
+}
 
+// Compute a second derivative volume without a gradient volume. Every task processes a slab of slices and computes the
+// gradients on the fly in a window of three slices (z - 1, z and z + 1) that moves along with z.
+static std::vector<SecondDerivativeVoxel, DefaultInitAllocator<SecondDerivativeVoxel>> computeSecondDerivativeVolume(const Volume& volume)
+{
+    const auto dim = volume.dims();
+    const size_t sliceSize = size_t(dim.x) * size_t(dim.y);
+    // Every slab computes two gradient slices more than it consumes, so do not split the volume too finely.
+    constexpr int minSlabSize = 8;
+
+    std::vector<SecondDerivativeVoxel, DefaultInitAllocator<SecondDerivativeVoxel>> out(sliceSize * size_t(dim.z));
+    tbb::parallel_for(tbb::blocked_range<int>(0, dim.z, minSlabSize), [&](const tbb::blocked_range<int>& range) {
+        std::array<std::vector<GradientVoxel, DefaultInitAllocator<GradientVoxel>>, 3> window;
+        for (auto& slice : window)
+            slice.resize(sliceSize);
+        const auto computeWindowSlice = [&](int z) {
+            if (z >= 0 && z < dim.z)
+                computeGradientSlice(volume, z, window[size_t(z + 3) % 3]);
+        };
+
+        computeWindowSlice(std::begin(range) - 1);
+        computeWindowSlice(std::begin(range));
+        for (int z = std::begin(range); z != std::end(range); z++) {
+            computeWindowSlice(z + 1);
+            computeSecondDerivativeSlice(volume, z,
+                window[size_t(z + 2) % 3].data(), window[size_t(z + 3) % 3].data(), window[size_t(z + 4) % 3].data(),
+                out.data() + size_t(z) * sliceSize);
+        }
+    });
     return out;
 }
 
 SecondDerivativeVolume::SecondDerivativeVolume(const Volume& volume)
     : m_dim(volume.dims())
     , m_data(computeSecondDerivativeVolume(volume))
+    , m_voxels(m_data)
+    , m_minMagnitude(computeMinMagnitude(m_data))
+    , m_maxMagnitude(computeMaxMagnitude(m_data))
+{
+}
+
+// Quantized gradients are not reused: the second derivative is computed from the exact (floating point) gradients.
+SecondDerivativeVolume::SecondDerivativeVolume(const Volume& volume, const GradientVolume& gradientVolume)
+    : m_dim(volume.dims())
+    , m_data(gradientVolume.storage() == GradientStorage::Float ? computeSecondDerivativeVolume(volume, gradientVolume) : computeSecondDerivativeVolume(volume))
+    , m_voxels(m_data)
     , m_minMagnitude(computeMinMagnitude(m_data))
     , m_maxMagnitude(computeMaxMagnitude(m_data))
 {
 }
 
+SecondDerivativeVolume::SecondDerivativeVolume(const glm::ivec3& dim, gsl::span<const SecondDerivativeVoxel> data, float minMagnitude, float maxMagnitude, std::shared_ptr<const void> pStorage)
+    : m_dim(dim)
+    , m_pStorage(std::move(pStorage))
+    , m_voxels(data)
+    , m_minMagnitude(minMagnitude)
+    , m_maxMagnitude(maxMagnitude)
+{
+    assert(m_voxels.size() == size_t(dim.x) * size_t(dim.y) * size_t(dim.z));
+}
+
 float SecondDerivativeVolume::maxMagnitude() const
 {
     return m_maxMagnitude;
@@ -119,6 +173,11 @@ glm::ivec3 SecondDerivativeVolume::dims() const
     return m_dim;
 }
 
+gsl::span<const SecondDerivativeVoxel> SecondDerivativeVolume::data() const
+{
+    return m_voxels;
+}
+
 // This function returns a gradientVoxel at coord based on the current interpolation mode.
 SecondDerivativeVoxel SecondDerivativeVolume::getSecondDerivativeInterpolate(const glm::vec3& coord) const
 {
@@ -212,6 +271,6 @@ SecondDerivativeVoxel SecondDerivativeVolume::linearInterpolate(const SecondDeri
 SecondDerivativeVoxel SecondDerivativeVolume::getSecondDerivative(int x, int y, int z) const
 {
     const size_t i = static_cast<size_t>(x + m_dim.x * (y + m_dim.y * z));
-    return m_data[i];
+    return m_voxels[i];
 }
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
 #pragma once
+#include "default_init_allocator.h"
+#include "gradient_volume.h"
 #include "volume.h"
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
+#include <gsl/span>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -16,14 +20,26 @@ public:
     InterpolationMode interpolationMode { InterpolationMode::NearestNeighbour };
 
 public:
+    // Computes the gradients on the fly, keeping only a window of three gradient slices in memory per thread.
     SecondDerivativeVolume(const Volume& volume);
+    // Reuses the gradients of an existing gradient volume of the same volume (if it uses GradientStorage::Float).
+    SecondDerivativeVolume(const Volume& volume, const GradientVolume& gradientVolume);
+    // Second derivatives that were computed before (see VolumeContainer). The data is not copied and must stay valid
+    // for as long as pStorage is alive.
+    SecondDerivativeVolume(const glm::ivec3& dim, gsl::span<const SecondDerivativeVoxel> data, float minMagnitude, float maxMagnitude, std::shared_ptr<const void> pStorage);
+    // m_voxels may point into m_data, which a copy would not update.
+    SecondDerivativeVolume(const SecondDerivativeVolume&) = delete;
 
+    SecondDerivativeVoxel getSecondDerivativeInterpolate(const glm::vec3& coord) const;
+    // Same as getSecondDerivativeInterpolate but with the interpolation mode fixed at compile time.
+    template <InterpolationMode mode>
     SecondDerivativeVoxel getSecondDerivativeInterpolate(const glm::vec3& coord) const;
     SecondDerivativeVoxel getSecondDerivative(int x, int y, int z) const;
 
     float minMagnitude() const;
     float maxMagnitude() const;
     glm::ivec3 dims() const;
+    gsl::span<const SecondDerivativeVoxel> data() const;
 
 protected:
     SecondDerivativeVoxel getSecondDerivativeNearestNeighbor(const glm::vec3& coord) const;
@@ -32,7 +48,20 @@ protected:
 
 protected:
     const glm::ivec3 m_dim;
-    const std::vector<SecondDerivativeVoxel> m_data;
+    const std::vector<SecondDerivativeVoxel, DefaultInitAllocator<SecondDerivativeVoxel>> m_data;
+    // View of either m_data or of memory owned by m_pStorage.
+    const std::shared_ptr<const void> m_pStorage;
+    const gsl::span<const SecondDerivativeVoxel> m_voxels;
     const float m_minMagnitude, m_maxMagnitude;
 };
+
+template <InterpolationMode mode>
+SecondDerivativeVoxel SecondDerivativeVolume::getSecondDerivativeInterpolate(const glm::vec3& coord) const
+{
+    // No cubic in this case, linear is good enough for the second derivative.
+    if constexpr (mode == InterpolationMode::NearestNeighbour)
+        return getSecondDerivativeNearestNeighbor(coord);
+    else
+        return getSecondDerivativeLinearInterpolate(coord);
+}
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "span_space_index.h"
+#include <algorithm>
+#include <cassert>
+#include <gsl/span>
+#include <tbb/parallel_for.h>
+
+namespace volume {
+
+SpanSpaceIndex::SpanSpaceIndex(const MacroCellGrid& grid, int numBuckets)
+{
+    assert(numBuckets > 0);
+    const gsl::span<const MacroCell> cells = grid.cells();
+    uint16_t maxValue = 0;
+    for (const MacroCell& cell : cells)
+        maxValue = std::max(maxValue, cell.max);
+    // The buckets are spread over the values that occur, so that byte volumes use as many buckets as 16-bit ones.
+    m_bucketWidth = std::max((int(maxValue) + numBuckets) / numBuckets, 1);
+    const auto bucketOf = [&](const MacroCell& cell) { return size_t(cell.min / m_bucketWidth); };
+
+    // Counting sort by bucket, then sort every bucket by decreasing maximum.
+    m_bucketOffsets.assign(size_t(numBuckets) + 1, 0);
+    for (const MacroCell& cell : cells)
+        m_bucketOffsets[bucketOf(cell) + 1]++;
+    for (size_t bucket = 0; bucket < size_t(numBuckets); bucket++)
+        m_bucketOffsets[bucket + 1] += m_bucketOffsets[bucket];
+
+    m_entries.resize(cells.size());
+    std::vector<uint32_t> next(std::begin(m_bucketOffsets), std::end(m_bucketOffsets) - 1);
+    for (size_t i = 0; i < cells.size(); i++)
+        m_entries[next[bucketOf(cells[i])]++] = Entry { cells[i].min, cells[i].max, uint32_t(i) };
+    tbb::parallel_for(size_t(0), size_t(numBuckets), [&](size_t bucket) {
+        std::sort(std::begin(m_entries) + m_bucketOffsets[bucket], std::begin(m_entries) + m_bucketOffsets[bucket + 1],
+            [](const Entry& lhs, const Entry& rhs) { return lhs.max > rhs.max; });
+    });
+}
+
+std::vector<uint32_t> SpanSpaceIndex::findCells(float lo, float hi) const
+{
+    std::vector<uint32_t> out;
+    forEachCell(lo, hi, [&](uint32_t cell) { out.push_back(cell); });
+    return out;
+}
+
+size_t SpanSpaceIndex::countCells(float lo, float hi) const
+{
+    size_t count = 0;
+    forEachCell(lo, hi, [&](uint32_t) { count++; });
+    return count;
+}
+
+}
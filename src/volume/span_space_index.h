@@ -0,0 +1,57 @@
+#pragma once
+#include "macro_cell_grid.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace volume {
+
+// Span space index over the cells of a MacroCellGrid (Livnat et al., "A Near Optimal Isosurface Extraction Algorithm
+// Using the Span Space"). Every cell is a point (min, max) in span space; the cells are bucketed by their minimum and
+// sorted by decreasing maximum within a bucket. A query visits the buckets up to the query value and stops in every
+// bucket at the first cell whose maximum is too low, so it only touches the cells that it returns (plus one per bucket
+// and the cells of the last bucket).
+class SpanSpaceIndex {
+public:
+    static constexpr int defaultNumBuckets = 256;
+
+    SpanSpaceIndex() = default;
+    explicit SpanSpaceIndex(const MacroCellGrid& grid, int numBuckets = defaultNumBuckets);
+
+    // Calls f(cell) for every cell that contains both a value of at least lo and a value below hi, where cell is the
+    // index into MacroCellGrid::cells(). The cells are visited in no particular order. For lo == hi these are the
+    // cells that the iso surface of that value passes through; with hi = infinity the cells that have a value of at
+    // least lo.
+    template <typename F>
+    void forEachCell(float lo, float hi, F&& f) const;
+    std::vector<uint32_t> findCells(float lo, float hi) const;
+    size_t countCells(float lo, float hi) const;
+
+private:
+    struct Entry {
+        uint16_t min, max;
+        uint32_t cell;
+    };
+
+    // Bucket b holds the cells with a minimum in [b * bucketWidth, (b + 1) * bucketWidth).
+    int m_bucketWidth { 1 };
+    std::vector<uint32_t> m_bucketOffsets;
+    std::vector<Entry> m_entries;
+};
+
+template <typename F>
+void SpanSpaceIndex::forEachCell(float lo, float hi, F&& f) const
+{
+    const size_t numBuckets = m_bucketOffsets.empty() ? 0 : m_bucketOffsets.size() - 1;
+    for (size_t bucket = 0; bucket < numBuckets && float(bucket * size_t(m_bucketWidth)) < hi; bucket++) {
+        for (uint32_t i = m_bucketOffsets[bucket]; i < m_bucketOffsets[bucket + 1]; i++) {
+            const Entry& entry = m_entries[i];
+            if (float(entry.max) < lo)
+                break;
+            if (float(entry.min) < hi)
+                f(entry.cell);
+        }
+    }
+}
+
+}
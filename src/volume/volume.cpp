@@ -1,6 +1,9 @@
 #include "volume.h"
+#include "mapped_file.h"
+#include "volume_container.h"
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
 #include <cctype> // isspace
 #include <chrono>
@@ -9,33 +12,43 @@
 #include <glm/glm.hpp>
 #include <gsl/span>
 #include <iostream>
+#include <limits>
 #include <string>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
 
 struct Header {
     glm::ivec3 dim;
     size_t elementSize;
 };
 static Header readHeader(std::ifstream& ifs);
-static float computeMinimum(gsl::span<const uint16_t> data);
-static float computeMaximum(gsl::span<const uint16_t> data);
-static std::vector<int> computeHistogram(gsl::span<const uint16_t> data);
 
 namespace volume {
 
-Volume::Volume(const std::filesystem::path& file)
+Volume::Volume(const std::filesystem::path& file, LoadMode loadMode, size_t brickCacheSize)
     : m_fileName(file.string())
 {
     using clock = std::chrono::high_resolution_clock;
     auto start = clock::now();
-    loadFile(file);
+    if (isVolumeContainerFile(file)) {
+        openContainer(file, loadMode, brickCacheSize);
+    } else if (isBrickedVolumeFile(file)) {
+        openBrickCache(file, brickCacheSize);
+    } else if (loadMode != LoadMode::MemoryMap || !mapFile(file)) {
+        // Fall back to reading the file if it cannot be mapped.
+        loadFile(file);
+    }
     auto end = clock::now();
-    std::cout << "Time to load: " << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+    std::cout << "Time to load: " << std::chrono::duration<double, std::milli>(end - start).count() << "ms"
+              << " (peak RSS: " << peakResidentSetSize() / (1024 * 1024) << "MB" << (m_pMappedFile ? ", memory mapped" : "") << (m_pBrickCache ? ", streamed" : "") << ")" << std::endl;
 
-    if (m_data.size() > 0) {
-        m_minimum = computeMinimum(m_data);
-        m_maximum = computeMaximum(m_data);
-        m_histogram = computeHistogram(m_data);
+    // Containers store the statistics.
+    if (!data().empty() && !m_pContainer) {
+        computeStatistics();
+        m_macroCells = MacroCellGrid(data(), m_dim);
     }
+    m_spanSpaceIndex = SpanSpaceIndex(m_macroCells);
 }
 
 Volume::Volume(std::vector<uint16_t> data, const glm::ivec3& dim)
@@ -43,10 +56,11 @@ Volume::Volume(std::vector<uint16_t> data, const glm::ivec3& dim)
     , m_elementSize(2)
     , m_dim(dim)
     , m_data(std::move(data))
-    , m_minimum(computeMinimum(m_data))
-    , m_maximum(computeMaximum(m_data))
-    , m_histogram(computeHistogram(m_data))
+    , m_pVoxels(m_data.data())
+    , m_macroCells(m_data, m_dim)
+    , m_spanSpaceIndex(m_macroCells)
 {
+    computeStatistics();
 }
 
 float Volume::minimum() const
@@ -59,11 +73,52 @@ float Volume::maximum() const
     return m_maximum;
 }
 
-std::vector<int> Volume::histogram() const
+// Number of voxels per value [0, maximum()].
+gsl::span<const int> Volume::histogram() const
 {
     return m_histogram;
 }
 
+// Histogram with at most numBins bins of equal width over [0, maximum()], for example one bin per pixel of a widget.
+std::vector<int> Volume::binnedHistogram(int numBins) const
+{
+    assert(numBins > 0);
+    const size_t numValues = m_histogram.size();
+    const size_t numOutBins = std::min(size_t(numBins), numValues);
+    std::vector<int> bins(numOutBins, 0);
+    for (size_t value = 0; value < numValues; value++)
+        bins[value * numOutBins / numValues] += m_histogram[value];
+    return bins;
+}
+
+// Smallest value such that at least the given fraction [0, 1] of the voxels is less than or equal to it.
+float Volume::percentile(float fraction) const
+{
+    size_t numVoxels = 0;
+    for (const int count : m_histogram)
+        numVoxels += size_t(count);
+    const double threshold = std::clamp(double(fraction), 0.0, 1.0) * double(numVoxels);
+    size_t cumulative = 0;
+    for (size_t value = 0; value < m_histogram.size(); value++) {
+        cumulative += size_t(m_histogram[value]);
+        if (m_histogram[value] > 0 && double(cumulative) >= threshold)
+            return float(value);
+    }
+    return m_maximum;
+}
+
+// Per block minimum/maximum values, used by the renderer to skip over empty space.
+const MacroCellGrid& Volume::macroCells() const
+{
+    return m_macroCells;
+}
+
+// Index of the macro cells by their value range, to find the cells that an iso surface passes through.
+const SpanSpaceIndex& Volume::spanSpaceIndex() const
+{
+    return m_spanSpaceIndex;
+}
+
 glm::ivec3 Volume::dims() const
 {
     return m_dim;
@@ -74,10 +129,64 @@ std::string_view Volume::fileName() const
     return m_fileName;
 }
 
+// Return a VIEW of the voxels in x-major order, regardless of whether they are owned or memory mapped.
+gsl::span<const uint16_t> Volume::data() const
+{
+    if (!m_pVoxels)
+        return {};
+    return { m_pVoxels, size_t(m_dim.x) * size_t(m_dim.y) * size_t(m_dim.z) };
+}
+
+BrickCache* Volume::brickCache() const
+{
+    return m_pBrickCache.get();
+}
+
+std::shared_ptr<const VolumeContainer> Volume::container() const
+{
+    return m_pContainer;
+}
+
+// Build the storage for the given layout (if needed) and use it for trilinear sampling from now on.
+// brickSize is only used by the bricked layout and must be a power of two (typically 8 or 16).
+void Volume::setVoxelLayout(VoxelLayout layout, int brickSize)
+{
+    // Streamed volumes are bricked on disk already.
+    if (m_pBrickCache)
+        return;
+    switch (layout) {
+    case VoxelLayout::Linear: {
+        m_pBrickedVoxels.reset();
+        m_pMortonVoxels.reset();
+        break;
+    }
+    case VoxelLayout::Bricked: {
+        if (!m_pBrickedVoxels || m_pBrickedVoxels->brickSize() != brickSize)
+            m_pBrickedVoxels = std::make_unique<BrickedVoxels>(data(), m_dim, brickSize);
+        m_pMortonVoxels.reset();
+        break;
+    }
+    case VoxelLayout::Morton: {
+        if (!m_pMortonVoxels)
+            m_pMortonVoxels = std::make_unique<MortonVoxels>(data(), m_dim);
+        m_pBrickedVoxels.reset();
+        break;
+    }
+    };
+    m_voxelLayout = layout;
+}
+
+VoxelLayout Volume::voxelLayout() const
+{
+    return m_voxelLayout;
+}
+
 float Volume::getVoxel(int x, int y, int z) const
 {
+    if (!m_pVoxels)
+        return m_pBrickCache->getVoxel(x, y, z);
     const size_t i = size_t(x + m_dim.x * (y + m_dim.y * z));
-    return static_cast<float>(m_data[i]);
+    return static_cast<float>(m_pVoxels[i]);
 }
 
 // This function returns a value based on the current interpolation mode
@@ -124,6 +233,15 @@ float Volume::getSampleTriLinearInterpolation(const glm::vec3& coord) const
     // check if the coordinate is within volume boundaries, since we only look at direct neighbours we only need to check within 0.5
     if (glm::any(glm::lessThan(coord, glm::vec3(0))) || glm::any(glm::greaterThanEqual(coord, glm::vec3(m_dim - 1))))
         return 0.0f;
+
+    if (m_pBrickCache)
+        return m_pBrickCache->getSampleTriLinear(coord);
+    // Bricked and Morton layouts fetch the 8 corners from their own (more cache friendly) copy of the data.
+    if (m_voxelLayout == VoxelLayout::Bricked)
+        return m_pBrickedVoxels->getSampleTriLinear(coord);
+    if (m_voxelLayout == VoxelLayout::Morton)
+        return m_pMortonVoxels->getSampleTriLinear(coord);
+
     /*glm::vec3 c000 = glm::vec3(floor(coord.x), floor(coord.y), floor(coord.z));
     glm::vec3 c010 = glm::vec3(floor(coord.x), ceil(coord.y), floor(coord.z));
     glm::vec3 c100 = glm::vec3(ceil(coord.x), floor(coord.y), floor(coord.z));
@@ -201,23 +319,178 @@ void Volume::loadFile(const std::filesystem::path& file)
     m_dim = header.dim;
     m_elementSize = header.elementSize;
 
-    const size_t voxelCount = static_cast<size_t>(header.dim.x * header.dim.y * header.dim.z);
+    const size_t voxelCount = static_cast<size_t>(header.dim.x) * static_cast<size_t>(header.dim.y) * static_cast<size_t>(header.dim.z);
     const size_t byteCount = voxelCount * header.elementSize;
-    std::vector<char> buffer(byteCount);
     // Data section is separated from header by two /f characters.
     ifs.seekg(2, std::ios::cur);
-    ifs.read(buffer.data(), std::streamsize(byteCount));
 
     m_data.resize(voxelCount);
     if (header.elementSize == 1) { // Bytes.
+        std::vector<char> buffer(byteCount);
+        ifs.read(buffer.data(), std::streamsize(byteCount));
         for (size_t i = 0; i < byteCount; i++) {
             m_data[i] = static_cast<uint16_t>(buffer[i] & 0xFF);
         }
     } else if (header.elementSize == 2) { // uint16_ts.
-        for (size_t i = 0; i < byteCount; i += 2) {
-            m_data[i / 2] = static_cast<uint16_t>((buffer[i] & 0xFF) + (buffer[i + 1] & 0xFF) * 256);
+        // Read straight into the voxel array and only swap bytes if the host is not little-endian.
+        ifs.read(reinterpret_cast<char*>(m_data.data()), std::streamsize(byteCount));
+        if constexpr (std::endian::native != std::endian::little) {
+            for (auto& v : m_data)
+                v = static_cast<uint16_t>((v >> 8) | (v << 8));
         }
     }
+    m_pVoxels = m_data.data();
+}
+
+// Minimum, maximum and histogram in a single parallel pass: every thread counts its voxels in histograms of its own,
+// which are merged at the end, and the minimum and maximum are the first and last non-empty bins.
+void Volume::computeStatistics()
+{
+    constexpr size_t numValues = size_t(std::numeric_limits<uint16_t>::max()) + 1;
+    const gsl::span<const uint16_t> voxels = data();
+    // Two interleaved histograms per thread, so that runs of equal voxels (such as empty space) do not wait for the
+    // previous increment of the same counter.
+    tbb::enumerable_thread_specific<std::vector<int>> threadHistograms(2 * numValues, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, voxels.size() / 2, size_t(1) << 14), [&](const tbb::blocked_range<size_t>& range) {
+        std::vector<int>& histograms = threadHistograms.local();
+        for (size_t i = range.begin(); i < range.end(); i++) {
+            histograms[voxels[2 * i]]++;
+            histograms[numValues + voxels[2 * i + 1]]++;
+        }
+    });
+
+    std::vector<int> histogram(numValues, 0);
+    if (voxels.size() % 2 == 1)
+        histogram[voxels.back()]++;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, numValues, 4096), [&](const tbb::blocked_range<size_t>& range) {
+        for (const std::vector<int>& histograms : threadHistograms) {
+            for (size_t value = range.begin(); value < range.end(); value++)
+                histogram[value] += histograms[value] + histograms[numValues + value];
+        }
+    });
+
+    const auto isNonEmpty = [](int count) { return count > 0; };
+    const auto first = std::find_if(std::begin(histogram), std::end(histogram), isNonEmpty);
+    const auto last = std::find_if(std::rbegin(histogram), std::rend(histogram), isNonEmpty);
+    m_minimum = first != std::end(histogram) ? float(first - std::begin(histogram)) : 0.0f;
+    m_maximum = last != std::rend(histogram) ? float(std::rend(histogram) - last - 1) : 0.0f;
+    histogram.resize(size_t(m_maximum) + 1);
+    m_histogram = std::move(histogram);
+}
+
+// Open a bricked volume file for streaming. The statistics are stored in the file, so the volume is never read as a whole.
+void Volume::openBrickCache(const std::filesystem::path& file, size_t brickCacheSize, uint64_t fileOffset)
+{
+    auto pBrickCache = std::make_unique<BrickCache>(file, brickCacheSize, fileOffset);
+    if (!pBrickCache->isOpen())
+        return;
+
+    const BrickFileHeader& header = pBrickCache->header();
+    m_dim = pBrickCache->dims();
+    m_elementSize = 2;
+    m_minimum = float(header.minimum);
+    m_maximum = float(header.maximum);
+    m_histogram = pBrickCache->readHistogram();
+    m_macroCells = pBrickCache->brickBounds();
+    m_pBrickCache = std::move(pBrickCache);
+}
+
+// Open a volume container: the voxels are used in place and the statistics are read from it, so nothing is computed.
+// Containers whose source file changed since the conversion are ignored in favour of the source file.
+void Volume::openContainer(const std::filesystem::path& file, LoadMode loadMode, size_t brickCacheSize)
+{
+    auto pContainer = std::make_shared<const VolumeContainer>(file);
+    if (!pContainer->isOpen())
+        return;
+    if (pContainer->isStale()) {
+        const std::filesystem::path sourceFile = pContainer->sourceFile();
+        std::cerr << "Container " << file << " is out of date (" << sourceFile << " changed since it was converted); loading the source file instead" << std::endl;
+        if (loadMode != LoadMode::MemoryMap || !mapFile(sourceFile))
+            loadFile(sourceFile);
+        return;
+    }
+
+    const ContainerHeader& header = pContainer->header();
+    m_dim = glm::ivec3(header.dim[0], header.dim[1], header.dim[2]);
+    m_elementSize = 2;
+    if (const ContainerSection* pVoxels = pContainer->findSection(ContainerSectionType::Voxels)) {
+        m_pVoxels = pContainer->sectionData<uint16_t>(*pVoxels).data();
+        m_pMappedFile = pContainer->mappedFile();
+    } else if (const ContainerSection* pBricks = pContainer->findSection(ContainerSectionType::Bricks)) {
+        openBrickCache(file, brickCacheSize, pBricks->offset);
+        if (!m_pBrickCache)
+            return;
+    } else {
+        std::cerr << "Container " << file << " has neither voxels nor bricks" << std::endl;
+        return;
+    }
+
+    m_minimum = float(header.minimum);
+    m_maximum = float(header.maximum);
+    if (const ContainerSection* pHistogram = pContainer->findSection(ContainerSectionType::Histogram)) {
+        const auto histogram = pContainer->sectionData<int>(*pHistogram);
+        m_histogram.assign(std::begin(histogram), std::end(histogram));
+    }
+    if (const ContainerSection* pMacroCells = pContainer->findSection(ContainerSectionType::MacroCells)) {
+        const auto cells = pContainer->sectionData<MacroCell>(*pMacroCells);
+        m_macroCells = MacroCellGrid({ std::begin(cells), std::end(cells) }, glm::ivec3(pMacroCells->dim[0], pMacroCells->dim[1], pMacroCells->dim[2]), MacroCellGrid::defaultCellSize);
+    }
+    m_pContainer = std::move(pContainer);
+}
+
+// Memory map an fld volume data file. The header is parsed as usual after which the data section of the
+// mapping is used in place if it contains little-endian uint16_ts. Byte volumes are widened to uint16_ts
+// directly from the mapping so no intermediate buffer is needed. Returns false if the file could not be mapped.
+bool Volume::mapFile(const std::filesystem::path& file)
+{
+    assert(std::filesystem::exists(file));
+    std::ifstream ifs(file, std::ios::binary);
+    assert(ifs.is_open());
+
+    const auto header = readHeader(ifs);
+    const std::streamoff headerSize = ifs.tellg();
+    if (headerSize < 0)
+        return false;
+    ifs.close();
+
+    auto pMappedFile = std::make_shared<const MappedFile>(file);
+    if (!pMappedFile->isOpen())
+        return false;
+
+    const size_t voxelCount = static_cast<size_t>(header.dim.x) * static_cast<size_t>(header.dim.y) * static_cast<size_t>(header.dim.z);
+    const size_t byteCount = voxelCount * header.elementSize;
+    // Data section is separated from header by two /f characters.
+    const size_t dataOffset = static_cast<size_t>(headerSize) + 2;
+    const auto bytes = pMappedFile->bytes();
+    if (bytes.size() < dataOffset + byteCount) {
+        std::cerr << "File " << file << " is smaller than its header claims" << std::endl;
+        return false;
+    }
+    const std::byte* pPayload = bytes.data() + dataOffset;
+
+    m_dim = header.dim;
+    m_elementSize = header.elementSize;
+
+    // Zero-copy path: the header length decides whether the payload happens to be 2-byte aligned.
+    const bool aligned = reinterpret_cast<uintptr_t>(pPayload) % alignof(uint16_t) == 0;
+    if (header.elementSize == 2 && aligned && std::endian::native == std::endian::little) {
+        m_pVoxels = reinterpret_cast<const uint16_t*>(pPayload);
+        m_pMappedFile = std::move(pMappedFile);
+        return true;
+    }
+
+    m_data.resize(voxelCount);
+    const size_t elementSize = header.elementSize;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, voxelCount), [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t i = std::begin(range); i != std::end(range); i++) {
+            if (elementSize == 1) // Bytes.
+                m_data[i] = std::to_integer<uint16_t>(pPayload[i]);
+            else // Little-endian uint16_ts.
+                m_data[i] = static_cast<uint16_t>(std::to_integer<uint16_t>(pPayload[2 * i]) | (std::to_integer<uint16_t>(pPayload[2 * i + 1]) << 8));
+        }
+    });
+    m_pVoxels = m_data.data();
+    return true;
 }
 }
 
@@ -274,21 +547,3 @@ static Header readHeader(std::ifstream& ifs)
     }
     return out;
 }
-
-static float computeMinimum(gsl::span<const uint16_t> data)
-{
-    return float(*std::min_element(std::begin(data), std::end(data)));
-}
-
-static float computeMaximum(gsl::span<const uint16_t> data)
-{
-    return float(*std::max_element(std::begin(data), std::end(data)));
-}
-
-static std::vector<int> computeHistogram(gsl::span<const uint16_t> data)
-{
-    std::vector<int> histogram(size_t(*std::max_element(std::begin(data), std::end(data)) + 1), 0);
-    for (const auto v : data)
-        histogram[v]++;
-    return histogram;
-}
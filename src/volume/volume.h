@@ -1,7 +1,13 @@
 #pragma once
+#include "brick_cache.h"
+#include "macro_cell_grid.h"
+#include "span_space_index.h"
+#include "voxel_layout.h"
 #include <filesystem>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <gsl/span>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -13,21 +19,55 @@ enum class InterpolationMode {
     Cubic
 };
 
+enum class LoadMode {
+    // Read the data section of the file into memory owned by the volume.
+    Copy = 0,
+    // Memory map the file and use the (little-endian) 16-bit payload directly as voxel storage.
+    // Byte volumes are widened straight from the mapping.
+    MemoryMap
+};
+
+class MappedFile;
+class VolumeContainer;
+
 class Volume {
 public:
     // DO NOT REMOVE
     InterpolationMode interpolationMode { InterpolationMode::NearestNeighbour };
 
 public:
-    Volume(const std::filesystem::path& file);
+    // Bricked volume files (see writeBrickedVolume) are always streamed from disk through a BrickCache of
+    // brickCacheSize bytes, whatever the load mode. Streamed volumes have no data(). Volume containers (see
+    // writeVolumeContainer) are always memory mapped, and streamed if they were converted without the voxels.
+    Volume(const std::filesystem::path& file, LoadMode loadMode = LoadMode::Copy, size_t brickCacheSize = BrickCache::defaultCacheSize);
     Volume(std::vector<uint16_t> data, const glm::ivec3& dim);
+    // m_pVoxels may point into m_data, which a copy would not update.
+    Volume(const Volume&) = delete;
+    Volume(Volume&&) = default;
 
     float minimum() const;
     float maximum() const;
-    std::vector<int> histogram() const;
+    gsl::span<const int> histogram() const;
+    std::vector<int> binnedHistogram(int numBins) const;
+    float percentile(float fraction) const;
+    const MacroCellGrid& macroCells() const;
+    const SpanSpaceIndex& spanSpaceIndex() const;
     glm::ivec3 dims() const;
     std::string_view fileName() const;
+    gsl::span<const uint16_t> data() const;
+    // Only for streamed volumes (nullptr otherwise). Not const: the cache changes as the volume is sampled.
+    BrickCache* brickCache() const;
+    // Only for volumes that were loaded from a container (nullptr otherwise); see loadGradientVolume() and friends.
+    std::shared_ptr<const VolumeContainer> container() const;
+
+    // Select the storage that trilinear sampling reads from. Other layouts are built as an extra copy; the
+    // linear array stays available to getVoxel() and to passes that stream over the whole volume.
+    void setVoxelLayout(VoxelLayout layout, int brickSize = 8);
+    VoxelLayout voxelLayout() const;
 
+    float getSampleInterpolate(const glm::vec3& coord) const;
+    // Same as getSampleInterpolate but with the interpolation mode fixed at compile time.
+    template <InterpolationMode mode>
     float getSampleInterpolate(const glm::vec3& coord) const;
     float getVoxel(int x, int y, int z) const;
 
@@ -44,16 +84,44 @@ protected:
     static float weight(float x);
 
 private:
+    void computeStatistics();
     void loadFile(const std::filesystem::path& file);
+    bool mapFile(const std::filesystem::path& file);
+    void openBrickCache(const std::filesystem::path& file, size_t brickCacheSize, uint64_t fileOffset = 0);
+    void openContainer(const std::filesystem::path& file, LoadMode loadMode, size_t brickCacheSize);
 
 protected:
     const std::string m_fileName;
     size_t m_elementSize;
     glm::ivec3 m_dim;
 
+    // Voxels are either owned by the volume (m_data) or live in a memory mapped file (m_pMappedFile).
+    // All accesses go through m_pVoxels which points to whichever of the two is in use.
     std::vector<uint16_t> m_data;
+    std::shared_ptr<const MappedFile> m_pMappedFile;
+    const uint16_t* m_pVoxels { nullptr };
+    // Streamed volumes sample from the brick cache instead.
+    std::unique_ptr<BrickCache> m_pBrickCache;
+    std::shared_ptr<const VolumeContainer> m_pContainer;
+
+    VoxelLayout m_voxelLayout { VoxelLayout::Linear };
+    std::unique_ptr<const BrickedVoxels> m_pBrickedVoxels;
+    std::unique_ptr<const MortonVoxels> m_pMortonVoxels;
 
     float m_minimum, m_maximum;
     std::vector<int> m_histogram;
+    MacroCellGrid m_macroCells;
+    SpanSpaceIndex m_spanSpaceIndex;
 };
+
+template <InterpolationMode mode>
+float Volume::getSampleInterpolate(const glm::vec3& coord) const
+{
+    if constexpr (mode == InterpolationMode::NearestNeighbour)
+        return getSampleNearestNeighbourInterpolation(coord);
+    else if constexpr (mode == InterpolationMode::Linear)
+        return getSampleTriLinearInterpolation(coord);
+    else
+        return getSampleTriCubicInterpolation(coord);
+}
 }
@@ -0,0 +1,409 @@
+#include "volume_container.h"
+#include "brick_cache.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace volume {
+
+static_assert(sizeof(int) == sizeof(int32_t));
+static_assert(std::endian::native == std::endian::little, "Volume containers are stored in little-endian byte order");
+
+static uint64_t mix(uint64_t h)
+{
+    // Finalizer of MurmurHash3.
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Four independent lanes of 8 bytes each, so the multiplications of consecutive words overlap.
+static uint64_t hashBlock(gsl::span<const std::byte> bytes)
+{
+    constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull, prime2 = 0xC2B2AE3D27D4EB4Full;
+    std::array<uint64_t, 4> lanes { prime1, prime2, prime1 ^ prime2, prime1 + prime2 };
+    size_t i = 0;
+    for (; i + 32 <= bytes.size(); i += 32) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            std::memcpy(&word, bytes.data() + i + 8 * lane, sizeof(word));
+            lanes[lane] = std::rotl(lanes[lane] + word * prime2, 31) * prime1;
+        }
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes.data() + i, std::min(bytes.size() - i, sizeof(tail)));
+    for (size_t j = i + 8; j < bytes.size(); j += 8) {
+        uint64_t word = 0;
+        std::memcpy(&word, bytes.data() + j, std::min(bytes.size() - j, sizeof(word)));
+        tail = std::rotl(tail ^ mix(word), 27) * prime1;
+    }
+    return mix(std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18) + mix(tail));
+}
+
+// Blocks of 1MB are hashed in parallel and the block hashes are combined in order, so the result does not depend on
+// the number of threads.
+uint64_t computeChecksum(gsl::span<const std::byte> bytes)
+{
+    constexpr size_t blockSize = size_t(1) << 20;
+    const size_t numBlocks = (bytes.size() + blockSize - 1) / blockSize;
+    std::vector<uint64_t> blockHashes(numBlocks);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, numBlocks), [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t block = range.begin(); block < range.end(); block++) {
+            const size_t begin = block * blockSize;
+            blockHashes[block] = hashBlock(bytes.subspan(begin, std::min(blockSize, bytes.size() - begin)));
+        }
+    });
+
+    uint64_t hash = mix(bytes.size());
+    for (const uint64_t blockHash : blockHashes)
+        hash = mix(hash ^ blockHash) + 0x9E3779B97F4A7C15ull;
+    return hash;
+}
+
+bool isVolumeContainerFile(const std::filesystem::path& file)
+{
+    std::ifstream ifs(file, std::ios::binary);
+    std::array<char, 8> magic {};
+    ifs.read(magic.data(), std::streamsize(magic.size()));
+    return ifs && magic == ContainerHeader::expectedMagic;
+}
+
+template <typename T>
+static void writeSpan(std::ostream& stream, gsl::span<const T> values)
+{
+    stream.write(reinterpret_cast<const char*>(values.data()), std::streamsize(values.size_bytes()));
+}
+
+static void writeZeros(std::ostream& stream, size_t count)
+{
+    static constexpr std::array<char, ContainerHeader::sectionAlignment> zeros {};
+    for (size_t i = 0; i < count; i += zeros.size())
+        stream.write(zeros.data(), std::streamsize(std::min(zeros.size(), count - i)));
+}
+
+static void alignStream(std::ostream& stream)
+{
+    const uint64_t position = uint64_t(stream.tellp());
+    writeZeros(stream, (ContainerHeader::sectionAlignment - position % ContainerHeader::sectionAlignment) % ContainerHeader::sectionAlignment);
+}
+
+static void writeGradientVolume(std::ostream& stream, const GradientVolume& gradientVolume, ContainerSection& section)
+{
+    section.storage = uint32_t(gradientVolume.storage());
+    section.values = { gradientVolume.minMagnitude(), gradientVolume.maxMagnitude(), gradientVolume.dequantizationScale() };
+    if (gradientVolume.storage() == GradientStorage::Quantized)
+        writeSpan(stream, gradientVolume.quantizedData());
+    else
+        writeSpan(stream, gradientVolume.data());
+}
+
+// The sections are written first and the header last, so that a container that was not written completely (for
+// example because the disk is full) is not recognized as one. The checksums are computed from the written file.
+bool writeVolumeContainer(const Volume& volume, const std::filesystem::path& file, const ContainerOptions& options)
+{
+    if (volume.data().empty()) {
+        std::cerr << "Only volumes that are loaded or memory mapped can be converted" << std::endl;
+        return false;
+    }
+
+    std::ofstream stream { file, std::ios::binary | std::ios::trunc };
+    if (!stream) {
+        std::cerr << "Could not open " << file << " for writing" << std::endl;
+        return false;
+    }
+    writeZeros(stream, sizeof(ContainerHeader));
+
+    std::vector<ContainerSection> sections;
+    const auto addSection = [&](ContainerSectionType type, int level, const glm::ivec3& sectionDim, auto&& write) {
+        alignStream(stream);
+        ContainerSection section {};
+        section.type = type;
+        section.level = level;
+        section.dim = { sectionDim.x, sectionDim.y, sectionDim.z };
+        section.offset = uint64_t(stream.tellp());
+        write(section);
+        section.size = uint64_t(stream.tellp()) - section.offset;
+        sections.push_back(section);
+        return bool(stream);
+    };
+
+    const glm::ivec3 dim = volume.dims();
+    std::error_code error;
+    const std::filesystem::path sourceFile = volume.fileName().empty() ? std::filesystem::path() : std::filesystem::absolute(volume.fileName(), error);
+    if (!sourceFile.empty()) {
+        const std::string sourceFileName = sourceFile.string();
+        addSection(ContainerSectionType::SourceFile, 0, glm::ivec3(0), [&](ContainerSection&) {
+            stream.write(sourceFileName.data(), std::streamsize(sourceFileName.size()));
+        });
+    }
+    if (options.voxels)
+        addSection(ContainerSectionType::Voxels, 0, dim, [&](ContainerSection&) { writeSpan(stream, volume.data()); });
+    const gsl::span<const int> histogram = volume.histogram();
+    addSection(ContainerSectionType::Histogram, 0, glm::ivec3(int(histogram.size()), 1, 1), [&](ContainerSection&) { writeSpan(stream, histogram); });
+    addSection(ContainerSectionType::MacroCells, 0, volume.macroCells().dims(), [&](ContainerSection&) { writeSpan(stream, volume.macroCells().cells()); });
+    if (options.bricks) {
+        bool written = false;
+        addSection(ContainerSectionType::Bricks, 0, dim, [&](ContainerSection&) { written = writeBrickedVolume(volume, stream, options.brickSize); });
+        if (!written)
+            return false;
+    }
+
+    // Each derived volume is released as soon as it has been written.
+    if (options.derivedVolumes) {
+        const GradientVolume gradientVolume { volume, options.gradientStorage };
+        addSection(ContainerSectionType::Gradient, 0, dim, [&](ContainerSection& section) { writeGradientVolume(stream, gradientVolume, section); });
+        const SecondDerivativeVolume secondDerivativeVolume { volume, gradientVolume };
+        addSection(ContainerSectionType::SecondDerivative, 0, dim, [&](ContainerSection& section) {
+            section.values = { secondDerivativeVolume.minMagnitude(), secondDerivativeVolume.maxMagnitude(), 0.0f };
+            writeSpan(stream, secondDerivativeVolume.data());
+        });
+    }
+    if (options.pyramid) {
+        const VolumePyramid pyramid { volume, options.gradientStorage };
+        for (int level = 1; level < pyramid.numLevels(); level++) {
+            const Volume& levelVolume = pyramid.volume(level);
+            addSection(ContainerSectionType::PyramidLevel, level, levelVolume.dims(), [&](ContainerSection&) { writeSpan(stream, levelVolume.data()); });
+            addSection(ContainerSectionType::Gradient, level, levelVolume.dims(), [&](ContainerSection& section) { writeGradientVolume(stream, pyramid.gradientVolume(level), section); });
+        }
+    }
+    alignStream(stream);
+    const uint64_t sectionTableOffset = uint64_t(stream.tellp());
+    stream.close();
+    if (!stream) {
+        std::cerr << "Could not write " << file << std::endl;
+        return false;
+    }
+
+    {
+        const MappedFile mappedFile { file };
+        if (!mappedFile.isOpen())
+            return false;
+        for (ContainerSection& section : sections)
+            section.checksum = computeChecksum(mappedFile.bytes().subspan(section.offset, section.size));
+    }
+
+    ContainerHeader header {};
+    header.magic = ContainerHeader::expectedMagic;
+    header.version = ContainerHeader::expectedVersion;
+    header.numSections = uint32_t(sections.size());
+    header.dim = { dim.x, dim.y, dim.z };
+    header.minimum = uint16_t(volume.minimum());
+    header.maximum = uint16_t(volume.maximum());
+    if (!sourceFile.empty()) {
+        header.sourceSize = std::filesystem::file_size(sourceFile, error);
+        header.sourceTime = std::filesystem::last_write_time(sourceFile, error).time_since_epoch().count();
+    }
+    header.sectionTableOffset = sectionTableOffset;
+    header.sectionTableChecksum = computeChecksum(gsl::as_bytes(gsl::span<const ContainerSection>(sections)));
+
+    std::fstream headerStream { file, std::ios::binary | std::ios::in | std::ios::out };
+    headerStream.seekp(std::streamoff(sectionTableOffset));
+    writeSpan(headerStream, gsl::span<const ContainerSection>(sections));
+    headerStream.seekp(0);
+    headerStream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    headerStream.close();
+    if (!headerStream) {
+        std::cerr << "Could not write " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+VolumeContainer::VolumeContainer(const std::filesystem::path& file)
+    : m_file(file)
+{
+    auto pMappedFile = std::make_shared<const MappedFile>(file);
+    if (!pMappedFile->isOpen())
+        return;
+
+    const gsl::span<const std::byte> bytes = pMappedFile->bytes();
+    if (bytes.size() >= sizeof(ContainerHeader))
+        std::memcpy(&m_header, bytes.data(), sizeof(m_header));
+    if (m_header.magic != ContainerHeader::expectedMagic || m_header.version != ContainerHeader::expectedVersion) {
+        std::cerr << "File " << file << " is not a volume container (or was written by a different version)" << std::endl;
+        return;
+    }
+    const uint64_t sectionTableSize = uint64_t(m_header.numSections) * sizeof(ContainerSection);
+    if (m_header.sectionTableOffset % ContainerHeader::sectionAlignment != 0 || m_header.sectionTableOffset + sectionTableSize > bytes.size()) {
+        std::cerr << "File " << file << " is smaller than its header claims" << std::endl;
+        return;
+    }
+    m_sections = { reinterpret_cast<const ContainerSection*>(bytes.data() + m_header.sectionTableOffset), m_header.numSections };
+    if (computeChecksum(gsl::as_bytes(m_sections)) != m_header.sectionTableChecksum) {
+        std::cerr << "The section table of " << file << " is corrupt" << std::endl;
+        return;
+    }
+
+    for (const ContainerSection& section : m_sections) {
+        if (section.offset % ContainerHeader::sectionAlignment != 0 || section.offset + section.size > bytes.size()) {
+            std::cerr << "File " << file << " is smaller than its section table claims" << std::endl;
+            return;
+        }
+        // The sections that are copied when the volume is opened are checked right away.
+        const bool copied = section.type == ContainerSectionType::SourceFile || section.type == ContainerSectionType::Histogram || section.type == ContainerSectionType::MacroCells;
+        if (copied && computeChecksum(bytes.subspan(size_t(section.offset), size_t(section.size))) != section.checksum) {
+            std::cerr << "File " << file << " is corrupt" << std::endl;
+            return;
+        }
+    }
+
+    m_pMappedFile = std::move(pMappedFile);
+    m_isOpen = true;
+}
+
+bool VolumeContainer::isOpen() const
+{
+    return m_isOpen;
+}
+
+// The source file may have been moved or deleted on purpose (the container has everything needed to render the
+// volume), so only a source file that still exists can make the container stale.
+bool VolumeContainer::isStale() const
+{
+    const std::filesystem::path source = sourceFile();
+    std::error_code error;
+    if (source.empty() || !std::filesystem::exists(source, error))
+        return false;
+    const uint64_t size = std::filesystem::file_size(source, error);
+    const int64_t time = std::filesystem::last_write_time(source, error).time_since_epoch().count();
+    return !error && (size != m_header.sourceSize || time != m_header.sourceTime);
+}
+
+std::filesystem::path VolumeContainer::sourceFile() const
+{
+    const ContainerSection* pSection = findSection(ContainerSectionType::SourceFile);
+    if (!pSection)
+        return {};
+    const gsl::span<const char> name = sectionData<char>(*pSection);
+    return std::string(name.data(), name.size());
+}
+
+const ContainerHeader& VolumeContainer::header() const
+{
+    return m_header;
+}
+
+gsl::span<const ContainerSection> VolumeContainer::sections() const
+{
+    return m_sections;
+}
+
+const ContainerSection* VolumeContainer::findSection(ContainerSectionType type, int level) const
+{
+    const auto iter = std::find_if(std::begin(m_sections), std::end(m_sections),
+        [&](const ContainerSection& section) { return section.type == type && section.level == level; });
+    return iter != std::end(m_sections) ? &*iter : nullptr;
+}
+
+gsl::span<const std::byte> VolumeContainer::sectionBytes(const ContainerSection& section) const
+{
+    return m_pMappedFile->bytes().subspan(size_t(section.offset), size_t(section.size));
+}
+
+bool VolumeContainer::verify() const
+{
+    if (!m_isOpen)
+        return false;
+    return std::all_of(std::begin(m_sections), std::end(m_sections),
+        [&](const ContainerSection& section) { return computeChecksum(sectionBytes(section)) == section.checksum; });
+}
+
+std::shared_ptr<const MappedFile> VolumeContainer::mappedFile() const
+{
+    return m_pMappedFile;
+}
+
+static size_t numVoxels(const std::array<int32_t, 3>& dim)
+{
+    return size_t(dim[0]) * size_t(dim[1]) * size_t(dim[2]);
+}
+
+static glm::ivec3 toIVec3(const std::array<int32_t, 3>& dim)
+{
+    return { dim[0], dim[1], dim[2] };
+}
+
+static const ContainerSection* findGradientSection(const VolumeContainer& container, int level, GradientStorage storage)
+{
+    const auto sections = container.sections();
+    const auto iter = std::find_if(std::begin(sections), std::end(sections), [&](const ContainerSection& section) {
+        return section.type == ContainerSectionType::Gradient && section.level == level && GradientStorage(section.storage) == storage;
+    });
+    return iter != std::end(sections) ? &*iter : nullptr;
+}
+
+// The gradients are used in place; the volume keeps the container (and so the mapping) alive.
+static std::unique_ptr<GradientVolume> loadGradientSection(const std::shared_ptr<const VolumeContainer>& pContainer, const ContainerSection& section)
+{
+    const auto [minMagnitude, maxMagnitude, dequantizationScale] = section.values;
+    if (GradientStorage(section.storage) == GradientStorage::Quantized) {
+        const auto voxels = pContainer->sectionData<QuantizedGradientVoxel>(section);
+        if (voxels.size() != numVoxels(section.dim))
+            return nullptr;
+        return std::make_unique<GradientVolume>(toIVec3(section.dim), gsl::span<const GradientVoxel>(), voxels, dequantizationScale, minMagnitude, maxMagnitude, pContainer);
+    } else {
+        const auto voxels = pContainer->sectionData<GradientVoxel>(section);
+        if (voxels.size() != numVoxels(section.dim))
+            return nullptr;
+        return std::make_unique<GradientVolume>(toIVec3(section.dim), voxels, gsl::span<const QuantizedGradientVoxel>(), dequantizationScale, minMagnitude, maxMagnitude, pContainer);
+    }
+}
+
+std::unique_ptr<GradientVolume> loadGradientVolume(const Volume& volume, GradientStorage storage)
+{
+    const std::shared_ptr<const VolumeContainer> pContainer = volume.container();
+    if (!pContainer)
+        return nullptr;
+    const ContainerSection* pSection = findGradientSection(*pContainer, 0, storage);
+    return pSection ? loadGradientSection(pContainer, *pSection) : nullptr;
+}
+
+std::unique_ptr<SecondDerivativeVolume> loadSecondDerivativeVolume(const Volume& volume)
+{
+    const std::shared_ptr<const VolumeContainer> pContainer = volume.container();
+    if (!pContainer)
+        return nullptr;
+    const ContainerSection* pSection = pContainer->findSection(ContainerSectionType::SecondDerivative);
+    if (!pSection)
+        return nullptr;
+    const auto voxels = pContainer->sectionData<SecondDerivativeVoxel>(*pSection);
+    if (voxels.size() != numVoxels(pSection->dim))
+        return nullptr;
+    return std::make_unique<SecondDerivativeVolume>(toIVec3(pSection->dim), voxels, pSection->values[0], pSection->values[1], pContainer);
+}
+
+// The levels are small compared to the volume, so they are copied (which also computes their statistics).
+std::unique_ptr<VolumePyramid> loadVolumePyramid(const Volume& volume, GradientStorage storage)
+{
+    const std::shared_ptr<const VolumeContainer> pContainer = volume.container();
+    if (!pContainer)
+        return nullptr;
+
+    std::vector<std::unique_ptr<Volume>> levels;
+    std::vector<std::unique_ptr<GradientVolume>> gradientLevels;
+    for (int level = 1; const ContainerSection* pSection = pContainer->findSection(ContainerSectionType::PyramidLevel, level); level++) {
+        const ContainerSection* pGradientSection = findGradientSection(*pContainer, level, storage);
+        const auto voxels = pContainer->sectionData<uint16_t>(*pSection);
+        if (!pGradientSection || voxels.size() != numVoxels(pSection->dim))
+            return nullptr;
+        auto pGradientVolume = loadGradientSection(pContainer, *pGradientSection);
+        if (!pGradientVolume)
+            return nullptr;
+        levels.push_back(std::make_unique<Volume>(std::vector<uint16_t>(std::begin(voxels), std::end(voxels)), toIVec3(pSection->dim)));
+        gradientLevels.push_back(std::move(pGradientVolume));
+    }
+    if (levels.empty())
+        return nullptr;
+    return std::make_unique<VolumePyramid>(std::move(levels), std::move(gradientLevels));
+}
+
+}
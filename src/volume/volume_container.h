@@ -0,0 +1,134 @@
+#pragma once
+#include "gradient_volume.h"
+#include "mapped_file.h"
+#include "secondderivative_volume.h"
+#include "volume.h"
+#include "volume_pyramid.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <gsl/span>
+#include <memory>
+#include <vector>
+
+namespace volume {
+
+// A volume that was converted by VolVisConvert, together with everything that is otherwise computed after loading
+// it. The file is memory mapped and the large sections are used in place, so opening it takes milliseconds.
+//
+// Layout: ContainerHeader, the sections (aligned to sectionAlignment bytes), and the table of numSections
+// ContainerSections at sectionTableOffset. All values are stored in little-endian byte order.
+enum class ContainerSectionType : uint32_t {
+    // Path of the file that the container was converted from.
+    SourceFile = 0,
+    // uint16_t per voxel, x-major.
+    Voxels,
+    // int32_t per voxel value [0, maximum].
+    Histogram,
+    // MacroCell per cell of MacroCellGrid::defaultCellSize^3 voxels.
+    MacroCells,
+    // A bricked volume file (see BrickFileHeader) for streaming the volume.
+    Bricks,
+    // uint16_t per voxel of a level of the VolumePyramid.
+    PyramidLevel,
+    // GradientVoxel or QuantizedGradientVoxel (see storage) per voxel of the volume or of a pyramid level.
+    Gradient,
+    // SecondDerivativeVoxel per voxel.
+    SecondDerivative
+};
+
+struct ContainerSection {
+    ContainerSectionType type;
+    // Level of the volume pyramid that the section belongs to (0 for the volume itself).
+    int32_t level;
+    std::array<int32_t, 3> dim;
+    // GradientStorage of a Gradient section.
+    uint32_t storage;
+    // Gradient: minimum magnitude, maximum magnitude and dequantization scale. SecondDerivative: minimum and maximum
+    // magnitude.
+    std::array<float, 3> values;
+    uint64_t offset;
+    uint64_t size;
+    // computeChecksum() of the contents, to detect containers that were not written completely or were modified.
+    uint64_t checksum;
+};
+
+struct ContainerHeader {
+    static constexpr std::array<char, 8> expectedMagic { 'V', 'V', 'C', 'O', 'N', 'T', 'N', 'R' };
+    static constexpr uint32_t expectedVersion = 1;
+    static constexpr uint64_t sectionAlignment = 64;
+
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t numSections;
+    std::array<int32_t, 3> dim;
+    uint16_t minimum, maximum;
+    // Size and modification time of the source file at the time of the conversion.
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t sectionTableOffset;
+    uint64_t sectionTableChecksum;
+};
+
+struct ContainerOptions {
+    // The voxels for in-memory rendering and/or as bricks for streaming.
+    bool voxels { true };
+    bool bricks { true };
+    int brickSize { 32 };
+    // The gradient and second derivative volumes, and the volume pyramid (with its gradients).
+    bool derivedVolumes { true };
+    bool pyramid { true };
+    GradientStorage gradientStorage { GradientStorage::Float };
+};
+
+// 64-bit hash of the bytes (not cryptographic); computed in parallel.
+uint64_t computeChecksum(gsl::span<const std::byte> bytes);
+
+bool isVolumeContainerFile(const std::filesystem::path& file);
+// The derived volumes are computed while writing and released as soon as they have been written.
+bool writeVolumeContainer(const Volume& volume, const std::filesystem::path& file, const ContainerOptions& options = {});
+
+class VolumeContainer {
+public:
+    // Checks the header, the section table and the checksums of the small sections. The large sections are only
+    // checked by verify(), since reading them would defeat the purpose of mapping them.
+    VolumeContainer(const std::filesystem::path& file);
+
+    bool isOpen() const;
+    // Whether the source file still exists but has changed since the conversion.
+    bool isStale() const;
+    std::filesystem::path sourceFile() const;
+    const ContainerHeader& header() const;
+    gsl::span<const ContainerSection> sections() const;
+    const ContainerSection* findSection(ContainerSectionType type, int level = 0) const;
+    gsl::span<const std::byte> sectionBytes(const ContainerSection& section) const;
+    template <typename T>
+    gsl::span<const T> sectionData(const ContainerSection& section) const;
+    // Compares the checksums of all sections with their contents.
+    bool verify() const;
+
+    std::shared_ptr<const MappedFile> mappedFile() const;
+
+private:
+    std::filesystem::path m_file;
+    std::shared_ptr<const MappedFile> m_pMappedFile;
+    ContainerHeader m_header {};
+    gsl::span<const ContainerSection> m_sections;
+    bool m_isOpen { false };
+};
+
+// The derived volumes stored in the container of the volume (see Volume::container()), or nullptr if the volume was
+// not loaded from a container or if the container does not have them (in the requested storage).
+std::unique_ptr<GradientVolume> loadGradientVolume(const Volume& volume, GradientStorage storage);
+std::unique_ptr<SecondDerivativeVolume> loadSecondDerivativeVolume(const Volume& volume);
+std::unique_ptr<VolumePyramid> loadVolumePyramid(const Volume& volume, GradientStorage storage);
+
+template <typename T>
+gsl::span<const T> VolumeContainer::sectionData(const ContainerSection& section) const
+{
+    const gsl::span<const std::byte> bytes = sectionBytes(section);
+    return { reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T) };
+}
+
+}
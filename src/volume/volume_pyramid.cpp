@@ -0,0 +1,104 @@
+#include "volume_pyramid.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <glm/common.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <utility>
+
+namespace volume {
+
+// Averages blocks of 2x2x2 voxels. Blocks at the border of a volume with an odd size repeat the last voxel.
+static std::vector<uint16_t> downsample(gsl::span<const uint16_t> voxels, const glm::ivec3& dim, const glm::ivec3& outDim)
+{
+    std::vector<uint16_t> out(size_t(outDim.x) * size_t(outDim.y) * size_t(outDim.z));
+    tbb::parallel_for(tbb::blocked_range<int>(0, outDim.z), [&](const tbb::blocked_range<int>& range) {
+        for (int z = std::begin(range); z != std::end(range); z++) {
+            const std::array<int, 2> zs { 2 * z, std::min(2 * z + 1, dim.z - 1) };
+            for (int y = 0; y < outDim.y; y++) {
+                const std::array<int, 2> ys { 2 * y, std::min(2 * y + 1, dim.y - 1) };
+                uint16_t* pOut = &out[size_t(outDim.x) * (size_t(y) + size_t(outDim.y) * size_t(z))];
+                for (int x = 0; x < outDim.x; x++) {
+                    const std::array<int, 2> xs { 2 * x, std::min(2 * x + 1, dim.x - 1) };
+                    uint32_t sum = 0;
+                    for (const int vz : zs) {
+                        for (const int vy : ys) {
+                            const size_t row = size_t(dim.x) * (size_t(vy) + size_t(dim.y) * size_t(vz));
+                            sum += uint32_t(voxels[row + size_t(xs[0])]) + uint32_t(voxels[row + size_t(xs[1])]);
+                        }
+                    }
+                    pOut[x] = uint16_t((sum + 4) / 8);
+                }
+            }
+        }
+    });
+    return out;
+}
+
+VolumePyramid::VolumePyramid(const Volume& volume, GradientStorage gradientStorage, int minLevelSize)
+{
+    const Volume* pPrevious = &volume;
+    while (glm::compMax(pPrevious->dims()) > minLevelSize) {
+        const glm::ivec3 dim = (pPrevious->dims() + 1) / 2;
+        m_levels.push_back(std::make_unique<Volume>(downsample(pPrevious->data(), pPrevious->dims(), dim), dim));
+        m_gradientLevels.push_back(std::make_unique<GradientVolume>(*m_levels.back(), gradientStorage));
+        pPrevious = m_levels.back().get();
+    }
+}
+
+VolumePyramid::VolumePyramid(std::vector<std::unique_ptr<Volume>> levels, std::vector<std::unique_ptr<GradientVolume>> gradientLevels)
+    : m_levels(std::move(levels))
+    , m_gradientLevels(std::move(gradientLevels))
+{
+    assert(m_levels.size() == m_gradientLevels.size());
+}
+
+int VolumePyramid::numLevels() const
+{
+    return int(m_levels.size()) + 1;
+}
+
+const Volume& VolumePyramid::volume(int level) const
+{
+    assert(level >= 1 && level < numLevels());
+    return *m_levels[size_t(level - 1)];
+}
+
+const GradientVolume& VolumePyramid::gradientVolume(int level) const
+{
+    assert(level >= 1 && level < numLevels());
+    return *m_gradientLevels[size_t(level - 1)];
+}
+
+size_t VolumePyramid::sizeInBytes() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < m_levels.size(); i++)
+        size += m_levels[i]->data().size_bytes() + m_gradientLevels[i]->sizeInBytes();
+    return size;
+}
+
+void VolumePyramid::setInterpolationMode(InterpolationMode interpolationMode)
+{
+    m_interpolationMode = interpolationMode;
+    for (auto& pLevel : m_levels)
+        pLevel->interpolationMode = interpolationMode;
+    for (auto& pGradientLevel : m_gradientLevels)
+        pGradientLevel->interpolationMode = interpolationMode;
+}
+
+InterpolationMode VolumePyramid::interpolationMode() const
+{
+    return m_interpolationMode;
+}
+
+// Voxel i of level l is the average of the voxels [i * 2^l, (i + 1) * 2^l), whose center is at i * 2^l + (2^l - 1) / 2.
+glm::vec3 VolumePyramid::toLevelCoordinates(const glm::vec3& position, int level)
+{
+    const float scale = float(1 << level);
+    return (position - (scale - 1.0f) / 2.0f) / scale;
+}
+
+}
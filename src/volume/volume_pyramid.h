@@ -0,0 +1,40 @@
+#pragma once
+#include "gradient_volume.h"
+#include "volume.h"
+#include <glm/vec3.hpp>
+#include <memory>
+#include <vector>
+
+namespace volume {
+
+// Downsampled copies of a volume and of its gradients for level of detail rendering. Every level averages blocks of
+// 2x2x2 voxels of the previous level, so voxel i of level l covers the voxels [i * 2^l, (i + 1) * 2^l) of the volume.
+// Level 0 is the volume itself (and its gradient volume); only the coarser levels are stored here.
+class VolumePyramid {
+public:
+    // Builds levels until the largest dimension is at most minLevelSize voxels.
+    VolumePyramid(const Volume& volume, GradientStorage gradientStorage = GradientStorage::Float, int minLevelSize = 32);
+    // Levels that were computed before (see VolumeContainer), starting at level 1.
+    VolumePyramid(std::vector<std::unique_ptr<Volume>> levels, std::vector<std::unique_ptr<GradientVolume>> gradientLevels);
+
+    // Number of levels, including level 0.
+    int numLevels() const;
+    // Only for the coarser levels (1 <= level < numLevels()).
+    const Volume& volume(int level) const;
+    const GradientVolume& gradientVolume(int level) const;
+    size_t sizeInBytes() const;
+
+    // Applied to all levels, like Volume::interpolationMode.
+    void setInterpolationMode(InterpolationMode interpolationMode);
+    InterpolationMode interpolationMode() const;
+
+    // Converts a position in voxel coordinates of level 0 to the voxel coordinates of the given level.
+    static glm::vec3 toLevelCoordinates(const glm::vec3& position, int level);
+
+private:
+    std::vector<std::unique_ptr<Volume>> m_levels;
+    std::vector<std::unique_ptr<GradientVolume>> m_gradientLevels;
+    InterpolationMode m_interpolationMode { InterpolationMode::NearestNeighbour };
+};
+
+}
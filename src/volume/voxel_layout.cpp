@@ -0,0 +1,169 @@
+#include "voxel_layout.h"
+#include <bit>
+#include <cassert>
+#include <glm/common.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace volume {
+
+static float linearInterpolate(float g0, float g1, float factor)
+{
+    return g0 * (1 - factor) + g1 * factor;
+}
+
+// Interpolate the 8 corners of a cell in the same order as Volume::getSampleTriLinearInterpolation (x, then y, then z)
+// so that all layouts return bit-identical samples.
+static float triLinearInterpolate(const std::array<float, 8>& c, const glm::vec3& factor)
+{
+    const float c00 = linearInterpolate(c[0], c[1], factor.x);
+    const float c10 = linearInterpolate(c[2], c[3], factor.x);
+    const float c01 = linearInterpolate(c[4], c[5], factor.x);
+    const float c11 = linearInterpolate(c[6], c[7], factor.x);
+    const float c0 = linearInterpolate(c00, c10, factor.y);
+    const float c1 = linearInterpolate(c01, c11, factor.y);
+    return linearInterpolate(c0, c1, factor.z);
+}
+
+BrickedVoxels::BrickedVoxels(gsl::span<const uint16_t> voxels, const glm::ivec3& dim, int brickSize)
+    : m_brickSize(brickSize)
+    , m_brickShift(std::countr_zero(unsigned(brickSize)))
+    , m_paddedBrickSize(brickSize + 1)
+    , m_paddedBrickVoxels(size_t(m_paddedBrickSize) * size_t(m_paddedBrickSize) * size_t(m_paddedBrickSize))
+    , m_numBricks((dim + brickSize - 1) / brickSize)
+{
+    assert(std::has_single_bit(unsigned(brickSize)));
+
+    const size_t numBricks = size_t(m_numBricks.x) * size_t(m_numBricks.y) * size_t(m_numBricks.z);
+    m_data.resize(numBricks * m_paddedBrickVoxels);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, numBricks), [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t brick = std::begin(range); brick != std::end(range); brick++) {
+            const glm::ivec3 brickPos {
+                int(brick % size_t(m_numBricks.x)),
+                int((brick / size_t(m_numBricks.x)) % size_t(m_numBricks.y)),
+                int(brick / (size_t(m_numBricks.x) * size_t(m_numBricks.y)))
+            };
+            const glm::ivec3 origin = brickPos * m_brickSize;
+
+            uint16_t* pOut = &m_data[brick * m_paddedBrickVoxels];
+            for (int z = 0; z < m_paddedBrickSize; z++) {
+                for (int y = 0; y < m_paddedBrickSize; y++) {
+                    for (int x = 0; x < m_paddedBrickSize; x++) {
+                        // The apron of bricks at the border of the volume replicates the edge voxels.
+                        const glm::ivec3 p = glm::min(origin + glm::ivec3(x, y, z), dim - 1);
+                        *pOut++ = voxels[size_t(p.x) + size_t(dim.x) * (size_t(p.y) + size_t(dim.y) * size_t(p.z))];
+                    }
+                }
+            }
+        }
+    });
+}
+
+int BrickedVoxels::brickSize() const
+{
+    return m_brickSize;
+}
+
+size_t BrickedVoxels::sizeInBytes() const
+{
+    return m_data.size() * sizeof(uint16_t);
+}
+
+size_t BrickedVoxels::voxelIndex(int x, int y, int z) const
+{
+    const size_t brick = size_t(x >> m_brickShift) + size_t(m_numBricks.x) * (size_t(y >> m_brickShift) + size_t(m_numBricks.y) * size_t(z >> m_brickShift));
+    const int mask = m_brickSize - 1;
+    const size_t local = size_t(x & mask) + size_t(m_paddedBrickSize) * (size_t(y & mask) + size_t(m_paddedBrickSize) * size_t(z & mask));
+    return brick * m_paddedBrickVoxels + local;
+}
+
+uint16_t BrickedVoxels::getVoxel(int x, int y, int z) const
+{
+    return m_data[voxelIndex(x, y, z)];
+}
+
+float BrickedVoxels::getSampleTriLinear(const glm::vec3& coord) const
+{
+    // coord is positive so truncation is equal to flooring.
+    const glm::ivec3 base { coord };
+    const size_t strideY = size_t(m_paddedBrickSize);
+    const size_t strideZ = strideY * strideY;
+
+    const uint16_t* p = &m_data[voxelIndex(base.x, base.y, base.z)];
+    const std::array<float, 8> corners {
+        float(p[0]), float(p[1]), float(p[strideY]), float(p[strideY + 1]),
+        float(p[strideZ]), float(p[strideZ + 1]), float(p[strideZ + strideY]), float(p[strideZ + strideY + 1])
+    };
+    return triLinearInterpolate(corners, coord - glm::vec3(base));
+}
+
+MortonVoxels::MortonVoxels(gsl::span<const uint16_t> voxels, const glm::ivec3& dim)
+{
+    // Number of bits needed to address each axis.
+    const glm::ivec3 bits {
+        std::bit_width(unsigned(dim.x - 1)), std::bit_width(unsigned(dim.y - 1)), std::bit_width(unsigned(dim.z - 1))
+    };
+
+    // Deal out the output bits round-robin over the axes that still have bits left. For a cubic power of two
+    // volume this is the regular xyzxyz... interleaving.
+    std::array<std::vector<int>, 3> outputBit;
+    int numOutputBits = 0;
+    for (int bit = 0; bit < glm::max(bits.x, glm::max(bits.y, bits.z)); bit++) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (bit < bits[axis])
+                outputBit[size_t(axis)].push_back(numOutputBits++);
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        auto& table = m_axisBits[size_t(axis)];
+        table.resize(size_t(dim[axis]));
+        for (size_t v = 0; v < table.size(); v++) {
+            uint64_t spread = 0;
+            for (size_t bit = 0; bit < outputBit[size_t(axis)].size(); bit++)
+                spread |= ((v >> bit) & 1) << outputBit[size_t(axis)][bit];
+            table[v] = spread;
+        }
+    }
+
+    m_data.resize(size_t(1) << numOutputBits, 0);
+    tbb::parallel_for(tbb::blocked_range<int>(0, dim.z), [&](const tbb::blocked_range<int>& range) {
+        for (int z = std::begin(range); z != std::end(range); z++) {
+            for (int y = 0; y < dim.y; y++) {
+                for (int x = 0; x < dim.x; x++) {
+                    m_data[voxelIndex(x, y, z)] = voxels[size_t(x) + size_t(dim.x) * (size_t(y) + size_t(dim.y) * size_t(z))];
+                }
+            }
+        }
+    });
+}
+
+size_t MortonVoxels::sizeInBytes() const
+{
+    return m_data.size() * sizeof(uint16_t);
+}
+
+size_t MortonVoxels::voxelIndex(int x, int y, int z) const
+{
+    return m_axisBits[0][size_t(x)] | m_axisBits[1][size_t(y)] | m_axisBits[2][size_t(z)];
+}
+
+uint16_t MortonVoxels::getVoxel(int x, int y, int z) const
+{
+    return m_data[voxelIndex(x, y, z)];
+}
+
+float MortonVoxels::getSampleTriLinear(const glm::vec3& coord) const
+{
+    const glm::ivec3 b { coord };
+    const std::array<float, 8> corners {
+        float(getVoxel(b.x, b.y, b.z)), float(getVoxel(b.x + 1, b.y, b.z)),
+        float(getVoxel(b.x, b.y + 1, b.z)), float(getVoxel(b.x + 1, b.y + 1, b.z)),
+        float(getVoxel(b.x, b.y, b.z + 1)), float(getVoxel(b.x + 1, b.y, b.z + 1)),
+        float(getVoxel(b.x, b.y + 1, b.z + 1)), float(getVoxel(b.x + 1, b.y + 1, b.z + 1))
+    };
+    return triLinearInterpolate(corners, coord - glm::vec3(b));
+}
+
+}
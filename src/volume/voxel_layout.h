@@ -0,0 +1,66 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <gsl/span>
+#include <vector>
+
+namespace volume {
+
+enum class VoxelLayout {
+    // x-major order: x + dim.x * (y + dim.y * z)
+    Linear = 0,
+    // Fixed size bricks with a one voxel apron so that all 8 corners of a trilinear fetch live in one brick.
+    Bricked,
+    // Z-order curve over the volume (padded to a power of two along each axis).
+    Morton
+};
+
+// Copy of a volume stored as cubic bricks of brickSize^3 voxels. Every brick also stores the voxels of the
+// next brick along +x, +y and +z (the apron) which makes a brick (brickSize+1)^3 voxels in size. A trilinear
+// fetch at a position p only needs the voxels floor(p) and floor(p)+1, so it never has to leave the brick
+// that contains floor(p).
+class BrickedVoxels {
+public:
+    BrickedVoxels(gsl::span<const uint16_t> voxels, const glm::ivec3& dim, int brickSize);
+
+    int brickSize() const;
+    size_t sizeInBytes() const;
+
+    uint16_t getVoxel(int x, int y, int z) const;
+    // Trilinear interpolation, coord must lie inside [0, dim - 1).
+    float getSampleTriLinear(const glm::vec3& coord) const;
+
+private:
+    size_t voxelIndex(int x, int y, int z) const;
+
+private:
+    int m_brickSize;
+    int m_brickShift;
+    int m_paddedBrickSize;
+    size_t m_paddedBrickVoxels;
+    glm::ivec3 m_numBricks;
+    std::vector<uint16_t> m_data;
+};
+
+// Copy of a volume stored along a Morton (Z-order) curve. The bits of the x, y and z coordinates are
+// interleaved through per-axis lookup tables, so the index computation is three loads and two ORs.
+class MortonVoxels {
+public:
+    MortonVoxels(gsl::span<const uint16_t> voxels, const glm::ivec3& dim);
+
+    size_t sizeInBytes() const;
+
+    uint16_t getVoxel(int x, int y, int z) const;
+    // Trilinear interpolation, coord must lie inside [0, dim - 1).
+    float getSampleTriLinear(const glm::vec3& coord) const;
+
+private:
+    size_t voxelIndex(int x, int y, int z) const;
+
+private:
+    std::array<std::vector<uint64_t>, 3> m_axisBits;
+    std::vector<uint16_t> m_data;
+};
+
+}